@@ -19,12 +19,12 @@
 #include <cstring>
 #include <iostream>
 #include <linux/videodev2.h>
-#include <malloc.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include "CameraDeviceAeroAtomIsp.h"
 #include "log.h"
+#include "pixel_convert.h"
 #include "v4l2_interface.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
@@ -33,6 +33,8 @@
 #define AERO_DEFAULT_HEIGHT 480
 #define AERO_DEFAULT_FRAME_RATE 30
 #define AERO_DEFAULT_BUFFER_COUNT 4
+/* Buffers kept queued in the driver, frames are copied below this: one is always queued */
+#define AERO_MIN_QUEUED_BUFFER_COUNT 2
 
 CameraDeviceAeroAtomIsp::CameraDeviceAeroAtomIsp(std::string device)
     : mDeviceId(device)
@@ -44,9 +46,13 @@ CameraDeviceAeroAtomIsp::CameraDeviceAeroAtomIsp(std::string device)
     , mFrmRate(AERO_DEFAULT_FRAME_RATE)
     , mCamDefUri{}
     , mFd(-1)
-    , mFrameBuffer(nullptr)
+    , mFramePool(nullptr)
+    , mConvPool(nullptr)
+    , mCopyPool(nullptr)
+    , mQueued(0)
     , mFrameBufferSize(0)
     , mFrameBufferCnt(AERO_DEFAULT_BUFFER_COUNT)
+    , mCaptureEngine([this](CameraData &data) { return read(data); })
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
 }
@@ -206,8 +212,29 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::start()
 
     int ret = 0;
 
+    /* buffers of the previous run still leased, let them go with the old pool */
+    if (!mFramePool || mFramePool->getFreeCount() != mFrameBufferCnt) {
+        freeFrameBuffer();
+        ret = allocFrameBuffer(mFrameBufferCnt, mWidth * mHeight * 2);
+        if (ret)
+            return Status::NO_MEMORY;
+    }
+
+    /* Sensor gives UYVY, other formats are converted into frames of their own */
+    if (mPixelFormat != CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY) {
+        mConvPool = FramePool::create(FramePool::HUB_FRAME_COUNT,
+                                      pixel_get_frame_size(mPixelFormat, mWidth, mHeight));
+        if (!mConvPool)
+            return Status::NO_MEMORY;
+    } else {
+        /* Frames are copied here when the consumers hold on to the driver buffers */
+        mCopyPool = FramePool::create(FramePool::HUB_FRAME_COUNT, mFrameBufferSize);
+        if (!mCopyPool)
+            return Status::NO_MEMORY;
+    }
+
     /* request buffer */
-    ret = v4l2_buf_req(mFd, 4);
+    ret = v4l2_buf_req(mFd, mFrameBufferCnt);
     if (ret)
         return Status::ERROR_UNKNOWN;
 
@@ -215,25 +242,77 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::start()
     CLEAR(buf);
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buf.memory = V4L2_MEMORY_USERPTR;
-    for (uint8_t i = 0; i < 4; i++) {
+    mQueued = 0;
+    for (uint32_t i = 0; i < mFrameBufferCnt; i++) {
         buf.index = i;
-        buf.m.userptr = (unsigned long)mFrameBuffer[i];
+        buf.m.userptr = (unsigned long)mFramePool->getData(i);
         buf.length = mFrameBufferSize;
         ret = v4l2_buf_q(mFd, &buf);
         if (ret)
             return Status::ERROR_UNKNOWN;
+        mQueued++;
     }
 
+    /* buffers are given back to the driver once consumers drop the lease */
+    mFramePool->setReleaseCallback([this](uint32_t index) { requeueBuffer(index); });
+
     ret = v4l2_streamon(mFd);
-    if (ret)
+    if (ret) {
+        mFramePool->setReleaseCallback(nullptr);
         return Status::ERROR_UNKNOWN;
+    }
 
     setState(State::STATE_RUN);
     return Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceAeroAtomIsp::start(const std::function<void(CameraData &)> cb)
+{
+    /*
+     * 1. Start the camera device, if not running.
+     * 2. Start the capture engine to read frames and push them to the callback.
+     */
+
+    if (!cb)
+        return Status::INVALID_ARGUMENT;
+
+    if (getState() != State::STATE_RUN) {
+        Status ret = start();
+        if (ret != Status::SUCCESS)
+            return ret;
+    }
+
+    if (mCaptureEngine.start(cb))
+        return Status::INVALID_STATE;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceAeroAtomIsp::setFrameQueue(const uint32_t depth,
+                                                            const DropPolicy policy)
+{
+    /*
+     * 1. Set the queue of the capture engine, applied on next start.
+     */
+
+    if (mCaptureEngine.setQueue(depth, policy))
+        return Status::INVALID_ARGUMENT;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceAeroAtomIsp::stopAsync()
+{
+    /* Device stays started, only the capture and delivery threads are stopped */
+    mCaptureEngine.stop();
+    return Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceAeroAtomIsp::stop()
 {
+    /* Capture thread may be blocked in read(), stop it before taking the lock */
+    mCaptureEngine.stop();
+
 
     std::lock_guard<std::mutex> locker(mLock);
 
@@ -244,7 +323,11 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::stop()
      * Undo whatever was done in start() call.
      */
 
+    mFramePool->setReleaseCallback(nullptr);
     v4l2_streamoff(mFd);
+    /* Buffers still leased by consumers are freed when the last lease is dropped */
+    mConvPool.reset();
+    mCopyPool.reset();
 
     setState(State::STATE_INIT);
     return Status::SUCCESS;
@@ -276,13 +359,49 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::read(CameraData &data)
         log_error("Error in dq buffer");
         return Status::ERROR_UNKNOWN;
     }
+    uint32_t queued = --mQueued;
 
     if (!buf.m.userptr) {
         log_error("Null buffer returned");
         return Status::ERROR_UNKNOWN;
     }
 
-    /* TODO:: Check if buffer valid */
+    /* The buffer stays out of the driver queue until the lease is dropped */
+    std::shared_ptr<FrameBuffer> frame = mFramePool->acquire(buf.index);
+    if (!frame) {
+        log_error("Dequeued buffer %u already in use", buf.index);
+        requeueBuffer(buf.index);
+        return Status::ERROR_UNKNOWN;
+    }
+    frame->bytesUsed = buf.bytesused;
+    uint32_t stride = mWidth * 2;
+
+    if (mConvPool) {
+        std::shared_ptr<FrameBuffer> conv = mConvPool->acquire();
+        if (!conv) {
+            log_error("No free frame buffer, all in use by consumers");
+            return Status::NO_MEMORY;
+        }
+        if (pixel_convert(CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY,
+                          (const uint8_t *)frame->data, stride, mPixelFormat,
+                          (uint8_t *)conv->data, mWidth, mHeight)) {
+            log_error("Error in converting frame");
+            return Status::ERROR_UNKNOWN;
+        }
+        conv->bytesUsed = pixel_get_frame_size(mPixelFormat, mWidth, mHeight);
+        stride = pixel_get_stride(mPixelFormat, mWidth);
+        /* Driver buffer is queued again as soon as the converted frame is ready */
+        frame = conv;
+    } else if (queued < AERO_MIN_QUEUED_BUFFER_COUNT) {
+        /* Consumers hold the other buffers, copy the frame so the driver does not starve */
+        std::shared_ptr<FrameBuffer> copy = mCopyPool ? mCopyPool->acquire() : nullptr;
+        if (copy && frame->bytesUsed <= copy->size) {
+            memcpy(copy->data, frame->data, frame->bytesUsed);
+            copy->bytesUsed = frame->bytesUsed;
+            frame = copy;
+        }
+    }
+
     /* TODO:: Check if there is need to change format or size */
     /* TODO:: Use v4l2 buffer timestamp instead for more accuracy */
 
@@ -293,20 +412,30 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::read(CameraData &data)
     data.nsec = timeofday.tv_usec * 1000;
     data.width = mWidth;
     data.height = mHeight;
-    data.stride = mWidth * 2; /* TODO :: Dependent on pixformat */
-    data.buf = (void *)buf.m.userptr;
-    data.bufSize = buf.bytesused;
-
-    /* queue buffer for refill */
-    ret = v4l2_buf_q(mFd, &buf);
-    if (ret) {
-        log_error("Error in enq buffer");
-        return Status::ERROR_UNKNOWN;
-    }
+    data.stride = stride;
+    data.buf = frame->data;
+    data.bufSize = frame->bytesUsed;
+    data.frame = frame;
 
     return Status::SUCCESS;
 }
 
+void CameraDeviceAeroAtomIsp::requeueBuffer(uint32_t index)
+{
+    /* Called from the thread dropping the last lease, queue buffer for refill */
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.index = index;
+    buf.m.userptr = (unsigned long)mFramePool->getData(index);
+    buf.length = mFrameBufferSize;
+    if (v4l2_buf_q(mFd, &buf))
+        log_error("Error in enq buffer");
+    else
+        mQueued++;
+}
+
 CameraDevice::Status CameraDeviceAeroAtomIsp::setParam(CameraParameters &camParam,
                                                        const std::string param,
                                                        const char *param_value,
@@ -376,6 +505,17 @@ CameraDeviceAeroAtomIsp::setPixelFormat(const CameraParameters::PixelFormat form
      * 4. Pixel format conversion logic can be added to support more formats
      */
 
+    if (format != CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY
+        && !pixel_can_convert(CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY, format))
+        return Status::NOT_SUPPORTED;
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    /* Frame buffers are allocated for the format on start */
+    if (getState() == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    mPixelFormat = format;
     return Status::SUCCESS;
 }
 
@@ -400,6 +540,10 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::getSupportedPixelFormats(
      * 3. At times, the pixel format and resolution is interdependent
      */
 
+    formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY);
+    formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420);
+    formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_NV12);
+
     return Status::SUCCESS;
 }
 
@@ -540,49 +684,28 @@ int CameraDeviceAeroAtomIsp::allocFrameBuffer(int bufCnt, size_t bufSize)
 {
     log_debug("%s count:%d", __func__, bufCnt);
 
-    int ret = -1;
-
     /* Check for valid input */
     if (!bufCnt || !bufSize)
-        return ret;
+        return -1;
 
-    int pageSize = getpagesize();
-    size_t bufLen = (bufSize + pageSize - 1) & ~(pageSize - 1);
-    log_debug("pagesize=%i buffer_len=%li", pageSize, bufLen);
-
-    mFrameBuffer = (void **)calloc(bufCnt, sizeof(void *));
-    for (int i = 0; i < bufCnt; i++) {
-        mFrameBuffer[i] = memalign(pageSize, bufLen);
-        if (!mFrameBuffer[i]) {
-            log_error("memalign failure");
-            while (i) {
-                i--;
-                free(mFrameBuffer[i]);
-                mFrameBuffer[i] = NULL;
-            }
-            break;
-        }
-
-        ret = 0;
+    /* Pool buffers are page aligned as required for user pointer I/O */
+    mFramePool = FramePool::create(bufCnt, bufSize);
+    if (!mFramePool) {
+        log_error("Frame buffer allocation failure");
+        return -1;
     }
 
-    mFrameBufferSize = bufLen;
+    mFrameBufferSize = mFramePool->getSize();
     log_debug("%s Exit", __func__);
-    return ret;
+    return 0;
 }
 
 int CameraDeviceAeroAtomIsp::freeFrameBuffer()
 {
     log_debug("%s", __func__);
 
-    if (!mFrameBuffer)
-        return 0;
-
-    for (uint8_t i = 0; i < mFrameBufferCnt; i++) {
-        free(mFrameBuffer[i]);
-    }
-    free(mFrameBuffer);
-    mFrameBuffer = NULL;
+    /* Leased buffers are freed when the last lease is dropped */
+    mFramePool.reset();
 
     return 0;
 }
@@ -613,12 +736,13 @@ int CameraDeviceAeroAtomIsp::pollCamera(int fd)
         }
 
         if (0 == r && mState == State::STATE_RUN) {
+            /*
+             * Called with mLock held from read(), possibly on the capture engine thread.
+             * Report the timeout, the reader retries.
+             */
             log_error("select timeout");
-            stop();
-            uninit();
-            init();
-            start();
-            continue;
+            ret = -1;
+            break;
         }
 
         ret = 0;
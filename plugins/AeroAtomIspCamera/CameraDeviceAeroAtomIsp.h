@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "CameraDevice.h"
+#include "CaptureEngine.h"
 #include "CameraParameters.h"
 
 class CameraDeviceAeroAtomIsp final : public CameraDevice {
@@ -34,6 +35,9 @@ public:
     Status init(CameraParameters &camParam);
     Status uninit();
     Status start();
+    Status start(const std::function<void(CameraData &)> cb);
+    Status setFrameQueue(const uint32_t depth, const DropPolicy policy);
+    Status stopAsync();
     Status stop();
     Status read(CameraData &data);
     Status setParam(CameraParameters &camParam, const std::string param, const char *param_value,
@@ -61,6 +65,7 @@ private:
     int allocFrameBuffer(int bufCnt, size_t bufSize);
     int freeFrameBuffer();
     int pollCamera(int fd);
+    void requeueBuffer(uint32_t index);
     std::string mDeviceId;
     std::atomic<CameraDevice::State> mState;
     uint32_t mWidth;
@@ -71,7 +76,11 @@ private:
     std::string mCamDefUri;
     std::mutex mLock;
     int mFd;
-    void **mFrameBuffer;
+    std::shared_ptr<FramePool> mFramePool;
+    std::shared_ptr<FramePool> mConvPool; /* Frames converted from UYVY */
+    std::shared_ptr<FramePool> mCopyPool; /* Frames copied when the driver runs low */
+    std::atomic<uint32_t> mQueued;        /* Buffers in the driver queue */
     size_t mFrameBufferSize;
     uint32_t mFrameBufferCnt;
+    CaptureEngine mCaptureEngine;
 };
@@ -46,6 +46,7 @@ CameraDeviceCustom::CameraDeviceCustom(std::string device)
     , mFrmRate(DEFAULT_FRAME_RATE)
     , mCamDefUri{}
     , mOvText(device)
+    , mCaptureEngine([this](CameraData &data) { return read(data); })
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
 }
@@ -148,12 +149,56 @@ CameraDevice::Status CameraDeviceCustom::start()
     return Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceCustom::start(const std::function<void(CameraData &)> cb)
+{
+    /*
+     * 1. Start the camera device.
+     * 2. Start the capture engine to read frames and push them to the callback.
+     *    The capture engine runs on top of read(), frames not in a pooled buffer are copied.
+     */
+
+    if (!cb)
+        return Status::INVALID_ARGUMENT;
+
+    Status ret = start();
+    if (ret != Status::SUCCESS)
+        return ret;
+
+    if (mCaptureEngine.start(cb))
+        return Status::INVALID_STATE;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceCustom::setFrameQueue(const uint32_t depth,
+                                                       const DropPolicy policy)
+{
+    /*
+     * 1. Set the queue of the capture engine, applied on next start.
+     */
+
+    if (mCaptureEngine.setQueue(depth, policy))
+        return Status::INVALID_ARGUMENT;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceCustom::stopAsync()
+{
+    /* Device stays started, only the capture and delivery threads are stopped */
+    mCaptureEngine.stop();
+    return Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceCustom::stop()
 {
     /*
      * Undo whatever was done in start() call.
+     * The capture engine reads from its own thread, stop it first.
      */
 
+    mCaptureEngine.stop();
+
     return Status::SUCCESS;
 }
 
@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "CameraDevice.h"
+#include "CaptureEngine.h"
 #include "CameraParameters.h"
 
 class CameraDeviceCustom final : public CameraDevice {
@@ -33,6 +34,9 @@ public:
     Status init(CameraParameters &camParam);
     Status uninit();
     Status start();
+    Status start(const std::function<void(CameraData &)> cb);
+    Status setFrameQueue(const uint32_t depth, const DropPolicy policy);
+    Status stopAsync();
     Status stop();
     Status read(CameraData &data);
     Status setParam(CameraParameters &camParam, const std::string param, const char *param_value,
@@ -76,4 +80,5 @@ private:
     uint32_t mFrmRate;
     std::string mCamDefUri;
     std::string mOvText;
+    CaptureEngine mCaptureEngine;
 };
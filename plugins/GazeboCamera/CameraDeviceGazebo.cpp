@@ -20,10 +20,14 @@
 #include <gazebo/gazebo_client.hh>
 #include <gazebo/msgs/msgs.hh>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sys/time.h>
 
 #include "CameraDeviceGazebo.h"
+#include "pixel_convert.h"
+
 
 const char CameraDeviceGazebo::PARAMETER_CUSTOM_UINT8[] = "custom-uint8";
 const int CameraDeviceGazebo::ID_PARAMETER_CUSTOM_UINT8 = 101;
@@ -44,6 +48,7 @@ CameraDeviceGazebo::CameraDeviceGazebo(std::string device)
     , mMode(CameraParameters::Mode::MODE_VIDEO)
     , mPixelFormat(CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24)
     , mOvText(device)
+    , mCaptureEngine([this](CameraData &data) { return read(data); })
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
 }
@@ -124,8 +129,7 @@ CameraDevice::Status CameraDeviceGazebo::start()
     mNode.reset(new gazebo::transport::Node());
     mNode->Init();
 
-    // TODO:: Get the number of buffers that gazebo camera has
-    // TODO:: Initialize size of mFrameBuffer based on that
+    // Frame pool is sized on reception of the first image
 
     // Listen to Gazebo <device> topic
     mSub = mNode->Subscribe(mDeviceId, &CameraDeviceGazebo::cbOnImages, this);
@@ -133,8 +137,53 @@ CameraDevice::Status CameraDeviceGazebo::start()
     return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceGazebo::start(const std::function<void(CameraData &)> cb)
+{
+    /*
+     * 1. Start the camera device, if not running.
+     * 2. Start the capture engine to read frames and push them to the callback.
+     */
+
+    if (!cb)
+        return Status::INVALID_ARGUMENT;
+
+    if (mState != State::STATE_RUN) {
+        Status ret = start();
+        if (ret != Status::SUCCESS)
+            return ret;
+    }
+
+    if (mCaptureEngine.start(cb))
+        return Status::INVALID_STATE;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceGazebo::setFrameQueue(const uint32_t depth,
+                                                       const DropPolicy policy)
+{
+    /*
+     * 1. Set the queue of the capture engine, applied on next start.
+     */
+
+    if (mCaptureEngine.setQueue(depth, policy))
+        return Status::INVALID_ARGUMENT;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceGazebo::stopAsync()
+{
+    /* Device stays started, only the capture and delivery threads are stopped */
+    mCaptureEngine.stop();
+    return Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceGazebo::stop()
 {
+    /* Capture thread may be blocked in read(), stop it before taking the lock */
+    mCaptureEngine.stop();
+
     std::lock_guard<std::mutex> locker(mLock);
     if (mState != State::STATE_RUN)
         return Status::INVALID_STATE;
@@ -153,7 +202,7 @@ CameraDevice::Status CameraDeviceGazebo::read(CameraData &data)
     if (mState != State::STATE_RUN)
         return Status::INVALID_STATE;
 
-    if (mFrameBuffer.empty())
+    if (!mFrame)
         return Status::ERROR_UNKNOWN;
 
     struct timeval timeofday;
@@ -163,9 +212,10 @@ CameraDevice::Status CameraDeviceGazebo::read(CameraData &data)
     data.nsec = timeofday.tv_usec * 1000;
     data.width = mWidth;
     data.height = mHeight;
-    data.stride = mWidth; // TODO :: Dependent on pixformat
-    data.buf = &mFrameBuffer[0];
-    data.bufSize = mFrameBuffer.size();
+    data.stride = pixel_get_stride(mPixelFormat, mWidth);
+    data.buf = mFrame->data;
+    data.bufSize = mFrame->bytesUsed;
+    data.frame = mFrame;
 
     return Status::SUCCESS;
 }
@@ -178,6 +228,19 @@ CameraDevice::Status CameraDeviceGazebo::getSize(uint32_t &width, uint32_t &heig
     return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceGazebo::setPixelFormat(const CameraParameters::PixelFormat format)
+{
+    /* Images are RGB, converted to I420 on reception if asked */
+    if (format != CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24
+        && format != CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420)
+        return CameraDevice::Status::NOT_SUPPORTED;
+
+    std::lock_guard<std::mutex> locker(mLock);
+    mPixelFormat = format;
+
+    return CameraDevice::Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceGazebo::getPixelFormat(CameraParameters::PixelFormat &format) const
 {
     format = mPixelFormat;
@@ -318,8 +381,12 @@ int CameraDeviceGazebo::getImage(const gazebo::msgs::Image &_msg)
         return failure;
     }
     case gazebo::common::Image::RGB_INT8:
+        break;
     case gazebo::common::Image::RGBA_INT8: {
-        mPixelFormat = CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24;
+        if (mPixelFormat == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420) {
+            log_error("Pixel Format RGBA :: Unsupported for conversion");
+            return failure;
+        }
         break;
     }
     default: {
@@ -332,11 +399,49 @@ int CameraDeviceGazebo::getImage(const gazebo::msgs::Image &_msg)
     // log_debug("Image Size: %lu Format:%d", _msg.data().size(), _msg.pixel_format());
     const char *buffer = (const char *)_msg.data().c_str();
     uint buffer_size = _msg.data().size();
-    mFrameBuffer = std::vector<uint8_t>(buffer, buffer + buffer_size);
+    if (buffer_size < _msg.step() * mHeight) {
+        log_error("Image of %u bytes too small for its size", buffer_size);
+        return failure;
+    }
+    // Rows of the image are packed, read() gives them at the stride of the pixel format
+    uint32_t stride = pixel_get_stride(mPixelFormat, mWidth);
+    bool toI420 = mPixelFormat == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    if (toI420)
+        buffer_size = pixel_get_frame_size(mPixelFormat, mWidth, mHeight);
+    else if (_msg.step() != stride)
+        buffer_size = stride * mHeight;
+    if (!mFramePool || mFramePool->getSize() < buffer_size) {
+        // Buffers of the old pool are freed when the last lease is dropped
+        mFramePool = FramePool::create(FramePool::HUB_FRAME_COUNT, buffer_size);
+        if (!mFramePool)
+            return failure;
+    }
+
+    // Copy to a free buffer, consumers may still be using the previous frames
+    std::shared_ptr<FrameBuffer> frame = mFramePool->acquire();
+    if (!frame) {
+        log_debug("No free frame buffer, dropping image");
+        return failure;
+    }
+    if (toI420) {
+        // Encoder-ready frame, no videoconvert needed in the pipelines
+        if (pixel_convert(CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24,
+                          (const uint8_t *)buffer, _msg.step(), mPixelFormat,
+                          (uint8_t *)frame->data, mWidth, mHeight))
+            return failure;
+    } else if (_msg.step() != stride) {
+        for (uint32_t row = 0; row < mHeight; row++)
+            memcpy((uint8_t *)frame->data + row * stride, buffer + row * _msg.step(),
+                   std::min(stride, _msg.step()));
+    } else {
+        memcpy(frame->data, buffer, buffer_size);
+    }
+    frame->bytesUsed = buffer_size;
+    mFrame = frame;
 
 #if 0
     std::ofstream fout("imgframe.rgb", std::ios::binary);
-    fout.write(reinterpret_cast<char*>(&mFrameBuffer[0]), mFrameBuffer.size() * sizeof(mFrameBuffer[0]));
+    fout.write(reinterpret_cast<char*>(mFrame->data), mFrame->bytesUsed);
     fout.close();
     std::cout<<"\nsaved";
 #endif
@@ -21,6 +21,7 @@
 #include <string>
 
 #include "CameraDevice.h"
+#include "CaptureEngine.h"
 #include "CameraParameters.h"
 
 class CameraDeviceGazebo final : public CameraDevice {
@@ -33,12 +34,16 @@ public:
     Status init(CameraParameters &camParam);
     Status uninit();
     Status start();
+    Status start(const std::function<void(CameraData &)> cb);
+    Status setFrameQueue(const uint32_t depth, const DropPolicy policy);
+    Status stopAsync();
     Status stop();
     Status read(CameraData &data);
     Status setParam(CameraParameters &camParam, const std::string param, const char *param_value,
                     const size_t value_size, const int param_type);
     Status resetParams(CameraParameters &camParam);
     Status getSize(uint32_t &width, uint32_t &height) const;
+    Status setPixelFormat(const CameraParameters::PixelFormat format);
     Status getPixelFormat(CameraParameters::PixelFormat &format) const;
     Status setMode(const CameraParameters::Mode mode);
     Status getMode(CameraParameters::Mode &mode) const;
@@ -73,6 +78,8 @@ private:
     gazebo::transport::NodePtr mNode;
     gazebo::transport::SubscriberPtr mSub;
     std::mutex mLock;
-    std::vector<uint8_t> mFrameBuffer = {};
+    std::shared_ptr<FramePool> mFramePool;
+    std::shared_ptr<FrameBuffer> mFrame;
     std::string mOvText;
+    CaptureEngine mCaptureEngine;
 };
@@ -16,42 +16,22 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <sys/time.h>
 
 #include "CameraDeviceRealSense.h"
+#include "pixel_convert.h"
 
 #define RS_DEFAULT_WIDTH 640
 #define RS_DEFAULT_HEIGHT 480
 #define RS_DEFAULT_FRAME_RATE 60
+#define RS_DEFAULT_MIN_DEPTH 300
+#define RS_DEFAULT_MAX_DEPTH 4000
 
 int CameraDeviceRealSense::sStrmCnt = 0;
 
-static void rainbow_scale(double value, uint8_t rgb[])
-{
-    rgb[0] = rgb[1] = rgb[2] = 0;
-
-    if (value <= 0.0)
-        return;
-
-    if (value < 0.25) { // RED to YELLOW
-        rgb[0] = 255;
-        rgb[1] = (uint8_t)255 * (value / 0.25);
-    } else if (value < 0.5) { // YELLOW to GREEN
-        rgb[0] = (uint8_t)255 * (1 - ((value - 0.25) / 0.25));
-        rgb[1] = 255;
-    } else if (value < 0.75) { // GREEN to CYAN
-        rgb[1] = 255;
-        rgb[2] = (uint8_t)255 * (value - 0.5 / 0.25);
-    } else if (value < 1.0) { // CYAN to BLUE
-        rgb[1] = (uint8_t)255 * (1 - ((value - 0.75) / 0.25));
-        rgb[2] = 255;
-    } else { // BLUE
-        rgb[2] = 255;
-    }
-}
-
 CameraDeviceRealSense::CameraDeviceRealSense(std::string device)
     : mDeviceId(device)
     , mState(State::STATE_IDLE)
@@ -61,11 +41,14 @@ CameraDeviceRealSense::CameraDeviceRealSense(std::string device)
     , mMode(CameraParameters::Mode::MODE_VIDEO)
     , mFrmRate(RS_DEFAULT_FRAME_RATE)
     , mCamDefUri{}
-    , mFrameBuffer(nullptr)
-    , mFrameBufferSize(0)
+    , mFramePool(nullptr)
+    , mColorizer(nullptr)
+    , mMinDepth(RS_DEFAULT_MIN_DEPTH)
+    , mMaxDepth(RS_DEFAULT_MAX_DEPTH)
     , mRSDev(nullptr)
     , mRSCtx(nullptr)
     , mRSStream(-1)
+    , mCaptureEngine([this](CameraData &data) { return read(data); })
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
     if (device == "rsdepth")
@@ -202,11 +185,19 @@ CameraDevice::Status CameraDeviceRealSense::start()
             rs_set_device_option(mRSDev, RS_OPTION_R200_LR_AUTO_EXPOSURE_ENABLED, 1, NULL);
     }
 
-    mFrameBufferSize = mWidth * mHeight * 3;
-    mFrameBuffer = new uint8_t[mFrameBufferSize];
-    if (!mFrameBuffer) {
+    if (mRSStream == RS_STREAM_DEPTH) {
+        if (!mColorizer)
+            mColorizer.reset(new DepthColorizer());
+        if (setColorizerRange()) {
+            rs_delete_context(mRSCtx, NULL);
+            return Status::INVALID_ARGUMENT;
+        }
+    }
+
+    mFramePool = FramePool::create(FramePool::HUB_FRAME_COUNT,
+                                   pixel_get_frame_size(mPixelFormat, mWidth, mHeight));
+    if (!mFramePool) {
         log_error("Memory alloc for frame buf failed");
-        mFrameBufferSize = 0;
         rs_delete_context(mRSCtx, NULL);
         return Status::NO_MEMORY;
     }
@@ -215,8 +206,94 @@ CameraDevice::Status CameraDeviceRealSense::start()
     return Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceRealSense::start(const std::function<void(CameraData &)> cb)
+{
+    /*
+     * 1. Start the camera device, if not running.
+     * 2. Start the capture engine to read frames and push them to the callback.
+     */
+
+    if (!cb)
+        return Status::INVALID_ARGUMENT;
+
+    if (getState() != State::STATE_RUN) {
+        Status ret = start();
+        if (ret != Status::SUCCESS)
+            return ret;
+    }
+
+    if (mCaptureEngine.start(cb))
+        return Status::INVALID_STATE;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceRealSense::setFrameQueue(const uint32_t depth,
+                                                          const DropPolicy policy)
+{
+    /*
+     * 1. Set the queue of the capture engine, applied on next start.
+     */
+
+    if (mCaptureEngine.setQueue(depth, policy))
+        return Status::INVALID_ARGUMENT;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceRealSense::stopAsync()
+{
+    /* Device stays started, only the capture and delivery threads are stopped */
+    mCaptureEngine.stop();
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceRealSense::setDepthRange(const uint32_t minDepth,
+                                                          const uint32_t maxDepth)
+{
+    /*
+     * 1. Set the depth range of the colors of the depth images.
+     * 2. Apply it right away if the camera is running.
+     */
+
+    if (mRSStream != RS_STREAM_DEPTH)
+        return Status::NOT_SUPPORTED;
+
+    if (minDepth >= maxDepth)
+        return Status::INVALID_ARGUMENT;
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mMinDepth = minDepth;
+    mMaxDepth = maxDepth;
+    if (getState() == State::STATE_RUN && setColorizerRange())
+        return Status::INVALID_ARGUMENT;
+
+    return Status::SUCCESS;
+}
+
+int CameraDeviceRealSense::setColorizerRange()
+{
+    /* Depth images are in device units, the range is in mm */
+    float scale = rs_get_device_depth_scale(mRSDev, NULL) * 1000;
+    if (scale <= 0)
+        scale = 1;
+
+    uint32_t minDepth = std::min<uint32_t>(mMinDepth / scale, UINT16_MAX);
+    uint32_t maxDepth = std::min<uint32_t>(mMaxDepth / scale, UINT16_MAX);
+    if (mColorizer->setRange(minDepth, maxDepth)) {
+        log_error("Invalid depth range %u-%u mm", mMinDepth, mMaxDepth);
+        return -1;
+    }
+
+    return 0;
+}
+
 CameraDevice::Status CameraDeviceRealSense::stop()
 {
+    /* Capture thread may be blocked in read(), stop it before taking the lock */
+    mCaptureEngine.stop();
+
     std::lock_guard<std::mutex> locker(mLock);
 
     if (getState() != State::STATE_RUN)
@@ -227,8 +304,8 @@ CameraDevice::Status CameraDeviceRealSense::stop()
      */
 
     rs_delete_context(mRSCtx, NULL);
-    delete[] mFrameBuffer;
-    mFrameBufferSize = 0;
+    /* Buffers still leased by consumers are freed when the last lease is dropped */
+    mFramePool.reset();
 
     setState(State::STATE_INIT);
     return Status::SUCCESS;
@@ -245,6 +322,15 @@ CameraDevice::Status CameraDeviceRealSense::read(CameraData &data)
      * Fill the CameraData with frame and its meta-data.
      */
 
+    std::shared_ptr<FrameBuffer> frame = mFramePool->acquire();
+    if (!frame) {
+        log_error("No free frame buffer, all in use by consumers");
+        return Status::NO_MEMORY;
+    }
+    uint8_t *frameBuffer = (uint8_t *)frame->data;
+    frame->bytesUsed = pixel_get_frame_size(mPixelFormat, mWidth, mHeight);
+    bool toI420 = mPixelFormat == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+
     rs_wait_for_frames(mRSDev, NULL);
 
     rs_error *e = 0;
@@ -258,11 +344,9 @@ CameraDevice::Status CameraDeviceRealSense::read(CameraData &data)
             return Status::ERROR_UNKNOWN;
         }
 
-        for (int i = 0, end = mWidth * mHeight; i < end; ++i) {
-            mFrameBuffer[3 * i] = ir[i];
-            mFrameBuffer[3 * i + 1] = ir[i];
-            mFrameBuffer[3 * i + 2] = ir[i];
-        }
+        /* Infrared is grey, straight to the luma plane or replicated to RGB */
+        pixel_convert(CameraParameters::PixelFormat::PIXEL_FORMAT_GREY, ir, mWidth, mPixelFormat,
+                      frameBuffer, mWidth, mHeight);
     } else {
         uint16_t *depth = (uint16_t *)rs_get_frame_data(mRSDev, RS_STREAM_DEPTH, NULL);
         if (!depth) {
@@ -270,14 +354,15 @@ CameraDevice::Status CameraDeviceRealSense::read(CameraData &data)
             return Status::ERROR_UNKNOWN;
         }
 
-        for (int i = 0, end = mWidth * mHeight; i < end; ++i) {
-            uint8_t rainbow[3];
-            rainbow_scale((double)depth[i], rainbow);
+        /* Depth is colored in RGB first when I420 is delivered */
+        if (toI420)
+            mRgbBuffer.resize(mWidth * mHeight * 3);
+        uint8_t *rgb = toI420 ? mRgbBuffer.data() : frameBuffer;
+        mColorizer->colorize(depth, mWidth, mHeight, rgb, mWidth * 3);
 
-            mFrameBuffer[3 * i] = rainbow[0];
-            mFrameBuffer[3 * i + 1] = rainbow[1];
-            mFrameBuffer[3 * i + 2] = rainbow[2];
-        }
+        if (toI420)
+            pixel_convert(CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24, rgb, mWidth * 3,
+                          mPixelFormat, frameBuffer, mWidth, mHeight);
     }
 
     struct timeval timeofday;
@@ -287,9 +372,10 @@ CameraDevice::Status CameraDeviceRealSense::read(CameraData &data)
     data.nsec = timeofday.tv_usec * 1000;
     data.width = mWidth;
     data.height = mHeight;
-    data.stride = mWidth * 3; // TODO :: Dependent on pixformat
-    data.buf = mFrameBuffer;
-    data.bufSize = mFrameBufferSize;
+    data.stride = pixel_get_stride(mPixelFormat, mWidth);
+    data.buf = frameBuffer;
+    data.bufSize = frame->bytesUsed;
+    data.frame = frame;
 
     return Status::SUCCESS;
 }
@@ -362,6 +448,17 @@ CameraDeviceRealSense::setPixelFormat(const CameraParameters::PixelFormat format
      * 4. Pixel format conversion logic can be added to support more formats
      */
 
+    if (format != CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24
+        && format != CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420)
+        return Status::NOT_SUPPORTED;
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    /* Frame buffers are allocated for the format on start */
+    if (getState() == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    mPixelFormat = format;
     return Status::SUCCESS;
 }
 
@@ -386,6 +483,9 @@ CameraDevice::Status CameraDeviceRealSense::getSupportedPixelFormats(
      * 3. At times, the pixel format and resolution is interdependent
      */
 
+    formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24);
+    formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420);
+
     return Status::SUCCESS;
 }
 
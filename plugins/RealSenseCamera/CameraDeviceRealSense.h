@@ -17,6 +17,7 @@
  */
 #pragma once
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -24,7 +25,9 @@
 #include <librealsense/rs.h>
 
 #include "CameraDevice.h"
+#include "CaptureEngine.h"
 #include "CameraParameters.h"
+#include "DepthColorizer.h"
 
 class CameraDeviceRealSense final : public CameraDevice {
 public:
@@ -36,6 +39,10 @@ public:
     Status init(CameraParameters &camParam);
     Status uninit();
     Status start();
+    Status start(const std::function<void(CameraData &)> cb);
+    Status setFrameQueue(const uint32_t depth, const DropPolicy policy);
+    Status stopAsync();
+    Status setDepthRange(const uint32_t minDepth, const uint32_t maxDepth);
     Status stop();
     Status read(CameraData &data);
     Status setParam(CameraParameters &camParam, const std::string param, const char *param_value,
@@ -59,6 +66,7 @@ public:
 private:
     Status setState(const CameraDevice::State state);
     CameraDevice::State getState() const;
+    int setColorizerRange();
     std::string mDeviceId;
     std::atomic<CameraDevice::State> mState;
     uint32_t mWidth;
@@ -68,10 +76,14 @@ private:
     uint32_t mFrmRate;
     std::string mCamDefUri;
     std::mutex mLock;
-    uint8_t *mFrameBuffer;
-    size_t mFrameBufferSize;
+    std::shared_ptr<FramePool> mFramePool;
+    std::vector<uint8_t> mRgbBuffer; /* Colored depth, before conversion to I420 */
+    std::unique_ptr<DepthColorizer> mColorizer;
+    uint32_t mMinDepth; /* Depth range of the colors, in mm */
+    uint32_t mMaxDepth;
     rs_device *mRSDev;
     rs_context *mRSCtx;
     int mRSStream;
     static int sStrmCnt;
+    CaptureEngine mCaptureEngine;
 };
@@ -0,0 +1,198 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <string.h>
+
+#include "DepthColorizer.h"
+#include "log.h"
+
+#define DEPTH_VALUE_COUNT 0x10000
+#define MAX_DEFAULT_THREAD_COUNT 4
+
+/* Color of a depth normalized to [0, 1] */
+static void rainbow_scale(double value, uint8_t rgb[])
+{
+    rgb[0] = rgb[1] = rgb[2] = 0;
+
+    if (value < 0.25) { // RED to YELLOW
+        rgb[0] = 255;
+        rgb[1] = 255 * (value / 0.25);
+    } else if (value < 0.5) { // YELLOW to GREEN
+        rgb[0] = 255 * (1 - ((value - 0.25) / 0.25));
+        rgb[1] = 255;
+    } else if (value < 0.75) { // GREEN to CYAN
+        rgb[1] = 255;
+        rgb[2] = 255 * ((value - 0.5) / 0.25);
+    } else if (value < 1.0) { // CYAN to BLUE
+        rgb[1] = 255 * (1 - ((value - 0.75) / 0.25));
+        rgb[2] = 255;
+    } else { // BLUE
+        rgb[2] = 255;
+    }
+}
+
+DepthColorizer::DepthColorizer(uint32_t threadCount)
+    : mLut(DEPTH_VALUE_COUNT)
+    , mMinDepth(0)
+    , mMaxDepth(0)
+    , mDepth(nullptr)
+    , mWidth(0)
+    , mHeight(0)
+    , mRgb(nullptr)
+    , mStride(0)
+    , mBandRows(0)
+    , mThreadCount(threadCount)
+    , mJob(0)
+    , mPending(0)
+    , mExit(false)
+{
+    if (!mThreadCount)
+        mThreadCount = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                                (unsigned)MAX_DEFAULT_THREAD_COUNT);
+
+    setRange(1, UINT16_MAX);
+
+    /* The caller thread colors the first band */
+    for (uint32_t band = 1; band < mThreadCount; band++)
+        mThreads.push_back(std::thread(&DepthColorizer::run, this, band));
+}
+
+DepthColorizer::~DepthColorizer()
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mExit = true;
+    }
+    mStartCond.notify_all();
+
+    for (auto &thread : mThreads)
+        thread.join();
+}
+
+int DepthColorizer::setRange(uint16_t minDepth, uint16_t maxDepth)
+{
+    if (minDepth >= maxDepth)
+        return -1;
+
+    mMinDepth = minDepth;
+    mMaxDepth = maxDepth;
+
+    double range = maxDepth - minDepth;
+    for (uint32_t depth = 0; depth < DEPTH_VALUE_COUNT; depth++) {
+        uint8_t rgb[4] = {};
+        /* Depth 0 is no data, left black */
+        if (depth) {
+            double value = ((double)depth - minDepth) / range;
+            rainbow_scale(std::min(std::max(value, 0.0), 1.0), rgb);
+        }
+        memcpy(&mLut[depth], rgb, sizeof(rgb));
+    }
+
+    log_debug("%s min:%u max:%u", __func__, minDepth, maxDepth);
+
+    return 0;
+}
+
+void DepthColorizer::getRange(uint16_t &minDepth, uint16_t &maxDepth) const
+{
+    minDepth = mMinDepth;
+    maxDepth = mMaxDepth;
+}
+
+uint32_t DepthColorizer::getThreadCount() const
+{
+    return mThreadCount;
+}
+
+int DepthColorizer::colorize(const uint16_t *depth, uint32_t width, uint32_t height, uint8_t *rgb,
+                             uint32_t stride)
+{
+    if (!depth || !rgb || !width || !height || stride < width * 3)
+        return -1;
+
+    /* Small images are not worth waking up the worker threads */
+    if (mThreads.empty() || height < mThreadCount) {
+        mDepth = depth;
+        mWidth = width;
+        mHeight = height;
+        mRgb = rgb;
+        mStride = stride;
+        colorizeRows(0, height);
+        return 0;
+    }
+
+    uint32_t bandRows = (height + mThreadCount - 1) / mThreadCount;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mDepth = depth;
+        mWidth = width;
+        mHeight = height;
+        mRgb = rgb;
+        mStride = stride;
+        mBandRows = bandRows;
+        mPending = mThreads.size();
+        mJob++;
+    }
+    mStartCond.notify_all();
+
+    colorizeRows(0, std::min(bandRows, height));
+
+    std::unique_lock<std::mutex> locker(mLock);
+    mDoneCond.wait(locker, [this] { return mPending == 0; });
+
+    return 0;
+}
+
+void DepthColorizer::colorizeRows(uint32_t first, uint32_t last)
+{
+    const uint32_t *lut = mLut.data();
+
+    for (uint32_t row = first; row < last; row++) {
+        const uint16_t *depth = mDepth + (size_t)row * mWidth;
+        uint8_t *rgb = mRgb + (size_t)row * mStride;
+        uint32_t x = 0;
+
+        /* 4 bytes stores, the 4th byte is overwritten by the next pixel */
+        for (; x + 1 < mWidth; x++)
+            memcpy(rgb + 3 * x, &lut[depth[x]], 4);
+        memcpy(rgb + 3 * x, &lut[depth[x]], 3);
+    }
+}
+
+void DepthColorizer::run(uint32_t band)
+{
+    uint64_t job = 0;
+    std::unique_lock<std::mutex> locker(mLock);
+
+    while (true) {
+        mStartCond.wait(locker, [this, job] { return mExit || mJob != job; });
+        if (mExit)
+            return;
+
+        job = mJob;
+        uint32_t first = std::min(band * mBandRows, mHeight);
+        uint32_t last = std::min(first + mBandRows, mHeight);
+
+        locker.unlock();
+        colorizeRows(first, last);
+        locker.lock();
+
+        if (--mPending == 0)
+            mDoneCond.notify_one();
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+/**
+ *  The DepthColorizer class colors 16 bits depth images in RGB24, from red for the near end of
+ *  the depth range to blue for the far end. Depth 0 means no data and is black.
+ *
+ *  Colors of all the depth values are computed once in a lookup table, each time the range is
+ *  set. Images are split in bands of rows colored in parallel, the caller thread takes the first
+ *  band and worker threads the others.
+ *
+ *  Not thread safe, colorize() and setRange() must be called from one thread at a time.
+ */
+class DepthColorizer {
+public:
+    /**
+     *  @param[in] threadCount Number of bands colored in parallel, 0 for the default.
+     */
+    DepthColorizer(uint32_t threadCount = 0);
+    ~DepthColorizer();
+
+    /**
+     *  Set the depth range of the colors, in depth units of the camera.
+     *
+     *  @param[in] minDepth Depth colored in red, nearer depths are red too.
+     *  @param[in] maxDepth Depth colored in blue, farther depths are blue too.
+     *
+     *  @return 0 on success, -1 if the range is empty.
+     */
+    int setRange(uint16_t minDepth, uint16_t maxDepth);
+    void getRange(uint16_t &minDepth, uint16_t &maxDepth) const;
+
+    uint32_t getThreadCount() const;
+
+    /**
+     *  Color a depth image.
+     *
+     *  @param[in] depth Depth image, lines of width values packed one after the other.
+     *  @param[in] width Width of the image.
+     *  @param[in] height Height of the image.
+     *  @param[out] rgb RGB24 image.
+     *  @param[in] stride Bytes per line of the RGB24 image, width * 3 at least.
+     *
+     *  @return 0 on success, -1 on error.
+     */
+    int colorize(const uint16_t *depth, uint32_t width, uint32_t height, uint8_t *rgb,
+                 uint32_t stride);
+
+private:
+    void colorizeRows(uint32_t first, uint32_t last);
+    void run(uint32_t band);
+
+    /* Color of each depth value, RGB in the first 3 bytes */
+    std::vector<uint32_t> mLut;
+    uint16_t mMinDepth;
+    uint16_t mMaxDepth;
+
+    /* Image being colored */
+    const uint16_t *mDepth;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint8_t *mRgb;
+    uint32_t mStride;
+    uint32_t mBandRows;
+
+    uint32_t mThreadCount;
+    std::vector<std::thread> mThreads;
+    std::mutex mLock;
+    std::condition_variable mStartCond;
+    std::condition_variable mDoneCond;
+    uint64_t mJob;      /* Incremented for each image */
+    uint32_t mPending;  /* Bands not colored yet by the worker threads */
+    bool mExit;
+};
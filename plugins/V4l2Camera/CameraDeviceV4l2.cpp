@@ -15,19 +15,144 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <cerrno>
 #include <cstring>
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
+#include <time.h>
+#include <vector>
 
 #include "CameraDeviceV4l2.h"
 #include "v4l2_interface.h"
 
+#define DEFAULT_BUFFER_COUNT 4
+#define MIN_BUFFER_COUNT 2
+/* Buffers kept queued in the driver, frames are copied below this: one is always queued */
+#define MIN_QUEUED_BUFFER_COUNT 2
+#define READ_TIMEOUT_MS 1000
+
+/*
+ * Buffers of the native capture mapped from the driver. Leases on the frames keep the stream
+ * alive, a buffer goes back to the driver queue when its lease is released.
+ */
+struct CameraDeviceV4l2::MmapStream {
+    struct Buffer {
+        void *addr;
+        size_t length;
+    };
+
+    int fd = -1;
+    bool streaming = false;
+    uint32_t queued = 0;
+    std::vector<Buffer> buffers;
+    std::mutex lock;
+
+    ~MmapStream()
+    {
+        for (auto &buf : buffers)
+            v4l2_munmap(buf.addr, buf.length);
+    }
+
+    void requeue(uint32_t index)
+    {
+        std::lock_guard<std::mutex> locker(lock);
+        if (!streaming)
+            return;
+
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(struct v4l2_buffer));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = index;
+        if (!v4l2_buf_q(fd, &buf))
+            queued++;
+    }
+};
+
+static CameraParameters::PixelFormat toPixelFormat(uint32_t fourcc)
+{
+    switch (fourcc) {
+    case V4L2_PIX_FMT_GREY:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_GREY;
+    case V4L2_PIX_FMT_YUV420:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    case V4L2_PIX_FMT_YUV422P:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P;
+    case V4L2_PIX_FMT_UYVY:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY;
+    case V4L2_PIX_FMT_YUYV:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV;
+    case V4L2_PIX_FMT_RGB24:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24;
+    case V4L2_PIX_FMT_RGB32:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_RGB32;
+    case V4L2_PIX_FMT_NV12:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_NV12;
+    default:
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_MAX;
+    }
+}
+
+static uint32_t toV4l2PixelFormat(CameraParameters::PixelFormat format)
+{
+    switch (format) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return V4L2_PIX_FMT_GREY;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+        return V4L2_PIX_FMT_YUV420;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P:
+        return V4L2_PIX_FMT_YUV422P;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return V4L2_PIX_FMT_UYVY;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return V4L2_PIX_FMT_YUYV;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return V4L2_PIX_FMT_RGB24;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB32:
+        return V4L2_PIX_FMT_RGB32;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return V4L2_PIX_FMT_NV12;
+    default:
+        return 0;
+    }
+}
+
+/* Convert the driver timestamp to system time, as expected in CameraData */
+static void toSystemTime(const struct v4l2_buffer &buf, uint32_t &sec, uint32_t &nsec)
+{
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    uint64_t ts = (uint64_t)buf.timestamp.tv_sec * 1000000000ULL + buf.timestamp.tv_usec * 1000ULL;
+    if (ts
+        && (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        int64_t offset = ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000LL
+            + ((int64_t)real.tv_nsec - mono.tv_nsec);
+        ts += offset;
+    } else {
+        /* No usable capture time, use dequeue time */
+        ts = (uint64_t)real.tv_sec * 1000000000ULL + real.tv_nsec;
+    }
+
+    sec = ts / 1000000000ULL;
+    nsec = ts % 1000000000ULL;
+}
+
 CameraDeviceV4l2::CameraDeviceV4l2(std::string device)
     : mDeviceId(device)
     , mCardName("v4l2-card")
     , mDriverName("v4l2-drv")
     , mCamDefURI{}
     , mMode(CameraParameters::Mode::MODE_VIDEO)
+    , mGstV4l2Src(true)
+    , mBufferCount(DEFAULT_BUFFER_COUNT)
+    , mWidth(0)
+    , mHeight(0)
+    , mStride(0)
+    , mPixFormat(CameraParameters::PixelFormat::PIXEL_FORMAT_MAX)
+    , mStream(nullptr)
+    , mCaptureEngine([this](CameraData &data) { return read(data); })
 {
     log_info("%s Node: %s", __func__, mDeviceId.c_str());
     int ret = initInfo();
@@ -37,6 +162,7 @@ CameraDeviceV4l2::CameraDeviceV4l2(std::string device)
 
 CameraDeviceV4l2::~CameraDeviceV4l2()
 {
+    stop();
 }
 
 std::string CameraDeviceV4l2::getDeviceId() const
@@ -72,7 +198,17 @@ CameraDevice::Status CameraDeviceV4l2::getInfo(struct CameraInfo &camInfo) const
 
 bool CameraDeviceV4l2::isGstV4l2Src() const
 {
-    return true;
+    return mGstV4l2Src;
+}
+
+CameraDevice::Status CameraDeviceV4l2::setGstV4l2Src(const bool enable)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    if (mStream)
+        return Status::INVALID_STATE;
+
+    mGstV4l2Src = enable;
+    return Status::SUCCESS;
 }
 
 CameraDevice::Status CameraDeviceV4l2::init(CameraParameters &camParam)
@@ -90,14 +226,238 @@ CameraDevice::Status CameraDeviceV4l2::uninit()
 
 CameraDevice::Status CameraDeviceV4l2::start()
 {
+    /* Native capture starts streaming on first read, v4l2src opens the device by itself */
     return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceV4l2::start(const std::function<void(CameraData &)> cb)
+{
+    /*
+     * 1. Start streaming from the device.
+     * 2. Start the capture engine to read frames and push them to the callback.
+     */
+
+    if (!cb)
+        return Status::INVALID_ARGUMENT;
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (!mStream && startStreaming())
+            return Status::ERROR_UNKNOWN;
+    }
+
+    if (mCaptureEngine.start(cb))
+        return Status::INVALID_STATE;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceV4l2::setFrameQueue(const uint32_t depth,
+                                                     const DropPolicy policy)
+{
+    if (mCaptureEngine.setQueue(depth, policy))
+        return Status::INVALID_ARGUMENT;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceV4l2::stopAsync()
+{
+    /* Device stays started, only the capture and delivery threads are stopped */
+    mCaptureEngine.stop();
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceV4l2::setBufferCount(const uint32_t count)
+{
+    if (count < MIN_BUFFER_COUNT)
+        return Status::INVALID_ARGUMENT;
+
+    std::lock_guard<std::mutex> locker(mLock);
+    mBufferCount = count;
+    return Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceV4l2::stop()
 {
+    /* Capture thread may be blocked in read(), stop it before taking the lock */
+    mCaptureEngine.stop();
+
+    std::lock_guard<std::mutex> locker(mLock);
+    stopStreaming();
     return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceV4l2::read(CameraData &data)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    if (!mStream && startStreaming())
+        return Status::ERROR_UNKNOWN;
+
+    int ret = v4l2_poll(mStream->fd, READ_TIMEOUT_MS);
+    if (ret == 0) {
+        /* No frame from the device, or all the buffers are leased */
+        log_debug("Timeout waiting for frame from %s", mDeviceId.c_str());
+        return Status::TIMED_OUT;
+    } else if (ret < 0) {
+        log_error("Error in polling %s", mDeviceId.c_str());
+        return Status::ERROR_UNKNOWN;
+    }
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    uint32_t queued;
+    {
+        std::lock_guard<std::mutex> streamLocker(mStream->lock);
+        if (v4l2_buf_dq(mStream->fd, &buf))
+            return Status::ERROR_UNKNOWN;
+        queued = --mStream->queued;
+    }
+
+    if (buf.index >= mStream->buffers.size()) {
+        log_error("Invalid buffer index %u", buf.index);
+        return Status::ERROR_UNKNOWN;
+    }
+
+    /* Lease on the mapped buffer, the buffer is queued back to the driver on release */
+    std::shared_ptr<MmapStream> stream = mStream;
+    FrameBuffer *frame = new FrameBuffer();
+    frame->index = buf.index;
+    frame->data = stream->buffers[buf.index].addr;
+    frame->size = stream->buffers[buf.index].length;
+    frame->bytesUsed = buf.bytesused;
+    data.frame = std::shared_ptr<FrameBuffer>(frame, [stream](FrameBuffer *f) {
+        stream->requeue(f->index);
+        delete f;
+    });
+
+    if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+        /* Corrupted frame, lease drop puts the buffer back in the queue */
+        data.frame.reset();
+        return Status::ERROR_UNKNOWN;
+    }
+
+    if (queued < MIN_QUEUED_BUFFER_COUNT) {
+        /* Consumers hold the other buffers, copy the frame so the driver does not starve */
+        std::shared_ptr<FrameBuffer> copy = mCopyPool ? mCopyPool->acquire() : nullptr;
+        if (copy && buf.bytesused <= copy->size) {
+            memcpy(copy->data, frame->data, buf.bytesused);
+            copy->bytesUsed = buf.bytesused;
+            data.frame = copy;
+        }
+    }
+
+    toSystemTime(buf, data.sec, data.nsec);
+    data.width = mWidth;
+    data.height = mHeight;
+    data.stride = mStride;
+    data.buf = data.frame->data;
+    data.bufSize = buf.bytesused;
+
+    return Status::SUCCESS;
+}
+
+int CameraDeviceV4l2::startStreaming()
+{
+    /*
+     * 1. Open the device, apply the size and format requested, read the format set.
+     * 2. Request the MMAP buffers, map and queue them.
+     * 3. Start streaming.
+     */
+
+    std::shared_ptr<MmapStream> stream = std::make_shared<MmapStream>();
+    stream->fd = v4l2_open(mDeviceId);
+    if (stream->fd < 0)
+        return -1;
+
+    if (configureStream(stream) || v4l2_streamon(stream->fd)) {
+        v4l2_close(stream->fd);
+        return -1;
+    }
+
+    stream->streaming = true;
+    mStream = stream;
+    log_info("%s streaming %ux%u with %zu buffers", mDeviceId.c_str(), mWidth, mHeight,
+             stream->buffers.size());
+
+    return 0;
+}
+
+int CameraDeviceV4l2::configureStream(const std::shared_ptr<MmapStream> &stream)
+{
+    struct v4l2_format fmt;
+    if (v4l2_get_format(stream->fd, fmt))
+        return -1;
+
+    uint32_t pixFormat = toV4l2PixelFormat(mPixFormat);
+    bool sizeChange = mWidth && mHeight
+        && (mWidth != fmt.fmt.pix.width || mHeight != fmt.fmt.pix.height);
+    bool formatChange = pixFormat && pixFormat != fmt.fmt.pix.pixelformat;
+    if (sizeChange || formatChange) {
+        if (v4l2_set_pixformat(stream->fd, sizeChange ? mWidth : fmt.fmt.pix.width,
+                               sizeChange ? mHeight : fmt.fmt.pix.height,
+                               formatChange ? pixFormat : fmt.fmt.pix.pixelformat))
+            log_warning("Using current format of %s", mDeviceId.c_str());
+        if (v4l2_get_format(stream->fd, fmt))
+            return -1;
+    }
+
+    CameraParameters::PixelFormat format = toPixelFormat(fmt.fmt.pix.pixelformat);
+    if (format == CameraParameters::PixelFormat::PIXEL_FORMAT_MAX) {
+        log_error("Pixel format 0x%08x not supported by native capture", fmt.fmt.pix.pixelformat);
+        return -1;
+    }
+    mPixFormat = format;
+    mWidth = fmt.fmt.pix.width;
+    mHeight = fmt.fmt.pix.height;
+    mStride = fmt.fmt.pix.bytesperline;
+
+    uint32_t count = mBufferCount;
+    if (v4l2_buf_req(stream->fd, count, V4L2_MEMORY_MMAP) || count < MIN_BUFFER_COUNT) {
+        log_error("Not enough buffers for %s", mDeviceId.c_str());
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct v4l2_buffer buf;
+        if (v4l2_buf_query(stream->fd, i, buf))
+            return -1;
+
+        void *addr = v4l2_mmap(stream->fd, buf.length, buf.m.offset);
+        if (!addr)
+            return -1;
+        stream->buffers.push_back({addr, buf.length});
+
+        if (v4l2_buf_q(stream->fd, &buf))
+            return -1;
+        stream->queued++;
+    }
+
+    /* Frames are copied here when the consumers hold on to the mapped buffers */
+    if (!mCopyPool || mCopyPool->getSize() < fmt.fmt.pix.sizeimage)
+        mCopyPool = FramePool::create(count, fmt.fmt.pix.sizeimage);
+
+    return 0;
+}
+
+void CameraDeviceV4l2::stopStreaming()
+{
+    if (!mStream)
+        return;
+
+    /* Buffers still leased stay mapped until their last lease is released */
+    {
+        std::lock_guard<std::mutex> locker(mStream->lock);
+        mStream->streaming = false;
+        v4l2_streamoff(mStream->fd);
+        v4l2_close(mStream->fd);
+        mStream->fd = -1;
+    }
+    mStream.reset();
+}
+
 CameraDevice::Status CameraDeviceV4l2::setParam(CameraParameters &camParam, std::string param,
                                                 const char *param_value, size_t value_size,
                                                 int param_type)
@@ -143,14 +503,71 @@ CameraDevice::Status CameraDeviceV4l2::resetParams(CameraParameters &camParam)
 
 CameraDevice::Status CameraDeviceV4l2::setSize(const uint32_t width, const uint32_t height)
 {
+    /* Applied by native capture on next start of streaming */
+    std::lock_guard<std::mutex> locker(mLock);
+    mWidth = width;
+    mHeight = height;
     return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceV4l2::getSize(uint32_t &width, uint32_t &height) const
+{
+    if (mWidth && mHeight) {
+        width = mWidth;
+        height = mHeight;
+        return Status::SUCCESS;
+    }
+
+    /* Not streaming yet, read the format of the device */
+    int fd = v4l2_open(mDeviceId);
+    if (fd < 0)
+        return Status::ERROR_UNKNOWN;
+
+    struct v4l2_format fmt;
+    int ret = v4l2_get_format(fd, fmt);
+    v4l2_close(fd);
+    if (ret)
+        return Status::ERROR_UNKNOWN;
+
+    width = fmt.fmt.pix.width;
+    height = fmt.fmt.pix.height;
+    return Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceV4l2::setPixelFormat(const CameraParameters::PixelFormat format)
 {
+    /* Applied by native capture on next start of streaming */
+    if (!toV4l2PixelFormat(format))
+        return Status::INVALID_ARGUMENT;
+
+    std::lock_guard<std::mutex> locker(mLock);
+    mPixFormat = format;
     return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status
+CameraDeviceV4l2::getPixelFormat(CameraParameters::PixelFormat &format) const
+{
+    if (mPixFormat != CameraParameters::PixelFormat::PIXEL_FORMAT_MAX) {
+        format = mPixFormat;
+        return Status::SUCCESS;
+    }
+
+    int fd = v4l2_open(mDeviceId);
+    if (fd < 0)
+        return Status::ERROR_UNKNOWN;
+
+    struct v4l2_format fmt;
+    int ret = v4l2_get_format(fd, fmt);
+    v4l2_close(fd);
+    if (ret)
+        return Status::ERROR_UNKNOWN;
+
+    format = toPixelFormat(fmt.fmt.pix.pixelformat);
+    return format == CameraParameters::PixelFormat::PIXEL_FORMAT_MAX ? Status::NOT_SUPPORTED
+                                                                     : Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceV4l2::setMode(const CameraParameters::Mode mode)
 {
     mMode = mode;
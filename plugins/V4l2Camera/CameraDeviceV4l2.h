@@ -17,10 +17,13 @@
  */
 #pragma once
 #include <linux/videodev2.h>
+#include <memory>
+#include <mutex>
 #include <string>
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
+#include "CaptureEngine.h"
 
 class CameraDeviceV4l2 final : public CameraDevice {
 public:
@@ -29,15 +32,23 @@ public:
     std::string getDeviceId() const;
     Status getInfo(CameraInfo &camInfo) const;
     bool isGstV4l2Src() const;
+    Status setGstV4l2Src(const bool enable);
     Status init(CameraParameters &camParam);
     Status uninit();
     Status start();
+    Status start(const std::function<void(CameraData &)> cb);
+    Status setFrameQueue(const uint32_t depth, const DropPolicy policy);
+    Status stopAsync();
+    Status setBufferCount(const uint32_t count);
     Status stop();
+    Status read(CameraData &data);
     Status setParam(CameraParameters &camParam, const std::string param, const char *param_value,
                     const size_t value_size, const int param_type);
     Status resetParams(CameraParameters &camParam);
     Status setSize(const uint32_t width, const uint32_t height);
+    Status getSize(uint32_t &width, uint32_t &height) const;
     Status setPixelFormat(const CameraParameters::PixelFormat format);
+    Status getPixelFormat(CameraParameters::PixelFormat &format) const;
     Status setMode(const CameraParameters::Mode mode);
     Status getMode(CameraParameters::Mode &mode) const;
     Status setCameraDefinitionUri(const std::string uri);
@@ -50,7 +61,20 @@ private:
     std::string mCamDefURI;
     uint32_t mVersion;
     CameraParameters::Mode mMode;
+    bool mGstV4l2Src;
+    uint32_t mBufferCount;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mStride;
+    CameraParameters::PixelFormat mPixFormat;
+    struct MmapStream;
+    std::shared_ptr<MmapStream> mStream;
+    std::shared_ptr<FramePool> mCopyPool;
+    std::mutex mLock;
     int initInfo();
+    int startStreaming();
+    int configureStream(const std::shared_ptr<MmapStream> &stream);
+    void stopStreaming();
     int initParams(CameraParameters &camParam);
     int declareParams(CameraParameters &camParam);
     int resetV4l2Params(CameraParameters &camParam);
@@ -60,4 +84,5 @@ private:
     CameraParameters::param_type getParamType(v4l2_ctrl_type type);
     int getV4l2ControlId(int paramId);
     int setV4l2Control(int ctrl_id, int value);
+    CaptureEngine mCaptureEngine;
 };
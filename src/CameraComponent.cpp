@@ -18,6 +18,7 @@
 #include <cstring>
 
 #include "CameraComponent.h"
+#include "FrameTap.h"
 #include "ImageCaptureGst.h"
 #include "VideoCaptureGst.h"
 #include "VideoStreamRtsp.h"
@@ -28,15 +29,20 @@
 #include "util.h"
 #include <algorithm>
 
+/* Storage reported until a capture location is set, default location of the captures */
+#define DEFAULT_STORAGE_PATH "/tmp/"
+
 CameraComponent::CameraComponent(std::shared_ptr<CameraDevice> device)
     : mCamDev(device)
+    , mFrameHub(std::make_shared<FrameHub>(device))
+    , mLatency(CaptureLatency::get(device->getDeviceId()))
 {
     mCamDevName = mCamDev->getDeviceId();
 
     // Get info from the camera device
     mCamDev->getInfo(mCamInfo);
 
-    initStorageInfo(mStoreInfo);
+    updateStorage();
 }
 
 CameraComponent::~CameraComponent()
@@ -55,18 +61,29 @@ CameraComponent::~CameraComponent()
         mImgCap.reset();
     }
 
+    // Images still queued are written and reported before the component is gone
+    mImgEncoder.reset();
+
     if (mVidStream) {
         mVidStream->stop();
         mVidStream->uninit();
         mVidStream.reset();
     }
 
-    // stop the camera device
+    if (mFrameRing)
+        mFrameRing->stop();
+
+    if (mPreRecorder)
+        mPreRecorder->stop();
+
+    // release the remaining frame consumers and stop the camera device
+    mFrameHub->stop();
     mCamDev->stop();
 
     // Uninit the camera device
     mCamDev->uninit();
 
+    mFrameHub.reset();
     mCamDev.reset();
 }
 
@@ -84,6 +101,9 @@ int CameraComponent::start()
     if (ret != CameraDevice::Status::SUCCESS)
         return -1;
 
+    updateFrameRing();
+    updatePreRecorder();
+
     return 0;
 }
 
@@ -107,7 +127,14 @@ int CameraComponent::stop()
         mVidStream.reset();
     }
 
-    // stop the camera device
+    if (mFrameRing)
+        mFrameRing->stop();
+
+    if (mPreRecorder)
+        mPreRecorder->stop();
+
+    // release the remaining frame consumers and stop the camera device
+    mFrameHub->stop();
     mCamDev->stop();
 
     // Uninit the camera device
@@ -121,9 +148,32 @@ const CameraInfo &CameraComponent::getCameraInfo() const
     return mCamInfo;
 }
 
-const StorageInfo &CameraComponent::getStorageInfo() const
+StorageInfo CameraComponent::getStorageInfo() const
 {
-    return mStoreInfo;
+    StorageMonitor::Status status = mStorage->getStatus();
+    StorageInfo storeInfo;
+
+    /* Capacities in MiB, speeds in MiB/s */
+    storeInfo.storage_id = 1;
+    storeInfo.storage_count = 1;
+    storeInfo.status = status.available ? 2 /* formatted */ : 0 /* not available */;
+    storeInfo.total_capacity = status.totalBytes / (1024.0 * 1024.0);
+    storeInfo.used_capacity = status.usedBytes / (1024.0 * 1024.0);
+    storeInfo.available_capacity = status.availableBytes / (1024.0 * 1024.0);
+    storeInfo.read_speed = 0; /* Not measured */
+    storeInfo.write_speed = status.writeSpeed;
+
+    return storeInfo;
+}
+
+std::shared_ptr<FrameHub> CameraComponent::getFrameHub() const
+{
+    return mFrameHub;
+}
+
+std::shared_ptr<CaptureLatency> CameraComponent::getLatency() const
+{
+    return mLatency;
 }
 
 const std::map<std::string, std::string> &CameraComponent::getParamList() const
@@ -131,17 +181,15 @@ const std::map<std::string, std::string> &CameraComponent::getParamList() const
     return mCamParam.getParameterList();
 }
 
-void CameraComponent::initStorageInfo(struct StorageInfo &storeInfo)
+/* Videos are the captures filling the storage, their location is followed first */
+void CameraComponent::updateStorage()
 {
-    // TODO:: Fill storage details with real values
-    storeInfo.storage_id = 1;
-    storeInfo.storage_count = 1;
-    storeInfo.status = 2; /*formatted*/
-    storeInfo.total_capacity = 50.0;
-    storeInfo.used_capacity = 0.0;
-    storeInfo.available_capacity = 50.0;
-    storeInfo.read_speed = 128;
-    storeInfo.write_speed = 128;
+    if (!mVidPath.empty())
+        mStorage = StorageMonitor::get(mVidPath);
+    else if (!mImgPath.empty())
+        mStorage = StorageMonitor::get(mImgPath);
+    else
+        mStorage = StorageMonitor::get(DEFAULT_STORAGE_PATH);
 }
 
 int CameraComponent::getParamType(const char *param_id, size_t id_size)
@@ -182,6 +230,11 @@ int CameraComponent::setParam(const char *param_name, size_t id_size, const char
 int CameraComponent::setCameraMode(CameraParameters::Mode mode)
 {
     mCamDev->setMode(mode);
+    // Still capture streams the camera between its images in still mode only
+    if (mode != CameraParameters::MODE_STILL)
+        FrameTap::releaseDevice(mCamDev->getDeviceId());
+    updateFrameRing();
+    updatePreRecorder();
     return 0;
 }
 
@@ -204,11 +257,18 @@ int CameraComponent::resetCameraSettings()
 int CameraComponent::setImageCaptureLocation(std::string imgPath)
 {
     mImgPath = imgPath;
+    if (mImgCap)
+        mImgCap->setLocation(mImgPath);
+    updateStorage();
     return 0;
 }
 
 int CameraComponent::setImageCaptureSettings(ImageSettings &imgSetting)
 {
+    // Capture pipeline is created again with the new settings
+    if (mImgCap && mImgCap->getState() != ImageCapture::STATE_RUN)
+        releaseImageCapture();
+
     if (mImgSetting)
         mImgSetting.reset();
 
@@ -220,7 +280,7 @@ int CameraComponent::setImageCaptureSettings(ImageSettings &imgSetting)
 
 /* 0: idle, 1: capture in progress, 2: interval set but idle, 3: interval set and capture in
  * progress */
-void CameraComponent::getImageCaptureStatus(uint8_t &status, int &interval)
+void CameraComponent::getImageCaptureStatus(uint8_t &status, float &interval)
 {
     if (!mImgCap) {
         status = 0;
@@ -247,44 +307,104 @@ void CameraComponent::getImageCaptureStatus(uint8_t &status, int &interval)
         break;
     }
 
-    log_debug("%s Status:%d Interval:%d", __func__, status, interval);
+    log_debug("%s Status:%d Interval:%.3f", __func__, status, interval);
     return;
 }
 
-int CameraComponent::startImageCapture(int interval, int count, capture_callback_t cb)
+int CameraComponent::getImageCaptureRecord(uint32_t seq_num, CaptureCatalog::Record &record)
 {
-    int ret = 0;
+    std::string path = mImgCap ? mImgCap->getLocation() : mImgPath;
+    if (path.empty())
+        return -1;
 
-    // TODO :: Check if video capture or video streaming is running
+    std::shared_ptr<CaptureCatalog> catalog
+        = CaptureCatalog::get(path, CaptureCatalog::Media::IMAGE);
+    if (!catalog || !catalog->lookup(seq_num, record))
+        return -1;
 
-    mImgCapCB = cb;
+    return 0;
+}
 
-    // Delete imgCap instance if already exists
-    // This could be because of no StopImageCapture call after done
-    // Or new startImageCapture call while prev call is still not done
-    if (mImgCap)
-        mImgCap.reset();
+int CameraComponent::setImageCapturePreTrigger(uint32_t frames, size_t memory,
+                                               FrameRing::Policy policy)
+{
+    if (mFrameRing)
+        mFrameRing->stop();
+    mFrameRing.reset();
 
-    // check if settings are available
-    if (mImgSetting)
-        mImgCap = std::make_shared<ImageCaptureGst>(mCamDev, *mImgSetting);
+    if (!frames)
+        return 0;
+
+    // The ring reads the frames of the camera device through the frame hub
+    if (mCamDev->isGstV4l2Src()) {
+        log_warning("Pre-trigger frames need native capture, disabled for %s",
+                    mCamDevName.c_str());
+        return -1;
+    }
+
+    mFrameRing = std::make_shared<FrameRing>(mFrameHub, frames, memory, policy);
+
+    return 0;
+}
+
+void CameraComponent::updateFrameRing()
+{
+    if (!mFrameRing)
+        return;
+
+    // Copying every frame only pays off when a still can be triggered
+    if (getCameraMode() == CameraParameters::MODE_STILL)
+        mFrameRing->start();
     else
-        mImgCap = std::make_shared<ImageCaptureGst>(mCamDev);
+        mFrameRing->stop();
+}
 
-    if (!mImgPath.empty())
-        mImgCap->setLocation(mImgPath);
+int CameraComponent::startImageCapture(float interval, int count, capture_callback_t cb)
+{
+    int ret = 0;
 
-    ret = mImgCap->init();
-    if (!ret) {
-        ret = mImgCap->start(interval, count,
-                             std::bind(&CameraComponent::cbImageCaptured, this,
-                                       std::placeholders::_1, std::placeholders::_2));
+    // TODO :: Check if video capture or video streaming is running
+
+    // Keep the imgCap instance and its capture pipeline from the previous capture.
+    // Stop it if there was no StopImageCapture call after done, or if the previous
+    // call is still not done. Create it again if it failed.
+    if (mImgCap) {
+        mImgCap->stop();
+        if (mImgCap->getState() != ImageCapture::STATE_INIT)
+            releaseImageCapture();
+    }
+
+    if (!mImgCap) {
+        // Encoders are kept across the captures, a new capture does not wait for the images of
+        // the previous one
+        if (!mImgEncoder)
+            mImgEncoder = std::make_shared<ImageEncoderPool>();
+
+        // check if settings are available
+        if (mImgSetting)
+            mImgCap = std::make_shared<ImageCaptureGst>(mCamDev, *mImgSetting, mFrameHub,
+                                                        mFrameRing, mImgEncoder);
+        else
+            mImgCap = std::make_shared<ImageCaptureGst>(mCamDev, mFrameHub, mFrameRing,
+                                                        mImgEncoder);
+
+        if (!mImgPath.empty())
+            mImgCap->setLocation(mImgPath);
+
+        ret = mImgCap->init();
         if (ret) {
-            mImgCap->uninit();
             mImgCap.reset();
+            return ret;
         }
     }
 
+    // Images of a previous capture may still be reported to its callback by the encoders
+    ret = mImgCap->start(interval, count,
+                         std::bind(&CameraComponent::cbImageCaptured, this, cb,
+                                   std::placeholders::_1, std::placeholders::_2));
+    if (ret)
+        releaseImageCapture();
+
     return ret;
 }
 
@@ -293,24 +413,36 @@ int CameraComponent::stopImageCapture()
     if (!mImgCap)
         return 0;
 
+    // Capture pipeline is kept for the next capture
     mImgCap->stop();
-    mImgCap->uninit();
-    mImgCap.reset();
+    if (mImgCap->getState() != ImageCapture::STATE_INIT)
+        releaseImageCapture();
 
     return 0;
 }
 
-void CameraComponent::cbImageCaptured(int result, int seq_num)
+void CameraComponent::releaseImageCapture()
+{
+    if (!mImgCap)
+        return;
+
+    mImgCap->stop();
+    mImgCap->uninit();
+    mImgCap.reset();
+}
+
+void CameraComponent::cbImageCaptured(capture_callback_t cb, int result, int seq_num)
 {
     log_debug("%s result:%d sequenc:%d", __func__, result, seq_num);
     // TODO :: Get the file path of the image and host it via http
-    if (mImgCapCB)
-        mImgCapCB(result, seq_num);
+    if (cb)
+        cb(result, seq_num);
 }
 
 int CameraComponent::setVideoCaptureLocation(std::string vidPath)
 {
     mVidPath = vidPath;
+    updateStorage();
     return 0;
 }
 
@@ -325,7 +457,48 @@ int CameraComponent::setVideoCaptureSettings(VideoSettings &vidSetting)
     return 0;
 }
 
-int CameraComponent::startVideoCapture(int status_freq)
+int CameraComponent::setVideoCaptureSegment(uint32_t durationSec, uint32_t sizeMB)
+{
+    mVidSegmentSec = durationSec;
+    mVidSegmentMB = sizeMB;
+
+    return 0;
+}
+
+int CameraComponent::setVideoCapturePreRecord(uint32_t seconds, size_t memory)
+{
+    if (mPreRecorder)
+        mPreRecorder->stop();
+    mPreRecorder.reset();
+
+    if (!seconds)
+        return 0;
+
+    // The encoder reads the frames of the camera device through the frame hub, all the time
+    if (mCamDev->isGstV4l2Src()) {
+        log_warning("Pre-record needs native capture, disabled for %s", mCamDevName.c_str());
+        return -1;
+    }
+
+    // Encoded at the settings of the video capture, the ring is written to its file as it is
+    mPreRecorder = std::make_shared<PreRecorder>(mFrameHub, seconds, memory, mVidSetting);
+
+    return 0;
+}
+
+void CameraComponent::updatePreRecorder()
+{
+    if (!mPreRecorder)
+        return;
+
+    // Encoding all the time only pays off when a recording can be started
+    if (getCameraMode() == CameraParameters::MODE_VIDEO)
+        mPreRecorder->start();
+    else
+        mPreRecorder->stop();
+}
+
+int CameraComponent::startVideoCapture()
 {
     int ret = 0;
 
@@ -335,20 +508,30 @@ int CameraComponent::startVideoCapture(int status_freq)
     // TODO :: Check if video capture or video streaming is running
 
     // check if settings are available
+    std::shared_ptr<VideoCaptureGst> vidCap;
     if (mVidSetting)
-        mVidCap = std::make_shared<VideoCaptureGst>(mCamDev, *mVidSetting);
+        vidCap = std::make_shared<VideoCaptureGst>(mCamDev, *mVidSetting, mFrameHub);
     else
-        mVidCap = std::make_shared<VideoCaptureGst>(mCamDev);
+        vidCap = std::make_shared<VideoCaptureGst>(mCamDev, mFrameHub);
+
+    // Recording starts with the video kept by the pre-recorder
+    vidCap->setPreRecorder(mPreRecorder);
+    mVidCap = vidCap;
 
     if (!mVidPath.empty())
         mVidCap->setLocation(mVidPath);
 
+    mVidCap->setSegment(mVidSegmentSec, mVidSegmentMB);
+    mVidCap->setFinalizedCallback(mVidFinalizedCb);
+
     ret = mVidCap->init();
     if (!ret) {
         ret = mVidCap->start();
         if (ret) {
             mVidCap->uninit();
             mVidCap.reset();
+        } else {
+            mVidStartUs = now_usec();
         }
     }
 
@@ -365,6 +548,7 @@ int CameraComponent::stopVideoCapture()
     mVidCap->stop();
     mVidCap->uninit();
     mVidCap.reset();
+    mVidStartUs = 0;
 
     return ret;
 }
@@ -395,6 +579,20 @@ uint8_t CameraComponent::getVideoCaptureStatus()
     return ret;
 }
 
+void CameraComponent::setVideoFinalizedCallback(capture_callback_t cb)
+{
+    mVidFinalizedCb = cb;
+}
+
+uint32_t CameraComponent::getVideoCaptureTime()
+{
+    if (getVideoCaptureStatus() != 1)
+        return 0;
+
+    /* Monotonic, not moved by the clock of the system being set during the recording */
+    return (now_usec() - mVidStartUs) / USEC_PER_MSEC;
+}
+
 int CameraComponent::setVideoSize(uint32_t param_value)
 {
     return 0;
@@ -409,19 +607,17 @@ int CameraComponent::startVideoStream(const bool isUdp)
 {
     int ret = 0;
 
-    // TODO :: Check if image/video capture is running
-    // If yes, video streaming may work by adding a tee element
-    // in the gstreamer pipeline. Currently conncurent use cases
-    // not supported
+    // Image capture and video streaming share the camera frames through the
+    // frame hub when the camera device supports the asynchronous mode
 
     // Close previous instance of video streaming if exist
     if (mVidStream)
         mVidStream.reset();
 
     if (isUdp)
-        mVidStream = std::make_shared<VideoStreamUdp>(mCamDev);
+        mVidStream = std::make_shared<VideoStreamUdp>(mCamDev, mFrameHub);
     else {
-        mVidStream = std::make_shared<VideoStreamRtsp>(mCamDev);
+        mVidStream = std::make_shared<VideoStreamRtsp>(mCamDev, mFrameHub);
     }
 
     ret = mVidStream->init();
@@ -24,7 +24,14 @@
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
+#include "CaptureCatalog.h"
+#include "CaptureLatency.h"
+#include "FrameHub.h"
+#include "FrameRing.h"
 #include "ImageCapture.h"
+#include "ImageEncoderPool.h"
+#include "PreRecorder.h"
+#include "StorageMonitor.h"
 #include "VideoCapture.h"
 #include "VideoStream.h"
 #include "log.h"
@@ -49,8 +56,10 @@ public:
     int start();
     int stop();
     const CameraInfo &getCameraInfo() const;
-    const StorageInfo &getStorageInfo() const;
+    StorageInfo getStorageInfo() const;
     const std::map<std::string, std::string> &getParamList() const;
+    std::shared_ptr<FrameHub> getFrameHub() const;
+    std::shared_ptr<CaptureLatency> getLatency() const;
     int getParamType(const char *param_id, size_t id_size);
     virtual int getParam(const char *param_id, size_t id_size, char *param_value,
                          size_t value_size);
@@ -61,15 +70,23 @@ public:
     typedef std::function<void(int result, int seq_num)> capture_callback_t;
     int setImageCaptureLocation(std::string imgPath);
     int setImageCaptureSettings(ImageSettings &imgSetting);
-    void getImageCaptureStatus(uint8_t &status, int &interval);
-    virtual int startImageCapture(int interval, int count, capture_callback_t cb);
+    int setImageCapturePreTrigger(uint32_t frames, size_t memory, FrameRing::Policy policy);
+    void getImageCaptureStatus(uint8_t &status, float &interval);
+    int getImageCaptureRecord(uint32_t seq_num, CaptureCatalog::Record &record);
+    virtual int startImageCapture(float interval, int count, capture_callback_t cb);
     virtual int stopImageCapture();
-    void cbImageCaptured(int result, int seq_num);
+    void cbImageCaptured(capture_callback_t cb, int result, int seq_num);
     int setVideoCaptureLocation(std::string vidPath);
     int setVideoCaptureSettings(VideoSettings &vidSetting);
-    virtual int startVideoCapture(int status_freq);
+    int setVideoCaptureSegment(uint32_t durationSec, uint32_t sizeMB);
+    int setVideoCapturePreRecord(uint32_t seconds, size_t memory);
+    virtual int startVideoCapture();
     virtual int stopVideoCapture();
+    /* Called once the file of each recording stopped is closed, on the finalizer thread */
+    void setVideoFinalizedCallback(capture_callback_t cb);
     virtual uint8_t getVideoCaptureStatus();
+    /* Time since the start of the recording in ms, 0 when not recording */
+    uint32_t getVideoCaptureTime();
     int startVideoStream(const bool isUdp);
     int stopVideoStream();
     uint8_t getVideoStreamStatus() const;
@@ -78,19 +95,30 @@ public:
 private:
     std::string mCamDevName;               /* Camera device name */
     CameraInfo mCamInfo;                   /* Camera Information Structure */
-    StorageInfo mStoreInfo;                /* Storage Information Structure */
     CameraParameters mCamParam;            /* Camera Parameters Object */
     std::shared_ptr<CameraDevice> mCamDev; /* Camera Device Object */
+    std::shared_ptr<FrameHub> mFrameHub;   /* Camera frames shared between consumers */
+    std::shared_ptr<FrameRing> mFrameRing; /* Frames before the trigger, in still mode */
     std::shared_ptr<ImageCapture> mImgCap; /* Image Capture Object */
-    std::function<void(int result, int seq_num)> mImgCapCB;
+    std::shared_ptr<ImageEncoderPool> mImgEncoder; /* Writes the images, outlives mImgCap */
     std::string mImgPath;
     std::shared_ptr<ImageSettings> mImgSetting; /* Image Setting Structure */
     std::shared_ptr<VideoCapture> mVidCap; /* Video Capture Object */
     std::string mVidPath;
     std::shared_ptr<VideoSettings> mVidSetting; /* Video Setting Structure */
+    uint32_t mVidSegmentSec = 0; /* Length of the files of a video, 0 for one file */
+    uint32_t mVidSegmentMB = 0;  /* Size of the files of a video, 0 for no limit */
+    std::shared_ptr<PreRecorder> mPreRecorder; /* Video before the start command, in video mode */
+    uint64_t mVidStartUs = 0; /* Start of the recording, monotonic time */
+    capture_callback_t mVidFinalizedCb; /* File of a recording closed */
     std::shared_ptr<VideoStream> mVidStream; /* Video Streaming Object*/
+    std::shared_ptr<CaptureLatency> mLatency; /* Time taken by the stages of the captures */
+    std::shared_ptr<StorageMonitor> mStorage; /* File system of the captures */
 
-    void initStorageInfo(struct StorageInfo &storeInfo);
+    void releaseImageCapture();
+    void updateFrameRing();
+    void updatePreRecorder();
+    void updateStorage();
     int setVideoFrameFormat(uint32_t param_value);
     int setVideoSize(uint32_t param_value);
     std::string toString(const char *buf, size_t buf_size);
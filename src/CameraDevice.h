@@ -18,9 +18,11 @@
 #pragma once
 //#include "CameraComponent.h"
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "CameraParameters.h"
+#include "FramePool.h"
 
 /**
  *  The CameraInfo structure is used to hold the camera device information.
@@ -53,6 +55,7 @@ struct CameraData {
     //    CameraDevice::PixelFormat pixFmt = 0; /**< pixel format of the image. */
     void *buf = nullptr; /**< buffer address. */
     size_t bufSize = 0;  /**< buffer size. */
+    std::shared_ptr<FrameBuffer> frame; /**< lease on the pooled buffer holding buf, if any. */
 };
 
 /**
@@ -91,6 +94,15 @@ public:
         STATE_RUN,
     };
 
+    /**
+     *  Policy applied by the asynchronous mode when the frame queue is full.
+     */
+    enum class DropPolicy {
+        DROP_OLDEST, /**< Drop the oldest queued frame, callback gets the most recent frames. */
+        DROP_NEWEST, /**< Drop the frame just read from the camera. */
+        BLOCK,       /**< Stop reading from the camera until there is space in the queue. */
+    };
+
     /**
      *  Size of the camera image.
      */
@@ -134,6 +146,16 @@ public:
      */
     virtual bool isGstV4l2Src() const = 0;
 
+    /**
+     *  Select if gstreamer v4l2src element or the native capture of the Camera Device is used.
+     *  With native capture, frames are read with read() or start(cb) and isGstV4l2Src() is false.
+     *
+     *  @param[in] enable True to use gstreamer v4l2src element, false for native capture.
+     *
+     *  @return Status of request.
+     */
+    virtual Status setGstV4l2Src(const bool enable) { return Status::NOT_SUPPORTED; }
+
     /**
      *  Initialize camera device.
      *
@@ -159,6 +181,10 @@ public:
 
     /**
      *  Start camera device in asynchronous mode.
+     *  The camera device is read by a capture thread, the frames are queued and passed to the
+     *  callback from a separate thread. Frames are dropped as per the policy set with
+     *  setFrameQueue() when the callback does not keep up with the camera. The asynchronous mode
+     *  runs until stop() is called, stop() must not be called from the callback.
      *
      *  @param[in] cb Callback function to receive camera data
      *
@@ -169,6 +195,51 @@ public:
         return Status::NOT_SUPPORTED;
     }
 
+    /**
+     *  Set the frame queue of the asynchronous mode.
+     *
+     *  @param[in] depth Number of frames that can be queued for the callback.
+     *  @param[in] policy Policy applied when the queue is full.
+     *
+     *  @return Status of request.
+     */
+    virtual Status setFrameQueue(const uint32_t depth, const DropPolicy policy)
+    {
+        return Status::NOT_SUPPORTED;
+    }
+
+    /**
+     *  Stop the asynchronous mode started with start(cb), without stopping the camera device.
+     *  The capture thread no longer reads the device and the callback is not called anymore once
+     *  it returns. Must not be called from the callback.
+     *
+     *  @return Status of request.
+     */
+    virtual Status stopAsync() { return Status::NOT_SUPPORTED; }
+
+    /**
+     *  Set number of buffers the camera device captures into.
+     *  Takes effect on next start of the capture.
+     *
+     *  @param[in] count Number of buffers.
+     *
+     *  @return Status of request.
+     */
+    virtual Status setBufferCount(const uint32_t count) { return Status::NOT_SUPPORTED; }
+
+    /**
+     *  Set the depth range mapped to the colors of the images, for depth cameras.
+     *
+     *  @param[in] minDepth Nearest depth in millimeters.
+     *  @param[in] maxDepth Farthest depth in millimeters.
+     *
+     *  @return Status of request.
+     */
+    virtual Status setDepthRange(const uint32_t minDepth, const uint32_t maxDepth)
+    {
+        return Status::NOT_SUPPORTED;
+    }
+
     /**
      *  Stop camera device.
      *
@@ -178,6 +249,9 @@ public:
 
     /**
      *  Read camera images from camera device.
+     *  When the device fills the image in a pooled buffer, data.frame holds a lease on it and the
+     *  image stays valid as long as a copy of the lease is held. Otherwise data.buf is only valid
+     *  until the next call to read().
      *
      *  @param[out] data CameraData to hold image and meta-data.
      *
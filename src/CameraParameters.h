@@ -201,6 +201,8 @@ public:
         PIXEL_FORMAT_UYVY,    /* 16 bpp YUV 4:2:2 */
         PIXEL_FORMAT_RGB24,   /* 24 bpp RGB 8:8:8 */
         PIXEL_FORMAT_RGB32,   /* 32 bpp RGB 8:8:8:8 */
+        PIXEL_FORMAT_YUYV,    /* 16 bpp YUV 4:2:2 */
+        PIXEL_FORMAT_NV12,    /* 12 bpp YUV 4:2:0, interleaved UV */
         PIXEL_FORMAT_MAX = 99
     };
 
@@ -18,13 +18,24 @@
 
 #include <cstddef>
 #include <set>
+#include <sstream>
 
 #include "CameraServer.h"
+#include "EncoderRegistry.h"
+#include "StorageMonitor.h"
+#include "VideoFinalizer.h"
 #include "log.h"
 #include "util.h"
 
 #define DEFAULT_SERVICE_PORT 8554
 #define DEFAULT_SERVICE_TYPE "_rtsp._udp"
+#define DEFAULT_PRETRIGGER_MEMORY_MB 64
+#define DEFAULT_SEGMENT_DURATION_S 60
+#define DEFAULT_PRERECORD_MEMORY_MB 32
+/* Period the capacity of the capture locations is read at */
+#define STORAGE_REFRESH_MS 2000
+/* Files of the recordings stopped are closed before exiting */
+#define FINALIZE_WAIT_MS 15000
 
 #ifdef ENABLE_GAZEBO
 #define GAZEBO_STRING "gazebo"
@@ -37,16 +48,47 @@ CameraServer::CameraServer(const ConfFile &conf)
 #endif
 {
     std::string confDeviceId;
+    // Select the video encoders once, before the cameras use them
+    readEncoderSettings(conf);
+    EncoderRegistry::probe();
+
     // Read image capture settings/destination
     ImageSettings imgSetting;
     bool isImgCapSetting = readImgCapSettings(conf, imgSetting);
     std::string imgPath = readImgCapLocation(conf);
 
+    // Read zero shutter lag settings of image capture
+    uint32_t preTriggerFrames;
+    size_t preTriggerMemory;
+    FrameRing::Policy preTriggerPolicy;
+    readImgCapPreTrigger(conf, preTriggerFrames, preTriggerMemory, preTriggerPolicy);
+
     // Read video capture settings/destination
     VideoSettings vidSetting;
     bool isVidCapSetting = readVidCapSettings(conf, vidSetting);
     std::string vidPath = readVidCapLocation(conf);
 
+    // Read the length of the files of the videos
+    uint32_t segmentSec, segmentMB;
+    readVidCapSegment(conf, segmentSec, segmentMB);
+
+    // Read frame queue settings of the camera devices
+    uint32_t queueDepth;
+    CameraDevice::DropPolicy dropPolicy;
+    bool isFrameQueueSetting = readFrameQueueSettings(conf, queueDepth, dropPolicy);
+
+    // Read native capture settings of the V4L2 camera devices
+    uint32_t bufferCount;
+    bool nativeCapture;
+    readV4l2CaptureSettings(conf, bufferCount, nativeCapture);
+
+    // Read pixel format delivered by the camera devices feeding appsrc
+    CameraParameters::PixelFormat pixelFormat = readCapturePixelFormat(conf);
+
+    // Read depth range of the colors of the depth camera devices
+    uint32_t minDepth, maxDepth;
+    bool isDepthRangeSetting = readDepthRange(conf, minDepth, maxDepth);
+
     // Read blacklisted camera devices
     std::set<std::string> blackList = readBlacklistDevices(conf);
 
@@ -88,6 +130,30 @@ CameraServer::CameraServer(const ConfFile &conf)
         // Set the GStreamer RTSP pipeline from conf file
         device->setGstRTSPPipeline(readRTSPPipeline(conf, confDeviceId));
 
+        // Set the frame queue used when the device runs in asynchronous mode
+        if (isFrameQueueSetting
+            && device->setFrameQueue(queueDepth, dropPolicy) == CameraDevice::Status::SUCCESS)
+            log_debug("Frame queue depth:%u policy:%d", queueDepth, (int)dropPolicy);
+
+        // Select native capture instead of gstreamer v4l2src, if supported by the device
+        if (nativeCapture && device->setGstV4l2Src(false) == CameraDevice::Status::SUCCESS)
+            log_info("Native capture for device : %s", deviceID.c_str());
+
+        if (bufferCount)
+            device->setBufferCount(bufferCount);
+
+        // Let the device give frames ready for the encoder, instead of converting in gstreamer
+        if (pixelFormat != CameraParameters::PixelFormat::PIXEL_FORMAT_MAX
+            && !device->isGstV4l2Src()
+            && device->setPixelFormat(pixelFormat) != CameraDevice::Status::SUCCESS)
+            log_warning("Pixel format %d not supported by device : %s", (int)pixelFormat,
+                        deviceID.c_str());
+
+        if (isDepthRangeSetting
+            && device->setDepthRange(minDepth, maxDepth) == CameraDevice::Status::SUCCESS)
+            log_debug("Depth range %u-%u mm for device : %s", minDepth, maxDepth,
+                      deviceID.c_str());
+
         // create camera component with camera device
         CameraComponent *comp = new CameraComponent(device);
 
@@ -98,12 +164,25 @@ CameraServer::CameraServer(const ConfFile &conf)
         if (!imgPath.empty())
             comp->setImageCaptureLocation(imgPath);
 
+        if (preTriggerFrames)
+            comp->setImageCapturePreTrigger(preTriggerFrames, preTriggerMemory,
+                                            preTriggerPolicy);
+
         if (isVidCapSetting)
             comp->setVideoCaptureSettings(vidSetting);
 
         if (!vidPath.empty())
             comp->setVideoCaptureLocation(vidPath);
 
+        comp->setVideoCaptureSegment(segmentSec, segmentMB);
+
+        // Set the video kept before the start of a recording, after the video settings
+        uint32_t preRecordSec;
+        size_t preRecordMemory;
+        readVidCapPreRecord(conf, confDeviceId, preRecordSec, preRecordMemory);
+        if (preRecordSec)
+            comp->setVideoCapturePreRecord(preRecordSec, preRecordMemory);
+
 // add to mavlink server
 #ifdef ENABLE_MAVLINK
         if (mMavlinkServer.addCameraComponent(comp) == -1) {
@@ -138,6 +217,8 @@ void CameraServer::start()
         camComp->startVideoStream(false);
     }
 
+    StorageMonitor::startRefresh(STORAGE_REFRESH_MS);
+
 #ifdef ENABLE_MAVLINK
     mMavlinkServer.start();
 #endif
@@ -173,6 +254,8 @@ void CameraServer::stop()
         camComp->stop();
     }
 
+    VideoFinalizer::get()->wait(FINALIZE_WAIT_MS);
+    StorageMonitor::stopRefresh();
 }
 
 void CameraServer::addCameraInformation(const std::shared_ptr<CameraDevice> &device)
@@ -276,6 +359,34 @@ std::string CameraServer::readImgCapLocation(const ConfFile &conf) const
     return ret;
 }
 
+void CameraServer::readImgCapPreTrigger(const ConfFile &conf, uint32_t &frames, size_t &memory,
+                                        FrameRing::Policy &policy) const
+{
+    struct options {
+        int frames;
+        int memory;
+        int policy;
+    } opt = {};
+
+    static const ConfFile::OptionsTable option_table[] = {
+        {"pretrigger_frames", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, frames)},
+        {"pretrigger_memory", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, memory)},
+        {"pretrigger_policy", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, policy)},
+    };
+    conf.extract_options("imgcap", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+
+    frames = opt.frames > 0 ? opt.frames : 0;
+    memory = (size_t)(opt.memory > 0 ? opt.memory : DEFAULT_PRETRIGGER_MEMORY_MB) << 20;
+    policy = opt.policy == (int)FrameRing::Policy::FIRST_AFTER ? FrameRing::Policy::FIRST_AFTER
+                                                               : FrameRing::Policy::CLOSEST;
+    if (frames)
+        log_info("Image Capture pre-trigger frames=%u memory=%zuMB policy=%d", frames,
+                 memory >> 20, (int)policy);
+}
+
 bool CameraServer::readVidCapSettings(const ConfFile &conf, VideoSettings &vidSetting) const
 {
     int ret = 0;
@@ -333,6 +444,155 @@ std::string CameraServer::readVidCapLocation(const ConfFile &conf) const
     return ret;
 }
 
+void CameraServer::readVidCapSegment(const ConfFile &conf, uint32_t &durationSec,
+                                     uint32_t &sizeMB) const
+{
+    struct options {
+        int duration;
+        int size;
+    } opt = {DEFAULT_SEGMENT_DURATION_S, 0};
+
+    static const ConfFile::OptionsTable option_table[] = {
+        {"segment_duration", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, duration)},
+        {"segment_size", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, size)},
+    };
+    conf.extract_options("vidcap", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+
+    durationSec = opt.duration > 0 ? opt.duration : 0;
+    sizeMB = opt.size > 0 ? opt.size : 0;
+    if (durationSec || sizeMB)
+        log_info("Video Capture segments of %us, %uMB", durationSec, sizeMB);
+    else
+        log_info("Video Capture in one file");
+}
+
+void CameraServer::readVidCapPreRecord(const ConfFile &conf, std::string deviceID,
+                                       uint32_t &seconds, size_t &memory) const
+{
+    char *value = 0;
+    int sec = 0, mb = 0;
+
+    seconds = 0;
+    memory = (size_t)DEFAULT_PRERECORD_MEMORY_MB << 20;
+    if (conf.extract_options("prerecord", deviceID.c_str(), &value))
+        return;
+
+    // <seconds>[,<memory in MB>]
+    int ret = sscanf(value, "%d,%d", &sec, &mb);
+    free(value);
+    if (ret < 1 || sec <= 0 || (ret == 2 && mb <= 0)) {
+        log_error("Invalid pre-record settings for %s, disabled", deviceID.c_str());
+        return;
+    }
+
+    seconds = sec;
+    if (ret == 2)
+        memory = (size_t)mb << 20;
+    log_info("Video Capture pre-record of %s: %us, %zuMB", deviceID.c_str(), seconds,
+             memory >> 20);
+}
+
+bool CameraServer::readFrameQueueSettings(const ConfFile &conf, uint32_t &depth,
+                                          CameraDevice::DropPolicy &policy) const
+{
+    int ret = 0;
+
+    struct options {
+        int depth;
+        int policy;
+    } opt = {};
+
+    static const ConfFile::OptionsTable option_table[] = {
+        {"queue_depth", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, depth)},
+        {"drop_policy", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, policy)},
+    };
+    ret = conf.extract_options("capture", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    if (ret)
+        return false;
+
+    if (opt.depth <= 0 || opt.policy < (int)CameraDevice::DropPolicy::DROP_OLDEST
+        || opt.policy > (int)CameraDevice::DropPolicy::BLOCK) {
+        log_error("Invalid frame queue settings, use default");
+        return false;
+    }
+
+    depth = opt.depth;
+    policy = static_cast<CameraDevice::DropPolicy>(opt.policy);
+    log_info("Frame queue depth=%u drop_policy=%d", depth, opt.policy);
+
+    return true;
+}
+
+void CameraServer::readV4l2CaptureSettings(const ConfFile &conf, uint32_t &bufferCount,
+                                           bool &nativeCapture) const
+{
+    struct options {
+        int bufferCount;
+        bool nativeCapture;
+    } opt = {};
+
+    static const ConfFile::OptionsTable option_table[] = {
+        {"buffer_count", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, bufferCount)},
+        {"native_capture", false, ConfFile::parse_bool,
+         OPTIONS_TABLE_STRUCT_FIELD(options, nativeCapture)},
+    };
+    conf.extract_options("v4l2", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+
+    bufferCount = opt.bufferCount > 0 ? opt.bufferCount : 0;
+    nativeCapture = opt.nativeCapture;
+}
+
+CameraParameters::PixelFormat CameraServer::readCapturePixelFormat(const ConfFile &conf) const
+{
+    struct options {
+        int format;
+    } opt = {};
+
+    static const ConfFile::OptionsTable option_table[] = {
+        {"pixel_format", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, format)},
+    };
+    if (conf.extract_options("capture", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_MAX;
+
+    if (opt.format != (int)CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420
+        && opt.format != (int)CameraParameters::PixelFormat::PIXEL_FORMAT_NV12) {
+        log_error("Invalid capture pixel format, use default");
+        return CameraParameters::PixelFormat::PIXEL_FORMAT_MAX;
+    }
+
+    log_info("Capture pixel_format=%d", opt.format);
+    return static_cast<CameraParameters::PixelFormat>(opt.format);
+}
+
+bool CameraServer::readDepthRange(const ConfFile &conf, uint32_t &minDepth,
+                                  uint32_t &maxDepth) const
+{
+    struct options {
+        int minDepth;
+        int maxDepth;
+    } opt = {};
+
+    static const ConfFile::OptionsTable option_table[] = {
+        {"depth_min", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, minDepth)},
+        {"depth_max", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, maxDepth)},
+    };
+    if (conf.extract_options("realsense", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return false;
+
+    if (opt.minDepth < 0 || opt.maxDepth <= opt.minDepth) {
+        log_error("Invalid depth range, use default");
+        return false;
+    }
+
+    minDepth = opt.minDepth;
+    maxDepth = opt.maxDepth;
+    log_info("Depth range depth_min=%u depth_max=%u", minDepth, maxDepth);
+
+    return true;
+}
+
 std::string CameraServer::readGazeboCamTopic(const ConfFile &conf) const
 {
     // Location must start and end with "/"
@@ -349,3 +609,48 @@ std::string CameraServer::readGazeboCamTopic(const ConfFile &conf) const
 
     return ret;
 }
+
+void CameraServer::readEncoderSettings(const ConfFile &conf) const
+{
+    char *value = 0;
+    std::vector<std::string> factories;
+    std::map<std::string, std::string> options;
+
+    // Encoders to try in order, separated by commas
+    if (!conf.extract_options("gstreamer", "encoder", &value)) {
+        log_info("Video encoders : %s", value);
+        std::stringstream ss(value);
+        std::string factory;
+        while (std::getline(ss, factory, ',')) {
+            factory.erase(0, factory.find_first_not_of(" \t"));
+            factory.erase(factory.find_last_not_of(" \t") + 1);
+            if (!factory.empty())
+                factories.push_back(factory);
+        }
+        free(value);
+    }
+
+    // Options of each encoder, the encoder probed may be any of the list
+    for (const std::string &factory : factories.empty() ? EncoderRegistry::getKnownFactories()
+                                                        : factories) {
+        std::string key = "encoder_options." + factory;
+        if (!conf.extract_options("gstreamer", key.c_str(), &value)) {
+            log_info("Video encoder options of %s : %s", factory.c_str(), value);
+            options[factory] = value;
+            free(value);
+        }
+    }
+
+    // Options without encoder name are only known to apply to a single encoder
+    if (!conf.extract_options("gstreamer", "encoder_options", &value)) {
+        if (factories.size() == 1 && !options.count(factories[0])) {
+            log_info("Video encoder options : %s", value);
+            options[factories[0]] = value;
+        } else {
+            log_warning("Video encoder options ignored, set encoder_options.<encoder> instead");
+        }
+        free(value);
+    }
+
+    EncoderRegistry::setPreference(factories, options);
+}
@@ -45,9 +45,21 @@ private:
     std::string readRTSPPipeline(const ConfFile &conf, std::string deviceID);
     bool readImgCapSettings(const ConfFile &conf, ImageSettings &imgSetting) const;
     std::string readImgCapLocation(const ConfFile &conf) const;
+    void readImgCapPreTrigger(const ConfFile &conf, uint32_t &frames, size_t &memory,
+                              FrameRing::Policy &policy) const;
     bool readVidCapSettings(const ConfFile &conf, VideoSettings &vidSetting) const;
     std::string readVidCapLocation(const ConfFile &conf) const;
+    void readVidCapSegment(const ConfFile &conf, uint32_t &durationSec, uint32_t &sizeMB) const;
+    void readVidCapPreRecord(const ConfFile &conf, std::string deviceID, uint32_t &seconds,
+                             size_t &memory) const;
+    bool readFrameQueueSettings(const ConfFile &conf, uint32_t &depth,
+                                CameraDevice::DropPolicy &policy) const;
+    void readV4l2CaptureSettings(const ConfFile &conf, uint32_t &bufferCount,
+                                 bool &nativeCapture) const;
+    CameraParameters::PixelFormat readCapturePixelFormat(const ConfFile &conf) const;
+    bool readDepthRange(const ConfFile &conf, uint32_t &minDepth, uint32_t &maxDepth) const;
     std::string readGazeboCamTopic(const ConfFile &conf) const;
+    void readEncoderSettings(const ConfFile &conf) const;
     PluginManager mPluginManager;
 
 #ifdef ENABLE_MAVLINK
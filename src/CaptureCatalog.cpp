@@ -0,0 +1,275 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CaptureCatalog.h"
+#include "log.h"
+
+#define CATALOG_MAGIC "DCMCATLG"
+#define CATALOG_VERSION 1
+/* File grows by this many records, 272 KiB */
+#define GROW_RECORDS 1024
+
+struct CaptureCatalog::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t media;
+    uint32_t count; /* Numbers reserved */
+    uint32_t done;  /* Records done */
+    uint32_t reserved[9]; /* Header is 64 bytes */
+};
+
+static_assert(sizeof(CaptureCatalog::Record) == 272, "Catalog record layout changed");
+
+static std::map<std::string, std::shared_ptr<CaptureCatalog>> catalogs;
+static std::mutex catalogsLock;
+
+std::shared_ptr<CaptureCatalog> CaptureCatalog::get(const std::string &dir, Media media)
+{
+    std::lock_guard<std::mutex> locker(catalogsLock);
+
+    std::shared_ptr<CaptureCatalog> catalog = std::make_shared<CaptureCatalog>(dir, media);
+    auto it = catalogs.find(catalog->getFilePath());
+    if (it != catalogs.end())
+        return it->second;
+
+    if (catalog->open())
+        return nullptr;
+
+    catalogs[catalog->getFilePath()] = catalog;
+    return catalog;
+}
+
+CaptureCatalog::CaptureCatalog(const std::string &dir, Media media)
+    : mMedia(media)
+    , mFd(-1)
+    , mMap(nullptr)
+    , mMapSize(0)
+    , mCapacity(0)
+    , mSessionStart(0)
+{
+    mFilePath = dir;
+    if (mFilePath.empty() || mFilePath.back() != '/')
+        mFilePath += '/';
+    mFilePath += media == Media::IMAGE ? ".img_catalog" : ".vid_catalog";
+}
+
+CaptureCatalog::~CaptureCatalog()
+{
+    if (mMap) {
+        msync(mMap, mMapSize, MS_SYNC);
+        munmap(mMap, mMapSize);
+    }
+    if (mFd >= 0)
+        close(mFd);
+}
+
+int CaptureCatalog::open()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (mFd >= 0)
+        return 0;
+
+    mFd = ::open(mFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        log_error("Unable to open capture catalog %s: %s", mFilePath.c_str(), strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(mFd, &st) < 0) {
+        log_error("Unable to open capture catalog %s: %s", mFilePath.c_str(), strerror(errno));
+        goto fail;
+    }
+
+    if (st.st_size == 0) {
+        if (grow(GROW_RECORDS))
+            goto fail;
+
+        Header *header = reinterpret_cast<Header *>(mMap);
+        memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+        header->version = CATALOG_VERSION;
+        header->recordSize = sizeof(Record);
+        header->media = static_cast<uint32_t>(mMedia);
+        log_info("Capture catalog %s created", mFilePath.c_str());
+    } else {
+        if ((size_t)st.st_size < sizeof(Header)) {
+            log_error("Capture catalog %s truncated", mFilePath.c_str());
+            goto fail;
+        }
+
+        mCapacity = (st.st_size - sizeof(Header)) / sizeof(Record);
+        mMapSize = sizeof(Header) + (size_t)mCapacity * sizeof(Record);
+        void *map = mmap(nullptr, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+        if (map == MAP_FAILED) {
+            log_error("Unable to map capture catalog %s: %s", mFilePath.c_str(), strerror(errno));
+            goto fail;
+        }
+        mMap = static_cast<uint8_t *>(map);
+
+        Header *header = reinterpret_cast<Header *>(mMap);
+        if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic))
+            || header->version != CATALOG_VERSION || header->recordSize != sizeof(Record)
+            || header->media != static_cast<uint32_t>(mMedia)) {
+            log_error("Capture catalog %s not supported", mFilePath.c_str());
+            goto fail;
+        }
+
+        /* File cut short by a copy, records past its end are lost */
+        if (header->count > mCapacity)
+            header->count = mCapacity;
+    }
+
+    mSessionStart = reinterpret_cast<Header *>(mMap)->count;
+    log_debug("Capture catalog %s: %u capture(s)", mFilePath.c_str(), mSessionStart);
+
+    return 0;
+
+fail:
+    if (mMap)
+        munmap(mMap, mMapSize);
+    mMap = nullptr;
+    mMapSize = 0;
+    mCapacity = 0;
+    close(mFd);
+    mFd = -1;
+    return -1;
+}
+
+int CaptureCatalog::reserve()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mMap)
+        return -1;
+
+    Header *header = reinterpret_cast<Header *>(mMap);
+    if (header->count >= INT_MAX)
+        return -1;
+    if (header->count == mCapacity && grow(mCapacity + GROW_RECORDS))
+        return -1;
+    header = reinterpret_cast<Header *>(mMap);
+
+    uint32_t seq = header->count;
+    Record *record = recordAt(seq);
+    memset(record, 0, sizeof(*record));
+    record->seq = seq;
+    record->state = STATE_PENDING;
+    header->count++;
+
+    return seq;
+}
+
+int CaptureCatalog::commit(const Record &record)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mMap)
+        return -1;
+
+    Header *header = reinterpret_cast<Header *>(mMap);
+    if (record.seq >= header->count)
+        return -1;
+
+    Record *slot = recordAt(record.seq);
+    if (slot->state == STATE_DONE)
+        header->done--;
+    *slot = record;
+    slot->path[PATH_SIZE - 1] = '\0';
+    if (slot->state == STATE_DONE)
+        header->done++;
+
+    /* Dirty pages reach the card in the background, a crash of the process loses nothing */
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)slot & ~(uintptr_t)(page - 1);
+    msync((void *)start, (uintptr_t)(slot + 1) - start, MS_ASYNC);
+
+    return 0;
+}
+
+bool CaptureCatalog::lookup(uint32_t seq, Record &record)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mMap || seq >= reinterpret_cast<Header *>(mMap)->count)
+        return false;
+
+    record = *recordAt(seq);
+    if (record.state == STATE_PENDING && seq < mSessionStart)
+        record.state = STATE_FAILED;
+
+    return true;
+}
+
+uint32_t CaptureCatalog::getCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mMap ? reinterpret_cast<Header *>(mMap)->count : 0;
+}
+
+uint32_t CaptureCatalog::getDoneCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mMap ? reinterpret_cast<Header *>(mMap)->done : 0;
+}
+
+std::string CaptureCatalog::getFilePath() const
+{
+    return mFilePath;
+}
+
+int CaptureCatalog::grow(uint32_t capacity)
+{
+    size_t size = sizeof(Header) + (size_t)capacity * sizeof(Record);
+
+    /* Blocks are allocated now, not on the first write of a record through the map */
+    int ret = posix_fallocate(mFd, 0, size);
+    if (ret) {
+        log_error("Unable to grow capture catalog %s: %s", mFilePath.c_str(), strerror(ret));
+        return -1;
+    }
+
+    void *map = mMap ? mremap(mMap, mMapSize, size, MREMAP_MAYMOVE)
+                     : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) {
+        log_error("Unable to map capture catalog %s: %s", mFilePath.c_str(), strerror(errno));
+        return -1;
+    }
+
+    mMap = static_cast<uint8_t *>(map);
+    mMapSize = size;
+    mCapacity = capacity;
+
+    return 0;
+}
+
+CaptureCatalog::Record *CaptureCatalog::recordAt(uint32_t seq)
+{
+    return reinterpret_cast<Record *>(mMap + sizeof(Header)) + seq;
+}
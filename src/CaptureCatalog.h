@@ -0,0 +1,135 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+/**
+ *  The CaptureCatalog class is the index of the images or the videos captured to a directory.
+ *
+ *  The catalog is a file in the directory, mapped in memory: a header followed by fixed size
+ *  records, one per capture, in the order of their sequence number. Numbers are handed out by
+ *  reserve() and kept in the file, so they go on after a restart and a file is never written
+ *  over. A record is found from its number without reading the others, and the directory is
+ *  never listed, however many files it holds.
+ */
+class CaptureCatalog {
+public:
+    enum class Media {
+        IMAGE,
+        VIDEO,
+    };
+
+    enum State {
+        STATE_PENDING = 0, /* Number reserved, capture not done */
+        STATE_DONE = 1,
+        STATE_FAILED = 2,
+    };
+
+    /* Room for file_url of CAMERA_IMAGE_CAPTURED in MAVLink, 205 characters */
+    static const size_t PATH_SIZE = 208;
+
+    /**
+     *  Record of a capture, laid out as it is in the file.
+     */
+    struct Record {
+        uint32_t seq;        /* Sequence number, index of the record */
+        uint8_t state;       /* State of the capture */
+        uint8_t format;      /* CameraParameters IMAGE_FILE_FORMAT or VIDEO_FILE_FORMAT */
+        uint16_t segments;   /* Files of a segmented video, path is the first one */
+        uint64_t timeUtcUs;  /* Time of the capture, system time */
+        uint32_t timeBootMs; /* Time of the capture, since boot */
+        uint32_t durationMs; /* Length of a video */
+        uint64_t size;       /* Size of the file in bytes */
+        int32_t lat;         /* Latitude in degrees * 1E7 */
+        int32_t lon;         /* Longitude in degrees * 1E7 */
+        int32_t alt;         /* Altitude above MSL in mm */
+        int32_t relativeAlt; /* Altitude above ground in mm */
+        float q[4];          /* Orientation of the camera, w x y z */
+        char path[PATH_SIZE];
+    };
+
+    /**
+     *  Get the catalog of a directory, opened once for the process.
+     *
+     *  @param[in] dir Directory of the captured files.
+     *  @param[in] media Images or videos.
+     *
+     *  @return Catalog, nullptr if it cannot be opened or created.
+     */
+    static std::shared_ptr<CaptureCatalog> get(const std::string &dir, Media media);
+
+    CaptureCatalog(const std::string &dir, Media media);
+    ~CaptureCatalog();
+
+    /**
+     *  Open the catalog file, create it if there is none.
+     *
+     *  @return 0 on success, -1 on error.
+     */
+    int open();
+
+    /**
+     *  Reserve the number of a new capture, with a pending record.
+     *
+     *  @return Sequence number, -1 on error.
+     */
+    int reserve();
+
+    /**
+     *  Write the record of a capture, once it is done or failed.
+     *
+     *  @param[in] record Record, with the sequence number given by reserve().
+     *
+     *  @return 0 on success, -1 if the number was not reserved.
+     */
+    int commit(const Record &record);
+
+    /**
+     *  Find the record of a capture.
+     *
+     *  @param[in] seq Sequence number.
+     *  @param[out] record Record of the capture. A capture pending when the process stopped is
+     *                     reported as failed.
+     *
+     *  @return true if the number was reserved.
+     */
+    bool lookup(uint32_t seq, Record &record);
+
+    /* Numbers reserved, next sequence number */
+    uint32_t getCount();
+    /* Captures done */
+    uint32_t getDoneCount();
+    std::string getFilePath() const;
+
+private:
+    struct Header;
+
+    int grow(uint32_t capacity);
+    Record *recordAt(uint32_t seq);
+    std::string mFilePath;
+    Media mMedia;
+    int mFd;
+    uint8_t *mMap;
+    size_t mMapSize;
+    uint32_t mCapacity;     /* Records the file has room for */
+    uint32_t mSessionStart; /* First number reserved by this process */
+    std::mutex mLock;
+};
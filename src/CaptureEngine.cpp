@@ -0,0 +1,205 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+#include <unistd.h>
+
+#include "CaptureEngine.h"
+#include "log.h"
+
+#define DEFAULT_QUEUE_DEPTH 2
+#define DEFAULT_DROP_POLICY CameraDevice::DropPolicy::DROP_OLDEST
+/* Frames copied by the engine that can be held by the callback on top of the queue */
+#define SPARE_FRAME_COUNT 8
+#define READ_RETRY_DELAY_US 10000
+
+CaptureEngine::CaptureEngine(std::function<CameraDevice::Status(CameraData &)> reader)
+    : mReader(reader)
+    , mCallback(nullptr)
+    , mDepth(DEFAULT_QUEUE_DEPTH)
+    , mPolicy(DEFAULT_DROP_POLICY)
+    , mFramePool(nullptr)
+    , mRunning(false)
+    , mFrameCnt(0)
+    , mDropCnt(0)
+{
+}
+
+CaptureEngine::~CaptureEngine()
+{
+    stop();
+}
+
+int CaptureEngine::setQueue(uint32_t depth, CameraDevice::DropPolicy policy)
+{
+    if (depth == 0)
+        return -1;
+
+    std::lock_guard<std::mutex> locker(mLock);
+    mDepth = depth;
+    mPolicy = policy;
+
+    return 0;
+}
+
+int CaptureEngine::start(const std::function<void(CameraData &)> cb)
+{
+    if (!cb || mRunning)
+        return -1;
+
+    /* Threads of a capture which ended on its own */
+    stop();
+
+    log_debug("%s depth:%u policy:%d", __func__, mDepth, (int)mPolicy);
+
+    mCallback = cb;
+    mFrameCnt = 0;
+    mDropCnt = 0;
+    mRunning = true;
+    mCaptureThread = std::thread(&CaptureEngine::captureThread, this);
+    mDeliveryThread = std::thread(&CaptureEngine::deliveryThread, this);
+
+    return 0;
+}
+
+int CaptureEngine::stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (!mRunning && !mCaptureThread.joinable())
+            return 0;
+        mRunning = false;
+    }
+    mFrameCond.notify_all();
+    mSpaceCond.notify_all();
+
+    if (mCaptureThread.joinable())
+        mCaptureThread.join();
+    if (mDeliveryThread.joinable())
+        mDeliveryThread.join();
+
+    mQueue.clear();
+    mCallback = nullptr;
+    log_debug("%s frames:%llu dropped:%llu", __func__, (unsigned long long)mFrameCnt,
+              (unsigned long long)mDropCnt);
+
+    return 0;
+}
+
+bool CaptureEngine::isRunning() const
+{
+    return mRunning;
+}
+
+uint64_t CaptureEngine::getFrameCount() const
+{
+    return mFrameCnt;
+}
+
+uint64_t CaptureEngine::getDropCount() const
+{
+    return mDropCnt;
+}
+
+bool CaptureEngine::ownFrame(CameraData &data)
+{
+    /* Frame in a pooled buffer, the lease keeps it valid */
+    if (data.frame)
+        return true;
+
+    /* Device memory is only valid until next read, copy the frame */
+    if (!mFramePool || mFramePool->getSize() < data.bufSize) {
+        mFramePool = FramePool::create(mDepth + SPARE_FRAME_COUNT, data.bufSize);
+        if (!mFramePool)
+            return false;
+    }
+
+    std::shared_ptr<FrameBuffer> frame = mFramePool->acquire();
+    if (!frame)
+        return false;
+
+    memcpy(frame->data, data.buf, data.bufSize);
+    frame->bytesUsed = data.bufSize;
+    data.buf = frame->data;
+    data.frame = frame;
+
+    return true;
+}
+
+void CaptureEngine::captureThread()
+{
+    while (mRunning) {
+        CameraData data;
+        CameraDevice::Status ret = mReader(data);
+        if (ret == CameraDevice::Status::NOT_SUPPORTED) {
+            log_error("Camera device does not support read");
+            /* Capture is over, a later start() must not see it running */
+            {
+                std::lock_guard<std::mutex> locker(mLock);
+                mRunning = false;
+            }
+            mFrameCond.notify_all();
+            break;
+        }
+
+        if (ret != CameraDevice::Status::SUCCESS || !data.buf || !data.bufSize) {
+            usleep(READ_RETRY_DELAY_US);
+            continue;
+        }
+
+        if (!ownFrame(data)) {
+            mDropCnt++;
+            continue;
+        }
+        mFrameCnt++;
+
+        std::unique_lock<std::mutex> locker(mLock);
+        if (mQueue.size() >= mDepth) {
+            if (mPolicy == CameraDevice::DropPolicy::DROP_NEWEST) {
+                mDropCnt++;
+                continue;
+            } else if (mPolicy == CameraDevice::DropPolicy::BLOCK) {
+                mSpaceCond.wait(locker, [this] { return mQueue.size() < mDepth || !mRunning; });
+                if (!mRunning)
+                    break;
+            } else {
+                mQueue.pop_front();
+                mDropCnt++;
+            }
+        }
+        mQueue.push_back(data);
+        locker.unlock();
+        mFrameCond.notify_one();
+    }
+}
+
+void CaptureEngine::deliveryThread()
+{
+    while (true) {
+        std::unique_lock<std::mutex> locker(mLock);
+        mFrameCond.wait(locker, [this] { return !mQueue.empty() || !mRunning; });
+        if (!mRunning)
+            break;
+
+        CameraData data = mQueue.front();
+        mQueue.pop_front();
+        locker.unlock();
+        mSpaceCond.notify_one();
+
+        mCallback(data);
+    }
+}
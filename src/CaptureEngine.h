@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "CameraDevice.h"
+
+/**
+ *  The CaptureEngine class implements the push mode of a CameraDevice on top of its read().
+ *  A capture thread reads the frames from the device at sensor pace and queues them, a delivery
+ *  thread passes the queued frames to the callback. A slow callback never delays the sensor, the
+ *  frames that do not fit in the queue are dropped as per the drop policy.
+ */
+class CaptureEngine {
+public:
+    CaptureEngine(std::function<CameraDevice::Status(CameraData &)> reader);
+    ~CaptureEngine();
+
+    /**
+     *  Set depth of the frame queue and policy applied when the queue is full.
+     *  Takes effect on next start().
+     *
+     *  @param[in] depth Number of frames that can be queued, at least 1.
+     *  @param[in] policy Drop policy.
+     *
+     *  @return 0 on success, -1 on invalid argument.
+     */
+    int setQueue(uint32_t depth, CameraDevice::DropPolicy policy);
+
+    /**
+     *  Start the capture and delivery threads.
+     *
+     *  @param[in] cb Callback function to receive camera data.
+     *
+     *  @return 0 on success, -1 if already running or callback is invalid.
+     */
+    int start(const std::function<void(CameraData &)> cb);
+
+    /**
+     *  Stop the threads, queued frames are discarded.
+     *  Must not be called from the callback.
+     *
+     *  @return 0 on success.
+     */
+    int stop();
+
+    bool isRunning() const;
+    uint64_t getFrameCount() const;
+    uint64_t getDropCount() const;
+
+private:
+    void captureThread();
+    void deliveryThread();
+    bool ownFrame(CameraData &data);
+    std::function<CameraDevice::Status(CameraData &)> mReader;
+    std::function<void(CameraData &)> mCallback;
+    uint32_t mDepth;
+    CameraDevice::DropPolicy mPolicy;
+    std::deque<CameraData> mQueue;
+    std::shared_ptr<FramePool> mFramePool;
+    std::mutex mLock;
+    std::condition_variable mFrameCond;
+    std::condition_variable mSpaceCond;
+    std::atomic<bool> mRunning;
+    std::atomic<uint64_t> mFrameCnt;
+    std::atomic<uint64_t> mDropCnt;
+    std::thread mCaptureThread;
+    std::thread mDeliveryThread;
+};
@@ -0,0 +1,226 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <map>
+
+#include "CaptureLatency.h"
+#include "log.h"
+
+/* Command not taken by a capture by then did not start one */
+#define MAX_COMMAND_AGE_US (1 * USEC_PER_SEC)
+
+static std::mutex camerasLock;
+static std::map<std::string, std::shared_ptr<CaptureLatency>> cameras;
+
+std::shared_ptr<CaptureLatency> CaptureLatency::get(const std::string &camera)
+{
+    std::lock_guard<std::mutex> locker(camerasLock);
+
+    std::shared_ptr<CaptureLatency> &latency = cameras[camera];
+    if (!latency)
+        latency = std::make_shared<CaptureLatency>(camera);
+
+    return latency;
+}
+
+void CaptureLatency::dumpAll()
+{
+    std::lock_guard<std::mutex> locker(camerasLock);
+
+    if (cameras.empty())
+        log_info("No capture latency measured");
+    for (auto &camera : cameras)
+        camera.second->dump();
+}
+
+CaptureLatency::CaptureLatency(const std::string &camera)
+    : mCamera(camera)
+{
+    for (auto &stages : mHistograms) {
+        for (Histogram &histogram : stages) {
+            for (std::atomic<uint64_t> &bucket : histogram.buckets)
+                bucket = 0;
+            histogram.count = 0;
+            histogram.sumUs = 0;
+            histogram.maxUs = 0;
+        }
+    }
+    for (std::atomic<usec_t> &commandUs : mCommandUs)
+        commandUs = 0;
+    for (auto &waiting : mWaiting)
+        waiting = {-1, 0};
+}
+
+void CaptureLatency::command(Kind kind, usec_t timeUs)
+{
+    mCommandUs[kind].store(timeUs, std::memory_order_relaxed);
+}
+
+usec_t CaptureLatency::begin(Kind kind, usec_t triggerUs)
+{
+    usec_t commandUs = mCommandUs[kind].exchange(0, std::memory_order_relaxed);
+    if (commandUs && commandUs <= triggerUs && triggerUs - commandUs <= MAX_COMMAND_AGE_US)
+        return commandUs;
+
+    return triggerUs;
+}
+
+void CaptureLatency::mark(Kind kind, Stage stage, usec_t startUs, usec_t timeUs)
+{
+    usec_t us = timeUs > startUs ? timeUs - startUs : 0;
+    Histogram &histogram = mHistograms[kind][stage];
+
+    histogram.buckets[getBucket(us)].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sumUs.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t maxUs = histogram.maxUs.load(std::memory_order_relaxed);
+    while (us > maxUs
+           && !histogram.maxUs.compare_exchange_weak(maxUs, us, std::memory_order_relaxed))
+        ;
+}
+
+void CaptureLatency::waitMessage(int seq, usec_t startUs)
+{
+    std::lock_guard<std::mutex> locker(mWaitingLock);
+
+    /* Image of the same slot never answered, its message was not sent */
+    mWaiting[seq % WAITING] = {seq, startUs};
+}
+
+void CaptureLatency::messageSent(int seq, usec_t timeUs)
+{
+    usec_t startUs;
+    {
+        std::lock_guard<std::mutex> locker(mWaitingLock);
+
+        if (seq < 0 || mWaiting[seq % WAITING].seq != seq)
+            return;
+        startUs = mWaiting[seq % WAITING].startUs;
+        mWaiting[seq % WAITING].seq = -1;
+    }
+
+    mark(IMAGE, STAGE_MESSAGE_SENT, startUs, timeUs);
+}
+
+unsigned int CaptureLatency::getBucket(usec_t us)
+{
+    if (us < 4)
+        return us;
+
+    unsigned int msb = 63 - __builtin_clzll(us);
+    unsigned int bucket = 4 * (msb - 1) + ((us >> (msb - 2)) & 3);
+
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+usec_t CaptureLatency::getBucketValue(unsigned int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+
+    /* Middle of the bucket */
+    unsigned int shift = bucket / 4 - 1;
+    return ((usec_t)(4 + bucket % 4) << shift) + ((usec_t)1 << shift) / 2;
+}
+
+CaptureLatency::Summary CaptureLatency::getSummary(Kind kind, Stage stage) const
+{
+    const Histogram &histogram = mHistograms[kind][stage];
+    Summary summary = {};
+
+    /* Buckets are read while captures go on, the count is the one of the buckets read */
+    uint64_t buckets[BUCKETS];
+    for (unsigned int i = 0; i < BUCKETS; i++) {
+        buckets[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+        summary.count += buckets[i];
+    }
+    if (!summary.count)
+        return summary;
+
+    summary.meanUs = histogram.sumUs.load(std::memory_order_relaxed)
+        / std::max(histogram.count.load(std::memory_order_relaxed), (uint64_t)1);
+    summary.maxUs = histogram.maxUs.load(std::memory_order_relaxed);
+
+    struct {
+        unsigned int permille;
+        usec_t *valueUs;
+    } percentiles[] = {{500, &summary.p50Us}, {900, &summary.p90Us}, {990, &summary.p99Us}};
+
+    uint64_t seen = 0;
+    unsigned int p = 0;
+    for (unsigned int i = 0; i < BUCKETS && p < 3; i++) {
+        seen += buckets[i];
+        while (p < 3 && seen * 1000 >= summary.count * percentiles[p].permille) {
+            *percentiles[p].valueUs = std::min(getBucketValue(i), summary.maxUs);
+            p++;
+        }
+    }
+
+    return summary;
+}
+
+void CaptureLatency::dump() const
+{
+    for (int kind = 0; kind < KIND_COUNT; kind++) {
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            Summary s = getSummary((Kind)kind, (Stage)stage);
+            if (!s.count)
+                continue;
+
+            log_info("Latency %s %s %s: %llu, mean %.1f ms, p50 %.1f ms, p90 %.1f ms, "
+                     "p99 %.1f ms, max %.1f ms",
+                     mCamera.c_str(), getKindName((Kind)kind), getStageName((Stage)stage),
+                     (unsigned long long)s.count, (double)s.meanUs / USEC_PER_MSEC,
+                     (double)s.p50Us / USEC_PER_MSEC, (double)s.p90Us / USEC_PER_MSEC,
+                     (double)s.p99Us / USEC_PER_MSEC, (double)s.maxUs / USEC_PER_MSEC);
+        }
+    }
+}
+
+const char *CaptureLatency::getKindName(Kind kind)
+{
+    switch (kind) {
+    case IMAGE:
+        return "image";
+    case VIDEO_START:
+        return "video-start";
+    case VIDEO_STOP:
+        return "video-stop";
+    default:
+        return "unknown";
+    }
+}
+
+const char *CaptureLatency::getStageName(Stage stage)
+{
+    switch (stage) {
+    case STAGE_PIPELINE_READY:
+        return "pipeline-ready";
+    case STAGE_FRAME:
+        return "frame";
+    case STAGE_ENCODED:
+        return "encoded";
+    case STAGE_FILE_CLOSED:
+        return "file-closed";
+    case STAGE_MESSAGE_SENT:
+        return "message-sent";
+    default:
+        return "unknown";
+    }
+}
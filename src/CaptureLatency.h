@@ -0,0 +1,167 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "util.h"
+
+/**
+ *  The CaptureLatency class measures where the time goes between a capture command and the
+ *  messages it is answered with, for one camera.
+ *
+ *  Each capture starts at the command received, or at the trigger of the timer for the next
+ *  images of an interval capture. The time from that start to each stage reached is added to the
+ *  histogram of the stage. Histograms have fixed buckets of a quarter of octave and are updated
+ *  with relaxed atomics, without lock, so they are always on. They are read at any time with
+ *  getSummary() and logged for every camera on SIGUSR1.
+ */
+class CaptureLatency {
+public:
+    enum Kind {
+        IMAGE,       /* From MAV_CMD_IMAGE_START_CAPTURE or the interval timer */
+        VIDEO_START, /* From MAV_CMD_VIDEO_START_CAPTURE */
+        VIDEO_STOP,  /* From MAV_CMD_VIDEO_STOP_CAPTURE */
+        KIND_COUNT,
+    };
+
+    enum Stage {
+        STAGE_PIPELINE_READY, /* Capture pipeline running, ready for the frame */
+        STAGE_FRAME,          /* Frame of the sensor taken */
+        STAGE_ENCODED,        /* Image encoded */
+        STAGE_FILE_CLOSED,    /* File written and closed */
+        STAGE_MESSAGE_SENT,   /* Ack or CAMERA_IMAGE_CAPTURED sent */
+        STAGE_COUNT,
+    };
+
+    struct Summary {
+        uint64_t count;
+        usec_t meanUs;
+        usec_t p50Us;
+        usec_t p90Us;
+        usec_t p99Us;
+        usec_t maxUs;
+    };
+
+    /**
+     *  Get the measures of a camera, created once for the process.
+     *
+     *  @param[in] camera Id of the camera device.
+     *
+     *  @return Measures of the camera.
+     */
+    static std::shared_ptr<CaptureLatency> get(const std::string &camera);
+
+    /**
+     *  Log the stages of all the cameras.
+     */
+    static void dumpAll();
+
+    CaptureLatency(const std::string &camera);
+
+    /**
+     *  Note the time a capture command is received, for the capture it starts.
+     *
+     *  @param[in] kind Kind of capture.
+     *  @param[in] timeUs Time the command was received.
+     */
+    void command(Kind kind, usec_t timeUs = now_usec());
+
+    /**
+     *  Get the start of a capture: the time of its command if one was just received, the time
+     *  given otherwise.
+     *
+     *  @param[in] kind Kind of capture.
+     *  @param[in] triggerUs Time the capture was triggered, without command.
+     *
+     *  @return Start of the capture, on the clock of now_usec().
+     */
+    usec_t begin(Kind kind, usec_t triggerUs = now_usec());
+
+    /**
+     *  Add a stage reached by a capture.
+     *
+     *  @param[in] kind Kind of capture.
+     *  @param[in] stage Stage reached.
+     *  @param[in] startUs Start of the capture, from begin().
+     *  @param[in] timeUs Time the stage was reached.
+     */
+    void mark(Kind kind, Stage stage, usec_t startUs, usec_t timeUs = now_usec());
+
+    /**
+     *  Keep the start of an image until CAMERA_IMAGE_CAPTURED is sent for it.
+     *
+     *  @param[in] seq Sequence number of the image.
+     *  @param[in] startUs Start of the capture, from begin().
+     */
+    void waitMessage(int seq, usec_t startUs);
+
+    /**
+     *  Add the message sent stage of an image kept by waitMessage().
+     *
+     *  @param[in] seq Sequence number of the image.
+     *  @param[in] timeUs Time the message was sent.
+     */
+    void messageSent(int seq, usec_t timeUs = now_usec());
+
+    /**
+     *  Get the distribution of the time from the start of the captures to a stage.
+     *
+     *  @param[in] kind Kind of capture.
+     *  @param[in] stage Stage.
+     *
+     *  @return Summary of the stage, values rounded to the buckets of the histogram.
+     */
+    Summary getSummary(Kind kind, Stage stage) const;
+
+    /**
+     *  Log the stages reached since the start of the process.
+     */
+    void dump() const;
+
+    static const char *getKindName(Kind kind);
+    static const char *getStageName(Stage stage);
+
+private:
+    /* 4 buckets per octave from 4 us, the last one holds everything above 2 hours */
+    static const unsigned int BUCKETS = 128;
+    /* Images between their file written and their message */
+    static const unsigned int WAITING = 32;
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sumUs;
+        std::atomic<uint64_t> maxUs;
+    };
+
+    static unsigned int getBucket(usec_t us);
+    static usec_t getBucketValue(unsigned int bucket);
+
+    std::string mCamera;
+    Histogram mHistograms[KIND_COUNT][STAGE_COUNT];
+    std::atomic<usec_t> mCommandUs[KIND_COUNT]; /* Command not taken by a capture yet */
+    std::mutex mWaitingLock;
+    struct {
+        int seq;
+        usec_t startUs;
+    } mWaiting[WAITING];
+};
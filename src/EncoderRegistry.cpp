@@ -0,0 +1,206 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "EncoderRegistry.h"
+#include "log.h"
+
+#define DEFAULT_FRAMERATE 25
+
+/* Property of an encoder set from a value, none if name is nullptr */
+struct EncoderProperty {
+    const char *name;
+    unsigned int scale;  /* Units of the property in a unit of the value */
+    const char *control; /* V4L2 control set through the property, nullptr to set the property */
+};
+
+/* Encoder of a codec, with the properties it is set with */
+struct EncoderInfo {
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    const char *factory;
+    const char *options;         /* Low latency settings */
+    EncoderProperty bitRate;     /* Bitrate, from kbps */
+    EncoderProperty keyInterval; /* Key frame interval, from frames */
+    EncoderProperty threads;     /* Number of threads of a software encoder */
+};
+
+/* Hardware encoders first, the software ones are only used without them */
+static const EncoderInfo encoders[] = {
+    {CameraParameters::VIDEO_CODING_AVC, "vaapih264enc", "rate-control=cbr", {"bitrate", 1},
+     {"keyframe-period", 1}, {}},
+    {CameraParameters::VIDEO_CODING_AVC, "msdkh264enc", "rate-control=cbr target-usage=7",
+     {"bitrate", 1}, {"gop-size", 1}, {}},
+    {CameraParameters::VIDEO_CODING_AVC, "v4l2h264enc", "",
+     {"extra-controls", 1000, "video_bitrate"}, {}, {}},
+    {CameraParameters::VIDEO_CODING_AVC, "omxh264enc", "control-rate=variable",
+     {"target-bitrate", 1000}, {"interval-intraframes", 1}, {}},
+    {CameraParameters::VIDEO_CODING_AVC, "x264enc", "tune=zerolatency speed-preset=ultrafast",
+     {"bitrate", 1}, {"key-int-max", 1}, {"threads", 1}},
+    {CameraParameters::VIDEO_CODING_AVC, "openh264enc", "complexity=low rate-control=bitrate",
+     {"bitrate", 1000}, {"gop-size", 1}, {"multi-thread", 1}},
+};
+
+static std::mutex registryLock;
+static bool probed = false;
+/* Encoders of the configuration, H.264 only. Not changed once probed, selected points to it */
+static std::vector<std::string> preference;
+static std::map<std::string, std::string> userOptions; /* Properties, by encoder */
+static std::map<int, EncoderInfo> selected; /* Encoder of each codec, by probe() */
+
+static bool probeFactory(const char *factory)
+{
+    GstElement *element = gst_element_factory_make(factory, nullptr);
+    if (!element)
+        return false;
+
+    /* Hardware encoders open their device on READY */
+    gst_object_ref_sink(element);
+    bool ok = gst_element_set_state(element, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE;
+    gst_element_set_state(element, GST_STATE_NULL);
+    gst_object_unref(element);
+
+    return ok;
+}
+
+static std::string format(const EncoderProperty &property, unsigned int value)
+{
+    std::string setting = std::to_string(value * property.scale);
+
+    if (property.control)
+        setting = std::string("\"controls,") + property.control + "=" + setting + "\"";
+
+    return std::string(" ") + property.name + "=" + setting;
+}
+
+void EncoderRegistry::setPreference(const std::vector<std::string> &factories,
+                                    const std::map<std::string, std::string> &options)
+{
+    std::lock_guard<std::mutex> locker(registryLock);
+
+    if (probed) {
+        log_warning("Encoders already probed, preference not applied");
+        return;
+    }
+    preference = factories;
+    userOptions = options;
+}
+
+std::vector<std::string> EncoderRegistry::getKnownFactories()
+{
+    std::vector<std::string> factories;
+    for (const EncoderInfo &encoder : encoders)
+        factories.push_back(encoder.factory);
+
+    return factories;
+}
+
+void EncoderRegistry::probe()
+{
+    std::lock_guard<std::mutex> locker(registryLock);
+
+    if (probed)
+        return;
+    probed = true;
+
+    if (!gst_is_initialized())
+        gst_init(nullptr, nullptr);
+
+    std::vector<EncoderInfo> candidates;
+    if (preference.empty()) {
+        candidates.assign(std::begin(encoders), std::end(encoders));
+    } else {
+        /* Known encoders keep their settings, the others are used as they are */
+        for (const std::string &factory : preference) {
+            auto it = std::find_if(std::begin(encoders), std::end(encoders),
+                                   [&](const EncoderInfo &e) { return factory == e.factory; });
+            if (it != std::end(encoders))
+                candidates.push_back(*it);
+            else
+                candidates.push_back(
+                    {CameraParameters::VIDEO_CODING_AVC, factory.c_str(), "", {}, {}, {}});
+        }
+    }
+
+    for (const EncoderInfo &candidate : candidates) {
+        if (selected.count(candidate.codec))
+            continue;
+        if (!probeFactory(candidate.factory)) {
+            log_debug("Encoder %s not available", candidate.factory);
+            continue;
+        }
+
+        log_info("Encoder of codec %d: %s", candidate.codec, candidate.factory);
+        selected[candidate.codec] = candidate;
+    }
+
+    if (!selected.count(CameraParameters::VIDEO_CODING_AVC))
+        log_error("No H.264 encoder available, video capture and streaming are disabled");
+}
+
+std::string EncoderRegistry::getEncoder(CameraParameters::VIDEO_CODING_FORMAT codec, int bitRate,
+                                        int frameRate)
+{
+    probe();
+
+    std::lock_guard<std::mutex> locker(registryLock);
+
+    auto it = selected.find(codec);
+    if (it == selected.end())
+        return {};
+    const EncoderInfo &encoder = it->second;
+
+    std::string desc = encoder.factory;
+    if (encoder.options[0])
+        desc += std::string(" ") + encoder.options;
+    if (encoder.bitRate.name && bitRate > 0)
+        desc += format(encoder.bitRate, bitRate);
+    if (encoder.keyInterval.name) {
+        unsigned int fps = frameRate > 0 ? frameRate : DEFAULT_FRAMERATE;
+        desc += format(encoder.keyInterval, std::max(fps * KEY_INTERVAL_MS / 1000, 1u));
+    }
+    if (encoder.threads.name) {
+        /* Leaves cores to the capture and to the other encoders of the camera */
+        desc += format(encoder.threads, std::max(std::thread::hardware_concurrency() / 2, 1u));
+    }
+    /* Last value of a property is the one set, options of the other encoders do not apply */
+    auto options = userOptions.find(encoder.factory);
+    if (options != userOptions.end() && !options->second.empty())
+        desc += " " + options->second;
+
+    return desc;
+}
+
+GstElement *EncoderRegistry::makeEncoder(CameraParameters::VIDEO_CODING_FORMAT codec, int bitRate,
+                                         int frameRate)
+{
+    std::string desc = getEncoder(codec, bitRate, frameRate);
+    if (desc.empty())
+        return nullptr;
+
+    GError *error = nullptr;
+    GstElement *encoder = gst_parse_launch(desc.c_str(), &error);
+    if (error) {
+        log_error("Error creating encoder %s: %s", desc.c_str(), error->message);
+        g_clear_error(&error);
+    }
+
+    return encoder;
+}
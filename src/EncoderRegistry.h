@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <gst/gst.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "CameraParameters.h"
+
+/**
+ *  The EncoderRegistry class selects the gstreamer video encoder used by the recording and the
+ *  video streams.
+ *
+ *  Encoders known for a codec are ranked, hardware first. Each one is probed once for the process,
+ *  by creating it and setting it to READY so hardware encoders open their device, and the first
+ *  one that works is kept. The encoder is configured for low latency, its bitrate and key frame
+ *  interval are set with the properties it understands. The ranking can be replaced by the
+ *  [gstreamer] section of the configuration.
+ */
+class EncoderRegistry {
+public:
+    /* Time between key frames, decoders joining a stream wait for the next one */
+    static const uint32_t KEY_INTERVAL_MS = 1000;
+
+    /**
+     *  Set the encoders to try, before any probe.
+     *
+     *  @param[in] factories Names of the encoder elements in order of preference, encoders of the
+     *                       built-in ranking are used if empty.
+     *  @param[in] options Properties added to an encoder when it is selected, in gst-launch
+     *                     syntax, by name of the encoder element.
+     */
+    static void setPreference(const std::vector<std::string> &factories,
+                              const std::map<std::string, std::string> &options);
+
+    /**
+     *  Get the encoders of the built-in ranking.
+     *
+     *  @return Names of the encoder elements, in order of preference.
+     */
+    static std::vector<std::string> getKnownFactories();
+
+    /**
+     *  Probe the encoders of all the codecs, done once. Later calls return at once.
+     */
+    static void probe();
+
+    /**
+     *  Get the description of the encoder of a codec.
+     *
+     *  @param[in] codec Video codec.
+     *  @param[in] bitRate Bitrate in kbps, 0 for the default of the encoder.
+     *  @param[in] frameRate Frame rate of the video to set the key frame interval, 0 if unknown.
+     *
+     *  @return Encoder element with its properties in gst-launch syntax, empty if no encoder of the
+     *          codec is available.
+     */
+    static std::string getEncoder(CameraParameters::VIDEO_CODING_FORMAT codec, int bitRate = 0,
+                                  int frameRate = 0);
+
+    /**
+     *  Create the encoder of a codec.
+     *
+     *  @param[in] codec Video codec.
+     *  @param[in] bitRate Bitrate in kbps, 0 for the default of the encoder.
+     *  @param[in] frameRate Frame rate of the video to set the key frame interval, 0 if unknown.
+     *
+     *  @return Floating reference on the encoder, nullptr if no encoder of the codec is available.
+     */
+    static GstElement *makeEncoder(CameraParameters::VIDEO_CODING_FORMAT codec, int bitRate = 0,
+                                   int frameRate = 0);
+};
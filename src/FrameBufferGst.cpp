@@ -0,0 +1,51 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FrameBufferGst.h"
+#include "log.h"
+
+static void releaseLease(gpointer data)
+{
+    /* Drop the reference held by the GstMemory, slot returns to the pool if it was the last */
+    delete static_cast<std::shared_ptr<FrameBuffer> *>(data);
+}
+
+GstBuffer *wrapCameraData(const CameraData &data)
+{
+    if (!data.buf || !data.bufSize)
+        return nullptr;
+
+    if (!data.frame) {
+        /* No owner to keep the memory alive, copy the image */
+        GstBuffer *buffer = gst_buffer_new_allocate(NULL, data.bufSize, NULL);
+        if (buffer)
+            gst_buffer_fill(buffer, 0, data.buf, data.bufSize);
+        return buffer;
+    }
+
+    gsize offset = (uint8_t *)data.buf - (uint8_t *)data.frame->data;
+    gsize size = data.bufSize;
+    gsize maxsize = data.frame->size;
+    if (offset + size > maxsize) {
+        log_error("Frame data outside of the leased buffer");
+        return nullptr;
+    }
+
+    std::shared_ptr<FrameBuffer> *lease = new std::shared_ptr<FrameBuffer>(data.frame);
+    return gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, data.frame->data, maxsize, offset,
+                                       size, lease, releaseLease);
+}
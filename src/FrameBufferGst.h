@@ -0,0 +1,32 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <gst/gst.h>
+
+#include "CameraDevice.h"
+
+/**
+ *  Create a GstBuffer holding the image of the CameraData.
+ *  If the image is in a pooled buffer, the GstBuffer wraps the memory without copy and holds the
+ *  lease until gstreamer releases the buffer. Otherwise the image is copied.
+ *
+ *  @param[in] data CameraData with the image.
+ *
+ *  @return GstBuffer, nullptr if the CameraData has no image.
+ */
+GstBuffer *wrapCameraData(const CameraData &data);
@@ -0,0 +1,233 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+
+#include "FrameHub.h"
+#include "log.h"
+
+FrameHub::Consumer::Consumer(const std::string &name, uint32_t depth, uint32_t skip)
+    : mName(name)
+    , mDepth(depth)
+    , mSkip(skip)
+    , mSkipCnt(0)
+    , mFrameCnt(0)
+    , mDropCnt(0)
+    , mClosed(false)
+    , mWaiting(false)
+{
+}
+
+bool FrameHub::Consumer::pop(CameraData &data, int timeoutMs)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+    auto ready = [this] {
+        return mClosed || (mDepth == LATEST_FRAME ? mLatestFrame.hasNew() : !mQueue.empty());
+    };
+
+    mWaiting = true;
+    bool received = true;
+    if (timeoutMs < 0)
+        mCond.wait(locker, ready);
+    else
+        received = mCond.wait_for(locker, std::chrono::milliseconds(timeoutMs), ready);
+    mWaiting = false;
+
+    if (!received || mClosed)
+        return false;
+
+    if (mDepth == LATEST_FRAME)
+        return mLatestFrame.read(data);
+
+    data = mQueue.front();
+    mQueue.pop_front();
+
+    return true;
+}
+
+const std::string &FrameHub::Consumer::getName() const
+{
+    return mName;
+}
+
+uint64_t FrameHub::Consumer::getFrameCount() const
+{
+    return mFrameCnt;
+}
+
+uint64_t FrameHub::Consumer::getDropCount() const
+{
+    return mDropCnt;
+}
+
+bool FrameHub::Consumer::isClosed() const
+{
+    return mClosed;
+}
+
+void FrameHub::Consumer::push(const CameraData &data)
+{
+    if (mClosed)
+        return;
+
+    /* Keep one frame out of mSkip + 1, push is only called from the hub */
+    if (mSkipCnt++ % (mSkip + 1))
+        return;
+
+    if (mDepth == LATEST_FRAME) {
+        /* Lock-free, the frame not read yet is replaced by the newest one */
+        if (mLatestFrame.write(data))
+            mDropCnt++;
+        mFrameCnt++;
+
+        /* Lock only to wake up a reader waiting for a frame */
+        if (mWaiting) {
+            std::lock_guard<std::mutex> locker(mLock);
+            mCond.notify_one();
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (mQueue.size() >= mDepth) {
+            mQueue.pop_front();
+            mDropCnt++;
+        }
+        mQueue.push_back(data);
+        mFrameCnt++;
+    }
+    mCond.notify_one();
+}
+
+void FrameHub::Consumer::close()
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mClosed = true;
+        mQueue.clear();
+    }
+    mCond.notify_all();
+}
+
+FrameHub::FrameHub(std::shared_ptr<CameraDevice> camDev)
+    : mCamDev(camDev)
+    , mRunning(false)
+{
+}
+
+FrameHub::~FrameHub()
+{
+    stop();
+}
+
+std::shared_ptr<FrameHub::Consumer> FrameHub::subscribe(const std::string &name, uint32_t depth,
+                                                        uint32_t skip)
+{
+    std::lock_guard<std::mutex> deviceLocker(mDeviceLock);
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mRunning) {
+        CameraDevice::Status ret
+            = mCamDev->start(std::bind(&FrameHub::onFrame, this, std::placeholders::_1));
+        if (ret != CameraDevice::Status::SUCCESS) {
+            log_debug("Camera device %s does not support frame sharing",
+                      mCamDev->getDeviceId().c_str());
+            return nullptr;
+        }
+        mRunning = true;
+    }
+
+    std::shared_ptr<Consumer> consumer = std::make_shared<Consumer>(name, depth, skip);
+    mConsumers.push_back(consumer);
+    log_debug("%s %s depth:%u skip:%u consumers:%zu", __func__, name.c_str(), depth, skip,
+              mConsumers.size());
+
+    return consumer;
+}
+
+void FrameHub::unsubscribe(const std::shared_ptr<Consumer> &consumer)
+{
+    if (!consumer)
+        return;
+
+    std::lock_guard<std::mutex> deviceLocker(mDeviceLock);
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        auto it = std::find(mConsumers.begin(), mConsumers.end(), consumer);
+        if (it == mConsumers.end())
+            return;
+
+        log_debug("%s %s frames:%llu dropped:%llu", __func__, consumer->getName().c_str(),
+                  (unsigned long long)consumer->getFrameCount(),
+                  (unsigned long long)consumer->getDropCount());
+        consumer->close();
+        mConsumers.erase(it);
+        if (!mConsumers.empty() || !mRunning)
+            return;
+        mRunning = false;
+    }
+
+    /* Nobody reads the frames anymore, the device is not read for nothing */
+    stopDevice();
+}
+
+void FrameHub::stop()
+{
+    std::lock_guard<std::mutex> deviceLocker(mDeviceLock);
+    bool running;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        for (auto &consumer : mConsumers)
+            consumer->close();
+        mConsumers.clear();
+        running = mRunning;
+        mRunning = false;
+    }
+
+    if (running)
+        stopDevice();
+}
+
+void FrameHub::stopDevice()
+{
+    /* Without mLock, the callback of the frame being delivered takes it */
+    CameraDevice::Status ret = mCamDev->stopAsync();
+    if (ret != CameraDevice::Status::SUCCESS)
+        log_error("Unable to stop frame sharing of camera device %s",
+                  mCamDev->getDeviceId().c_str());
+    else
+        log_debug("%s %s", __func__, mCamDev->getDeviceId().c_str());
+}
+
+std::shared_ptr<CameraDevice> FrameHub::getCameraDevice() const
+{
+    return mCamDev;
+}
+
+void FrameHub::onFrame(CameraData &data)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mRunning)
+        return;
+
+    /* Consumers share the lease on the frame, no copy */
+    for (auto &consumer : mConsumers)
+        consumer->push(data);
+}
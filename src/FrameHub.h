@@ -0,0 +1,127 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CameraDevice.h"
+#include "TripleBuffer.h"
+
+/**
+ *  The FrameHub class shares one acquisition of a camera device between any number of consumers
+ *  (video stream, video capture, image capture, external users).
+ *  The camera device runs in asynchronous mode, every frame is passed to all the consumers
+ *  without copy, each consumer holding a lease on the pooled buffer for the frames in its queue.
+ */
+class FrameHub {
+public:
+    /**
+     *  Queue depth of the consumers that only need the latest frame, like live encoders.
+     *  Frames are passed through a lock-free triple buffer, a frame not read before the next one
+     *  is dropped so the consumer is never more than one frame late.
+     */
+    static const uint32_t LATEST_FRAME = 0;
+
+    /**
+     *  The Consumer class is the frame queue of one consumer of the hub.
+     *  A consumer is read from one thread.
+     */
+    class Consumer {
+    public:
+        Consumer(const std::string &name, uint32_t depth, uint32_t skip);
+
+        /**
+         *  Get the oldest frame of the queue, wait for a frame if the queue is empty.
+         *
+         *  @param[out] data CameraData to hold image and meta-data.
+         *  @param[in] timeoutMs Time to wait for a frame in milliseconds, -1 to wait forever.
+         *
+         *  @return true if a frame was received, false on timeout or if the hub is stopped.
+         */
+        bool pop(CameraData &data, int timeoutMs);
+
+        const std::string &getName() const;
+        uint64_t getFrameCount() const;
+        uint64_t getDropCount() const;
+        /* Closed by unsubscribe() or stop() of the hub, pop() returns false from now on */
+        bool isClosed() const;
+
+    private:
+        friend class FrameHub;
+        void push(const CameraData &data);
+        void close();
+        std::string mName;
+        uint32_t mDepth;
+        uint32_t mSkip;
+        uint32_t mSkipCnt;
+        std::deque<CameraData> mQueue;
+        TripleBuffer<CameraData> mLatestFrame;
+        std::atomic<uint64_t> mFrameCnt;
+        std::atomic<uint64_t> mDropCnt;
+        std::atomic<bool> mClosed;
+        std::atomic<bool> mWaiting;
+        std::mutex mLock;
+        std::condition_variable mCond;
+    };
+
+    FrameHub(std::shared_ptr<CameraDevice> camDev);
+    ~FrameHub();
+
+    /**
+     *  Add a consumer to the hub, the camera device is started in asynchronous mode on first
+     *  consumer, and its asynchronous mode stopped when the last consumer leaves.
+     *
+     *  @param[in] name Name of the consumer, for logs.
+     *  @param[in] depth Number of frames queued for the consumer, the oldest frame is dropped when
+     *                   the queue is full. LATEST_FRAME to get the latest frame only.
+     *  @param[in] skip Number of frames skipped after each frame queued, 0 to get all frames.
+     *
+     *  @return Consumer queue, nullptr if the camera device does not support asynchronous mode.
+     */
+    std::shared_ptr<Consumer> subscribe(const std::string &name, uint32_t depth = 2,
+                                        uint32_t skip = 0);
+
+    /**
+     *  Remove a consumer from the hub, frames in its queue are released.
+     *
+     *  @param[in] consumer Consumer queue returned by subscribe().
+     */
+    void unsubscribe(const std::shared_ptr<Consumer> &consumer);
+
+    /**
+     *  Close all the consumers and stop the asynchronous mode of the camera device, the next
+     *  subscribe() starts it again.
+     */
+    void stop();
+
+    std::shared_ptr<CameraDevice> getCameraDevice() const;
+
+private:
+    void onFrame(CameraData &data);
+    void stopDevice();
+    std::shared_ptr<CameraDevice> mCamDev;
+    std::vector<std::shared_ptr<Consumer>> mConsumers;
+    bool mRunning;
+    std::mutex mLock;       /* Consumers, taken by the callback of the camera device */
+    std::mutex mDeviceLock; /* Start and stop of the camera device, never by the callback */
+};
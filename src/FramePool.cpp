@@ -0,0 +1,149 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "FramePool.h"
+#include "log.h"
+
+FramePool::FramePool()
+{
+}
+
+FramePool::~FramePool()
+{
+    for (FrameBuffer &slot : mSlots)
+        free(slot.data);
+}
+
+std::shared_ptr<FramePool> FramePool::create(uint32_t count, size_t size)
+{
+    std::shared_ptr<FramePool> pool(new FramePool());
+
+    if (pool->alloc(count, size))
+        return nullptr;
+
+    return pool;
+}
+
+int FramePool::alloc(uint32_t count, size_t size)
+{
+    if (!count || !size)
+        return -1;
+
+    size_t pageSize = getpagesize();
+    size_t bufLen = (size + pageSize - 1) & ~(pageSize - 1);
+
+    mSlots.resize(count);
+    mBusy.assign(count, false);
+    for (uint32_t i = 0; i < count; i++) {
+        if (posix_memalign(&mSlots[i].data, pageSize, bufLen)) {
+            log_error("Frame pool allocation failure, count:%u size:%zu", count, bufLen);
+            mSlots[i].data = nullptr;
+            return -1;
+        }
+        mSlots[i].index = i;
+        mSlots[i].size = bufLen;
+        mFree.push_back(count - 1 - i);
+    }
+
+    log_debug("Frame pool count:%u size:%zu", count, bufLen);
+    return 0;
+}
+
+std::shared_ptr<FrameBuffer> FramePool::acquire()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (mFree.empty())
+        return nullptr;
+
+    uint32_t index = mFree.back();
+    mFree.pop_back();
+    mBusy[index] = true;
+    mSlots[index].bytesUsed = 0;
+
+    /* The lease keeps the pool alive until the buffer is returned */
+    std::shared_ptr<FramePool> self = shared_from_this();
+    return std::shared_ptr<FrameBuffer>(&mSlots[index],
+                                        [self](FrameBuffer *buf) { self->release(buf->index); });
+}
+
+std::shared_ptr<FrameBuffer> FramePool::acquire(uint32_t index)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (index >= mSlots.size() || mBusy[index])
+        return nullptr;
+
+    for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+        if (*it == index) {
+            mFree.erase(it);
+            break;
+        }
+    }
+    mBusy[index] = true;
+    mSlots[index].bytesUsed = 0;
+
+    std::shared_ptr<FramePool> self = shared_from_this();
+    return std::shared_ptr<FrameBuffer>(&mSlots[index],
+                                        [self](FrameBuffer *buf) { self->release(buf->index); });
+}
+
+void FramePool::release(uint32_t index)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mBusy[index] = false;
+    mFree.push_back(index);
+
+    if (mReleaseCB)
+        mReleaseCB(index);
+}
+
+void FramePool::setReleaseCallback(std::function<void(uint32_t index)> cb)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mReleaseCB = cb;
+}
+
+uint32_t FramePool::getCount() const
+{
+    return mSlots.size();
+}
+
+size_t FramePool::getSize() const
+{
+    return mSlots.empty() ? 0 : mSlots[0].size;
+}
+
+uint32_t FramePool::getFreeCount() const
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mFree.size();
+}
+
+void *FramePool::getData(uint32_t index) const
+{
+    if (index >= mSlots.size())
+        return nullptr;
+
+    return mSlots[index].data;
+}
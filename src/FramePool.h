@@ -0,0 +1,100 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ *  The FrameBuffer structure describes one slot of a FramePool.
+ *  A FrameBuffer is handed out as a lease (std::shared_ptr), the slot goes back to the pool
+ *  when the last copy of the lease is dropped.
+ */
+struct FrameBuffer {
+    uint32_t index = 0;   /**< index of the slot in the pool. */
+    void *data = nullptr; /**< start address of the slot memory. */
+    size_t size = 0;      /**< capacity of the slot in bytes. */
+    size_t bytesUsed = 0; /**< number of valid bytes in the slot. */
+};
+
+/**
+ *  The FramePool class owns a fixed number of equally sized, page aligned frame buffers.
+ *  Camera devices fill the buffers and hand out leases through CameraData, consumers (gstreamer
+ *  pipelines, capture threads) hold the lease as long as they access the memory.
+ */
+class FramePool : public std::enable_shared_from_this<FramePool> {
+public:
+    /* Buffers of a camera device filling frames for the frame hub: the queue of its capture
+     * engine plus the queues of the consumers of the hub */
+    static const uint32_t HUB_FRAME_COUNT = 8;
+
+    /**
+     *  Create a frame pool.
+     *
+     *  @param[in] count Number of buffers in the pool.
+     *  @param[in] size Minimum size of each buffer in bytes, rounded up to page size.
+     *
+     *  @return Pointer to the pool, nullptr on allocation failure.
+     */
+    static std::shared_ptr<FramePool> create(uint32_t count, size_t size);
+    ~FramePool();
+
+    /**
+     *  Lease any free buffer of the pool.
+     *
+     *  @return Lease on the buffer, nullptr if all the buffers are in use.
+     */
+    std::shared_ptr<FrameBuffer> acquire();
+
+    /**
+     *  Lease a specific buffer of the pool. Used when the buffer is selected by the driver, like
+     *  on dequeue of a v4l2 buffer.
+     *
+     *  @param[in] index Index of the buffer.
+     *
+     *  @return Lease on the buffer, nullptr if the index is invalid or the buffer is in use.
+     */
+    std::shared_ptr<FrameBuffer> acquire(uint32_t index);
+
+    /**
+     *  Set the function called when a buffer returns to the pool.
+     *  The callback is called with the pool lock held, it must not call back into the pool.
+     *  Once this function returns, the previous callback is not called anymore.
+     *
+     *  @param[in] cb Callback function with the index of the released buffer, may be nullptr.
+     */
+    void setReleaseCallback(std::function<void(uint32_t index)> cb);
+
+    uint32_t getCount() const;
+    size_t getSize() const;
+    uint32_t getFreeCount() const;
+    void *getData(uint32_t index) const;
+
+private:
+    FramePool();
+    int alloc(uint32_t count, size_t size);
+    void release(uint32_t index);
+    std::vector<FrameBuffer> mSlots;
+    std::vector<bool> mBusy;
+    std::vector<uint32_t> mFree;
+    std::function<void(uint32_t index)> mReleaseCB;
+    mutable std::mutex mLock;
+};
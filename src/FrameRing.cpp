@@ -0,0 +1,215 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "FrameRing.h"
+#include "log.h"
+#include "util.h"
+
+/* Frames queued by the hub while the previous one is copied */
+#define HUB_QUEUE_DEPTH 2
+#define FRAME_TIMEOUT_MS 1000
+
+static uint64_t frameTimeUs(const CameraData &data)
+{
+    return (uint64_t)data.sec * USEC_PER_SEC + data.nsec / NSEC_PER_USEC;
+}
+
+FrameRing::FrameRing(std::shared_ptr<FrameHub> frameHub, uint32_t frames, size_t memory,
+                     Policy policy)
+    : mFrameHub(frameHub)
+    , mMaxFrames(frames)
+    , mMemory(memory)
+    , mPolicy(policy)
+    , mRunning(false)
+    , mDropCnt(0)
+{
+}
+
+FrameRing::~FrameRing()
+{
+    stop();
+}
+
+int FrameRing::start()
+{
+    if (mRunning)
+        return 0;
+
+    if (!mFrameHub || !mMaxFrames)
+        return -1;
+
+    mConsumer = mFrameHub->subscribe("zsl", HUB_QUEUE_DEPTH);
+    if (!mConsumer) {
+        log_error("Pre-trigger frames not supported by camera device");
+        return -1;
+    }
+
+    mRunning = true;
+    mThread = std::thread(&FrameRing::fillThread, this);
+
+    return 0;
+}
+
+void FrameRing::stop()
+{
+    if (mThread.joinable()) {
+        mRunning = false;
+        mFrameHub->unsubscribe(mConsumer);
+        mThread.join();
+        mConsumer.reset();
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mFrames.clear();
+        mRunning = false;
+    }
+    mNewFrame.notify_all();
+}
+
+bool FrameRing::isRunning() const
+{
+    return mRunning;
+}
+
+bool FrameRing::get(uint64_t triggerUs, CameraData &data, int timeoutMs)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    mNewFrame.wait_for(locker, std::chrono::milliseconds(timeoutMs), [this, triggerUs] {
+        return !mRunning || (!mFrames.empty() && mFrames.back().timeUs >= triggerUs);
+    });
+    if (mFrames.empty())
+        return false;
+
+    /* First frame taken at or after the trigger, the newest one if none yet */
+    auto it = std::lower_bound(
+        mFrames.begin(), mFrames.end(), triggerUs,
+        [](const Entry &entry, uint64_t timeUs) { return entry.timeUs < timeUs; });
+    if (it == mFrames.end())
+        --it;
+    else if (mPolicy == Policy::CLOSEST && it != mFrames.begin()
+             && triggerUs - (it - 1)->timeUs < it->timeUs - triggerUs)
+        --it;
+
+    data = it->data;
+    log_debug("Pre-trigger frame %lld us from trigger, %zu frame(s) in ring",
+              (long long)(it->timeUs - triggerUs), mFrames.size());
+
+    return true;
+}
+
+uint32_t FrameRing::getCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mFrames.size();
+}
+
+uint64_t FrameRing::getDropCount() const
+{
+    return mDropCnt;
+}
+
+void FrameRing::fillThread()
+{
+    CameraData frame;
+
+    while (mRunning) {
+        if (!mConsumer->pop(frame, FRAME_TIMEOUT_MS)) {
+            /* Camera stopped under the ring */
+            if (mConsumer->isClosed())
+                break;
+            continue;
+        }
+
+        int ret = push(frame);
+        /* Lease on the buffer of the camera is given back right away */
+        frame = {};
+        if (ret)
+            break;
+    }
+
+    log_debug("Pre-trigger ring stopped, %llu frame(s) dropped", (unsigned long long)mDropCnt);
+
+    std::lock_guard<std::mutex> locker(mLock);
+    mRunning = false;
+    mNewFrame.notify_all();
+}
+
+int FrameRing::push(const CameraData &frame)
+{
+    if (!frame.buf || !frame.bufSize)
+        return 0;
+
+    /* Slots are sized on the first frame, and again if the frames get bigger */
+    if (!mPool || mPool->getSize() < frame.bufSize) {
+        {
+            std::lock_guard<std::mutex> locker(mLock);
+            mFrames.clear();
+        }
+
+        uint32_t count = std::min<size_t>(mMaxFrames, mMemory / frame.bufSize);
+        if (!count) {
+            log_error("Pre-trigger memory of %zu bytes too small for a frame of %zu bytes", mMemory,
+                      frame.bufSize);
+            return -1;
+        }
+
+        mPool = FramePool::create(count, frame.bufSize);
+        if (!mPool) {
+            log_error("Unable to allocate %u pre-trigger frames", count);
+            return -1;
+        }
+        log_info("Pre-trigger ring of %u frame(s) of %zu bytes", count, frame.bufSize);
+    }
+
+    /* Oldest frames make room, unless handed out to a capture */
+    std::shared_ptr<FrameBuffer> slot = mPool->acquire();
+    while (!slot) {
+        {
+            std::lock_guard<std::mutex> locker(mLock);
+            if (mFrames.empty())
+                break;
+            mFrames.pop_front();
+        }
+        slot = mPool->acquire();
+    }
+    if (!slot) {
+        mDropCnt++;
+        return 0;
+    }
+
+    memcpy(slot->data, frame.buf, frame.bufSize);
+    slot->bytesUsed = frame.bufSize;
+
+    Entry entry;
+    entry.timeUs = frameTimeUs(frame);
+    entry.data = frame;
+    entry.data.buf = slot->data;
+    entry.data.frame = slot;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mFrames.push_back(entry);
+    }
+    mNewFrame.notify_all();
+
+    return 0;
+}
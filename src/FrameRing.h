@@ -0,0 +1,110 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "CameraDevice.h"
+#include "FrameHub.h"
+#include "FramePool.h"
+
+/**
+ *  The FrameRing class keeps the last frames of a camera in memory, for zero shutter lag still
+ *  capture: the image saved is the frame taken at the time of the trigger, not the next frame
+ *  read once the capture is started.
+ *
+ *  Frames of the hub are copied to a pool of the ring, so the camera keeps all its buffers. The
+ *  number of frames kept is limited by a count and by a memory budget. The ring only fills while
+ *  it is started, the camera component starts it in still mode.
+ */
+class FrameRing {
+public:
+    /**
+     *  Frame picked for a trigger.
+     */
+    enum class Policy {
+        CLOSEST,     /**< Frame taken closest to the trigger, before or after it. */
+        FIRST_AFTER, /**< First frame taken at or after the trigger. */
+    };
+
+    /**
+     *  @param[in] frameHub Frame hub of the camera.
+     *  @param[in] frames Maximum number of frames kept.
+     *  @param[in] memory Maximum memory used by the frames in bytes.
+     *  @param[in] policy Frame picked for a trigger.
+     */
+    FrameRing(std::shared_ptr<FrameHub> frameHub, uint32_t frames, size_t memory,
+              Policy policy = Policy::CLOSEST);
+    ~FrameRing();
+
+    /**
+     *  Start filling the ring with the frames of the camera.
+     *
+     *  @return 0 on success, -1 if the camera device does not support frame sharing.
+     */
+    int start();
+
+    /**
+     *  Stop filling the ring and release the frames.
+     */
+    void stop();
+
+    bool isRunning() const;
+
+    /**
+     *  Get the frame of a trigger. If no frame was taken after the trigger yet, wait for it.
+     *
+     *  @param[in] triggerUs Time of the trigger, system time in microseconds.
+     *  @param[out] data CameraData with the frame, holding a lease on the memory of the ring.
+     *  @param[in] timeoutMs Time to wait for a frame after the trigger in milliseconds. On
+     *                       timeout the newest frame is returned.
+     *
+     *  @return true if a frame was found, false if the ring is empty.
+     */
+    bool get(uint64_t triggerUs, CameraData &data, int timeoutMs);
+
+    /* Frames in the ring */
+    uint32_t getCount();
+    /* Frames not kept because all the slots were in use */
+    uint64_t getDropCount() const;
+
+private:
+    struct Entry {
+        uint64_t timeUs;
+        CameraData data;
+    };
+
+    void fillThread();
+    int push(const CameraData &frame);
+    std::shared_ptr<FrameHub> mFrameHub;
+    std::shared_ptr<FrameHub::Consumer> mConsumer;
+    uint32_t mMaxFrames;
+    size_t mMemory;
+    Policy mPolicy;
+    std::shared_ptr<FramePool> mPool; /* Slots sized on the first frame */
+    std::deque<Entry> mFrames;        /* Oldest first */
+    std::thread mThread;
+    std::atomic<bool> mRunning;
+    std::atomic<uint64_t> mDropCnt;
+    std::mutex mLock;
+    std::condition_variable mNewFrame;
+};
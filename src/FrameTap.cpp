@@ -0,0 +1,242 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <map>
+
+#include "FrameTap.h"
+#include "log.h"
+
+const char *FrameTap::SOURCE_NAME = "camsrc";
+
+/* Taps of the cameras, the last pipeline attached to a camera wins */
+static std::map<std::string, std::weak_ptr<FrameTap>> taps;
+static std::mutex tapsLock;
+
+/* Pipelines of still capture streaming a camera between clicks, stopped for another pipeline */
+static std::map<std::string, std::function<void()>> parked;
+static std::mutex parkedLock;
+
+std::shared_ptr<FrameTap> FrameTap::attach(const std::string &deviceId, GstElement *pipeline)
+{
+    if (!pipeline)
+        return nullptr;
+
+    GstElement *source = GST_IS_BIN(pipeline)
+        ? gst_bin_get_by_name(GST_BIN(pipeline), SOURCE_NAME)
+        : (GstElement *)gst_object_ref(pipeline);
+    if (!source)
+        return nullptr;
+
+    GstPad *pad = gst_element_get_static_pad(source, "src");
+    gst_object_unref(source);
+    if (!pad)
+        return nullptr;
+
+    std::shared_ptr<FrameTap> tap(new FrameTap(deviceId, pad));
+
+    /* Probe holds a weak reference, the tap goes away with its owner */
+    tap->mProbeId = gst_pad_add_probe(
+        pad, GST_PAD_PROBE_TYPE_BUFFER, onBuffer, new std::weak_ptr<FrameTap>(tap),
+        [](gpointer data) { delete static_cast<std::weak_ptr<FrameTap> *>(data); });
+    if (!tap->mProbeId) {
+        log_error("Unable to tap frames of camera %s", deviceId.c_str());
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> locker(tapsLock);
+    taps[deviceId] = tap;
+    log_debug("Frames of camera %s tapped", deviceId.c_str());
+
+    return tap;
+}
+
+std::shared_ptr<FrameTap> FrameTap::get(const std::string &deviceId)
+{
+    std::lock_guard<std::mutex> locker(tapsLock);
+
+    auto it = taps.find(deviceId);
+    if (it == taps.end())
+        return nullptr;
+
+    std::shared_ptr<FrameTap> tap = it->second.lock();
+    if (!tap)
+        taps.erase(it);
+
+    return tap;
+}
+
+void FrameTap::park(const std::string &deviceId, std::function<void()> release)
+{
+    std::lock_guard<std::mutex> locker(parkedLock);
+
+    parked[deviceId] = release;
+}
+
+void FrameTap::unpark(const std::string &deviceId)
+{
+    std::lock_guard<std::mutex> locker(parkedLock);
+
+    parked.erase(deviceId);
+}
+
+void FrameTap::releaseDevice(const std::string &deviceId)
+{
+    /* Lock is held during the release, the pipeline is not used again before it is done */
+    std::lock_guard<std::mutex> locker(parkedLock);
+
+    auto it = parked.find(deviceId);
+    if (it == parked.end())
+        return;
+
+    log_debug("Camera %s released by still capture", deviceId.c_str());
+    it->second();
+    parked.erase(it);
+}
+
+FrameTap::FrameTap(const std::string &deviceId, GstPad *pad)
+    : mDeviceId(deviceId)
+    , mPad(pad)
+    , mProbeId(0)
+    , mArmed(false)
+    , mFrame(nullptr)
+    , mFrameUs(0)
+    , mDetached(false)
+{
+}
+
+FrameTap::~FrameTap()
+{
+    detach();
+    gst_object_unref(mPad);
+}
+
+void FrameTap::detach()
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (mDetached)
+            return;
+        mDetached = true;
+        if (mFrame) {
+            gst_sample_unref(mFrame);
+            mFrame = nullptr;
+        }
+    }
+    mFrameReady.notify_all();
+
+    if (mProbeId) {
+        gst_pad_remove_probe(mPad, mProbeId);
+        mProbeId = 0;
+    }
+
+    std::lock_guard<std::mutex> locker(tapsLock);
+    auto it = taps.find(mDeviceId);
+    if (it != taps.end()) {
+        std::shared_ptr<FrameTap> tap = it->second.lock();
+        if (!tap || tap.get() == this)
+            taps.erase(it);
+    }
+}
+
+GstSample *FrameTap::grab(int timeoutMs, usec_t *frameUs)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    if (mDetached)
+        return nullptr;
+
+    if (mFrame) {
+        gst_sample_unref(mFrame);
+        mFrame = nullptr;
+    }
+    mArmed = true;
+
+    mFrameReady.wait_for(locker, std::chrono::milliseconds(timeoutMs),
+                         [this] { return mFrame || mDetached; });
+    mArmed = false;
+
+    GstSample *sample = mFrame;
+    mFrame = nullptr;
+    if (!sample)
+        log_error("No frame from the pipeline of camera %s", mDeviceId.c_str());
+    else if (frameUs)
+        *frameUs = mFrameUs;
+
+    return sample;
+}
+
+usec_t FrameTap::getFrameTime(GstElement *element, GstBuffer *buffer)
+{
+    usec_t nowUs = now_usec();
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    GstClock *clock = gst_element_get_clock(element);
+    if (!clock)
+        return nowUs;
+
+    /* Timestamp is the running time of the frame, its age is taken on the pipeline clock */
+    GstClockTime frameTime = gst_element_get_base_time(element) + pts;
+    GstClockTime clockTime = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || frameTime > clockTime)
+        return nowUs;
+
+    return nowUs - (clockTime - frameTime) / GST_USECOND;
+}
+
+GstPadProbeReturn FrameTap::onBuffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    std::shared_ptr<FrameTap> tap = static_cast<std::weak_ptr<FrameTap> *>(user_data)->lock();
+
+    /* Streaming thread only pays for a flag check, unless a grab is waiting */
+    if (!tap || !tap->mArmed)
+        return GST_PAD_PROBE_OK;
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!buffer || !caps) {
+        if (caps)
+            gst_caps_unref(caps);
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstElement *source = gst_pad_get_parent_element(pad);
+    usec_t frameUs = source ? getFrameTime(source, buffer) : now_usec();
+    if (source)
+        gst_object_unref(source);
+
+    /* Copy, as the buffer goes back to the v4l2 queue once the stream is done with it */
+    GstBuffer *copy = gst_buffer_copy_deep(buffer);
+    GstSample *sample = gst_sample_new(copy, caps, nullptr, nullptr);
+    gst_buffer_unref(copy);
+    gst_caps_unref(caps);
+
+    {
+        std::lock_guard<std::mutex> locker(tap->mLock);
+        if (tap->mArmed && !tap->mFrame && !tap->mDetached) {
+            tap->mFrame = sample;
+            tap->mFrameUs = frameUs;
+            tap->mArmed = false;
+            sample = nullptr;
+        }
+    }
+    if (sample)
+        gst_sample_unref(sample);
+    else
+        tap->mFrameReady.notify_all();
+
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "util.h"
+
+/**
+ *  The FrameTap class gives access to the raw frames of a running pipeline that reads a camera
+ *  with v4l2src, like the video stream or the video capture. The camera can only be streamed by
+ *  one pipeline, still capture grabs its frames from the tap instead of opening the device again.
+ *
+ *  The tap is a buffer probe on the source pad of v4l2src. It passes all the frames through, and
+ *  only copies the frame asked for by grab().
+ */
+class FrameTap : public std::enable_shared_from_this<FrameTap> {
+public:
+    /* Name of the v4l2src element to tap, in the pipelines built by the camera manager */
+    static const char *SOURCE_NAME;
+
+    /**
+     *  Tap the raw frames of the camera read by a pipeline.
+     *
+     *  @param[in] deviceId Id of the camera device.
+     *  @param[in] pipeline Pipeline with a v4l2src element named SOURCE_NAME.
+     *
+     *  @return Tap registered for the camera until detach(), nullptr if there is no such element.
+     */
+    static std::shared_ptr<FrameTap> attach(const std::string &deviceId, GstElement *pipeline);
+
+    /**
+     *  Get the tap of a camera.
+     *
+     *  @param[in] deviceId Id of the camera device.
+     *
+     *  @return Tap of the last pipeline attached, nullptr if no pipeline reads the camera.
+     */
+    static std::shared_ptr<FrameTap> get(const std::string &deviceId);
+
+    /**
+     *  Register the pipeline of still capture left streaming a camera between its clicks, so the
+     *  next click does not wait for the camera to start.
+     *
+     *  @param[in] deviceId Id of the camera device.
+     *  @param[in] release Stops the streaming of the pipeline, called by releaseDevice().
+     */
+    static void park(const std::string &deviceId, std::function<void()> release);
+
+    /**
+     *  Unregister the pipeline parked on a camera, before it is used again or destroyed. Waits
+     *  for a release in progress.
+     *
+     *  @param[in] deviceId Id of the camera device.
+     */
+    static void unpark(const std::string &deviceId);
+
+    /**
+     *  Stop the streaming of the pipeline parked on a camera, before another pipeline opens the
+     *  device.
+     *
+     *  @param[in] deviceId Id of the camera device.
+     */
+    static void releaseDevice(const std::string &deviceId);
+
+    ~FrameTap();
+
+    /**
+     *  Remove the probe and unregister the tap, when the pipeline stops.
+     */
+    void detach();
+
+    /**
+     *  Get a copy of the next frame of the pipeline.
+     *
+     *  @param[in] timeoutMs Time to wait for the frame in milliseconds.
+     *  @param[out] frameUs Time the frame was taken, on the clock of now_usec(). Optional.
+     *
+     *  @return Frame with its caps, nullptr on timeout or if the tap is detached.
+     */
+    GstSample *grab(int timeoutMs, usec_t *frameUs = nullptr);
+
+    /**
+     *  Get the time a frame of a running pipeline was taken, from its timestamp.
+     *
+     *  @param[in] element Pipeline, or element of the pipeline, the frame comes from.
+     *  @param[in] buffer Frame.
+     *
+     *  @return Time of the frame on the clock of now_usec(), the current time if the frame has
+     *          no timestamp.
+     */
+    static usec_t getFrameTime(GstElement *element, GstBuffer *buffer);
+
+private:
+    FrameTap(const std::string &deviceId, GstPad *pad);
+    static GstPadProbeReturn onBuffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    std::string mDeviceId;
+    GstPad *mPad;
+    gulong mProbeId;
+    std::atomic<bool> mArmed; /* A grab() waits for the next frame */
+    std::mutex mLock;
+    std::condition_variable mFrameReady;
+    GstSample *mFrame;
+    usec_t mFrameUs; /* Time mFrame was taken */
+    bool mDetached;
+};
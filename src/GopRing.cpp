@@ -0,0 +1,165 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include "GopRing.h"
+#include "log.h"
+
+GopRing::GopRing(GstClockTime duration, size_t memory)
+    : mDuration(duration)
+    , mMemory(memory)
+    , mSize(0)
+    , mDropCnt(0)
+    , mReaderSynced(false)
+{
+}
+
+GopRing::~GopRing()
+{
+    clear();
+}
+
+void GopRing::push(GstBuffer *buffer)
+{
+    Entry entry = {buffer, GST_BUFFER_DTS_OR_PTS(buffer), gst_buffer_get_size(buffer),
+                   !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)};
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    /* Reader gets the live buffers even if the ring can not keep them */
+    if (mReader) {
+        if (entry.key)
+            mReaderSynced = true;
+        if (mReaderSynced)
+            mReader(gst_buffer_ref(buffer));
+    }
+
+    /* Buffers before the first key frame can not be decoded */
+    if (mBuffers.empty() && !entry.key) {
+        gst_buffer_unref(buffer);
+        mDropCnt++;
+        return;
+    }
+    mBuffers.push_back(entry);
+    mSize += entry.size;
+
+    /* A GOP bigger than the budget is dropped whole, the ring waits for the next key frame */
+    while (mSize > mMemory)
+        mDropCnt += dropGop();
+
+    /* Oldest GOP goes once the next ones cover the duration */
+    while (mBuffers.size() > 1) {
+        auto next = std::find_if(mBuffers.begin() + 1, mBuffers.end(),
+                                 [](const Entry &e) { return e.key; });
+        if (next == mBuffers.end() || !GST_CLOCK_TIME_IS_VALID(next->time)
+            || !GST_CLOCK_TIME_IS_VALID(entry.time) || entry.time < next->time
+            || entry.time - next->time < mDuration)
+            break;
+        dropGop();
+    }
+}
+
+GstClockTime GopRing::attach(Reader reader)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mReader = reader;
+    mReaderSynced = !mBuffers.empty();
+    for (const Entry &entry : mBuffers)
+        mReader(gst_buffer_ref(entry.buffer));
+
+    GstClockTime duration = getDurationLocked();
+    log_debug("Pre-record ring of %zu buffer(s), %zu bytes, %llu ms", mBuffers.size(), mSize,
+              (unsigned long long)(duration / GST_MSECOND));
+
+    return duration;
+}
+
+void GopRing::detach()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mReader = nullptr;
+    mReaderSynced = false;
+}
+
+void GopRing::clear()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    for (const Entry &entry : mBuffers)
+        gst_buffer_unref(entry.buffer);
+    mBuffers.clear();
+    mSize = 0;
+}
+
+GstClockTime GopRing::getDuration()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return getDurationLocked();
+}
+
+size_t GopRing::getSize()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mSize;
+}
+
+uint32_t GopRing::getCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mBuffers.size();
+}
+
+uint64_t GopRing::getDropCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mDropCnt;
+}
+
+uint32_t GopRing::dropGop()
+{
+    uint32_t count = 0;
+
+    /* Key frame of the oldest GOP, then its delta frames */
+    do {
+        gst_buffer_unref(mBuffers.front().buffer);
+        mSize -= mBuffers.front().size;
+        mBuffers.pop_front();
+        count++;
+    } while (!mBuffers.empty() && !mBuffers.front().key);
+
+    return count;
+}
+
+GstClockTime GopRing::getDurationLocked() const
+{
+    if (mBuffers.empty())
+        return 0;
+
+    GstClockTime first = mBuffers.front().time;
+    GstClockTime last = mBuffers.back().time;
+    if (!GST_CLOCK_TIME_IS_VALID(first) || !GST_CLOCK_TIME_IS_VALID(last) || last < first)
+        return 0;
+
+    return last - first;
+}
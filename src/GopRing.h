@@ -0,0 +1,102 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <deque>
+#include <functional>
+#include <gst/gst.h>
+#include <mutex>
+
+/**
+ *  The GopRing class keeps the last seconds of an encoded video in memory, as whole groups of
+ *  pictures (GOP): it always starts on a key frame, so it can be written to a file as it is.
+ *
+ *  Buffers are the ones of the encoder, referenced without copy. The oldest GOP is dropped once
+ *  the next ones cover the duration of the ring, or if the buffers do not fit in its memory
+ *  budget. A reader attached to the ring gets the GOPs kept, then every buffer pushed until it is
+ *  detached.
+ */
+class GopRing {
+public:
+    /**
+     *  Receives a buffer of the ring, with a reference it has to release. Called with the ring
+     *  locked: it must not block, nor call the ring.
+     */
+    typedef std::function<void(GstBuffer *buffer)> Reader;
+
+    /**
+     *  @param[in] duration Duration of the video kept, in nanoseconds.
+     *  @param[in] memory Maximum memory used by the buffers in bytes.
+     */
+    GopRing(GstClockTime duration, size_t memory);
+    ~GopRing();
+
+    /**
+     *  Add a buffer of the encoder to the ring. Buffers without the DELTA_UNIT flag are key
+     *  frames, they start a GOP.
+     *
+     *  @param[in] buffer Encoded buffer, the reference is taken by the ring.
+     */
+    void push(GstBuffer *buffer);
+
+    /**
+     *  Give the GOPs of the ring to a reader, then the buffers pushed until detach().
+     *
+     *  @param[in] reader Reader of the buffers, replaces the previous one.
+     *
+     *  @return Duration of the video given from the ring in nanoseconds, 0 if the ring is empty.
+     */
+    GstClockTime attach(Reader reader);
+
+    /**
+     *  Stop giving buffers to the reader. Once it returns, the reader is not called anymore.
+     */
+    void detach();
+
+    /**
+     *  Release the buffers of the ring.
+     */
+    void clear();
+
+    /* Duration of the video in the ring, in nanoseconds */
+    GstClockTime getDuration();
+    /* Memory used by the buffers of the ring */
+    size_t getSize();
+    /* Buffers in the ring */
+    uint32_t getCount();
+    /* Buffers dropped before their time, for the memory budget or waiting for a key frame */
+    uint64_t getDropCount();
+
+private:
+    struct Entry {
+        GstBuffer *buffer;
+        GstClockTime time;
+        size_t size;
+        bool key;
+    };
+
+    uint32_t dropGop();
+    GstClockTime getDurationLocked() const;
+    GstClockTime mDuration;
+    size_t mMemory;
+    std::deque<Entry> mBuffers; /* Oldest first, starts on a key frame */
+    size_t mSize;
+    uint64_t mDropCnt;
+    Reader mReader;
+    bool mReaderSynced; /* Reader got a key frame, the next buffers can be decoded */
+    std::mutex mLock;
+};
@@ -43,12 +43,15 @@ public:
 
     virtual int init() = 0;
     virtual int uninit() = 0;
-    virtual int start(int num, int interval, std::function<void(int result, int seq_num)> cb) = 0;
+    virtual int start(float interval, int count,
+                      std::function<void(int result, int seq_num)> cb) = 0;
     virtual int stop() = 0;
     virtual int getState() = 0;
-    virtual int setInterval(int interval) = 0;
-    virtual int getInterval() = 0;
+    // Interval between images in seconds
+    virtual int setInterval(float interval) = 0;
+    virtual float getInterval() = 0;
     virtual int setResolution(int imgWidth, int imgHeight) = 0;
     virtual int setFormat(CameraParameters::IMAGE_FILE_FORMAT imgFormat) = 0;
     virtual int setLocation(const std::string imgPath) = 0;
+    virtual std::string getLocation() = 0;
 };
@@ -16,24 +16,48 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <gst/app/gstappsink.h>
 #include <gst/gst.h>
 #include <sstream>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
 #include "CameraParameters.h"
+#include "FrameBufferGst.h"
+#include "FrameTap.h"
 #include "ImageCaptureGst.h"
 
 #include "log.h"
+#include "util.h"
 
 #define DEFAULT_IMAGE_FILE_FORMAT CameraParameters::IMAGE_FILE_JPEG
 #define DEFAULT_FILE_PATH "/tmp/"
 #define V4L2_DEVICE_PREFIX "/dev/"
+#define FRAME_TIMEOUT_MS 1000
+/* Includes the start of the camera streaming, for v4l2src */
+#define CAPTURE_TIMEOUT_MS 3000
 
-int ImageCaptureGst::imgCount = 0;
+std::atomic<int> ImageCaptureGst::imgCount(0);
 
-ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev)
+/* Same clock as the timestamps of the camera frames */
+static uint64_t systemTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts_usec(&ts);
+}
+
+ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                                 std::shared_ptr<FrameHub> frameHub,
+                                 std::shared_ptr<FrameRing> frameRing,
+                                 std::shared_ptr<ImageEncoderPool> encoder)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mFrameRing(frameRing)
     , mState(STATE_IDLE)
     , mWidth(0)
     , mHeight(0)
@@ -41,6 +65,13 @@ ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev)
     , mInterval(0)
     , mPath(DEFAULT_FILE_PATH)
     , mResultCB(nullptr)
+    , mPipeline(nullptr)
+    , mValve(nullptr)
+    , mAppsink(nullptr)
+    , mPipelineStale(false)
+    , mEncoder(encoder ? encoder : std::make_shared<ImageEncoderPool>())
+    , mLatency(CaptureLatency::get(camDev->getDeviceId()))
+    , mReadyUs(0)
 {
     log_info("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
 
@@ -49,8 +80,13 @@ ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev)
 }
 
 ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
-                                 struct ImageSettings &imgSetting)
+                                 struct ImageSettings &imgSetting,
+                                 std::shared_ptr<FrameHub> frameHub,
+                                 std::shared_ptr<FrameRing> frameRing,
+                                 std::shared_ptr<ImageEncoderPool> encoder)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mFrameRing(frameRing)
     , mState(STATE_IDLE)
     , mWidth(imgSetting.width)
     , mHeight(imgSetting.height)
@@ -58,6 +94,13 @@ ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
     , mInterval(0)
     , mPath(DEFAULT_FILE_PATH)
     , mResultCB(nullptr)
+    , mPipeline(nullptr)
+    , mValve(nullptr)
+    , mAppsink(nullptr)
+    , mPipelineStale(false)
+    , mEncoder(encoder ? encoder : std::make_shared<ImageEncoderPool>())
+    , mLatency(CaptureLatency::get(camDev->getDeviceId()))
+    , mReadyUs(0)
 {
     log_info("%s Device:%s with settings", __func__, mCamDev->getDeviceId().c_str());
 
@@ -68,6 +111,10 @@ ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
 ImageCaptureGst::~ImageCaptureGst()
 {
     stop();
+
+    /* Images still encoded are written and reported by the pool, without this object */
+    FrameTap::unpark(mCamDev->getDeviceId());
+    destroyPipeline();
 }
 
 int ImageCaptureGst::init()
@@ -79,6 +126,10 @@ int ImageCaptureGst::init()
         return -1;
     }
 
+    /* Pipeline is ready before the first click, and kept until uninit() */
+    if (createPipeline())
+        return -1;
+
     setState(STATE_INIT);
     return 0;
 }
@@ -92,17 +143,20 @@ int ImageCaptureGst::uninit()
         return -1;
     }
 
+    FrameTap::unpark(mCamDev->getDeviceId());
+    destroyPipeline();
+
     setState(STATE_IDLE);
     return 0;
 }
 
-int ImageCaptureGst::start(int interval, int count, std::function<void(int result, int seq_num)> cb)
+int ImageCaptureGst::start(float interval, int count,
+                           std::function<void(int result, int seq_num)> cb)
 {
-    int ret = 0;
-    log_info("%s::%s interval:%d count:%d", typeid(this).name(), __func__, interval, count);
+    log_info("%s::%s interval:%.3f count:%d", typeid(this).name(), __func__, interval, count);
     // Invalid Arguments
     // Either the capture is count based or interval based or count with interval
-    if (count <= 0 && interval <= 0) {
+    if ((count <= 0 && interval <= 0) || !(interval >= 0)) {
         log_error("Invalid Parameters");
         return 1;
     }
@@ -113,20 +167,23 @@ int ImageCaptureGst::start(int interval, int count, std::function<void(int resul
         return -1;
     }
 
+    // Thread of the previous capture is done, the state is back to INIT
+    if (mThread.joinable())
+        mThread.join();
+
+    // Clicks are due every interval from now, whatever the time taken by each click
+    if (count != 1 && interval > 0 && mTimer.start(interval * USEC_PER_SEC)) {
+        log_error("Invalid interval");
+        return 1;
+    }
+
     mResultCB = cb;
     mInterval = interval;
     setState(STATE_RUN);
 
-    if (count == 1) {
-        // There will be no stop call
-        ret = click();
-        setState(STATE_INIT);
-        if (mResultCB)
-            mResultCB(ret, 1);
-    } else {
-        // create a thread to capture images
-        mThread = std::thread(&ImageCaptureGst::captureThread, this, count);
-    }
+    // Capture on a thread even for a single image, the caller is the mavlink main loop. The
+    // thread is done once the images are queued for encoding, there will be no stop call.
+    mThread = std::thread(&ImageCaptureGst::captureThread, this, count, systemTimeUs());
 
     return 0;
 }
@@ -137,6 +194,8 @@ int ImageCaptureGst::stop()
 
     setState(STATE_INIT);
 
+    // Wake up the capture thread waiting for the next click
+    mTimer.cancel();
     if (mThread.joinable())
         mThread.join();
 
@@ -194,15 +253,20 @@ int ImageCaptureGst::getState()
 
 int ImageCaptureGst::setResolution(int imgWidth, int imgHeight)
 {
+    std::lock_guard<std::mutex> locker(mLock);
+
     mWidth = imgWidth;
     mHeight = imgHeight;
 
+    /* Created again with the new settings on next click, a click may use it now */
+    mPipelineStale = true;
+
     return 0;
 }
 
-int ImageCaptureGst::setInterval(int interval)
+int ImageCaptureGst::setInterval(float interval)
 {
-    if (interval < 0)
+    if (!(interval >= 0))
         return -1;
 
     mInterval = interval;
@@ -210,7 +274,7 @@ int ImageCaptureGst::setInterval(int interval)
     return 0;
 }
 
-int ImageCaptureGst::getInterval()
+float ImageCaptureGst::getInterval()
 {
     return mInterval;
 }
@@ -223,6 +287,8 @@ int ImageCaptureGst::setFormat(CameraParameters::IMAGE_FILE_FORMAT imgFormat)
         return 1;
     }
 
+    std::lock_guard<std::mutex> locker(mLock);
+
     mFormat = imgFormat;
 
     return 0;
@@ -232,61 +298,242 @@ int ImageCaptureGst::setLocation(const std::string imgPath)
 {
     // TODO::Check if the path is writeable/valid
     log_debug("%s:%s", __func__, imgPath.c_str());
+    std::lock_guard<std::mutex> locker(mLock);
     mPath = imgPath;
+    /* Catalog of the new directory is opened by the next capture */
+    mCatalog.reset();
 
     return 0;
 }
 
-void ImageCaptureGst::captureThread(int num)
+std::string ImageCaptureGst::getLocation()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mPath;
+}
+
+void ImageCaptureGst::captureThread(int num, uint64_t triggerUs)
 {
-    log_debug("captureThread num:%d int:%d", num, mInterval);
+    log_debug("captureThread num:%d int:%.3f", num, mInterval);
     int ret = -1;
     int count = num;
     int seq_num = 0;
+    std::shared_ptr<CaptureCatalog> catalog;
     while (mState == STATE_RUN) {
-        ret = click();
-        if (getState() != STATE_RUN)
-            continue;
-
-        seq_num++;
-        if (mResultCB)
-            mResultCB(ret, seq_num);
+        // First image starts at the command, the next ones at their trigger
+        usec_t startUs = mLatency->begin(CaptureLatency::IMAGE,
+                                         now_usec() - (systemTimeUs() - triggerUs));
 
+        // Result of the image is reported once encoded and written
+        seq_num = reserve(catalog);
+        ret = click(seq_num, triggerUs, startUs, catalog);
         if (ret) {
+            addRecord(catalog, seq_num, mFormat, ret, {}, triggerUs, {});
+            if (getState() != STATE_RUN)
+                continue;
+
             log_error("Error in Image Capture");
+            mLatency->waitMessage(seq_num, startUs);
+            if (mResultCB)
+                mResultCB(ret, seq_num);
             setState(STATE_ERROR);
             continue;
         }
 
         // Check if the capture is periodic or count(w/wo interval) based
         if (count <= 0) {
-            if (mInterval > 0)
-                sleep(mInterval);
-            else
+            if (mInterval <= 0)
                 break;
         } else {
             log_debug("Current Count : %d", count);
             count--;
-            if (count == 0)
+            if (count == 0) {
                 setState(STATE_INIT);
-            else {
-                if (mInterval > 0)
-                    sleep(mInterval);
+                continue;
             }
         }
+
+        if (mInterval > 0) {
+            int missed = mTimer.wait();
+            if (missed > 0)
+                log_warning("Image capture overran the interval, %d image(s) skipped", missed);
+        }
+
+        // Next images of the capture are triggered by the timer
+        triggerUs = systemTimeUs();
+    }
+
+    if (mInterval > 0)
+        log_info("Interval capture done, %llu image(s) skipped, wake up late by %llu us max",
+                 (unsigned long long)mTimer.getOverrunCount(),
+                 (unsigned long long)mTimer.getMaxLatenessUs());
+
+    idle();
+}
+
+int ImageCaptureGst::reserve(std::shared_ptr<CaptureCatalog> &catalog)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    /* Opened on the first image, a capture object alone does not write to the directory */
+    if (!mCatalog)
+        mCatalog = CaptureCatalog::get(mPath, CaptureCatalog::Media::IMAGE);
+    catalog = mCatalog;
+    int seq_num = catalog ? catalog->reserve() : -1;
+    if (seq_num < 0) {
+        /* No catalog in the directory, numbers start over with the process */
+        catalog.reset();
+        seq_num = imgCount++;
+    }
+
+    return seq_num;
+}
+
+void ImageCaptureGst::addRecord(const std::shared_ptr<CaptureCatalog> &catalog, int seq_num,
+                                int format, int result, const std::string &filepath,
+                                uint64_t timeUs, const PoseCache::Pose &pose)
+{
+    if (!catalog)
+        return;
+
+    CaptureCatalog::Record record = {};
+    record.seq = seq_num;
+    record.state = result ? CaptureCatalog::STATE_FAILED : CaptureCatalog::STATE_DONE;
+    record.format = format;
+    record.timeUtcUs = timeUs;
+    record.timeBootMs = (now_usec() - (systemTimeUs() - timeUs)) / USEC_PER_MSEC;
+    struct stat st;
+    if (!result && !stat(filepath.c_str(), &st))
+        record.size = st.st_size;
+    if (pose.hasPosition) {
+        record.lat = pose.position.lat;
+        record.lon = pose.position.lon;
+        record.alt = pose.position.alt;
+        record.relativeAlt = pose.position.relativeAlt;
+    }
+    if (pose.hasAttitude)
+        memcpy(record.q, pose.q, sizeof(record.q));
+    snprintf(record.path, sizeof(record.path), "%s", filepath.c_str());
+
+    catalog->commit(record);
+}
+
+GstTagList *ImageCaptureGst::getPoseTags(const PoseCache::Pose &pose)
+{
+    if (!pose.hasPosition && !pose.hasAttitude)
+        return nullptr;
+
+    GstTagList *tags = gst_tag_list_new_empty();
+    if (pose.hasPosition) {
+        gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_TAG_GEO_LOCATION_LATITUDE,
+                         pose.position.lat / 1E7, GST_TAG_GEO_LOCATION_LONGITUDE,
+                         pose.position.lon / 1E7, GST_TAG_GEO_LOCATION_ELEVATION,
+                         pose.position.alt / 1000.0, NULL);
+    }
+    if (pose.hasAttitude) {
+        /* Camera looking ahead of the vehicle, tags only have room for its heading */
+        const float *q = pose.q;
+        double yaw
+            = atan2(2.0 * (q[0] * q[3] + q[1] * q[2]), 1 - 2.0 * (q[2] * q[2] + q[3] * q[3]));
+        double direction = fmod(yaw * 180 / M_PI + 360, 360);
+        gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_TAG_GEO_LOCATION_CAPTURE_DIRECTION,
+                         direction, NULL);
     }
+
+    return tags;
 }
 
-int ImageCaptureGst::click()
+int ImageCaptureGst::click(int seq_num, uint64_t triggerUs, usec_t startUs,
+                           std::shared_ptr<CaptureCatalog> catalog)
 {
     log_debug("%s", __func__);
 
-    int ret = 0;
-    if (mCamDev->isGstV4l2Src())
-        ret = createV4l2Pipeline();
-    else
-        ret = createAppsrcPipeline();
-    return ret;
+    std::string encoder;
+    std::string filepath;
+    uint32_t width, height;
+    int format;
+    bool stale;
+    {
+        /* Settings of this image, they may change during the grab */
+        std::lock_guard<std::mutex> locker(mLock);
+
+        /* Raw frames are written as they come, without encoder */
+        encoder = getGstImgEncName(mFormat);
+        if (encoder.empty() && mFormat != CameraParameters::IMAGE_FILE_RAW) {
+            log_error("Image format not supported: %d", mFormat);
+            return 1;
+        }
+
+        filepath = mPath + "img_" + std::to_string(seq_num) + "." + getImgExt(mFormat);
+        width = mWidth;
+        height = mHeight;
+        format = mFormat;
+        stale = mPipelineStale;
+    }
+
+    /* Pipeline is only used by the capture thread once it is back from the parked ones */
+    FrameTap::unpark(mCamDev->getDeviceId());
+    if (stale)
+        destroyPipeline();
+
+    uint64_t frameUs; /* Time the frame was taken, system time */
+    GstSample *frame = mCamDev->isGstV4l2Src() ? grabV4l2Frame(frameUs)
+                                               : grabDeviceFrame(triggerUs, frameUs);
+    if (!frame)
+        return 1;
+    mLatency->mark(CaptureLatency::IMAGE, CaptureLatency::STAGE_PIPELINE_READY, startUs,
+                   mReadyUs);
+    mLatency->mark(CaptureLatency::IMAGE, CaptureLatency::STAGE_FRAME, startUs);
+
+    /* Pose of the vehicle when the frame was taken, from the samples already received */
+    PoseCache::Pose pose;
+    PoseCache::getInstance().get(now_usec() - (systemTimeUs() - frameUs), pose);
+
+    /* Waits only if the encoders are behind by a full queue, not for the disk */
+    auto cb = mResultCB;
+    std::shared_ptr<CaptureLatency> latency = mLatency;
+    /* Result may come after this object is gone, the callback keeps what it needs */
+    if (mEncoder->push(frame, getPoseTags(pose), encoder, width, height, filepath,
+                       [cb, seq_num, catalog, format, filepath, frameUs, pose, latency,
+                        startUs](int result, usec_t encodedUs) {
+                           if (!result) {
+                               latency->mark(CaptureLatency::IMAGE,
+                                             CaptureLatency::STAGE_ENCODED, startUs, encodedUs);
+                               latency->mark(CaptureLatency::IMAGE,
+                                             CaptureLatency::STAGE_FILE_CLOSED, startUs);
+                           }
+                           addRecord(catalog, seq_num, format, result, filepath, frameUs,
+                                     pose);
+                           latency->waitMessage(seq_num, startUs);
+                           if (cb)
+                               cb(result, seq_num);
+                       }))
+        return 1;
+
+    return 0;
+}
+
+void ImageCaptureGst::idle()
+{
+    if (!mPipeline || !mValve)
+        return;
+
+    /*
+     * In still mode v4l2src keeps streaming with the valve closed, the next click does not wait
+     * for the camera to start. A pipeline needing the device, or the video mode, stops it: READY
+     * keeps the device open with its caps known for the next click.
+     */
+    CameraParameters::Mode mode = CameraParameters::MODE_STILL;
+    mCamDev->getMode(mode);
+    if (mode != CameraParameters::MODE_STILL) {
+        gst_element_set_state(mPipeline, GST_STATE_READY);
+        return;
+    }
+
+    GstElement *pipeline = mPipeline;
+    FrameTap::park(mCamDev->getDeviceId(),
+                   [pipeline] { gst_element_set_state(pipeline, GST_STATE_READY); });
 }
 
 std::string ImageCaptureGst::getGstImgEncName(int format)
@@ -296,6 +543,8 @@ std::string ImageCaptureGst::getGstImgEncName(int format)
         return "jpegenc";
         break;
     case CameraParameters::IMAGE_FILE_PNG:
+        return "pngenc";
+        break;
     case CameraParameters::IMAGE_FILE_RAW:
     default:
         return {};
@@ -308,6 +557,21 @@ std::string ImageCaptureGst::getGstPixFormat(CameraParameters::PixelFormat pixFo
     case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
         return "RGB";
         break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return "UYVY";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return "YUY2";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return "GRAY8";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+        return "I420";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return "NV12";
+        break;
     default:
         return {};
     }
@@ -326,7 +590,7 @@ std::string ImageCaptureGst::getImgExt(int format)
     }
 }
 
-std::string ImageCaptureGst::getGstPipelineNameV4l2()
+std::string ImageCaptureGst::getGstPipelineNameV4l2(uint32_t width, uint32_t height)
 {
     std::string device = mCamDev->getDeviceId();
     if (device.empty())
@@ -334,226 +598,251 @@ std::string ImageCaptureGst::getGstPipelineNameV4l2()
 
     device.insert(0, V4L2_DEVICE_PREFIX);
 
-    std::string enc = getGstImgEncName(mFormat);
-    if (enc.empty())
-        return {};
-
-    std::string ext = getImgExt(mFormat);
-    if (ext.empty())
-        return {};
-
     std::stringstream filter;
-    filter << "video/x-raw, ";
-    if (mWidth > 0 && mHeight > 0) {
-        filter << " width=" << std::to_string(mWidth) << ", height=" << std::to_string(mHeight);
+    filter << "video/x-raw";
+    if (width > 0 && height > 0) {
+        filter << ", width=" << std::to_string(width) << ", height=" << std::to_string(height);
     }
 
+    /* Frames are dropped by the valve, until a click opens it for one frame to encode */
     std::stringstream ss;
-    ss << "v4l2src device=" << device + " num-buffers=1"
-       << " ! " << filter.str() << " ! " << enc << " ! "
-       << "filesink location=" << mPath + "img_" << std::to_string(++imgCount) << "." + ext;
+    ss << "v4l2src device=" << device << " ! " << filter.str()
+       << " ! valve name=valve drop=true ! appsink name=sink max-buffers=1 drop=true sync=false";
     log_debug("Gstreamer pipeline: %s", ss.str().c_str());
     return ss.str();
 }
 
-int ImageCaptureGst::createV4l2Pipeline()
+int ImageCaptureGst::createPipeline()
+{
+    CameraParameters::IMAGE_FILE_FORMAT format;
+    uint32_t width, height;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        format = mFormat;
+        width = mWidth;
+        height = mHeight;
+        mPipelineStale = false;
+    }
+
+    if (getGstImgEncName(format).empty() && format != CameraParameters::IMAGE_FILE_RAW) {
+        log_error("Image format not supported: %d", format);
+        return 1;
+    }
+
+    /* Frames of the other camera devices are read on click, no pipeline to capture them */
+    if (!mCamDev->isGstV4l2Src()) {
+        if (getGstPixFormat(mCamPixFormat).empty()) {
+            log_error("Pixel format not supported: %d", mCamPixFormat);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (createV4l2Pipeline(width, height)) {
+        destroyPipeline();
+        return 1;
+    }
+
+    /* v4l2src opens the camera and finds its caps in READY */
+    if (gst_element_set_state(mPipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        log_error("Error starting capture pipeline");
+        logPipelineError();
+        destroyPipeline();
+        return 1;
+    }
+
+    return 0;
+}
+
+void ImageCaptureGst::destroyPipeline()
+{
+    if (!mPipeline)
+        return;
+
+    gst_element_set_state(mPipeline, GST_STATE_NULL);
+    if (mValve)
+        gst_object_unref(mValve);
+    if (mAppsink)
+        gst_object_unref(mAppsink);
+    gst_object_unref(mPipeline);
+    mPipeline = nullptr;
+    mValve = nullptr;
+    mAppsink = nullptr;
+}
+
+int ImageCaptureGst::createV4l2Pipeline(uint32_t width, uint32_t height)
 {
     log_info("%s", __func__);
 
-    int ret = 0;
     GError *error = nullptr;
-    GstElement *pipeline;
-    GstMessage *msg;
-    GstBus *bus;
-    std::string pipeline_str = getGstPipelineNameV4l2();
+    std::string pipeline_str = getGstPipelineNameV4l2(width, height);
     if (pipeline_str.empty()) {
         log_error("Pipeline String error");
         return 1;
     }
-    pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
-    if (!pipeline) {
+    mPipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!mPipeline) {
         log_error("Error creating pipeline");
         if (error)
             g_clear_error(&error);
         return 1;
     }
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
-    bus = gst_element_get_bus(pipeline);
-    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
-                                     (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
-    switch (GST_MESSAGE_TYPE(msg)) {
-    case GST_MESSAGE_EOS: {
-        log_debug("EOS\n");
-        log_info("Image Captured Successfully");
-        ret = 0;
-        break;
-    }
-    case GST_MESSAGE_ERROR: {
-        GError *err = NULL; /* error to show to users                 */
-        gchar *dbg = NULL;  /* additional debug string for developers */
+    if (error)
+        g_clear_error(&error);
 
-        gst_message_parse_error(msg, &err, &dbg);
-        if (err) {
-            log_error("ERROR: %s", err->message);
-            g_error_free(err);
-        }
-        if (dbg) {
-            log_error("[Debug details: %s]", dbg);
-            g_free(dbg);
-        }
-        ret = 1;
-        break;
-    }
-    default:
-        log_error("Unexpected message of type %d", GST_MESSAGE_TYPE(msg));
-        ret = 1;
-        break;
+    mValve = gst_bin_get_by_name(GST_BIN(mPipeline), "valve");
+    mAppsink = gst_bin_get_by_name(GST_BIN(mPipeline), "sink");
+    if (!mValve || !mAppsink) {
+        log_error("Error creating pipeline");
+        return 1;
     }
 
-    gst_message_unref(msg);
-    gst_object_unref(bus);
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(pipeline);
-
-    return ret;
+    return 0;
 }
 
-static void cbNeedData(GstElement *appsrc, guint unused_size, ImageCaptureGst *obj)
+CameraDevice::Status ImageCaptureGst::readFrame(CameraData &data)
 {
-    log_debug("%s", __func__);
+    std::shared_ptr<FrameHub::Consumer> consumer;
+    if (mFrameHub)
+        consumer = mFrameHub->subscribe("image", 1);
+    if (!consumer)
+        return mCamDev->read(data);
 
-    GstFlowReturn ret;
-    CameraData data;
-    CameraDevice::Status status = obj->mCamDev->read(data);
-    if (status != CameraDevice::Status::SUCCESS) {
-        log_error("No data from camera device");
-        // TODO :: return error or feed blank frames?
-    }
-    gsize size = data.bufSize; // width*height*3/2/1.5
-    gsize offset = 0;
-    gsize maxsize = size;
-    GstBuffer *buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, data.buf, maxsize, offset,
-                                                    size, NULL, NULL);
-    assert(buffer);
-
-    g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
-    gst_buffer_unref(buffer);
-    if (ret != GST_FLOW_OK) {
-        /* some error */
-        log_error("Error in sending data to gst pipeline");
-    }
-    g_signal_emit_by_name(appsrc, "end-of-stream", &ret);
-    // gst_app_src_end_of_stream (appsrc);
+    /* Next frame of the camera, shared with the other consumers */
+    bool received = consumer->pop(data, FRAME_TIMEOUT_MS);
+    mFrameHub->unsubscribe(consumer);
+
+    return received ? CameraDevice::Status::SUCCESS : CameraDevice::Status::TIMED_OUT;
 }
 
-int ImageCaptureGst::createAppsrcPipeline()
+GstSample *ImageCaptureGst::grabV4l2Frame(uint64_t &frameUs)
 {
-    log_info("%s", __func__);
-
-    int ret = 0;
-    GstElement *pipeline, *appsrc, *enc, *imagesink;
-    GstMessage *msg;
+    /* Camera streamed by a video stream or a recording, take the frame from its pipeline */
+    std::shared_ptr<FrameTap> tap = FrameTap::get(mCamDev->getDeviceId());
+    if (tap) {
+        mReadyUs = now_usec();
+        usec_t tapUs;
+        GstSample *sample = tap->grab(CAPTURE_TIMEOUT_MS, &tapUs);
+        if (!sample)
+            return nullptr;
+        frameUs = systemTimeUs() - (now_usec() - tapUs);
+
+        GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+        if (!gst_structure_has_name(s, "video/x-raw")) {
+            log_error("Camera streams %s, still capture needs raw frames",
+                      gst_structure_get_name(s));
+            gst_sample_unref(sample);
+            return nullptr;
+        }
 
-    std::string encname = getGstImgEncName(mFormat);
-    std::string fmt = getGstPixFormat(mCamPixFormat);
-    std::string ext = getImgExt(mFormat);
-    if (encname.empty() || fmt.empty() || ext.empty()) {
-        log_error("Error in fetching gst info");
-        return 1;
+        return sample;
     }
 
-    /* setup pipeline */
-    pipeline = gst_pipeline_new("pipeline");
-    appsrc = gst_element_factory_make("appsrc", "source");
-    enc = gst_element_factory_make(encname.c_str(), "enc");
-    imagesink = gst_element_factory_make("filesink", "imagesink");
+    /* Pipeline is kept from the previous click, unless settings changed or it failed */
+    if (!mPipeline && createPipeline())
+        return nullptr;
 
-    if (!pipeline || !appsrc || !enc || !imagesink) {
-        log_error("Gst element could not be created. Exiting");
-        return 1;
+    if (gst_element_set_state(mPipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        log_error("Error starting capture pipeline");
+        destroyPipeline();
+        return nullptr;
     }
 
-    std::string filepath = mPath + "img_" + std::to_string(++imgCount) + "." + ext;
-    g_object_set(G_OBJECT(imagesink), "location", filepath.c_str(), NULL);
-
-    log_info("Pipeline Format:%d, width:%d, Height:%d", mCamPixFormat, mWidth, mHeight);
-    log_info("Pipeline File:%s", filepath.c_str());
-
-    /* setup */
-    g_object_set(G_OBJECT(appsrc), "caps",
-                 gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, fmt.c_str(), "width",
-                                     G_TYPE_INT, mCamWidth, "height", G_TYPE_INT, mCamHeight,
-                                     "framerate", GST_TYPE_FRACTION, 0, 1, NULL),
-                 NULL);
-
-    // Resize
-    if (mWidth > 0 && mHeight > 0) {
-        // Add videoscale to resize
-        // TODO :: Rescaling has issues and outputs corrupted data, need to fix
-        GstElement *videoscale = gst_element_factory_make("videoscale", "videoscale");
-        GstElement *filter = gst_element_factory_make("capsfilter", "resize");
-        if (!videoscale || !filter) {
-            log_error("Gst element could not be created. Exiting.\n");
-            // free resources
-            return 1;
-        }
+    GstAppSink *sink = GST_APP_SINK(mAppsink);
+
+    /* Drop a frame left by a previous click */
+    GstSample *sample;
+    while ((sample = gst_app_sink_try_pull_sample(sink, 0)))
+        gst_sample_unref(sample);
+
+    /* Let the next frame of the camera through */
+    mReadyUs = now_usec();
+    g_object_set(G_OBJECT(mValve), "drop", FALSE, NULL);
+    sample = gst_app_sink_try_pull_sample(sink, CAPTURE_TIMEOUT_MS * GST_MSECOND);
+    g_object_set(G_OBJECT(mValve), "drop", TRUE, NULL);
+    if (!sample || !gst_sample_get_buffer(sample)) {
+        log_error("No image from capture pipeline");
+        logPipelineError();
+        if (sample)
+            gst_sample_unref(sample);
+        destroyPipeline();
+        return nullptr;
+    }
+
+    frameUs = systemTimeUs()
+        - (now_usec() - FrameTap::getFrameTime(mPipeline, gst_sample_get_buffer(sample)));
+
+    /* v4l2src has a few buffers only, give this one back before it waits in the queue */
+    GstBuffer *buffer = gst_buffer_copy_deep(gst_sample_get_buffer(sample));
+    GstSample *frame = gst_sample_new(buffer, gst_sample_get_caps(sample), NULL, NULL);
+    gst_buffer_unref(buffer);
+    gst_sample_unref(sample);
+
+    return frame;
+}
 
-        g_object_set(filter, "caps", gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING,
-                                                         fmt.c_str(), "width", G_TYPE_INT, mWidth,
-                                                         "height", G_TYPE_INT, mHeight, NULL),
-                     NULL);
+GstSample *ImageCaptureGst::grabDeviceFrame(uint64_t triggerUs, uint64_t &frameUs)
+{
+    CameraData data;
+    GstBuffer *buffer;
 
-        gst_bin_add_many(GST_BIN(pipeline), appsrc, videoscale, filter, enc, imagesink, NULL);
-        gst_element_link_many(appsrc, videoscale, filter, enc, imagesink, NULL);
+    mReadyUs = now_usec();
+    if (mFrameRing && mFrameRing->isRunning()
+        && mFrameRing->get(triggerUs, data, FRAME_TIMEOUT_MS)) {
+        /* Frame taken at the trigger, its slot in the ring is held until it is encoded */
+        buffer = wrapCameraData(data);
     } else {
-        gst_bin_add_many(GST_BIN(pipeline), appsrc, enc, imagesink, NULL);
-        gst_element_link_many(appsrc, enc, imagesink, NULL);
-    }
-    /* setup appsrc */
-    g_object_set(G_OBJECT(appsrc), "stream-type", 0, // GST_APP_STREAM_TYPE_STREAM
-                 "format", GST_FORMAT_TIME, "is-live", TRUE, NULL);
-    g_signal_connect(appsrc, "need-data", G_CALLBACK(cbNeedData), this);
-
-    /* play */
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
-
-    /* add watch for messages */
-    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
-    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
-                                     (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
-    switch (GST_MESSAGE_TYPE(msg)) {
-    case GST_MESSAGE_EOS: {
-        log_info("EOS\n");
-        ret = 0;
-        break;
+        if (readFrame(data) != CameraDevice::Status::SUCCESS || !data.buf || !data.bufSize) {
+            log_error("No data from camera device");
+            return nullptr;
+        }
+
+        /* Frame may be leased from the pool of the camera, copy it before it waits in the queue */
+        buffer = gst_buffer_new_allocate(NULL, data.bufSize, NULL);
+        if (buffer)
+            gst_buffer_fill(buffer, 0, data.buf, data.bufSize);
+    }
+    if (!buffer) {
+        log_error("Error allocating image buffer");
+        return nullptr;
     }
-    case GST_MESSAGE_ERROR: {
+
+    /* Time the frame was taken, from the camera if it gives it */
+    frameUs = data.sec || data.nsec ? (uint64_t)data.sec * USEC_PER_SEC + data.nsec / 1000
+                                    : systemTimeUs();
+
+    GstCaps *caps = gst_caps_new_simple(
+        "video/x-raw", "format", G_TYPE_STRING, getGstPixFormat(mCamPixFormat).c_str(), "width",
+        G_TYPE_INT, mCamWidth, "height", G_TYPE_INT, mCamHeight, "framerate", GST_TYPE_FRACTION,
+        0, 1, NULL);
+    GstSample *frame = gst_sample_new(buffer, caps, NULL, NULL);
+    gst_caps_unref(caps);
+    gst_buffer_unref(buffer);
+
+    return frame;
+}
+
+void ImageCaptureGst::logPipelineError()
+{
+    if (!mPipeline)
+        return;
+
+    GstBus *bus = gst_element_get_bus(mPipeline);
+    GstMessage *msg;
+    while ((msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR))) {
         GError *err = NULL; /* error to show to users                 */
         gchar *dbg = NULL;  /* additional debug string for developers */
 
         gst_message_parse_error(msg, &err, &dbg);
         if (err) {
-            log_error("ERROR: %s\n", err->message);
+            log_error("ERROR: %s", err->message);
             g_error_free(err);
         }
         if (dbg) {
-            log_error("[Debug details: %s]\n", dbg);
+            log_error("[Debug details: %s]", dbg);
             g_free(dbg);
         }
-        ret = 1;
-        break;
-    }
-    default:
-        log_error("Unexpected message of type %d", GST_MESSAGE_TYPE(msg));
-        ret = 1;
-        break;
+        gst_message_unref(msg);
     }
-
-    /* clean up */
-    gst_message_unref(msg);
     gst_object_unref(bus);
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(GST_OBJECT(pipeline));
-
-    return ret;
 }
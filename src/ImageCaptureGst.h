@@ -16,50 +16,91 @@
  * limitations under the License.
  */
 #pragma once
+#include <gst/gst.h>
+#include <mutex>
 #include <string>
 
 #include "CameraDevice.h"
+#include "CaptureCatalog.h"
+#include "CaptureLatency.h"
+#include "FrameHub.h"
+#include "FrameRing.h"
 #include "ImageCapture.h"
+#include "ImageEncoderPool.h"
+#include "IntervalTimer.h"
+#include "PoseCache.h"
 
 class ImageCaptureGst final : public ImageCapture {
 public:
-    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev);
-    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev, struct ImageSettings &imgSetting);
+    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                    std::shared_ptr<FrameHub> frameHub = nullptr,
+                    std::shared_ptr<FrameRing> frameRing = nullptr,
+                    std::shared_ptr<ImageEncoderPool> encoder = nullptr);
+    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev, struct ImageSettings &imgSetting,
+                    std::shared_ptr<FrameHub> frameHub = nullptr,
+                    std::shared_ptr<FrameRing> frameRing = nullptr,
+                    std::shared_ptr<ImageEncoderPool> encoder = nullptr);
     ~ImageCaptureGst();
 
     int init();
     int uninit();
-    int start(int interval, int count, std::function<void(int result, int seq_num)> cb);
+    int start(float interval, int count, std::function<void(int result, int seq_num)> cb);
     int stop();
     int getState();
-    int setInterval(int interval);
-    int getInterval();
+    int setInterval(float interval);
+    float getInterval();
     int setResolution(int imgWidth, int imgHeight);
     int setFormat(CameraParameters::IMAGE_FILE_FORMAT imgFormat);
     int setLocation(const std::string imgPath);
+    std::string getLocation();
+    CameraDevice::Status readFrame(CameraData &data);
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
+    std::shared_ptr<FrameRing> mFrameRing;
 
 private:
-    static int imgCount;
+    static std::atomic<int> imgCount;
     int setState(int state);
-    int click();
-    void captureThread(int num);
-    int createV4l2Pipeline();
+    int reserve(std::shared_ptr<CaptureCatalog> &catalog);
+    int click(int seq_num, uint64_t triggerUs, usec_t startUs,
+              std::shared_ptr<CaptureCatalog> catalog);
+    static void addRecord(const std::shared_ptr<CaptureCatalog> &catalog, int seq_num, int format,
+                          int result, const std::string &filepath, uint64_t timeUs,
+                          const PoseCache::Pose &pose);
+    static GstTagList *getPoseTags(const PoseCache::Pose &pose);
+    void idle();
+    void captureThread(int num, uint64_t triggerUs);
+    int createPipeline();
+    void destroyPipeline();
+    int createV4l2Pipeline(uint32_t width, uint32_t height);
     std::string getGstImgEncName(int format);
     std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat);
     std::string getImgExt(int format);
-    std::string getGstPipelineNameV4l2();
-    int createAppsrcPipeline();
+    std::string getGstPipelineNameV4l2(uint32_t width, uint32_t height);
+    GstSample *grabV4l2Frame(uint64_t &frameUs);
+    GstSample *grabDeviceFrame(uint64_t triggerUs, uint64_t &frameUs);
+    void logPipelineError();
     std::string mDevice;
     std::atomic<int> mState;
     uint32_t mWidth;                             /* Image Width*/
     uint32_t mHeight;                            /* Image Height*/
     CameraParameters::IMAGE_FILE_FORMAT mFormat; /* Image File Format*/
-    uint32_t mInterval;                          /* Image Capture interval */
+    float mInterval;                             /* Image Capture interval in sec */
     std::string mPath;                           /* Image File Destination Path*/
+    std::shared_ptr<CaptureCatalog> mCatalog;    /* Images of mPath, numbers them */
     uint32_t mCamWidth;                          /* Camera Frame Width*/
     uint32_t mCamHeight;                         /* Camera Frame Height*/
     CameraParameters::PixelFormat mCamPixFormat; /* Camera Frame Pixel Format*/
     std::function<void(int result, int seq_num)> mResultCB;
     std::thread mThread;
+    IntervalTimer mTimer;      /* Deadlines of the clicks of interval capture */
+    std::mutex mLock;          /* Settings of the images, not held by the grab of a frame */
+    GstElement *mPipeline;     /* Captures one frame of v4l2src per click, kept between clicks */
+    GstElement *mValve;        /* Lets one frame of v4l2src through per click */
+    GstElement *mAppsink;      /* Raw frames */
+    bool mPipelineStale;       /* Settings of mPipeline changed, created again on next click */
+    /* Encodes and writes the images off the capture thread, may outlive the capture */
+    std::shared_ptr<ImageEncoderPool> mEncoder;
+    std::shared_ptr<CaptureLatency> mLatency; /* Stages of the images of the camera */
+    usec_t mReadyUs;                          /* Grab of the frame started, by the click */
 };
@@ -0,0 +1,285 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <sstream>
+
+#include "ImageEncoderPool.h"
+#include "log.h"
+
+/* Encoders hold a few frames of memory each, more workers do not pay off for bursts */
+#define MAX_WORKERS 4
+#define ENCODE_TIMEOUT_MS 3000
+
+ImageEncoderPool::ImageEncoderPool(unsigned int workers, unsigned int depth)
+    : mBusy(0)
+    , mStop(false)
+{
+    if (!workers)
+        workers = std::min(std::thread::hardware_concurrency(), (unsigned int)MAX_WORKERS);
+    if (!workers)
+        workers = 1;
+    mDepth = depth ? depth : 2 * workers;
+
+    for (unsigned int i = 0; i < workers; i++) {
+        Worker *worker = new Worker{};
+        mWorkers.emplace_back(worker);
+        worker->thread = std::thread(&ImageEncoderPool::workerThread, this, worker);
+    }
+
+    log_debug("Image encoder pool: %u worker(s), %u image(s) queued max", workers, mDepth);
+}
+
+ImageEncoderPool::~ImageEncoderPool()
+{
+    /* Images queued are still written */
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mStop = true;
+    }
+    mJobReady.notify_all();
+
+    for (auto &worker : mWorkers) {
+        worker->thread.join();
+        destroyPipeline(worker.get());
+    }
+}
+
+int ImageEncoderPool::push(GstSample *sample, GstTagList *tags, const std::string &encoder,
+                           uint32_t width, uint32_t height, const std::string &filepath,
+                           std::function<void(int result, usec_t encodedUs)> done)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    mJobTaken.wait(locker, [this] { return mStop || mJobs.size() < mDepth; });
+    if (mStop) {
+        locker.unlock();
+        gst_sample_unref(sample);
+        if (tags)
+            gst_tag_list_unref(tags);
+        return -1;
+    }
+
+    mJobs.push_back({sample, tags, encoder, width, height, filepath, done});
+    locker.unlock();
+    mJobReady.notify_one();
+
+    return 0;
+}
+
+void ImageEncoderPool::flush()
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    mJobTaken.wait(locker, [this] { return mJobs.empty() && !mBusy; });
+}
+
+unsigned int ImageEncoderPool::getWorkerCount() const
+{
+    return mWorkers.size();
+}
+
+unsigned int ImageEncoderPool::getPendingCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mJobs.size() + mBusy;
+}
+
+void ImageEncoderPool::workerThread(Worker *worker)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    while (true) {
+        mJobReady.wait(locker, [this] { return mStop || !mJobs.empty(); });
+        if (mJobs.empty())
+            break;
+
+        Job job = mJobs.front();
+        mJobs.pop_front();
+        mBusy++;
+        locker.unlock();
+        mJobTaken.notify_all();
+
+        int ret;
+        usec_t encodedUs;
+        if (job.encoder.empty()) {
+            /* Nothing to encode, the frame is written as it is */
+            encodedUs = now_usec();
+            ret = worker->raw.write(job.sample, job.filepath, job.tags);
+            gst_sample_unref(job.sample);
+        } else {
+            GstSample *image = nullptr;
+            ret = encode(worker, job, &image);
+            encodedUs = now_usec();
+            gst_sample_unref(job.sample);
+            if (!ret) {
+                ret = writeImage(image, job.filepath);
+                gst_sample_unref(image);
+            }
+        }
+        if (job.tags)
+            gst_tag_list_unref(job.tags);
+
+        if (!ret)
+            log_info("Image Captured Successfully: %s", job.filepath.c_str());
+        else
+            log_error("Error in encoding image %s", job.filepath.c_str());
+
+        if (job.done)
+            job.done(ret, encodedUs);
+
+        locker.lock();
+        mBusy--;
+        mJobTaken.notify_all();
+    }
+}
+
+int ImageEncoderPool::encode(Worker *worker, Job &job, GstSample **image)
+{
+    std::stringstream desc;
+    desc << "appsrc name=src format=time";
+    if (job.width > 0 && job.height > 0)
+        desc << " ! videoscale ! video/x-raw, width=" << job.width << ", height=" << job.height;
+    desc << " ! videoconvert ! " << job.encoder;
+    if (job.encoder == "jpegenc")
+        desc << " ! jifmux name=mux";
+    desc << " ! appsink name=sink sync=false";
+
+    /* Pipeline is kept from the previous image, unless settings changed or it failed */
+    if (worker->pipelineDesc != desc.str()) {
+        destroyPipeline(worker);
+        if (createPipeline(worker, desc.str()))
+            return 1;
+    }
+
+    /* Tags of the previous image are dropped, the muxer writes the ones of this image */
+    if (worker->tagger) {
+        GstTagSetter *setter = GST_TAG_SETTER(worker->tagger);
+        gst_tag_setter_reset_tags(setter);
+        if (job.tags)
+            gst_tag_setter_merge_tags(setter, job.tags, GST_TAG_MERGE_REPLACE_ALL);
+    }
+
+    /* Caps of the appsrc follow the caps of the sample */
+    if (gst_app_src_push_sample(GST_APP_SRC(worker->appsrc), job.sample) != GST_FLOW_OK) {
+        log_error("Error in sending data to encode pipeline");
+        destroyPipeline(worker);
+        return 1;
+    }
+
+    *image = gst_app_sink_try_pull_sample(GST_APP_SINK(worker->appsink),
+                                          ENCODE_TIMEOUT_MS * GST_MSECOND);
+    if (!*image) {
+        GstBus *bus = gst_element_get_bus(worker->pipeline);
+        GstMessage *msg;
+        while ((msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR))) {
+            GError *err = NULL;
+            gchar *dbg = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg);
+            log_error("ERROR: %s", err ? err->message : "unknown");
+            if (dbg)
+                log_debug("[Debug details: %s]", dbg);
+            g_clear_error(&err);
+            g_free(dbg);
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+
+        log_error("No image from encode pipeline");
+        destroyPipeline(worker);
+        return 1;
+    }
+
+    return 0;
+}
+
+int ImageEncoderPool::createPipeline(Worker *worker, const std::string &desc)
+{
+    log_debug("Encode pipeline: %s", desc.c_str());
+
+    GError *error = nullptr;
+    worker->pipeline = gst_parse_launch(desc.c_str(), &error);
+    if (error) {
+        log_error("Error creating encode pipeline: %s", error->message);
+        g_clear_error(&error);
+    }
+    if (!worker->pipeline)
+        return 1;
+
+    worker->appsrc = gst_bin_get_by_name(GST_BIN(worker->pipeline), "src");
+    worker->appsink = gst_bin_get_by_name(GST_BIN(worker->pipeline), "sink");
+    worker->tagger = gst_bin_get_by_name(GST_BIN(worker->pipeline), "mux");
+    if (!worker->appsrc || !worker->appsink
+        || gst_element_set_state(worker->pipeline, GST_STATE_PLAYING)
+            == GST_STATE_CHANGE_FAILURE) {
+        log_error("Error starting encode pipeline");
+        destroyPipeline(worker);
+        return 1;
+    }
+
+    worker->pipelineDesc = desc;
+    return 0;
+}
+
+void ImageEncoderPool::destroyPipeline(Worker *worker)
+{
+    if (!worker->pipeline)
+        return;
+
+    gst_element_set_state(worker->pipeline, GST_STATE_NULL);
+    if (worker->appsrc)
+        gst_object_unref(worker->appsrc);
+    if (worker->appsink)
+        gst_object_unref(worker->appsink);
+    if (worker->tagger)
+        gst_object_unref(worker->tagger);
+    gst_object_unref(worker->pipeline);
+    worker->pipeline = nullptr;
+    worker->appsrc = nullptr;
+    worker->appsink = nullptr;
+    worker->tagger = nullptr;
+    worker->pipelineDesc.clear();
+}
+
+int ImageEncoderPool::writeImage(GstSample *image, const std::string &filepath)
+{
+    GstBuffer *buffer = gst_sample_get_buffer(image);
+    GstMapInfo map;
+    if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        log_error("Invalid image");
+        return 1;
+    }
+
+    int ret = 0;
+    FILE *file = fopen(filepath.c_str(), "wb");
+    if (!file || fwrite(map.data, 1, map.size, file) != map.size) {
+        log_error("Error writing image %s", filepath.c_str());
+        ret = 1;
+    }
+    if (file && fclose(file)) {
+        log_error("Error writing image %s", filepath.c_str());
+        ret = 1;
+    }
+
+    gst_buffer_unmap(buffer, &map);
+    return ret;
+}
@@ -0,0 +1,114 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RawImageWriter.h"
+#include "util.h"
+
+/**
+ *  The ImageEncoderPool class encodes still images and writes them to files on worker threads,
+ *  so the capture of the next image does not wait for the encoder or the disk.
+ *
+ *  Raw frames are queued in a bounded queue. Each worker owns an encode pipeline
+ *  (appsrc ! videoscale ! capsfilter ! videoconvert ! encoder ! appsink), built on its first
+ *  image and kept while the encoder and the image size stay the same. JPEG images go through
+ *  jifmux, which writes the tags of each image as EXIF and XMP. Raw images skip the pipeline and
+ *  are written as they come by the RawImageWriter of the worker, with their tags in the header.
+ */
+class ImageEncoderPool {
+public:
+    /**
+     *  @param[in] workers Number of worker threads, 0 for one per core up to a maximum.
+     *  @param[in] depth Number of images queued before push() waits, 0 for twice the workers.
+     */
+    ImageEncoderPool(unsigned int workers = 0, unsigned int depth = 0);
+    ~ImageEncoderPool();
+
+    /**
+     *  Queue a raw frame to encode and write to a file, wait while the queue is full.
+     *
+     *  @param[in] sample Raw frame with its caps, the pool takes the reference.
+     *  @param[in] tags Tags of the image, like its location, nullptr for none. The pool takes the
+     *                  reference.
+     *  @param[in] encoder Name of the gstreamer element encoding the image, empty to write the
+     *                     raw frame.
+     *  @param[in] width Width of the image, 0 to keep the frame size. Ignored for raw frames.
+     *  @param[in] height Height of the image, 0 to keep the frame size. Ignored for raw frames.
+     *  @param[in] filepath File the image is written to.
+     *  @param[in] done Called from a worker thread with 0 once the file is written, 1 on error,
+     *                  and the time the image was encoded, on the clock of now_usec().
+     *
+     *  @return 0 on success, -1 if the pool is stopping.
+     */
+    int push(GstSample *sample, GstTagList *tags, const std::string &encoder, uint32_t width,
+             uint32_t height, const std::string &filepath,
+             std::function<void(int result, usec_t encodedUs)> done);
+
+    /**
+     *  Wait until all the queued images are written.
+     */
+    void flush();
+
+    unsigned int getWorkerCount() const;
+    /* Images queued or being encoded */
+    unsigned int getPendingCount();
+
+private:
+    struct Job {
+        GstSample *sample;
+        GstTagList *tags;
+        std::string encoder;
+        uint32_t width;
+        uint32_t height;
+        std::string filepath;
+        std::function<void(int result, usec_t encodedUs)> done;
+    };
+    struct Worker {
+        std::thread thread;
+        std::string pipelineDesc; /* Encoder and size the pipeline was built for */
+        GstElement *pipeline;
+        GstElement *appsrc;
+        GstElement *appsink;
+        GstElement *tagger; /* Muxer writing the tags, if the encoder has one */
+        RawImageWriter raw;
+    };
+
+    void workerThread(Worker *worker);
+    int encode(Worker *worker, Job &job, GstSample **image);
+    int createPipeline(Worker *worker, const std::string &desc);
+    void destroyPipeline(Worker *worker);
+    static int writeImage(GstSample *image, const std::string &filepath);
+
+    unsigned int mDepth;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::mutex mLock;
+    std::condition_variable mJobReady; /* Job queued or stopping */
+    std::condition_variable mJobTaken; /* Room in the queue or job done */
+    std::deque<Job> mJobs;
+    unsigned int mBusy; /* Jobs taken by the workers and not done */
+    bool mStop;
+};
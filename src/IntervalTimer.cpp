@@ -0,0 +1,140 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+
+#include "IntervalTimer.h"
+#include "log.h"
+#include "util.h"
+
+/* Longest sleep before checking for cancel, long periods are slept in slices */
+#define CANCEL_CHECK_US 50000
+
+static uint64_t toUs(const struct timespec &ts)
+{
+    return (uint64_t)ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / NSEC_PER_USEC;
+}
+
+static void addUs(struct timespec &ts, uint64_t us)
+{
+    ts.tv_sec += us / USEC_PER_SEC;
+    ts.tv_nsec += (us % USEC_PER_SEC) * NSEC_PER_USEC;
+    if (ts.tv_nsec >= (long)NSEC_PER_SEC) {
+        ts.tv_sec++;
+        ts.tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+static bool isBefore(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+IntervalTimer::IntervalTimer()
+    : mPeriodUs(0)
+    , mDeadline{}
+    , mCancelled(false)
+    , mTickCnt(0)
+    , mOverrunCnt(0)
+    , mMaxLatenessUs(0)
+{
+}
+
+int IntervalTimer::start(uint64_t periodUs)
+{
+    if (!periodUs)
+        return -1;
+
+    mPeriodUs = periodUs;
+    mTickCnt = 0;
+    mOverrunCnt = 0;
+    mMaxLatenessUs = 0;
+    mCancelled = false;
+    clock_gettime(CLOCK_MONOTONIC, &mDeadline);
+
+    return 0;
+}
+
+int IntervalTimer::wait()
+{
+    struct timespec now;
+
+    if (!mPeriodUs)
+        return -1;
+
+    /* Next tick on the grid, skipping the ones already past */
+    addUs(mDeadline, mPeriodUs);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int missed = 0;
+    if (isBefore(mDeadline, now)) {
+        uint64_t late = toUs(now) - toUs(mDeadline);
+        missed = late / mPeriodUs + 1;
+        addUs(mDeadline, missed * mPeriodUs);
+        mOverrunCnt += missed;
+        log_debug("Interval of %llu us overrun, %d tick(s) skipped",
+                  (unsigned long long)mPeriodUs, missed);
+    }
+
+    while (!mCancelled && isBefore(now, mDeadline)) {
+        struct timespec slice = now;
+        addUs(slice, CANCEL_CHECK_US);
+        if (isBefore(mDeadline, slice))
+            slice = mDeadline;
+
+        int ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slice, NULL);
+        if (ret && ret != EINTR) {
+            log_error("clock_nanosleep failed: %d", ret);
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+
+    if (mCancelled)
+        return -1;
+
+    uint64_t lateness = toUs(now) - toUs(mDeadline);
+    if (lateness > mMaxLatenessUs)
+        mMaxLatenessUs = lateness;
+    mTickCnt++;
+
+    return missed;
+}
+
+void IntervalTimer::cancel()
+{
+    mCancelled = true;
+}
+
+uint64_t IntervalTimer::getPeriodUs() const
+{
+    return mPeriodUs;
+}
+
+uint64_t IntervalTimer::getTickCount() const
+{
+    return mTickCnt;
+}
+
+uint64_t IntervalTimer::getOverrunCount() const
+{
+    return mOverrunCnt;
+}
+
+uint64_t IntervalTimer::getMaxLatenessUs() const
+{
+    return mMaxLatenessUs;
+}
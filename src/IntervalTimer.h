@@ -0,0 +1,70 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ *  The IntervalTimer class paces a periodic task on absolute deadlines of CLOCK_MONOTONIC.
+ *  Tick n is due at start + n * period whatever the time taken by the task, so the period does
+ *  not drift. A task running longer than the period overruns: the ticks missed are skipped and
+ *  counted, the next tick stays on the grid.
+ *
+ *  wait() is called from one thread, cancel() from any thread.
+ */
+class IntervalTimer {
+public:
+    IntervalTimer();
+
+    /**
+     *  Start the timer, the first tick is due now.
+     *
+     *  @param[in] periodUs Period in microseconds.
+     *
+     *  @return 0 on success, -1 if the period is 0.
+     */
+    int start(uint64_t periodUs);
+
+    /**
+     *  Sleep until the next tick.
+     *
+     *  @return Number of ticks missed since the previous tick, -1 if the timer was cancelled.
+     */
+    int wait();
+
+    /**
+     *  Wake up wait() and make it return -1, until next start().
+     */
+    void cancel();
+
+    uint64_t getPeriodUs() const;
+    uint64_t getTickCount() const;
+    /* Ticks skipped because the task overran the period */
+    uint64_t getOverrunCount() const;
+    /* Worst delay between a deadline and the wake up */
+    uint64_t getMaxLatenessUs() const;
+
+private:
+    uint64_t mPeriodUs;
+    struct timespec mDeadline;
+    std::atomic<bool> mCancelled;
+    std::atomic<uint64_t> mTickCnt;
+    std::atomic<uint64_t> mOverrunCnt;
+    std::atomic<uint64_t> mMaxLatenessUs;
+};
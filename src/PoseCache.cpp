@@ -0,0 +1,181 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "PoseCache.h"
+
+/* Pose older than this at the time looked up is unknown */
+#define MAX_EXTRAPOLATION_US (1 * USEC_PER_SEC)
+/* Offset between the clocks is measured again over this period, to follow their drift */
+#define OFFSET_WINDOW_US (10 * USEC_PER_SEC)
+/* Change of offset taken as a reboot of the vehicle */
+#define CLOCK_JUMP_US (1 * USEC_PER_SEC)
+#define EARTH_RADIUS_M 6371000.0
+#define DEG_E7_PER_RAD (1E7 * 180.0 / M_PI)
+
+PoseCache &PoseCache::getInstance()
+{
+    static PoseCache cache;
+    return cache;
+}
+
+PoseCache::PoseCache()
+    : mHasOffset(false)
+    , mOffsetUs(0)
+    , mNextOffsetUs(0)
+    , mWindowStartUs(0)
+{
+}
+
+usec_t PoseCache::toLocalTime(uint32_t timeBootMs, usec_t recvUs)
+{
+    int64_t vehicleUs = (int64_t)timeBootMs * USEC_PER_MSEC;
+    int64_t offset = (int64_t)recvUs - vehicleUs;
+
+    if (!mHasOffset || offset < mOffsetUs - (int64_t)CLOCK_JUMP_US
+        || offset > mOffsetUs + (int64_t)CLOCK_JUMP_US) {
+        mHasOffset = true;
+        mOffsetUs = mNextOffsetUs = offset;
+        mWindowStartUs = recvUs;
+    } else {
+        /* Sample delayed the least by the link is the closest to the real offset */
+        mOffsetUs = std::min(mOffsetUs, offset);
+        mNextOffsetUs = std::min(mNextOffsetUs, offset);
+        if (recvUs - mWindowStartUs >= OFFSET_WINDOW_US) {
+            mOffsetUs = mNextOffsetUs;
+            mNextOffsetUs = offset;
+            mWindowStartUs = recvUs;
+        }
+    }
+
+    return vehicleUs + mOffsetUs;
+}
+
+void PoseCache::pushPosition(uint32_t timeBootMs, const Position &position, usec_t recvUs)
+{
+    mPositions.push(toLocalTime(timeBootMs, recvUs), position);
+}
+
+void PoseCache::pushAttitude(uint32_t timeBootMs, const float q[4], usec_t recvUs)
+{
+    Attitude attitude;
+    memcpy(attitude.q, q, sizeof(attitude.q));
+    mAttitudes.push(toLocalTime(timeBootMs, recvUs), attitude);
+}
+
+bool PoseCache::get(usec_t timeUs, Pose &pose) const
+{
+    pose = {};
+    pose.hasPosition = getPosition(timeUs, pose.position);
+    pose.hasAttitude = getAttitude(timeUs, pose.q);
+
+    return pose.hasPosition || pose.hasAttitude;
+}
+
+bool PoseCache::getPosition(usec_t timeUs, Position &position) const
+{
+    Ring<Position>::Entry before = {}, after = {};
+    bool hasBefore, hasAfter;
+    mPositions.find(timeUs, before, hasBefore, after, hasAfter);
+
+    if (hasBefore && hasAfter) {
+        double f = (double)(timeUs - before.timeUs) / (after.timeUs - before.timeUs);
+        const Position &a = before.value;
+        const Position &b = after.value;
+        position = a;
+        position.lat = lround(a.lat + f * ((int64_t)b.lat - a.lat));
+        position.lon = lround(a.lon + f * ((int64_t)b.lon - a.lon));
+        position.alt = lround(a.alt + f * ((int64_t)b.alt - a.alt));
+        position.relativeAlt = lround(a.relativeAlt + f * ((int64_t)b.relativeAlt - a.relativeAlt));
+        return true;
+    }
+
+    if (hasBefore && timeUs - before.timeUs <= MAX_EXTRAPOLATION_US) {
+        /* Image taken after the last position received, moved on with the speed */
+        double dt = (double)(timeUs - before.timeUs) / USEC_PER_SEC;
+        const Position &a = before.value;
+        double north = a.vx / 100.0 * dt;
+        double east = a.vy / 100.0 * dt;
+        double lat = a.lat / DEG_E7_PER_RAD;
+        position = a;
+        position.lat = lround(a.lat + north / EARTH_RADIUS_M * DEG_E7_PER_RAD);
+        position.lon = lround(a.lon + east / (EARTH_RADIUS_M * cos(lat)) * DEG_E7_PER_RAD);
+        position.alt = lround(a.alt - a.vz * 10.0 * dt);
+        position.relativeAlt = lround(a.relativeAlt - a.vz * 10.0 * dt);
+        return true;
+    }
+
+    if (hasAfter && after.timeUs - timeUs <= MAX_EXTRAPOLATION_US) {
+        position = after.value;
+        return true;
+    }
+
+    return false;
+}
+
+bool PoseCache::getAttitude(usec_t timeUs, float q[4]) const
+{
+    Ring<Attitude>::Entry before = {}, after = {};
+    bool hasBefore, hasAfter;
+    mAttitudes.find(timeUs, before, hasBefore, after, hasAfter);
+
+    if (hasBefore && hasAfter) {
+        double f = (double)(timeUs - before.timeUs) / (after.timeUs - before.timeUs);
+        const float *a = before.value.q;
+        float b[4];
+        memcpy(b, after.value.q, sizeof(b));
+
+        /* Shortest path between the two rotations */
+        double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+        if (dot < 0) {
+            for (int i = 0; i < 4; i++)
+                b[i] = -b[i];
+            dot = -dot;
+        }
+
+        double wa = 1 - f, wb = f;
+        if (dot < 0.9995) {
+            double theta = acos(dot);
+            wa = sin((1 - f) * theta) / sin(theta);
+            wb = sin(f * theta) / sin(theta);
+        }
+
+        double norm = 0;
+        for (int i = 0; i < 4; i++) {
+            q[i] = wa * a[i] + wb * b[i];
+            norm += (double)q[i] * q[i];
+        }
+        norm = sqrt(norm);
+        for (int i = 0; norm > 0 && i < 4; i++)
+            q[i] /= norm;
+        return true;
+    }
+
+    if (hasBefore && timeUs - before.timeUs <= MAX_EXTRAPOLATION_US) {
+        memcpy(q, before.value.q, sizeof(before.value.q));
+        return true;
+    }
+
+    if (hasAfter && after.timeUs - timeUs <= MAX_EXTRAPOLATION_US) {
+        memcpy(q, after.value.q, sizeof(after.value.q));
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+
+#include "util.h"
+
+/**
+ *  The PoseCache class keeps the last positions and attitudes of the vehicle, received from
+ *  GLOBAL_POSITION_INT and ATTITUDE_QUATERNION, to geotag the images with the pose of the
+ *  vehicle at the time they were taken.
+ *
+ *  Samples are written by the mavlink thread and read by the capture threads without lock, in
+ *  fixed size rings. A lookup reads a bounded number of samples and never waits for the writer.
+ *  Times are on the monotonic clock of now_usec(): the time of boot of the vehicle in the
+ *  messages is mapped to it with the smallest offset seen, so the delay of the link does not
+ *  shift the samples.
+ */
+class PoseCache {
+public:
+    /* Samples kept of each kind, 5 s at 50 Hz */
+    static const unsigned int SAMPLES = 256;
+
+    struct Position {
+        int32_t lat;         /* Latitude in degrees * 1E7 */
+        int32_t lon;         /* Longitude in degrees * 1E7 */
+        int32_t alt;         /* Altitude above MSL in mm */
+        int32_t relativeAlt; /* Altitude above ground in mm */
+        int16_t vx;          /* Speed north in cm/s */
+        int16_t vy;          /* Speed east in cm/s */
+        int16_t vz;          /* Speed down in cm/s */
+    };
+
+    struct Pose {
+        bool hasPosition;
+        bool hasAttitude;
+        Position position;
+        float q[4]; /* Attitude, w x y z */
+    };
+
+    /* Cache of the vehicle, filled by the mavlink server */
+    static PoseCache &getInstance();
+
+    PoseCache();
+
+    /**
+     *  Add a position of the vehicle, from the mavlink thread only.
+     *
+     *  @param[in] timeBootMs Time of the sample, since boot of the vehicle.
+     *  @param[in] position Position of the vehicle.
+     *  @param[in] recvUs Time the sample was received.
+     */
+    void pushPosition(uint32_t timeBootMs, const Position &position, usec_t recvUs = now_usec());
+
+    /**
+     *  Add an attitude of the vehicle, from the mavlink thread only.
+     *
+     *  @param[in] timeBootMs Time of the sample, since boot of the vehicle.
+     *  @param[in] q Attitude quaternion, w x y z.
+     *  @param[in] recvUs Time the sample was received.
+     */
+    void pushAttitude(uint32_t timeBootMs, const float q[4], usec_t recvUs = now_usec());
+
+    /**
+     *  Get the pose of the vehicle at a time, interpolated between the samples around it. After
+     *  the last sample, the position is moved on with the speed of the vehicle for a short time.
+     *
+     *  @param[in] timeUs Time on the clock of now_usec().
+     *  @param[out] pose Pose of the vehicle, with the parts known.
+     *
+     *  @return true if the position or the attitude is known.
+     */
+    bool get(usec_t timeUs, Pose &pose) const;
+
+private:
+    /* Ring of samples, one writer and any number of readers, each slot under a sequence lock */
+    template <typename T> class Ring {
+    public:
+        struct Entry {
+            uint64_t index;
+            usec_t timeUs;
+            T value;
+        };
+
+        Ring()
+            : mHead(0)
+        {
+            for (Slot &slot : mSlots) {
+                slot.seq = 0;
+                for (std::atomic<uint64_t> &word : slot.words)
+                    word = 0;
+            }
+        }
+
+        void push(usec_t timeUs, const T &value)
+        {
+            uint64_t index = mHead.load(std::memory_order_relaxed);
+            Slot &slot = mSlots[index % SAMPLES];
+
+            Entry entry = {index, timeUs, value};
+            uint64_t words[WORDS] = {};
+            memcpy(words, &entry, sizeof(entry));
+
+            uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+            slot.seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (unsigned int i = 0; i < WORDS; i++)
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+            slot.seq.store(seq + 2, std::memory_order_release);
+
+            mHead.store(index + 1, std::memory_order_release);
+        }
+
+        /* Entry of an index, false if it is being written or was written over */
+        bool read(uint64_t index, Entry &entry) const
+        {
+            const Slot &slot = mSlots[index % SAMPLES];
+            uint64_t words[WORDS];
+
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq & 1)
+                return false;
+            for (unsigned int i = 0; i < WORDS; i++)
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != seq)
+                return false;
+
+            memcpy(&entry, words, sizeof(entry));
+            return entry.index == index;
+        }
+
+        /*
+         * Entries around a time: before is the last one at or before it, after the first one
+         * past it. Either one is missing if the time is out of the ring.
+         */
+        void find(usec_t timeUs, Entry &before, bool &hasBefore, Entry &after,
+                  bool &hasAfter) const
+        {
+            hasBefore = hasAfter = false;
+
+            uint64_t head = mHead.load(std::memory_order_acquire);
+            /* Oldest slot may be written over during the search */
+            uint64_t lo = head > SAMPLES ? head - SAMPLES + 1 : 0;
+            uint64_t hi = head;
+
+            /* First entry past the time, entries lost to the writer count as older */
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                Entry entry;
+                if (!read(mid, entry) || entry.timeUs <= timeUs)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            if (lo < head && read(lo, after))
+                hasAfter = true;
+            if (lo > 0 && read(lo - 1, before) && before.timeUs <= timeUs)
+                hasBefore = true;
+        }
+
+    private:
+        static const unsigned int WORDS = (sizeof(Entry) + 7) / 8;
+
+        struct Slot {
+            std::atomic<uint32_t> seq;
+            std::atomic<uint64_t> words[WORDS];
+        };
+
+        Slot mSlots[SAMPLES];
+        std::atomic<uint64_t> mHead; /* Entries written */
+    };
+
+    struct Attitude {
+        float q[4];
+    };
+
+    usec_t toLocalTime(uint32_t timeBootMs, usec_t recvUs);
+    bool getPosition(usec_t timeUs, Position &position) const;
+    bool getAttitude(usec_t timeUs, float q[4]) const;
+
+    Ring<Position> mPositions;
+    Ring<Attitude> mAttitudes;
+    /* Clock of the vehicle to local clock, written by the mavlink thread only */
+    bool mHasOffset;
+    int64_t mOffsetUs;     /* Offset in use */
+    int64_t mNextOffsetUs; /* Smallest offset of the current window */
+    usec_t mWindowStartUs;
+};
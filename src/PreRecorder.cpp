@@ -0,0 +1,351 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gst/app/gstappsrc.h>
+#include <sstream>
+
+#include "EncoderRegistry.h"
+#include "FrameBufferGst.h"
+#include "PreRecorder.h"
+#include "log.h"
+#include "pixel_convert.h"
+#include "util.h"
+
+#define FRAME_TIMEOUT_MS 1000
+/* Always running, the camera keeps most of its buffers for the other consumers */
+#define HUB_QUEUE_FRAMES 2
+#define APPSRC_QUEUE_FRAMES 2
+#define APPSRC_MIN_PERCENT 50
+
+static const char *getGstPixFormat(CameraParameters::PixelFormat pixFormat)
+{
+    switch (pixFormat) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return "RGB";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return "UYVY";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return "YUY2";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return "GRAY8";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return "NV12";
+    default:
+        return "I420";
+    }
+}
+
+static void cbNeedData(GstAppSrc *appsrc, guint length, gpointer user_data)
+{
+    *static_cast<std::atomic<bool> *>(user_data) = false;
+}
+
+static void cbEnoughData(GstAppSrc *appsrc, gpointer user_data)
+{
+    *static_cast<std::atomic<bool> *>(user_data) = true;
+}
+
+PreRecorder::PreRecorder(std::shared_ptr<FrameHub> frameHub, uint32_t seconds, size_t memory,
+                         std::shared_ptr<VideoSettings> vidSetting)
+    : mFrameHub(frameHub)
+    , mVidSetting(vidSetting)
+    , mMemory(memory)
+    , mRing((GstClockTime)seconds * GST_SECOND, memory)
+    , mPipeline(nullptr)
+    , mAppsrc(nullptr)
+    , mCaps(nullptr)
+    , mRunning(false)
+    , mEnough(false)
+    , mFrameCnt(0)
+    , mDropCnt(0)
+{
+}
+
+PreRecorder::~PreRecorder()
+{
+    stop();
+}
+
+int PreRecorder::start()
+{
+    if (mRunning)
+        return 0;
+
+    /* Feed thread ended on an error of the pipeline or with the camera */
+    if (mThread.joinable())
+        stop();
+
+    if (!mFrameHub)
+        return -1;
+
+    mConsumer = mFrameHub->subscribe("prerecord", HUB_QUEUE_FRAMES);
+    if (!mConsumer) {
+        log_error("Pre-record not supported by camera device");
+        return -1;
+    }
+
+    if (createPipeline()) {
+        mFrameHub->unsubscribe(mConsumer);
+        mConsumer.reset();
+        return -1;
+    }
+
+    mFrameCnt = 0;
+    mDropCnt = 0;
+    mEnough = false;
+    mRunning = true;
+    mThread = std::thread(&PreRecorder::feedThread, this);
+
+    return 0;
+}
+
+void PreRecorder::stop()
+{
+    if (mThread.joinable()) {
+        mRunning = false;
+        mFrameHub->unsubscribe(mConsumer);
+        mThread.join();
+        mConsumer.reset();
+        log_info("Pre-record stopped, %llu frames encoded, %llu dropped by the encoder, %llu "
+                 "buffers dropped by the ring",
+                 (unsigned long long)mFrameCnt, (unsigned long long)mDropCnt,
+                 (unsigned long long)mRing.getDropCount());
+    }
+    mRunning = false;
+
+    destroyPipeline();
+    mRing.clear();
+
+    std::lock_guard<std::mutex> locker(mCapsLock);
+    gst_caps_replace(&mCaps, nullptr);
+}
+
+bool PreRecorder::isRunning() const
+{
+    return mRunning;
+}
+
+GstCaps *PreRecorder::getCaps()
+{
+    std::lock_guard<std::mutex> locker(mCapsLock);
+
+    return mCaps ? gst_caps_ref(mCaps) : nullptr;
+}
+
+GstClockTime PreRecorder::attach(GopRing::Reader reader)
+{
+    return mRing.attach(reader);
+}
+
+void PreRecorder::detach()
+{
+    mRing.detach();
+}
+
+size_t PreRecorder::getMemory() const
+{
+    return mMemory;
+}
+
+GstFlowReturn PreRecorder::onSample(GstAppSink *appsink, gpointer user_data)
+{
+    PreRecorder *preRecorder = static_cast<PreRecorder *>(user_data);
+
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (!sample)
+        return GST_FLOW_OK;
+
+    {
+        std::lock_guard<std::mutex> locker(preRecorder->mCapsLock);
+        GstCaps *caps = gst_sample_get_caps(sample);
+        if (caps)
+            gst_caps_replace(&preRecorder->mCaps, caps);
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (buffer)
+        preRecorder->mRing.push(gst_buffer_ref(buffer));
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+std::string PreRecorder::getPipelineName(std::shared_ptr<CameraDevice> camDev)
+{
+    int width = mVidSetting ? mVidSetting->width : 0;
+    int height = mVidSetting ? mVidSetting->height : 0;
+    int bitRate = mVidSetting ? mVidSetting->bitRate : 0;
+    int frameRate = mVidSetting ? mVidSetting->frameRate : 0;
+
+    std::string encoder
+        = EncoderRegistry::getEncoder(CameraParameters::VIDEO_CODING_AVC, bitRate, frameRate);
+    if (encoder.empty())
+        return {};
+
+    uint32_t camWidth = 0, camHeight = 0;
+    camDev->getSize(camWidth, camHeight);
+
+    std::stringstream scale;
+    std::stringstream ss;
+
+    if (width > 0 && height > 0 && ((uint32_t)width != camWidth || (uint32_t)height != camHeight))
+        scale << " ! videoscale ! video/x-raw, width=" << std::to_string(width)
+              << ", height=" << std::to_string(height);
+
+    /* Parameter sets go with every key frame, the ring can be written from any of them */
+    ss << "appsrc name=src ! videoconvert" << scale.str() << " ! " << encoder
+       << " ! h264parse config-interval=-1 ! video/x-h264, stream-format=byte-stream, "
+          "alignment=au ! appsink name=sink sync=false";
+
+    return ss.str();
+}
+
+int PreRecorder::createPipeline()
+{
+    std::shared_ptr<CameraDevice> camDev = mFrameHub->getCameraDevice();
+    GError *error = nullptr;
+    GstElement *appsink = nullptr;
+    GstAppSrcCallbacks srcCbs = {};
+    GstAppSinkCallbacks sinkCbs = {};
+    GstCaps *caps;
+
+    uint32_t width = 0, height = 0, fps = 0;
+    CameraParameters::PixelFormat format;
+    if (camDev->getSize(width, height) != CameraDevice::Status::SUCCESS || !width || !height
+        || camDev->getPixelFormat(format) != CameraDevice::Status::SUCCESS) {
+        log_error("Camera frame size or format unknown");
+        return -1;
+    }
+    if (camDev->getFrameRate(fps) != CameraDevice::Status::SUCCESS)
+        fps = 0;
+
+    std::string desc = getPipelineName(camDev);
+    if (desc.empty()) {
+        log_error("Pipeline String error");
+        return -1;
+    }
+    log_debug("Pre-record pipeline = %s", desc.c_str());
+
+    mPipeline = gst_parse_launch(desc.c_str(), &error);
+    if (error) {
+        log_error("Error creating pre-record pipeline: %s", error->message);
+        g_clear_error(&error);
+    }
+    if (!mPipeline)
+        return -1;
+
+    mAppsrc = gst_bin_get_by_name(GST_BIN(mPipeline), "src");
+    appsink = gst_bin_get_by_name(GST_BIN(mPipeline), "sink");
+    if (!mAppsrc || !appsink) {
+        log_error("Error creating pre-record appsrc or appsink");
+        goto fail;
+    }
+
+    caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, getGstPixFormat(format),
+                               "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+                               "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    gst_app_src_set_caps(GST_APP_SRC(mAppsrc), caps);
+    gst_caps_unref(caps);
+
+    g_object_set(G_OBJECT(mAppsrc), "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp",
+                 FALSE, "block", FALSE, "max-bytes",
+                 (guint64)pixel_get_frame_size(format, width, height) * APPSRC_QUEUE_FRAMES,
+                 "min-percent", APPSRC_MIN_PERCENT, NULL);
+    srcCbs.need_data = cbNeedData;
+    srcCbs.enough_data = cbEnoughData;
+    gst_app_src_set_callbacks(GST_APP_SRC(mAppsrc), &srcCbs, &mEnough, nullptr);
+
+    sinkCbs.new_sample = onSample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &sinkCbs, this, nullptr);
+    gst_object_unref(appsink);
+    appsink = nullptr;
+
+    if (gst_element_set_state(mPipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        log_error("Error starting pre-record pipeline");
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if (appsink)
+        gst_object_unref(appsink);
+    destroyPipeline();
+    return -1;
+}
+
+void PreRecorder::destroyPipeline()
+{
+    if (!mPipeline)
+        return;
+
+    /* Streaming thread is stopped, no more samples for the ring */
+    gst_element_set_state(mPipeline, GST_STATE_NULL);
+    if (mAppsrc)
+        gst_object_unref(mAppsrc);
+    gst_object_unref(mPipeline);
+    mAppsrc = nullptr;
+    mPipeline = nullptr;
+}
+
+void PreRecorder::feedThread()
+{
+    usec_t firstUs = 0;
+    GstClockTime lastPts = GST_CLOCK_TIME_NONE;
+
+    while (mRunning) {
+        CameraData data;
+        if (!mConsumer->pop(data, FRAME_TIMEOUT_MS)) {
+            /* Camera stopped under the pre-recorder */
+            if (mConsumer->isClosed())
+                break;
+            continue;
+        }
+        if (!data.buf || !data.bufSize)
+            continue;
+
+        usec_t frameUs = data.sec || data.nsec
+            ? (usec_t)data.sec * USEC_PER_SEC + data.nsec / 1000
+            : now_usec();
+        if (!GST_CLOCK_TIME_IS_VALID(lastPts))
+            firstUs = frameUs;
+
+        if (mEnough) {
+            mDropCnt++;
+            continue;
+        }
+
+        GstBuffer *buffer = wrapCameraData(data);
+        if (!buffer)
+            continue;
+
+        GstClockTime pts = frameUs > firstUs ? (frameUs - firstUs) * GST_USECOND : 0;
+        if (GST_CLOCK_TIME_IS_VALID(lastPts) && pts <= lastPts)
+            pts = lastPts + 1;
+        GST_BUFFER_PTS(buffer) = pts;
+        lastPts = pts;
+
+        GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(mAppsrc), buffer);
+        if (ret != GST_FLOW_OK) {
+            log_error("Error in sending data to pre-record pipeline: %s", gst_flow_get_name(ret));
+            break;
+        }
+        mFrameCnt++;
+    }
+
+    mRunning = false;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <gst/app/gstappsink.h>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "FrameHub.h"
+#include "GopRing.h"
+#include "VideoCapture.h"
+
+/**
+ *  The PreRecorder class encodes the frames of a camera all the time, and keeps the last seconds
+ *  of H.264 in a GopRing: a recording started by a command also holds the video taken before it.
+ *
+ *  Frames are read from the frame hub, the camera device must support frame sharing. The
+ *  encoder is the one of the EncoderRegistry, at the settings of the video capture. The camera
+ *  component starts it in video mode.
+ */
+class PreRecorder {
+public:
+    /**
+     *  @param[in] frameHub Frame hub of the camera.
+     *  @param[in] seconds Duration of the video kept before a recording.
+     *  @param[in] memory Maximum memory used by the encoded video in bytes.
+     *  @param[in] vidSetting Settings of the video capture, nullptr for the size of the camera.
+     */
+    PreRecorder(std::shared_ptr<FrameHub> frameHub, uint32_t seconds, size_t memory,
+                std::shared_ptr<VideoSettings> vidSetting = nullptr);
+    ~PreRecorder();
+
+    /**
+     *  Start encoding the frames of the camera.
+     *
+     *  @return 0 on success, -1 if the camera device does not support frame sharing or the
+     *          encoder can not be started.
+     */
+    int start();
+
+    /**
+     *  Stop encoding and release the video kept.
+     */
+    void stop();
+
+    bool isRunning() const;
+
+    /**
+     *  Get the caps of the encoded video, for the appsrc of a recording.
+     *
+     *  @return Caps with a reference to release, nullptr if nothing was encoded yet.
+     */
+    GstCaps *getCaps();
+
+    /**
+     *  Give the video kept to a recording, then the video encoded until detach(). See
+     *  GopRing::attach().
+     *
+     *  @param[in] reader Reader of the buffers of the recording.
+     *
+     *  @return Duration of the video kept, given first, in nanoseconds.
+     */
+    GstClockTime attach(GopRing::Reader reader);
+
+    /**
+     *  Stop giving the video encoded to the recording.
+     */
+    void detach();
+
+    /* Memory budget of the video kept */
+    size_t getMemory() const;
+
+private:
+    static GstFlowReturn onSample(GstAppSink *appsink, gpointer user_data);
+    std::string getPipelineName(std::shared_ptr<CameraDevice> camDev);
+    int createPipeline();
+    void destroyPipeline();
+    void feedThread();
+    std::shared_ptr<FrameHub> mFrameHub;
+    std::shared_ptr<FrameHub::Consumer> mConsumer;
+    std::shared_ptr<VideoSettings> mVidSetting;
+    size_t mMemory;
+    GopRing mRing;
+    GstElement *mPipeline;
+    GstElement *mAppsrc;
+    GstCaps *mCaps; /* Caps of the last buffer encoded */
+    std::mutex mCapsLock;
+    std::thread mThread; /* Pushes the frames of the hub to appsrc */
+    std::atomic<bool> mRunning;
+    std::atomic<bool> mEnough; /* Queue of appsrc full, frames are dropped until it drains */
+    uint64_t mFrameCnt;        /* Frames pushed to the encoder */
+    uint64_t mDropCnt;         /* Frames dropped on backpressure of the encoder */
+};
@@ -0,0 +1,181 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <gst/video/video.h>
+#include <unistd.h>
+
+#include "RawImageWriter.h"
+#include "StorageMonitor.h"
+#include "log.h"
+#include "util.h"
+
+#define HEADER_EXT ".hdr"
+
+RawImageWriter::RawImageWriter()
+    : mBuffer(nullptr)
+    , mBufferSize(0)
+{
+}
+
+RawImageWriter::~RawImageWriter()
+{
+    free(mBuffer);
+}
+
+std::string RawImageWriter::getHeaderPath(const std::string &filepath)
+{
+    size_t dot = filepath.rfind('.');
+    size_t slash = filepath.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return filepath + HEADER_EXT;
+
+    return filepath.substr(0, dot) + HEADER_EXT;
+}
+
+int RawImageWriter::write(GstSample *sample, const std::string &filepath,
+                          const GstTagList *tags)
+{
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        log_error("Invalid image");
+        return 1;
+    }
+
+    int ret = writeData(filepath, map.data, map.size);
+    if (!ret)
+        ret = writeHeader(filepath, gst_sample_get_caps(sample), buffer, map.size, tags);
+
+    gst_buffer_unmap(buffer, &map);
+    return ret;
+}
+
+int RawImageWriter::writeData(const std::string &filepath, const uint8_t *data, size_t size)
+{
+    /* O_DIRECT needs the buffer, the offset and the length aligned */
+    size_t align = sysconf(_SC_PAGESIZE);
+    size_t len = (size + align - 1) / align * align;
+    if (len > mBufferSize) {
+        void *buf;
+        if (posix_memalign(&buf, align, len)) {
+            log_error("Unable to allocate %zu bytes for raw image", len);
+            return 1;
+        }
+        free(mBuffer);
+        mBuffer = static_cast<uint8_t *>(buf);
+        mBufferSize = len;
+    }
+    memcpy(mBuffer, data, size);
+    memset(mBuffer + size, 0, len - size);
+
+    usec_t startUs = now_usec();
+    bool direct = true;
+    int fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EINVAL) {
+        /* File system without direct I/O, like tmpfs */
+        direct = false;
+        fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        log_error("Unable to open %s: %s", filepath.c_str(), strerror(errno));
+        return 1;
+    }
+
+    /* Whole frame in one request, the padding is cut once it is on disk */
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = ::write(fd, mBuffer + written, len - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            log_error("Error writing raw image %s: %s", filepath.c_str(),
+                      n < 0 ? strerror(errno) : "short write");
+            close(fd);
+            return 1;
+        }
+        written += n;
+    }
+
+    if (ftruncate(fd, size) < 0 || close(fd) < 0) {
+        log_error("Error writing raw image %s: %s", filepath.c_str(), strerror(errno));
+        return 1;
+    }
+
+    /* Without page cache the time taken is the one of the storage */
+    if (direct)
+        StorageMonitor::reportWrite(filepath, len, now_usec() - startUs);
+
+    return 0;
+}
+
+int RawImageWriter::writeHeader(const std::string &filepath, GstCaps *caps, GstBuffer *buffer,
+                                size_t size, const GstTagList *tags)
+{
+    GstVideoInfo info;
+    if (!caps || !gst_video_info_from_caps(&info, caps)) {
+        log_error("Unknown layout of raw image %s", filepath.c_str());
+        return 1;
+    }
+
+    /* Planes padded by the camera driver are described by the meta of the buffer */
+    GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+    if (meta) {
+        for (guint i = 0; i < meta->n_planes; i++) {
+            GST_VIDEO_INFO_PLANE_STRIDE(&info, i) = meta->stride[i];
+            GST_VIDEO_INFO_PLANE_OFFSET(&info, i) = meta->offset[i];
+        }
+    }
+
+    std::string path = getHeaderPath(filepath);
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        log_error("Unable to open %s: %s", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    fprintf(file, "[image]\nformat=%s\nwidth=%d\nheight=%d\nsize=%zu\nplanes=%u\n",
+            GST_VIDEO_INFO_NAME(&info), GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info),
+            size, GST_VIDEO_INFO_N_PLANES(&info));
+    for (guint i = 0; i < GST_VIDEO_INFO_N_PLANES(&info); i++)
+        fprintf(file, "stride%u=%d\noffset%u=%zu\n", i, GST_VIDEO_INFO_PLANE_STRIDE(&info, i), i,
+                GST_VIDEO_INFO_PLANE_OFFSET(&info, i));
+
+    /* First value of each tag, as the encoders keep for the image */
+    if (tags && gst_tag_list_n_tags(tags) > 0) {
+        fprintf(file, "[tags]\n");
+        for (gint i = 0; i < gst_tag_list_n_tags(tags); i++) {
+            const gchar *tag = gst_tag_list_nth_tag_name(tags, i);
+            const GValue *value = gst_tag_list_get_value_index(tags, tag, 0);
+            gchar *str = value ? gst_value_serialize(value) : nullptr;
+            if (str)
+                fprintf(file, "%s=%s\n", tag, str);
+            g_free(str);
+        }
+    }
+
+    if (fclose(file)) {
+        log_error("Error writing %s", path.c_str());
+        return 1;
+    }
+
+    return 0;
+}
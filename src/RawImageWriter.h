@@ -0,0 +1,76 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <gst/gst.h>
+#include <string>
+
+/**
+ *  The RawImageWriter class writes raw frames to files as they come from the camera, without
+ *  encoding, for high rate bursts.
+ *
+ *  Frames are written with O_DIRECT from an aligned buffer, so a burst does not fill the page
+ *  cache and evict the pages of the other files. The layout of the frame is written to a sidecar
+ *  header file next to it, in the key file format of the configuration:
+ *
+ *      [image]
+ *      format=I420
+ *      width=1920
+ *      height=1080
+ *      size=3110400
+ *      planes=3
+ *      stride0=1920
+ *      offset0=0
+ *      ...
+ *      [tags]
+ *      geo-location-latitude=47.397700000000000
+ *      ...
+ *
+ *  A writer is not thread safe, each worker owns one.
+ */
+class RawImageWriter {
+public:
+    RawImageWriter();
+    ~RawImageWriter();
+
+    /**
+     *  Write a raw frame and its header.
+     *
+     *  @param[in] sample Raw frame with its caps.
+     *  @param[in] filepath File the frame is written to, the header gets the extension ".hdr".
+     *  @param[in] tags Tags of the image written to the header, nullptr for none.
+     *
+     *  @return 0 on success, 1 on error.
+     */
+    int write(GstSample *sample, const std::string &filepath, const GstTagList *tags = nullptr);
+
+    /**
+     *  Get the file the header of a frame is written to.
+     *
+     *  @param[in] filepath File of the frame.
+     *
+     *  @return Path of the header file.
+     */
+    static std::string getHeaderPath(const std::string &filepath);
+
+private:
+    int writeData(const std::string &filepath, const uint8_t *data, size_t size);
+    static int writeHeader(const std::string &filepath, GstCaps *caps, GstBuffer *buffer,
+                           size_t size, const GstTagList *tags);
+    uint8_t *mBuffer; /* Aligned for O_DIRECT, kept between frames */
+    size_t mBufferSize;
+};
@@ -0,0 +1,233 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <map>
+#include <sys/statvfs.h>
+#include <thread>
+#include <vector>
+
+#include "IntervalTimer.h"
+#include "StorageMonitor.h"
+#include "log.h"
+#include "util.h"
+
+#define MIB (1024.0 * 1024.0)
+/* Recording time left under which each refresh warns */
+#define LOW_SPACE_WARNING_MS (60 * MSEC_PER_SEC)
+
+static std::mutex monitorsLock;
+static std::map<std::string, std::shared_ptr<StorageMonitor>> monitors;
+static IntervalTimer refreshTimer;
+static std::thread refreshThread;
+
+/* Average of the last values, the previous value weighs three quarters */
+template <typename T> static T average(T prev, T sample)
+{
+    return prev > 0 ? (3 * prev + sample) / 4 : sample;
+}
+
+static std::string toDir(const std::string &path)
+{
+    if (!path.empty() && path.back() == '/')
+        return path;
+
+    return path + '/';
+}
+
+static void refreshLoop()
+{
+    while (refreshTimer.wait() >= 0) {
+        std::vector<std::shared_ptr<StorageMonitor>> list;
+        {
+            std::lock_guard<std::mutex> locker(monitorsLock);
+            for (auto &it : monitors)
+                list.push_back(it.second);
+        }
+
+        /* Slow storage only holds this thread */
+        for (auto &monitor : list)
+            monitor->refresh();
+    }
+}
+
+std::shared_ptr<StorageMonitor> StorageMonitor::get(const std::string &path)
+{
+    std::lock_guard<std::mutex> locker(monitorsLock);
+
+    std::string dir = toDir(path);
+    auto it = monitors.find(dir);
+    if (it != monitors.end())
+        return it->second;
+
+    std::shared_ptr<StorageMonitor> monitor = std::make_shared<StorageMonitor>(dir);
+    monitor->refresh();
+    monitors[dir] = monitor;
+
+    return monitor;
+}
+
+int StorageMonitor::startRefresh(uint32_t periodMs)
+{
+    if (refreshThread.joinable())
+        return 0;
+
+    if (refreshTimer.start((uint64_t)periodMs * USEC_PER_MSEC))
+        return -1;
+    refreshThread = std::thread(refreshLoop);
+
+    return 0;
+}
+
+void StorageMonitor::stopRefresh()
+{
+    if (!refreshThread.joinable())
+        return;
+
+    refreshTimer.cancel();
+    refreshThread.join();
+}
+
+void StorageMonitor::reportWrite(const std::string &filepath, uint64_t bytes,
+                                 uint64_t durationUs)
+{
+    std::shared_ptr<StorageMonitor> monitor;
+    {
+        std::lock_guard<std::mutex> locker(monitorsLock);
+
+        /* Deepest location holding the file */
+        for (auto &it : monitors) {
+            if (!filepath.compare(0, it.first.size(), it.first)
+                && (!monitor || it.first.size() > monitor->getPath().size()))
+                monitor = it.second;
+        }
+    }
+
+    if (monitor)
+        monitor->addWrite(bytes, durationUs);
+}
+
+StorageMonitor::StorageMonitor(const std::string &path)
+    : mPath(toDir(path))
+    , mStatus{}
+    , mRefreshUs(0)
+{
+    mStatus.recordingTimeMs = -1;
+}
+
+StorageMonitor::Status StorageMonitor::getStatus()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mStatus;
+}
+
+int StorageMonitor::refresh()
+{
+    struct statvfs st;
+    int ret = statvfs(mPath.c_str(), &st);
+    int err = errno;
+    usec_t now = now_usec();
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (ret) {
+        if (mStatus.available || !mRefreshUs)
+            log_error("Storage %s not available: %s", mPath.c_str(), strerror(err));
+        mStatus.available = false;
+        mStatus.totalBytes = 0;
+        mStatus.usedBytes = 0;
+        mStatus.availableBytes = 0;
+        mStatus.fillRate = 0;
+        mRefreshUs = now;
+        updateRecordingTime();
+        return -1;
+    }
+
+    uint64_t available = (uint64_t)st.f_bavail * st.f_frsize;
+
+    /* Files deleted in the meantime count as nothing written */
+    if (mStatus.available && mRefreshUs && now > mRefreshUs) {
+        uint64_t shrunk
+            = mStatus.availableBytes > available ? mStatus.availableBytes - available : 0;
+        mStatus.fillRate = average(mStatus.fillRate, shrunk * USEC_PER_SEC / (now - mRefreshUs));
+    }
+
+    if (!mStatus.available)
+        log_info("Storage %s: %llu MiB available of %llu MiB", mPath.c_str(),
+                 (unsigned long long)(available >> 20),
+                 (unsigned long long)(((uint64_t)st.f_blocks * st.f_frsize) >> 20));
+
+    mStatus.available = true;
+    mStatus.totalBytes = (uint64_t)st.f_blocks * st.f_frsize;
+    mStatus.usedBytes = (uint64_t)(st.f_blocks - st.f_bfree) * st.f_frsize;
+    mStatus.availableBytes = available;
+    mRefreshUs = now;
+    updateRecordingTime();
+
+    if (mStatus.recordingTimeMs >= 0 && mStatus.recordingTimeMs < (int64_t)LOW_SPACE_WARNING_MS)
+        log_warning("Storage %s full in %lld s", mPath.c_str(),
+                    (long long)(mStatus.recordingTimeMs / MSEC_PER_SEC));
+
+    return 0;
+}
+
+void StorageMonitor::addRecording(uint32_t bitRate)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mStatus.bitRate += bitRate;
+    updateRecordingTime();
+}
+
+void StorageMonitor::removeRecording(uint32_t bitRate)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    mStatus.bitRate -= std::min(bitRate, mStatus.bitRate);
+    updateRecordingTime();
+}
+
+void StorageMonitor::addWrite(uint64_t bytes, uint64_t durationUs)
+{
+    if (!durationUs)
+        return;
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    float speed = bytes * USEC_PER_SEC / MIB / durationUs;
+    mStatus.writeSpeed = average(mStatus.writeSpeed, speed);
+}
+
+const std::string &StorageMonitor::getPath() const
+{
+    return mPath;
+}
+
+void StorageMonitor::updateRecordingTime()
+{
+    if (!mStatus.bitRate) {
+        mStatus.recordingTimeMs = -1;
+        return;
+    }
+
+    /* Bitrate of the recordings until the free space is seen shrinking */
+    uint64_t rate = std::max<uint64_t>(mStatus.fillRate, (uint64_t)mStatus.bitRate * 1000 / 8);
+    mStatus.recordingTimeMs = mStatus.availableBytes * MSEC_PER_SEC / rate;
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+/**
+ *  The StorageMonitor class follows the file system of a capture location: its capacity, the
+ *  speed the captures are written at and the recording time left.
+ *
+ *  The file system is read with statvfs() by a refresh thread shared by all the locations, the
+ *  values are cached: getStatus() does not touch the file system, it can be called from the
+ *  MAVLink replies. Write speed is measured on the images written without page cache. The
+ *  recording time left is estimated from the rate the free space shrinks at, or from the
+ *  bitrate of the recordings until it is measured.
+ */
+class StorageMonitor {
+public:
+    struct Status {
+        bool available;          /* File system of the location could be read */
+        uint64_t totalBytes;     /* Size of the file system */
+        uint64_t usedBytes;      /* Used by all the files of the file system */
+        uint64_t availableBytes; /* Left to the captures, without the blocks reserved to root */
+        float writeSpeed;        /* Measured in MiB/s, 0 until something is written */
+        uint64_t fillRate;       /* Bytes per second the free space shrinks by */
+        uint32_t bitRate;        /* Sum of the bitrates of the recordings running, kbps */
+        int64_t recordingTimeMs; /* Recording time left at the current rate, -1 if not recording */
+    };
+
+    /**
+     *  Get the monitor of a capture location, created on the first call for the location. The
+     *  file system is read once when the monitor is created.
+     *
+     *  @param[in] path Capture location, a directory.
+     *
+     *  @return Monitor of the location.
+     */
+    static std::shared_ptr<StorageMonitor> get(const std::string &path);
+
+    /**
+     *  Start the thread refreshing the monitors of all the locations.
+     *
+     *  @param[in] periodMs Period of the refresh in milliseconds.
+     *
+     *  @return 0 on success, -1 if the period is 0.
+     */
+    static int startRefresh(uint32_t periodMs);
+
+    /**
+     *  Stop the refresh thread.
+     */
+    static void stopRefresh();
+
+    /**
+     *  Add a write of a capture to the write speed of the location of the file, if it has a
+     *  monitor.
+     *
+     *  @param[in] filepath File written.
+     *  @param[in] bytes Bytes written.
+     *  @param[in] durationUs Time taken by the write, until the data was on the storage.
+     */
+    static void reportWrite(const std::string &filepath, uint64_t bytes, uint64_t durationUs);
+
+    StorageMonitor(const std::string &path);
+
+    /* Values of the last refresh */
+    Status getStatus();
+
+    /**
+     *  Read the file system of the location and update the values.
+     *
+     *  @return 0 on success, -1 if the file system can not be read.
+     */
+    int refresh();
+
+    /**
+     *  Account a recording in the rate the location fills at, until it is measured.
+     *
+     *  @param[in] bitRate Bitrate of the recording in kbps.
+     */
+    void addRecording(uint32_t bitRate);
+
+    /**
+     *  Remove a recording added by addRecording().
+     *
+     *  @param[in] bitRate Bitrate given to addRecording().
+     */
+    void removeRecording(uint32_t bitRate);
+
+    void addWrite(uint64_t bytes, uint64_t durationUs);
+
+    const std::string &getPath() const;
+
+private:
+    void updateRecordingTime();
+    std::string mPath;   /* Ends with '/' */
+    Status mStatus;
+    uint64_t mRefreshUs; /* Time of the last refresh, monotonic */
+    std::mutex mLock;
+};
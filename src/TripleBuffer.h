@@ -0,0 +1,89 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <utility>
+
+/**
+ *  The TripleBuffer class passes the latest value from one writer thread to one reader thread
+ *  without lock. The writer never waits, a value not read before the next write is replaced
+ *  (newest value wins). The reader gets each value at most once.
+ */
+template <typename T> class TripleBuffer {
+public:
+    TripleBuffer()
+        : mBack(0)
+        , mMiddle(1)
+        , mFront(2)
+    {
+    }
+
+    /**
+     *  Publish a value, to be called from the writer thread only.
+     *
+     *  @param[in] value Value to publish.
+     *
+     *  @return true if the previous value was replaced before being read.
+     */
+    bool write(T value)
+    {
+        mSlots[mBack] = std::move(value);
+        /* Sequentially consistent so a reader going to sleep cannot miss the new value */
+        uint8_t prev = mMiddle.exchange(mBack | FRESH, std::memory_order_seq_cst);
+        mBack = prev & INDEX_MASK;
+        /* Release the value replaced, if any */
+        mSlots[mBack] = T();
+        return prev & FRESH;
+    }
+
+    /**
+     *  Take the latest value, to be called from the reader thread only.
+     *
+     *  @param[out] value Latest value published.
+     *
+     *  @return true if a value was published since the last read, false otherwise.
+     */
+    bool read(T &value)
+    {
+        if (!hasNew())
+            return false;
+
+        /* Only the reader clears FRESH, middle is still fresh */
+        uint8_t prev = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+        mFront = prev & INDEX_MASK;
+        value = std::move(mSlots[mFront]);
+        mSlots[mFront] = T();
+        return true;
+    }
+
+    /**
+     *  Check if a value was published since the last read.
+     *
+     *  @return true if read() would return a value.
+     */
+    bool hasNew() const { return mMiddle.load(std::memory_order_seq_cst) & FRESH; }
+
+private:
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t FRESH = 0x4;
+    T mSlots[3];
+    uint8_t mBack;                /* Slot written by the writer */
+    std::atomic<uint8_t> mMiddle; /* Slot exchanged, with FRESH flag */
+    uint8_t mFront;               /* Slot read by the reader */
+};
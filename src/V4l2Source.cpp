@@ -0,0 +1,94 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <sstream>
+#include <vector>
+
+#include "V4l2Source.h"
+#include "log.h"
+#include "v4l2_interface.h"
+
+static bool isCompressed(uint32_t pixelformat)
+{
+    return pixelformat == V4L2_PIX_FMT_H264 || pixelformat == V4L2_PIX_FMT_MJPEG
+        || pixelformat == V4L2_PIX_FMT_JPEG;
+}
+
+static std::string getCaps(uint32_t pixelformat, uint32_t width, uint32_t height,
+                           uint32_t frameRate)
+{
+    std::stringstream ss;
+
+    if (pixelformat == V4L2_PIX_FMT_H264)
+        ss << "video/x-h264, stream-format=byte-stream";
+    else
+        ss << "image/jpeg";
+    if (width && height)
+        ss << ", width=" << width << ", height=" << height;
+    if (frameRate)
+        ss << ", framerate=" << frameRate << "/1";
+
+    return ss.str();
+}
+
+V4l2Source getV4l2Source(const std::string &deviceId, uint32_t width, uint32_t height,
+                         uint32_t frameRate, bool needRaw)
+{
+    V4l2Source source = {V4l2Source::RAW, {}};
+
+    int fd = v4l2_open(deviceId);
+    if (fd < 0)
+        return source;
+
+    std::vector<struct v4l2_fmtdesc> formats;
+    v4l2_enum_formats(fd, formats);
+
+    /* H.264 is preferred to MJPEG, it is smaller for the same quality */
+    bool hasRaw = false;
+    uint32_t compressed = 0;
+    uint32_t passthrough = 0;
+    for (const struct v4l2_fmtdesc &fmt : formats) {
+        if (!(fmt.flags & V4L2_FMT_FLAG_COMPRESSED)) {
+            hasRaw = true;
+            continue;
+        }
+        if (!isCompressed(fmt.pixelformat))
+            continue;
+
+        if (!compressed || fmt.pixelformat == V4L2_PIX_FMT_H264)
+            compressed = fmt.pixelformat;
+        if ((!width || !height || v4l2_has_framesize(fd, fmt.pixelformat, width, height))
+            && (!passthrough || fmt.pixelformat == V4L2_PIX_FMT_H264))
+            passthrough = fmt.pixelformat;
+    }
+    v4l2_close(fd);
+
+    if (passthrough && !needRaw) {
+        source.format = passthrough == V4L2_PIX_FMT_H264 ? V4l2Source::H264 : V4l2Source::MJPEG;
+        source.filter = getCaps(passthrough, width, height, frameRate)
+            + (source.format == V4l2Source::H264 ? " ! h264parse" : " ! jpegparse");
+        log_info("Camera %s gives %s frames, passed through without encoding", deviceId.c_str(),
+                 source.format == V4l2Source::H264 ? "H.264" : "MJPEG");
+    } else if (compressed && !hasRaw) {
+        /* Size of the camera is scaled to the size of the video after the decoder */
+        source.filter = getCaps(compressed, 0, 0, frameRate)
+            + " ! decodebin ! videoconvert ! videoscale";
+        log_info("Camera %s only gives compressed frames, decoded", deviceId.c_str());
+    }
+
+    return source;
+}
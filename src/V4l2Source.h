@@ -0,0 +1,53 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdint.h>
+#include <string>
+
+/**
+ *  Frames read by v4l2src from a camera, for the elements that follow it in a pipeline.
+ *
+ *  Cameras giving H.264 or MJPEG at the size of the video are read compressed, the frames go to
+ *  the muxer or the payloader without being encoded again. A camera only giving compressed frames
+ *  at other sizes is decoded to be scaled. Other cameras give raw frames as before.
+ */
+struct V4l2Source {
+    enum Format {
+        RAW,   /* Raw frames, to be encoded */
+        H264,  /* H.264 byte stream, parsed */
+        MJPEG, /* JPEG images, parsed */
+    };
+
+    Format format;      /* Frames out of the filter */
+    std::string filter; /* Elements after v4l2src in gst-launch syntax, empty for the raw frames of
+                           the camera */
+};
+
+/**
+ *  Select the frames to read from a camera with the V4L2 formats it enumerates.
+ *
+ *  @param[in] deviceId Id of the V4L2 camera device.
+ *  @param[in] width Width of the video, 0 for the size of the camera.
+ *  @param[in] height Height of the video, 0 for the size of the camera.
+ *  @param[in] frameRate Frame rate of the video, 0 for the frame rate of the camera.
+ *  @param[in] needRaw True if raw frames are needed, for an overlay.
+ *
+ *  @return Frames to read, raw frames if the camera can not be opened.
+ */
+V4l2Source getV4l2Source(const std::string &deviceId, uint32_t width, uint32_t height,
+                         uint32_t frameRate, bool needRaw = false);
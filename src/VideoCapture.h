@@ -56,5 +56,11 @@ public:
     virtual int setBitRate(int bitRate) = 0;
     virtual int setFrameRate(int frameRate) = 0;
     virtual int setLocation(const std::string vidPath) = 0;
+    virtual int setSegment(uint32_t durationSec, uint32_t sizeMB) = 0;
     virtual std::string getLocation() = 0;
+    /*
+     * Called once the file of a stopped recording is closed, off the thread of stop(), with 0
+     * if it is complete and the number of the video.
+     */
+    virtual int setFinalizedCallback(std::function<void(int result, int seq_num)> cb) = 0;
 };
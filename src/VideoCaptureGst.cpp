@@ -15,10 +15,21 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <gst/app/gstappsrc.h>
 #include <sstream>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "EncoderRegistry.h"
+#include "FrameBufferGst.h"
+#include "V4l2Source.h"
 #include "VideoCaptureGst.h"
+#include "VideoFinalizer.h"
 #include "log.h"
+#include "pixel_convert.h"
+#include "util.h"
 
 #define DEFAULT_WIDTH 640
 #define DEFAULT_HEIGHT 480
@@ -28,11 +39,114 @@
 #define DEFAULT_FILE_FORMAT CameraParameters::VIDEO_FILE_MP4
 #define DEFAULT_FILE_PATH "/tmp/"
 #define V4L2_DEVICE_PREFIX "/dev/"
+/* Recording with v4l2src opens the device, once the source of the previous pipeline closed it */
+#define DEVICE_RELEASE_TIMEOUT_MS 500
+#define FRAME_TIMEOUT_MS 1000
+/* Frames queued on the frame hub for the recording, absorbs the bursts of the camera */
+#define HUB_QUEUE_FRAMES 4
+/* Frames queued in appsrc, absorbs the jitter of the encoder */
+#define APPSRC_QUEUE_FRAMES 8
+/* Frames are pushed again once appsrc drained half of its queue */
+#define APPSRC_MIN_PERCENT 50
+#define READ_RETRY_US (10 * USEC_PER_MSEC)
+/* Index of the file of a segmented video, in its name */
+#define SEGMENT_INDEX_FORMAT "%03u"
 
 int VideoCaptureGst::vidCount = 0;
 
-VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev)
+static const char *getGstPixFormat(CameraParameters::PixelFormat pixFormat)
+{
+    switch (pixFormat) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return "RGB";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return "UYVY";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return "YUY2";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return "GRAY8";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return "NV12";
+    default:
+        return "I420";
+    }
+}
+
+/* Capture measured by a callback of the pipeline */
+struct LatencyMark {
+    std::shared_ptr<CaptureLatency> latency;
+    usec_t startUs;
+};
+
+static void deleteLatencyMark(gpointer data)
+{
+    delete static_cast<LatencyMark *>(data);
+}
+
+/* Recording of a camera without v4l2src, fed with the frames of the device through appsrc */
+struct AppsrcFeed {
+    GstAppSrc *appsrc;
+    std::atomic<bool> running; /* Feed thread pushes frames until the recording stops */
+    std::atomic<bool> enough;  /* Queue of appsrc full, frames are dropped until it drains */
+    usec_t firstUs;            /* Time of the first frame, origin of the PTS */
+    GstClockTime lastPts;
+    uint64_t frameCnt;  /* Frames pushed to the encoder */
+    uint64_t dropCnt;   /* Frames dropped on backpressure of the encoder */
+    uint64_t missedCnt; /* Frames not received from the camera in time */
+};
+
+static void cbNeedData(GstAppSrc *appsrc, guint length, gpointer user_data)
+{
+    (*static_cast<std::shared_ptr<AppsrcFeed> *>(user_data))->enough = false;
+}
+
+static void cbEnoughData(GstAppSrc *appsrc, gpointer user_data)
+{
+    (*static_cast<std::shared_ptr<AppsrcFeed> *>(user_data))->enough = true;
+}
+
+static void deleteFeed(gpointer user_data)
+{
+    delete static_cast<std::shared_ptr<AppsrcFeed> *>(user_data);
+}
+
+/* Recording of the video of a pre-recorder, its buffers pushed to appsrc as they are encoded */
+struct PreRecordFeed {
+    GstAppSrc *appsrc;
+    GstClockTime origin; /* Time of the first buffer, from the ring, origin of the recording */
+    uint64_t bufferCnt;  /* Buffers pushed to the muxer */
+    uint64_t dropCnt;    /* Buffers refused by appsrc */
+};
+
+/* Called by the pre-recorder with its ring locked, appsrc does not block */
+static void pushPreRecorded(std::shared_ptr<PreRecordFeed> feed, GstBuffer *buffer)
+{
+    /* Copy of the metadata only, the memory is shared with the ring */
+    buffer = gst_buffer_make_writable(buffer);
+
+    if (!GST_CLOCK_TIME_IS_VALID(feed->origin))
+        feed->origin = GST_BUFFER_DTS_OR_PTS(buffer);
+    if (GST_CLOCK_TIME_IS_VALID(feed->origin)) {
+        if (GST_BUFFER_PTS_IS_VALID(buffer))
+            GST_BUFFER_PTS(buffer) = GST_BUFFER_PTS(buffer) > feed->origin
+                ? GST_BUFFER_PTS(buffer) - feed->origin
+                : 0;
+        if (GST_BUFFER_DTS_IS_VALID(buffer))
+            GST_BUFFER_DTS(buffer) = GST_BUFFER_DTS(buffer) > feed->origin
+                ? GST_BUFFER_DTS(buffer) - feed->origin
+                : 0;
+    }
+
+    if (gst_app_src_push_buffer(feed->appsrc, buffer) == GST_FLOW_OK)
+        feed->bufferCnt++;
+    else
+        feed->dropCnt++;
+}
+
+VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
     , mState(STATE_IDLE)
     , mWidth(0)
     , mHeight(0)
@@ -41,14 +155,24 @@ VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev)
     , mEnc(DEFAULT_ENCODER)
     , mFileFmt(DEFAULT_FILE_FORMAT)
     , mFilePath(DEFAULT_FILE_PATH)
+    , mSegmentSec(0)
+    , mSegmentMB(0)
+    , mSeq(0)
+    , mStartUs(0)
+    , mStartBootUs(0)
+    , mStorageBitRate(0)
+    , mDeviceHold(0)
     , mPipeline(nullptr)
+    , mLatency(CaptureLatency::get(camDev->getDeviceId()))
 {
     log_info("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
 }
 
 VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
-                                 struct VideoSettings &vidSetting)
+                                 struct VideoSettings &vidSetting,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
     , mState(STATE_IDLE)
     , mWidth(vidSetting.width)
     , mHeight(vidSetting.height)
@@ -57,8 +181,15 @@ VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
     , mEnc(vidSetting.encoder)
     , mFileFmt(vidSetting.fileFormat)
     , mFilePath(DEFAULT_FILE_PATH)
+    , mSegmentSec(0)
+    , mSegmentMB(0)
+    , mSeq(0)
+    , mStartUs(0)
+    , mStartBootUs(0)
+    , mStorageBitRate(0)
+    , mDeviceHold(0)
     , mPipeline(nullptr)
-
+    , mLatency(CaptureLatency::get(camDev->getDeviceId()))
 {
     log_info("%s Device:%s with settings", __func__, mCamDev->getDeviceId().c_str());
 }
@@ -93,6 +224,8 @@ int VideoCaptureGst::uninit()
         return -1;
     }
 
+    /* Recording ended on an error of the pipeline */
+    releaseStorage();
     setState(STATE_IDLE);
     return 0;
 }
@@ -109,14 +242,34 @@ int VideoCaptureGst::start()
     // TODO::Validate video settings
 
     int ret = 0;
-    if (mCamDev->isGstV4l2Src()) {
-        ret = createV4l2Pipeline();
-        if (!ret)
-            setState(STATE_RUN);
+    usec_t startUs = mLatency->begin(CaptureLatency::VIDEO_START);
+    reserve();
+    /* Pre-recorded video is only used once the pre-recorder encoded its first frames */
+    GstCaps *caps = mPreRecorder && mPreRecorder->isRunning()
+            && mEnc == CameraParameters::VIDEO_CODING_AVC
+        ? mPreRecorder->getCaps()
+        : nullptr;
+    if (caps) {
+        ret = createPreRecordPipeline(caps);
+        gst_caps_unref(caps);
+    } else if (mCamDev->isGstV4l2Src()) {
+        FrameTap::releaseDevice(mCamDev->getDeviceId());
+        if (VideoFinalizer::get()->waitDevice(mCamDev->getDeviceId(), DEVICE_RELEASE_TIMEOUT_MS))
+            ret = 1;
         else
-            setState(STATE_ERROR);
-    } else
-        ret = -1;
+            ret = createV4l2Pipeline();
+    } else {
+        ret = createAppsrcPipeline();
+    }
+    if (!ret) {
+        mLatency->mark(CaptureLatency::VIDEO_START, CaptureLatency::STAGE_PIPELINE_READY, startUs);
+        markFirstFrame(startUs);
+        accountStorage();
+        setState(STATE_RUN);
+    } else {
+        addRecord(1);
+        setState(STATE_ERROR);
+    }
 
     return ret;
 }
@@ -125,17 +278,212 @@ int VideoCaptureGst::stop()
 {
     log_info("%s::%s", typeid(this).name(), __func__);
 
-    if (getState() != STATE_RUN) {
+    /* Pipeline failed during the recording, still to be released */
+    bool failed = getState() == STATE_ERROR && mPipeline;
+    if (getState() != STATE_RUN && !failed) {
         log_error("Invalid State : %d", getState());
         return -1;
     }
 
+    usec_t stopUs = mLatency->begin(CaptureLatency::VIDEO_STOP);
+    stopFeed();
     destroyPipeline();
+    if (failed) {
+        /* No end of stream to wait for, the state is left for uninit() */
+        gst_element_set_state(mPipeline, GST_STATE_NULL);
+        gst_object_unref(mPipeline);
+        mPipeline = nullptr;
+        addRecord(1);
+        if (mFinalizedCb)
+            mFinalizedCb(1, mSeq);
+        releaseStorage();
+        return 0;
+    }
+    finalize(stopUs);
+    releaseStorage();
 
     setState(STATE_INIT);
     return 0;
 }
 
+static GstPadProbeReturn firstFrameCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    LatencyMark *mark = static_cast<LatencyMark *>(user_data);
+    mark->latency->mark(CaptureLatency::VIDEO_START, CaptureLatency::STAGE_FRAME, mark->startUs);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void VideoCaptureGst::markFirstFrame(usec_t startUs)
+{
+    GstElement *source = gst_bin_get_by_name(GST_BIN(mPipeline), FrameTap::SOURCE_NAME);
+    if (!source)
+        return;
+
+    GstPad *pad = gst_element_get_static_pad(source, "src");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, firstFrameCb,
+                          new LatencyMark{mLatency, startUs}, deleteLatencyMark);
+        gst_object_unref(pad);
+    }
+    gst_object_unref(source);
+}
+
+static void deleteDeviceHold(gpointer data)
+{
+    delete static_cast<uint64_t *>(data);
+}
+
+static void releaseSourceCb(GstElement *source, gpointer user_data)
+{
+    /* Left out of the state changes of the pipeline, which still drains */
+    gst_element_set_locked_state(source, TRUE);
+    gst_element_set_state(source, GST_STATE_NULL);
+    VideoFinalizer::get()->releaseDevice(*static_cast<uint64_t *>(user_data));
+}
+
+static GstPadProbeReturn sourceEosCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+        return GST_PAD_PROBE_OK;
+
+    /* Source can't be stopped from its own streaming thread */
+    GstElement *source = gst_pad_get_parent_element(pad);
+    if (source) {
+        gst_element_call_async(source, releaseSourceCb,
+                               new uint64_t(*static_cast<uint64_t *>(user_data)),
+                               deleteDeviceHold);
+        gst_object_unref(source);
+    }
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+uint64_t VideoCaptureGst::releaseSourceOnEos()
+{
+    GstElement *source = gst_bin_get_by_name(GST_BIN(mPipeline), FrameTap::SOURCE_NAME);
+    if (!source)
+        return 0;
+
+    GstPad *pad = gst_element_get_static_pad(source, "src");
+    gst_object_unref(source);
+    if (!pad)
+        return 0;
+
+    /* Without the probe the device is still released with the pipeline */
+    uint64_t hold = VideoFinalizer::get()->holdDevice(mCamDev->getDeviceId());
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, sourceEosCb, new uint64_t(hold),
+                      deleteDeviceHold);
+    gst_object_unref(pad);
+
+    return hold;
+}
+
+void VideoCaptureGst::accountStorage()
+{
+    mStorage = StorageMonitor::get(mFilePath);
+    mStorageBitRate = mBitRate > 0 ? mBitRate : DEFAULT_BITRATE;
+    mStorage->addRecording(mStorageBitRate);
+}
+
+void VideoCaptureGst::releaseStorage()
+{
+    if (!mStorage)
+        return;
+
+    mStorage->removeRecording(mStorageBitRate);
+    mStorage.reset();
+    mStorageBitRate = 0;
+}
+
+void VideoCaptureGst::reserve()
+{
+    mCatalog = CaptureCatalog::get(mFilePath, CaptureCatalog::Media::VIDEO);
+    mSeq = mCatalog ? mCatalog->reserve() : -1;
+    if (mSeq < 0) {
+        /* No catalog in the directory, numbers start over with the process */
+        mCatalog.reset();
+        mSeq = vidCount++;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    mStartUs = ts_usec(&ts);
+    mStartBootUs = now_usec();
+}
+
+static std::string segmentPath(const std::string &path, int seq, uint32_t segment,
+                               const std::string &ext)
+{
+    char index[16];
+    snprintf(index, sizeof(index), SEGMENT_INDEX_FORMAT, segment);
+
+    return path + "vid_" + std::to_string(seq) + "_" + index + "." + ext;
+}
+
+CaptureCatalog::Record VideoCaptureGst::getRecord(int result)
+{
+    CaptureCatalog::Record record = {};
+    record.seq = mSeq;
+    record.state = result ? CaptureCatalog::STATE_FAILED : CaptureCatalog::STATE_DONE;
+    record.format = mFileFmt;
+    record.timeUtcUs = mStartUs;
+    record.timeBootMs = mStartBootUs / USEC_PER_MSEC;
+    record.durationMs = (now_usec() - mStartBootUs) / USEC_PER_MSEC;
+    snprintf(record.path, sizeof(record.path), "%s", mFile.c_str());
+
+    return record;
+}
+
+void VideoCaptureGst::addRecord(int result)
+{
+    if (!mCatalog)
+        return;
+
+    mCatalog->commit(getRecord(result));
+}
+
+void VideoCaptureGst::finalize(usec_t stopUs)
+{
+    std::shared_ptr<CaptureCatalog> catalog = mCatalog;
+    std::shared_ptr<CaptureLatency> latency = mLatency;
+    CaptureCatalog::Record record = getRecord(0);
+    bool segmented = mSegmentSec || mSegmentMB;
+    std::string path = mFilePath;
+    std::string ext = getFileExt(mFileFmt);
+    FinalizedCallback cb = mFinalizedCb;
+    uint64_t hold = mDeviceHold;
+    mDeviceHold = 0;
+
+    /* Capture may be gone once its file is closed, the callback only holds copies */
+    VideoFinalizer::get()->finalize(
+        mCamDev->getDeviceId(), mPipeline, [=](bool success) mutable {
+            if (success)
+                latency->mark(CaptureLatency::VIDEO_STOP, CaptureLatency::STAGE_FILE_CLOSED,
+                              stopUs);
+
+            if (catalog) {
+                struct stat st;
+                record.state = success ? CaptureCatalog::STATE_DONE : CaptureCatalog::STATE_FAILED;
+                if (!stat(record.path, &st))
+                    record.size = st.st_size;
+                /* Files of the video, all closed by now */
+                for (uint16_t i = 1; segmented && i < UINT16_MAX; i++) {
+                    record.segments = i;
+                    if (stat(segmentPath(path, record.seq, i, ext).c_str(), &st))
+                        break;
+                    record.size += st.st_size;
+                }
+                catalog->commit(record);
+            }
+
+            if (cb)
+                cb(success ? 0 : 1, record.seq);
+        },
+        hold);
+    mPipeline = nullptr;
+}
+
 int VideoCaptureGst::setState(int state)
 {
     int ret = 0;
@@ -271,25 +619,41 @@ int VideoCaptureGst::setLocation(const std::string vidPath)
     return ret;
 }
 
+int VideoCaptureGst::setSegment(uint32_t durationSec, uint32_t sizeMB)
+{
+    int ret = 0;
+
+    if (getState() == STATE_RUN)
+        log_warning("Change will not take effect");
+
+    mSegmentSec = durationSec;
+    mSegmentMB = sizeMB;
+
+    return ret;
+}
+
 std::string VideoCaptureGst::getLocation()
 {
     return mFilePath;
 }
 
-std::string VideoCaptureGst::getGstEncName(int encFormat)
+int VideoCaptureGst::setFinalizedCallback(std::function<void(int result, int seq_num)> cb)
 {
-    std::string ret;
+    mFinalizedCb = cb;
+    return 0;
+}
 
-    switch (encFormat) {
-    case CameraParameters::VIDEO_CODING_AVC:
-        ret = std::string("x264enc");
-        break;
-    default:
-        ret = {};
-        break;
-    }
+void VideoCaptureGst::setPreRecorder(std::shared_ptr<PreRecorder> preRecorder)
+{
+    mPreRecorder = preRecorder;
+}
 
-    return ret;
+std::string VideoCaptureGst::getGstEncName(int encFormat)
+{
+    /* Best encoder available for the codec, with its bitrate */
+    CameraParameters::VIDEO_CODING_FORMAT codec
+        = static_cast<CameraParameters::VIDEO_CODING_FORMAT>(encFormat);
+    return EncoderRegistry::getEncoder(codec, mBitRate, mFrmRate);
 }
 
 std::string VideoCaptureGst::getGstParserName(int encFormat)
@@ -340,44 +704,127 @@ std::string VideoCaptureGst::getFileExt(int fileFormat)
     return ret;
 }
 
+std::string VideoCaptureGst::getSegmentPath(uint32_t segment)
+{
+    return segmentPath(mFilePath, mSeq, segment, getFileExt(mFileFmt));
+}
+
+std::string VideoCaptureGst::getGstSinkName(const std::string &muxer, const std::string &ext)
+{
+    std::stringstream ss;
+
+    if (!mSegmentSec && !mSegmentMB) {
+        /* Muxer keeps the index of the whole video in memory and writes it at the end */
+        mFile = mFilePath + "vid_" + std::to_string(mSeq) + "." + ext;
+        ss << muxer << " ! filesink location=" << mFile;
+        return ss.str();
+    }
+
+    /*
+     * One muxer per file, its index only holds the samples of the segment and each file is
+     * complete once the next one starts. Files are split on a key frame, asked to the encoder.
+     * splitmuxsink muxes in mp4mux, the only file format supported.
+     */
+    mFile = getSegmentPath(0);
+    ss << "splitmuxsink location=" << mFilePath << "vid_" << std::to_string(mSeq) << "_"
+       << SEGMENT_INDEX_FORMAT << "." << ext << " send-keyframe-requests=true";
+    if (mSegmentSec)
+        ss << " max-size-time=" << std::to_string((guint64)mSegmentSec * GST_SECOND);
+    if (mSegmentMB)
+        ss << " max-size-bytes=" << std::to_string((guint64)mSegmentMB << 20);
+
+    return ss.str();
+}
+
 std::string VideoCaptureGst::getGstV4l2PipelineName()
 {
     std::string device = mCamDev->getDeviceId();
     if (device.empty())
         return {};
 
+    V4l2Source source = getV4l2Source(device, std::max(mWidth, 0), std::max(mHeight, 0),
+                                      std::max(mFrmRate, 0));
     device.insert(0, V4L2_DEVICE_PREFIX);
 
-    std::string encoder = getGstEncName(mEnc);
-    std::string parser = getGstParserName(mEnc);
     std::string muxer = getGstMuxerName(mFileFmt);
     std::string ext = getFileExt(mFileFmt);
-    if (encoder.empty() || parser.empty() || muxer.empty() || ext.empty())
+    if (muxer.empty() || ext.empty())
         return {};
 
     std::stringstream filter;
-    std::stringstream sbr;
     std::stringstream ss;
 
+    /* Queue after the source: the end of stream leaves it at once, the device is closed while
+     * the encoder and the muxer drain. Compressed frames of the camera are muxed as they are */
+    if (source.format != V4l2Source::RAW) {
+        ss << "v4l2src name=" << FrameTap::SOURCE_NAME << " device=" << device << " ! queue ! "
+           << source.filter << " ! " << getGstSinkName(muxer, ext);
+        return ss.str();
+    }
+
+    std::string encoder = getGstEncName(mEnc);
+    std::string parser = getGstParserName(mEnc);
+    if (encoder.empty() || parser.empty())
+        return {};
+
+    if (!source.filter.empty())
+        filter << source.filter << " ! ";
     filter << "video/x-raw, ";
     if (mFrmRate > 0)
         filter << " framerate=" << std::to_string(mFrmRate) << "/1,";
     if (mWidth > 0 && mHeight > 0)
         filter << " width=" << std::to_string(mWidth) << ", height=" << std::to_string(mHeight);
 
-    if (mBitRate > 0)
-        sbr << " bitrate=" << std::to_string(mBitRate);
+    ss << "v4l2src name=" << FrameTap::SOURCE_NAME << " device=" << device << " ! queue ! "
+       << filter.str() << " ! " << encoder << " ! " << parser << " ! "
+       << getGstSinkName(muxer, ext);
 
-    ss << "v4l2src device=" << device << " ! " << filter.str() << " ! " << encoder << sbr.str()
-       << " ! " << parser << " ! " << muxer << " ! "
-       << "filesink location=" << mFilePath + "vid_" << std::to_string(++vidCount) << "." + ext;
+    return ss.str();
+}
+
+std::string VideoCaptureGst::getGstAppsrcPipelineName()
+{
+    std::string encoder = getGstEncName(mEnc);
+    std::string parser = getGstParserName(mEnc);
+    std::string muxer = getGstMuxerName(mFileFmt);
+    std::string ext = getFileExt(mFileFmt);
+    if (encoder.empty() || parser.empty() || muxer.empty() || ext.empty())
+        return {};
+
+    uint32_t camWidth = 0, camHeight = 0;
+    mCamDev->getSize(camWidth, camHeight);
+
+    std::stringstream scale;
+    std::stringstream ss;
+
+    /* Frames keep the timing of the camera, only the resolution is converted */
+    if (mWidth > 0 && mHeight > 0
+        && ((uint32_t)mWidth != camWidth || (uint32_t)mHeight != camHeight))
+        scale << " ! videoscale ! video/x-raw, width=" << std::to_string(mWidth)
+              << ", height=" << std::to_string(mHeight);
+
+    ss << "appsrc name=" << FrameTap::SOURCE_NAME << " ! videoconvert" << scale.str() << " ! "
+       << encoder << " ! " << parser << " ! " << getGstSinkName(muxer, ext);
 
     return ss.str();
 }
 
-static gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data)
+std::string VideoCaptureGst::getGstPreRecordPipelineName()
+{
+    std::string muxer = getGstMuxerName(mFileFmt);
+    std::string ext = getFileExt(mFileFmt);
+    if (muxer.empty() || ext.empty())
+        return {};
+
+    /* Video is already encoded, the parser gives the muxer its timestamps and format */
+    return std::string("appsrc name=") + FrameTap::SOURCE_NAME + " ! h264parse ! "
+        + getGstSinkName(muxer, ext);
+}
+
+gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data)
 {
-    GstElement *pipeline = (GstElement *)user_data;
+    VideoCaptureGst *capture = static_cast<VideoCaptureGst *>(user_data);
+
     switch (GST_MESSAGE_TYPE(message)) {
     case GST_MESSAGE_ERROR: {
         GError *err = NULL;
@@ -394,8 +841,9 @@ static gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data)
         g_free(debug);
         g_free(name);
 
-        // TODO :: stop the pipeline
-        // Update video cap status
+        /* Recording is over, the pipeline is released by stop() */
+        if (capture->getState() == VideoCaptureGst::STATE_RUN)
+            capture->setState(VideoCaptureGst::STATE_ERROR);
         break;
     }
     case GST_MESSAGE_WARNING: {
@@ -414,12 +862,6 @@ static gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data)
         g_free(name);
         break;
     }
-    case GST_MESSAGE_EOS: {
-        log_info("Got EOS\n");
-        gst_element_set_state(pipeline, GST_STATE_NULL);
-        gst_object_unref(pipeline);
-        break;
-    }
     default:
         break;
     }
@@ -467,21 +909,335 @@ int VideoCaptureGst::createV4l2Pipeline()
 
     GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(mPipeline));
     gst_bus_add_signal_watch(bus);
-    g_signal_connect(G_OBJECT(bus), "message", G_CALLBACK(gstMsgCb), mPipeline);
+    g_signal_connect(G_OBJECT(bus), "message", G_CALLBACK(gstMsgCb), this);
     gst_object_unref(GST_OBJECT(bus));
 
+    /* Still capture takes its frames from the recording while it runs */
+    mFrameTap = FrameTap::attach(mCamDev->getDeviceId(), mPipeline);
+
     return ret;
 }
 
+int VideoCaptureGst::createAppsrcPipeline()
+{
+    log_info("%s", __func__);
+
+    GError *error = nullptr;
+    GstStateChangeReturn result;
+    GstElement *appsrc;
+    GstCaps *caps;
+    GstAppSrcCallbacks cbs = {};
+    GstBus *bus;
+    guint64 maxBytes;
+
+    uint32_t width = 0, height = 0, fps = 0;
+    CameraParameters::PixelFormat format;
+    if (mCamDev->getSize(width, height) != CameraDevice::Status::SUCCESS || !width || !height
+        || mCamDev->getPixelFormat(format) != CameraDevice::Status::SUCCESS) {
+        log_error("Camera frame size or format unknown");
+        return 1;
+    }
+    /* Frames are timestamped by the camera, without frame rate the stream is variable */
+    if (mCamDev->getFrameRate(fps) != CameraDevice::Status::SUCCESS)
+        fps = 0;
+
+    std::string pipeline_str = getGstAppsrcPipelineName();
+    if (pipeline_str.empty()) {
+        log_error("Pipeline String error");
+        return 1;
+    }
+    log_debug("pipeline = %s", pipeline_str.c_str());
+
+    mPipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!mPipeline) {
+        log_error("Error creating pipeline");
+        if (error)
+            g_clear_error(&error);
+        return 1;
+    }
+
+    appsrc = gst_bin_get_by_name(GST_BIN(mPipeline), FrameTap::SOURCE_NAME);
+    if (!appsrc) {
+        log_error("Error creating appsrc");
+        gst_object_unref(GST_OBJECT(mPipeline));
+        mPipeline = nullptr;
+        return 1;
+    }
+
+    caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, getGstPixFormat(format),
+                               "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+                               "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    gst_caps_unref(caps);
+
+    /* Never blocks the feed thread, it drops the frames the encoder can not keep up with */
+    maxBytes = pixel_get_frame_size(format, width, height) * APPSRC_QUEUE_FRAMES;
+    g_object_set(G_OBJECT(appsrc), "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp",
+                 FALSE, "block", FALSE, "max-bytes", maxBytes, "min-percent", APPSRC_MIN_PERCENT,
+                 NULL);
+
+    mFeed = std::make_shared<AppsrcFeed>();
+    mFeed->appsrc = GST_APP_SRC(appsrc);
+    mFeed->running = true;
+    mFeed->enough = false;
+    mFeed->firstUs = 0;
+    mFeed->lastPts = GST_CLOCK_TIME_NONE;
+    mFeed->frameCnt = 0;
+    mFeed->dropCnt = 0;
+    mFeed->missedCnt = 0;
+
+    cbs.need_data = cbNeedData;
+    cbs.enough_data = cbEnoughData;
+    gst_app_src_set_callbacks(GST_APP_SRC(appsrc), &cbs, new std::shared_ptr<AppsrcFeed>(mFeed),
+                              deleteFeed);
+
+    /* Share the camera frames with the other consumers, if supported by the device */
+    if (mFrameHub)
+        mFrameConsumer = mFrameHub->subscribe("video", HUB_QUEUE_FRAMES);
+
+    result = gst_element_set_state(mPipeline, GST_STATE_PLAYING);
+    if (result == GST_STATE_CHANGE_FAILURE) {
+        log_error("Error setting PLAY state");
+        goto fail;
+    }
+
+    /* Sinks go to PLAYING once the first frames are encoded, appsrc has to be fed by then */
+    mFeedThread = std::thread(&VideoCaptureGst::feedThread, this, mFeed);
+
+    result = gst_element_get_state(mPipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+    if (result != GST_STATE_CHANGE_SUCCESS) {
+        log_error("Error going to PLAY state");
+        goto fail;
+    }
+
+    bus = gst_pipeline_get_bus(GST_PIPELINE(mPipeline));
+    gst_bus_add_signal_watch(bus);
+    g_signal_connect(G_OBJECT(bus), "message", G_CALLBACK(gstMsgCb), this);
+    gst_object_unref(GST_OBJECT(bus));
+
+    return 0;
+
+fail:
+    stopFeed();
+    gst_element_set_state(mPipeline, GST_STATE_NULL);
+    gst_object_unref(mFeed->appsrc);
+    mFeed.reset();
+    gst_object_unref(GST_OBJECT(mPipeline));
+    mPipeline = nullptr;
+    return 1;
+}
+
+int VideoCaptureGst::createPreRecordPipeline(GstCaps *caps)
+{
+    log_info("%s", __func__);
+
+    GError *error = nullptr;
+    GstStateChangeReturn result;
+    GstElement *appsrc;
+    GstBus *bus;
+    GstClockTime preRoll;
+    std::shared_ptr<PreRecordFeed> feed;
+
+    std::string pipeline_str = getGstPreRecordPipelineName();
+    if (pipeline_str.empty()) {
+        log_error("Pipeline String error");
+        return 1;
+    }
+    log_debug("pipeline = %s", pipeline_str.c_str());
+
+    mPipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!mPipeline) {
+        log_error("Error creating pipeline");
+        if (error)
+            g_clear_error(&error);
+        return 1;
+    }
+
+    appsrc = gst_bin_get_by_name(GST_BIN(mPipeline), FrameTap::SOURCE_NAME);
+    if (!appsrc) {
+        log_error("Error creating appsrc");
+        gst_object_unref(GST_OBJECT(mPipeline));
+        mPipeline = nullptr;
+        return 1;
+    }
+
+    /* Whole ring is pushed at once when the recording starts, then the live video */
+    gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    g_object_set(G_OBJECT(appsrc), "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp",
+                 FALSE, "block", FALSE, "max-bytes", (guint64)mPreRecorder->getMemory() * 2,
+                 NULL);
+
+    feed = std::make_shared<PreRecordFeed>();
+    feed->appsrc = GST_APP_SRC(appsrc);
+    feed->origin = GST_CLOCK_TIME_NONE;
+    feed->bufferCnt = 0;
+    feed->dropCnt = 0;
+    mPreRecordFeed = feed;
+
+    result = gst_element_set_state(mPipeline, GST_STATE_PLAYING);
+    if (result == GST_STATE_CHANGE_FAILURE) {
+        log_error("Error setting PLAY state");
+        goto fail;
+    }
+
+    /* Sinks go to PLAYING once the muxer got the first buffers, the ones of the ring */
+    preRoll = mPreRecorder->attach([feed](GstBuffer *buffer) { pushPreRecorded(feed, buffer); });
+
+    result = gst_element_get_state(mPipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+    if (result != GST_STATE_CHANGE_SUCCESS) {
+        log_error("Error going to PLAY state");
+        goto fail;
+    }
+
+    bus = gst_pipeline_get_bus(GST_PIPELINE(mPipeline));
+    gst_bus_add_signal_watch(bus);
+    g_signal_connect(G_OBJECT(bus), "message", G_CALLBACK(gstMsgCb), this);
+    gst_object_unref(GST_OBJECT(bus));
+
+    /* Video starts with the oldest frame of the ring, before the command */
+    mStartUs -= preRoll / GST_USECOND;
+    mStartBootUs -= preRoll / GST_USECOND;
+    log_info("Video %d starts %llu ms before the command", mSeq,
+             (unsigned long long)(preRoll / GST_MSECOND));
+
+    return 0;
+
+fail:
+    mPreRecorder->detach();
+    gst_element_set_state(mPipeline, GST_STATE_NULL);
+    gst_object_unref(appsrc);
+    mPreRecordFeed.reset();
+    gst_object_unref(GST_OBJECT(mPipeline));
+    mPipeline = nullptr;
+    return 1;
+}
+
+bool VideoCaptureGst::readFrame(CameraData &data)
+{
+    if (mFrameConsumer)
+        return mFrameConsumer->pop(data, FRAME_TIMEOUT_MS);
+
+    if (mCamDev->read(data) == CameraDevice::Status::SUCCESS)
+        return true;
+
+    /* Device not ready, do not spin on it */
+    usleep(READ_RETRY_US);
+    return false;
+}
+
+void VideoCaptureGst::feedThread(std::shared_ptr<AppsrcFeed> feed)
+{
+    while (feed->running) {
+        CameraData data;
+        if (!readFrame(data) || !data.buf || !data.bufSize) {
+            if (feed->running)
+                feed->missedCnt++;
+            continue;
+        }
+
+        /* Time the frame was taken, from the camera if it gives it */
+        usec_t frameUs = data.sec || data.nsec
+            ? (usec_t)data.sec * USEC_PER_SEC + data.nsec / 1000
+            : now_usec();
+        if (!GST_CLOCK_TIME_IS_VALID(feed->lastPts))
+            feed->firstUs = frameUs;
+
+        if (feed->enough) {
+            /* Lease on the frame is released right away, the camera keeps its buffers */
+            feed->dropCnt++;
+            continue;
+        }
+
+        GstBuffer *buffer = wrapCameraData(data);
+        if (!buffer) {
+            feed->missedCnt++;
+            continue;
+        }
+
+        /* PTS must increase even if the system clock of the camera steps back */
+        GstClockTime pts = frameUs > feed->firstUs ? (frameUs - feed->firstUs) * GST_USECOND : 0;
+        if (GST_CLOCK_TIME_IS_VALID(feed->lastPts) && pts <= feed->lastPts)
+            pts = feed->lastPts + 1;
+        GST_BUFFER_PTS(buffer) = pts;
+        feed->lastPts = pts;
+
+        GstFlowReturn ret = gst_app_src_push_buffer(feed->appsrc, buffer);
+        if (ret != GST_FLOW_OK) {
+            log_error("Error in sending data to gst pipeline: %s", gst_flow_get_name(ret));
+            feed->dropCnt++;
+            continue;
+        }
+        feed->frameCnt++;
+    }
+}
+
+void VideoCaptureGst::stopFeed()
+{
+    if (!mFeed)
+        return;
+
+    mFeed->running = false;
+    /* Unblock the feed thread waiting for a frame */
+    if (mFrameConsumer)
+        mFrameHub->unsubscribe(mFrameConsumer);
+    if (mFeedThread.joinable())
+        mFeedThread.join();
+
+    log_info("Video %d: %llu frames recorded, %llu dropped by the encoder, %llu by the frame "
+             "queue, %llu missed",
+             mSeq, (unsigned long long)mFeed->frameCnt, (unsigned long long)mFeed->dropCnt,
+             (unsigned long long)(mFrameConsumer ? mFrameConsumer->getDropCount() : 0),
+             (unsigned long long)mFeed->missedCnt);
+    mFrameConsumer.reset();
+}
+
 int VideoCaptureGst::destroyPipeline()
 {
     int ret = 0;
     log_info("%s", __func__);
 
-    // gst_element_set_state (mPipeline, GST_STATE_NULL);
-    // gst_object_unref (mPipeline);
-    log_info("Sending EoS");
-    gst_element_send_event(mPipeline, gst_event_new_eos());
+    if (mFrameTap) {
+        mFrameTap->detach();
+        mFrameTap.reset();
+    }
+
+    /* End of stream and errors of the drain are read from the bus by the finalizer */
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(mPipeline));
+    g_signal_handlers_disconnect_by_func(bus, (gpointer)gstMsgCb, this);
+    gst_bus_remove_signal_watch(bus);
+    gst_object_unref(GST_OBJECT(bus));
+
+    if (getState() == STATE_ERROR) {
+        /* Pipeline failed, nothing to drain */
+        if (mFeed)
+            gst_object_unref(mFeed->appsrc);
+        if (mPreRecordFeed) {
+            mPreRecorder->detach();
+            gst_object_unref(mPreRecordFeed->appsrc);
+        }
+        mFeed.reset();
+        mPreRecordFeed.reset();
+    } else if (mFeed) {
+        log_info("Sending EoS");
+        /* After the frames still queued in appsrc, an EOS event would drop them */
+        gst_app_src_end_of_stream(mFeed->appsrc);
+        gst_object_unref(mFeed->appsrc);
+        mFeed.reset();
+    } else if (mPreRecordFeed) {
+        log_info("Sending EoS");
+        /* No buffer pushed once detached, the pre-recorder keeps encoding for the next video */
+        mPreRecorder->detach();
+        gst_app_src_end_of_stream(mPreRecordFeed->appsrc);
+        log_info("Video %d: %llu buffers recorded, %llu dropped", mSeq,
+                 (unsigned long long)mPreRecordFeed->bufferCnt,
+                 (unsigned long long)mPreRecordFeed->dropCnt);
+        gst_object_unref(mPreRecordFeed->appsrc);
+        mPreRecordFeed.reset();
+    } else {
+        log_info("Sending EoS");
+        mDeviceHold = releaseSourceOnEos();
+        gst_element_send_event(mPipeline, gst_event_new_eos());
+    }
 
     return ret;
 }
@@ -23,12 +23,23 @@
 #include <thread>
 
 #include "CameraDevice.h"
+#include "CaptureCatalog.h"
+#include "CaptureLatency.h"
+#include "FrameHub.h"
+#include "FrameTap.h"
+#include "PreRecorder.h"
+#include "StorageMonitor.h"
 #include "VideoCapture.h"
 
+struct AppsrcFeed;
+struct PreRecordFeed;
+
 class VideoCaptureGst final : public VideoCapture {
 public:
-    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev);
-    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev, struct VideoSettings &vidSetting);
+    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
+    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev, struct VideoSettings &vidSetting,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
     ~VideoCaptureGst();
 
     int init();
@@ -43,19 +54,50 @@ public:
     int setEncoder(CameraParameters::VIDEO_CODING_FORMAT vidEnc);
     int setFormat(CameraParameters::VIDEO_FILE_FORMAT fileFormat);
     int setLocation(const std::string vidPath);
+    int setSegment(uint32_t durationSec, uint32_t sizeMB);
     std::string getLocation();
+    int setFinalizedCallback(std::function<void(int result, int seq_num)> cb);
+
+    /**
+     *  Record the video of a pre-recorder, from the oldest key frame it kept, instead of
+     *  encoding the frames of the camera from the start of the recording.
+     *
+     *  @param[in] preRecorder Pre-recorder of the camera, used if it runs when the recording
+     *                         starts.
+     */
+    void setPreRecorder(std::shared_ptr<PreRecorder> preRecorder);
 
 private:
+    friend gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data);
     static int vidCount;
     int setState(int state);
+    void reserve();
+    void accountStorage();
+    void releaseStorage();
+    typedef std::function<void(int result, int seq_num)> FinalizedCallback;
+    CaptureCatalog::Record getRecord(int result);
+    void addRecord(int result);
+    void finalize(usec_t stopUs);
     std::string getGstEncName(int format);
     std::string getGstParserName(int format);
     std::string getGstMuxerName(int format);
     std::string getFileExt(int format);
+    std::string getGstSinkName(const std::string &muxer, const std::string &ext);
+    std::string getSegmentPath(uint32_t segment);
     std::string getGstV4l2PipelineName();
+    std::string getGstAppsrcPipelineName();
+    std::string getGstPreRecordPipelineName();
     int createV4l2Pipeline();
+    int createAppsrcPipeline();
+    int createPreRecordPipeline(GstCaps *caps);
     int destroyPipeline();
+    void stopFeed();
+    void feedThread(std::shared_ptr<AppsrcFeed> feed);
+    bool readFrame(CameraData &data);
+    void markFirstFrame(usec_t startUs);
+    uint64_t releaseSourceOnEos();
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
     std::atomic<int> mState;
     int mWidth;
     int mHeight;
@@ -64,5 +106,23 @@ private:
     CameraParameters::VIDEO_CODING_FORMAT mEnc;
     CameraParameters::VIDEO_FILE_FORMAT mFileFmt;
     std::string mFilePath;
+    uint32_t mSegmentSec;                     /* Length of the files of a video, 0 for one file */
+    uint32_t mSegmentMB;                      /* Size of the files of a video, 0 for no limit */
+    std::shared_ptr<CaptureCatalog> mCatalog; /* Videos of mFilePath, numbers them */
+    int mSeq;                                 /* Number of the video recorded */
+    std::string mFile;                        /* File of the video recorded */
+    uint64_t mStartUs;                        /* Start of the recording, system time */
+    uint64_t mStartBootUs;                    /* Start of the recording, monotonic time */
+    std::shared_ptr<StorageMonitor> mStorage; /* Location recorded to, while recording */
+    uint32_t mStorageBitRate;                 /* Bitrate accounted in mStorage, kbps */
+    uint64_t mDeviceHold;                     /* Device held until its source is closed, or 0 */
     GstElement *mPipeline;
+    std::shared_ptr<FrameTap> mFrameTap;
+    std::shared_ptr<FrameHub::Consumer> mFrameConsumer; /* Frames of the native capture */
+    std::shared_ptr<AppsrcFeed> mFeed;                  /* State shared with the appsrc callbacks */
+    std::thread mFeedThread;                            /* Pushes the frames to appsrc */
+    std::shared_ptr<PreRecorder> mPreRecorder;          /* Video encoded before the start */
+    std::shared_ptr<PreRecordFeed> mPreRecordFeed;      /* State shared with the pre-recorder */
+    std::shared_ptr<CaptureLatency> mLatency; /* Stages of the start and stop of the camera */
+    FinalizedCallback mFinalizedCb;           /* File of a stopped recording closed */
 };
@@ -0,0 +1,186 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+
+#include "VideoFinalizer.h"
+#include "log.h"
+#include "util.h"
+
+/* Muxer writing its index on a slow storage, past that the file is given up */
+#define FINALIZE_TIMEOUT_S 10
+
+std::shared_ptr<VideoFinalizer> VideoFinalizer::get()
+{
+    static std::mutex finalizerLock;
+    static std::shared_ptr<VideoFinalizer> finalizer;
+
+    std::lock_guard<std::mutex> locker(finalizerLock);
+    if (!finalizer)
+        finalizer = std::make_shared<VideoFinalizer>();
+
+    return finalizer;
+}
+
+VideoFinalizer::VideoFinalizer()
+    : mNextHold(1)
+    , mRunning(true)
+{
+    mThread = std::thread(&VideoFinalizer::run, this);
+}
+
+VideoFinalizer::~VideoFinalizer()
+{
+    /* Files of the recordings queued are still closed */
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mRunning = false;
+    }
+    mQueued.notify_all();
+    mThread.join();
+}
+
+uint64_t VideoFinalizer::holdDevice(const std::string &device)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    uint64_t hold = mNextHold++;
+    mHolds[hold] = device;
+
+    return hold;
+}
+
+void VideoFinalizer::releaseDevice(uint64_t hold)
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (!mHolds.erase(hold))
+            return;
+    }
+    mDone.notify_all();
+}
+
+void VideoFinalizer::finalize(const std::string &name, GstElement *pipeline, Callback cb,
+                              uint64_t hold)
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mJobs.push_back({name, pipeline, cb, hold});
+    }
+    mQueued.notify_one();
+}
+
+int VideoFinalizer::waitDevice(const std::string &device, uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+    auto released = [&] {
+        return std::none_of(mHolds.begin(), mHolds.end(),
+                            [&](const std::pair<const uint64_t, std::string> &it) {
+                                return it.second == device;
+                            });
+    };
+
+    if (!mDone.wait_for(locker, std::chrono::milliseconds(timeoutMs), released)) {
+        log_error("Camera device %s still held by the last recording after %u ms",
+                  device.c_str(), timeoutMs);
+        return -1;
+    }
+
+    return 0;
+}
+
+int VideoFinalizer::wait(uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    if (!mDone.wait_for(locker, std::chrono::milliseconds(timeoutMs),
+                        [this] { return mJobs.empty(); })) {
+        log_error("%zu recording(s) still finalizing after %u ms", mJobs.size(), timeoutMs);
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t VideoFinalizer::getPending()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    return mJobs.size();
+}
+
+void VideoFinalizer::run()
+{
+    std::unique_lock<std::mutex> locker(mLock);
+
+    while (true) {
+        mQueued.wait(locker, [this] { return !mJobs.empty() || !mRunning; });
+        if (mJobs.empty())
+            break;
+
+        /* Job stays queued until its pipeline is released, for wait() */
+        Job job = mJobs.front();
+        locker.unlock();
+
+        usec_t startUs = now_usec();
+        bool success = drain(job.pipeline);
+        log_info("Recording %s %s in %llu ms", job.name.c_str(),
+                 success ? "finalized" : "failed",
+                 (unsigned long long)((now_usec() - startUs) / USEC_PER_MSEC));
+        if (job.cb)
+            job.cb(success);
+
+        locker.lock();
+        /* Pipeline is released, so is its device */
+        if (job.hold)
+            mHolds.erase(job.hold);
+        mJobs.pop_front();
+        mDone.notify_all();
+    }
+}
+
+bool VideoFinalizer::drain(GstElement *pipeline)
+{
+    bool success = false;
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(
+        bus, FINALIZE_TIMEOUT_S * GST_SECOND,
+        (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+
+    if (!message) {
+        log_error("No end of stream from the pipeline after %d s", FINALIZE_TIMEOUT_S);
+    } else if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+        GError *err = nullptr;
+        gchar *name = gst_object_get_path_string(message->src);
+        gst_message_parse_error(message, &err, nullptr);
+        log_error("Error finalizing recording, from element %s: %s", name, err->message);
+        g_error_free(err);
+        g_free(name);
+    } else {
+        success = true;
+    }
+
+    if (message)
+        gst_message_unref(message);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    return success;
+}
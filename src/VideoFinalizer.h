@@ -0,0 +1,125 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ *  The VideoFinalizer class closes the files of the recordings stopped, off the thread of the
+ *  stop command: the end of stream was sent to the pipeline, the muxer still has to write its
+ *  index. A thread shared by all the cameras waits for the end of stream of each pipeline in
+ *  turn, releases it and tells whether the file is complete.
+ *
+ *  A pipeline opening the camera device itself holds it until its source is released, before
+ *  the file is closed: a recording of the device can start again once the source is gone.
+ *
+ *  The bus of a pipeline given must have no watch left, its messages are read by the finalizer.
+ */
+class VideoFinalizer {
+public:
+    /**
+     *  Called on the finalizer thread once the pipeline is released.
+     *
+     *  @param[in] success True if the end of stream reached the sinks, false on an error of the
+     *                     pipeline or if it did not end in time.
+     */
+    typedef std::function<void(bool success)> Callback;
+
+    /* Finalizer of the process, created on the first call */
+    static std::shared_ptr<VideoFinalizer> get();
+
+    VideoFinalizer();
+    ~VideoFinalizer();
+
+    /**
+     *  Mark a camera device as held by a pipeline being stopped, until releaseDevice() or the end
+     *  of the finalization of the pipeline.
+     *
+     *  @param[in] device Camera device.
+     *
+     *  @return Hold of the device, to give to releaseDevice() and finalize().
+     */
+    uint64_t holdDevice(const std::string &device);
+
+    /**
+     *  Release a camera device held, once the source of the pipeline closed it. Can be called
+     *  from any thread, before or after finalize().
+     *
+     *  @param[in] hold Hold returned by holdDevice().
+     */
+    void releaseDevice(uint64_t hold);
+
+    /**
+     *  Queue a pipeline which was sent the end of stream.
+     *
+     *  @param[in] name Name of the recording, for logs.
+     *  @param[in] pipeline Pipeline, the reference is taken by the finalizer.
+     *  @param[in] cb Callback once the file is closed, may be empty.
+     *  @param[in] hold Hold of the device released at the latest with the pipeline, 0 for none.
+     */
+    void finalize(const std::string &name, GstElement *pipeline, Callback cb, uint64_t hold = 0);
+
+    /**
+     *  Wait for a camera device to be released by the pipelines being stopped, for a recording
+     *  which opens the device itself.
+     *
+     *  @param[in] device Camera device.
+     *  @param[in] timeoutMs Maximum time waited in milliseconds.
+     *
+     *  @return 0 once released, -1 on timeout.
+     */
+    int waitDevice(const std::string &device, uint32_t timeoutMs);
+
+    /**
+     *  Wait for the files of all the pipelines queued to be closed.
+     *
+     *  @param[in] timeoutMs Maximum time waited in milliseconds.
+     *
+     *  @return 0 once all closed, -1 on timeout.
+     */
+    int wait(uint32_t timeoutMs);
+
+    /* Pipelines queued or being finalized */
+    size_t getPending();
+
+private:
+    struct Job {
+        std::string name;
+        GstElement *pipeline;
+        Callback cb;
+        uint64_t hold;
+    };
+
+    void run();
+    static bool drain(GstElement *pipeline);
+    std::deque<Job> mJobs;                  /* Front one is being finalized */
+    std::map<uint64_t, std::string> mHolds; /* Devices held, by hold */
+    uint64_t mNextHold;
+    std::mutex mLock;
+    std::condition_variable mQueued;
+    std::condition_variable mDone; /* Job done or device released */
+    bool mRunning;
+    std::thread mThread;
+};
@@ -16,12 +16,19 @@
  * limitations under the License.
  */
 
+#include <cstdlib>
 #include <gst/app/gstappsrc.h>
 
+#include "EncoderRegistry.h"
+#include "FrameBufferGst.h"
+#include "FrameTap.h"
+#include "V4l2Source.h"
 #include "VideoStreamRtsp.h"
+#include "pixel_convert.h"
 
 #define DEFAULT_HOST "127.0.0.1"
 #define DEFAULT_SERVICE_PORT 8554
+#define FRAME_TIMEOUT_MS 1000
 
 GstRTSPServer *VideoStreamRtsp::mServer = nullptr;
 bool VideoStreamRtsp::isAttach = false;
@@ -68,18 +75,7 @@ static std::string getGstVideoConvertorCaps(std::map<std::string, std::string> &
 
 static std::string getGstVideoEncoder(CameraParameters::VIDEO_CODING_FORMAT encFormat)
 {
-    std::string enc;
-
-    switch (encFormat) {
-    case CameraParameters::VIDEO_CODING_AVC:
-        enc = std::string("vaapih264enc");
-        break;
-    default:
-        enc = std::string("vaapih264enc");
-        break;
-    }
-
-    return enc;
+    return EncoderRegistry::getEncoder(encFormat);
 }
 
 static std::string getGstRtspVideoSink()
@@ -102,29 +98,20 @@ static std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat)
     case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
         pix = "UYVY";
         break;
-    default:
-        pix = "I420";
-    }
-
-    return pix;
-}
-
-static float getBytesPerPixel(CameraParameters::PixelFormat pixFormat)
-{
-    float ret = 2;
-
-    switch (pixFormat) {
-    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
-        ret = 3;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        pix = "YUY2";
         break;
-    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
-        ret = 2;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        pix = "GRAY8";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        pix = "NV12";
         break;
     default:
-        ret = 2;
+        pix = "I420";
     }
 
-    return ret;
+    return pix;
 }
 
 static void addParam(std::map<std::string, std::string> &map, const std::string &param)
@@ -157,8 +144,10 @@ static std::map<std::string, std::string> parseUrlQuery(const char *query)
     return map;
 }
 
-VideoStreamRtsp::VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev)
+VideoStreamRtsp::VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
     , mState(STATE_IDLE)
     , mWidth(0)
     , mHeight(0)
@@ -358,7 +347,28 @@ std::string VideoStreamRtsp::getGstPipeline(std::map<std::string, std::string> &
     std::string name;
     std::string source;
     if (mCamDev->isGstV4l2Src()) {
-        source = "v4l2src device=/dev/" + mCamDev->getDeviceId();
+        source = std::string("v4l2src name=") + FrameTap::SOURCE_NAME + " device=/dev/"
+            + mCamDev->getDeviceId();
+
+        /* Size of the stream, as set by getGstVideoConvertorCaps() */
+        uint32_t width = mWidth, height = mHeight;
+        if (!params["width"].empty() && !params["height"].empty()) {
+            width = strtoul(params["width"].c_str(), nullptr, 10);
+            height = strtoul(params["height"].c_str(), nullptr, 10);
+        }
+
+        /* Compressed frames of the camera are sent as they are */
+        V4l2Source v4l2 = getV4l2Source(mCamDev->getDeviceId(), width, height, 0);
+        if (v4l2.format == V4l2Source::H264)
+            name = source + " ! " + v4l2.filter + " ! rtph264pay name=pay0 config-interval=-1";
+        else if (v4l2.format == V4l2Source::MJPEG)
+            name = source + " ! " + v4l2.filter + " ! rtpjpegpay name=pay0";
+        if (!name.empty()) {
+            log_debug("%s:%s", __func__, name.c_str());
+            return name;
+        }
+        if (!v4l2.filter.empty())
+            source += " ! " + v4l2.filter;
     } else {
         source = "appsrc name=mysrc";
     }
@@ -371,26 +381,28 @@ std::string VideoStreamRtsp::getGstPipeline(std::map<std::string, std::string> &
     return name;
 }
 
-GstBuffer *VideoStreamRtsp::readFrame()
+GstBuffer *VideoStreamRtsp::readFrame(FrameHub::Consumer *consumer)
 {
     // log_debug("%s::%s", typeid(this).name(), __func__);
 
-    GstBuffer *buffer;
+    GstBuffer *buffer = nullptr;
     CameraData data;
-    CameraDevice::Status ret = CameraDevice::Status::ERROR_UNKNOWN;
-    ret = mCamDev->read(data);
-    /* add retry logic? */
-    if (ret == CameraDevice::Status::SUCCESS) {
-        gsize size = data.bufSize;
-        gsize offset = 0;
-        gsize maxsize = size;
-        buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, data.buf, maxsize, offset, size,
-                                             NULL, NULL);
+    if (consumer) {
+        /* Latest frame of the camera, never waits for frames the encoder could not keep up with */
+        if (consumer->pop(data, FRAME_TIMEOUT_MS))
+            buffer = wrapCameraData(data);
     } else {
+        CameraDevice::Status ret = mCamDev->read(data);
+        /* add retry logic? */
+        if (ret == CameraDevice::Status::SUCCESS)
+            buffer = wrapCameraData(data);
+    }
+
+    if (!buffer) {
         log_error("Camera returned no frame");
         uint32_t width, height;
         getCameraResolution(width, height);
-        gsize size = width * height * getBytesPerPixel(getCameraPixelFormat());
+        gsize size = pixel_get_frame_size(getCameraPixelFormat(), width, height);
         buffer = gst_buffer_new_allocate(NULL, size, NULL);
         /* this makes the image white */
         gst_buffer_memset(buffer, 0, 0xff, size);
@@ -399,13 +411,29 @@ GstBuffer *VideoStreamRtsp::readFrame()
     return buffer;
 }
 
+/* appsrc of one media, each media gets its own queue on the frame hub */
+struct AppSrcContext {
+    VideoStreamRtsp *obj;
+    std::shared_ptr<FrameHub> frameHub;
+    std::shared_ptr<FrameHub::Consumer> consumer;
+};
+
+static void cb_appsrc_destroy(gpointer user_data)
+{
+    AppSrcContext *ctx = reinterpret_cast<AppSrcContext *>(user_data);
+
+    if (ctx->frameHub)
+        ctx->frameHub->unsubscribe(ctx->consumer);
+    delete ctx;
+}
+
 /* called when we need to give data to appsrc */
 static void cb_need_data(GstAppSrc *appsrc, guint unused, gpointer user_data)
 {
     GstFlowReturn ret;
-    VideoStreamRtsp *obj = reinterpret_cast<VideoStreamRtsp *>(user_data);
+    AppSrcContext *ctx = reinterpret_cast<AppSrcContext *>(user_data);
 
-    GstBuffer *buffer = obj->readFrame();
+    GstBuffer *buffer = ctx->obj->readFrame(ctx->consumer.get());
     if (buffer) {
         ret = gst_app_src_push_buffer(appsrc, buffer);
         if (ret != GST_FLOW_OK) {
@@ -415,6 +443,14 @@ static void cb_need_data(GstAppSrc *appsrc, guint unused, gpointer user_data)
     }
 }
 
+static void cb_frame_tap_destroy(gpointer user_data)
+{
+    std::shared_ptr<FrameTap> *tap = reinterpret_cast<std::shared_ptr<FrameTap> *>(user_data);
+
+    (*tap)->detach();
+    delete tap;
+}
+
 /*
  * ### For future reference ###
  * After setup request, gst-rtsp-server does following to construct media and pipeline
@@ -446,6 +482,10 @@ static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSP
 
     log_info("GST Pipeline: %s", launch.c_str());
 
+    /* Still capture stops streaming the camera, the stream opens the device itself */
+    if (launch.find("appsrc") == std::string::npos)
+        FrameTap::releaseDevice(obj->getCameraDevice()->getDeviceId());
+
     GError *error = NULL;
     GstElement *pipeline = NULL;
     /* create new pipeline */
@@ -463,8 +503,15 @@ static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSP
     }
 
     /* return if not appsrc pipeline, else configure */
-    if (launch.find("appsrc") == std::string::npos)
+    if (launch.find("appsrc") == std::string::npos) {
+        /* Still capture takes its frames from the stream while it runs */
+        std::shared_ptr<FrameTap> tap
+            = FrameTap::attach(obj->getCameraDevice()->getDeviceId(), pipeline);
+        if (tap)
+            g_object_set_data_full(G_OBJECT(pipeline), "frame-tap",
+                                   new std::shared_ptr<FrameTap>(tap), cb_frame_tap_destroy);
         return pipeline;
+    }
 
     /* configure the appsrc element*/
     GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "mysrc");
@@ -488,7 +535,12 @@ static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSP
     cbs.need_data = cb_need_data;
     cbs.enough_data = NULL;
     cbs.seek_data = NULL;
-    gst_app_src_set_callbacks(GST_APP_SRC_CAST(appsrc), &cbs, obj, NULL);
+    AppSrcContext *ctx = new AppSrcContext();
+    ctx->obj = obj;
+    ctx->frameHub = obj->getFrameHub();
+    if (ctx->frameHub)
+        ctx->consumer = ctx->frameHub->subscribe("rtsp", FrameHub::LATEST_FRAME);
+    gst_app_src_set_callbacks(GST_APP_SRC_CAST(appsrc), &cbs, ctx, cb_appsrc_destroy);
 
     gst_object_unref(appsrc);
 
@@ -499,6 +551,13 @@ static void cb_unprepared(GstRTSPMedia *media, gpointer user_data)
 {
     log_debug("%s", __func__);
 
+    /* Stream no longer reads the camera, still capture opens it again */
+    GstElement *element = gst_rtsp_media_get_element(media);
+    if (element) {
+        g_object_set_data(G_OBJECT(element), "frame-tap", NULL);
+        gst_object_unref(element);
+    }
+
     /* TODO:: Stop camera device capturing*/
 }
 
@@ -25,12 +25,14 @@
 #include <string>
 
 #include "CameraDevice.h"
+#include "FrameHub.h"
 #include "VideoStream.h"
 #include "log.h"
 
 class VideoStreamRtsp final : public VideoStream {
 public:
-    VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev);
+    VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
     ~VideoStreamRtsp();
 
     int init();
@@ -51,8 +53,9 @@ public:
     int getCameraResolution(uint32_t &width, uint32_t &height);
     CameraParameters::PixelFormat getCameraPixelFormat();
     std::string getGstPipeline(std::map<std::string, std::string> &params);
-    GstBuffer *readFrame();
+    GstBuffer *readFrame(FrameHub::Consumer *consumer);
     std::shared_ptr<CameraDevice> getCameraDevice() { return mCamDev;  };
+    std::shared_ptr<FrameHub> getFrameHub() { return mFrameHub; };
 
 private:
     GstRTSPServer *createRtspServer();
@@ -62,6 +65,7 @@ private:
     int startRtspServer();
     int stopRtspServer();
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
     std::atomic<int> mState;
     uint32_t mWidth;
     uint32_t mHeight;
@@ -20,11 +20,37 @@
 #include <gst/gst.h>
 #include <unistd.h>
 
+#include "EncoderRegistry.h"
+#include "FrameBufferGst.h"
 #include "VideoStreamUdp.h"
 #include "log.h"
+#include "pixel_convert.h"
 
-VideoStreamUdp::VideoStreamUdp(std::shared_ptr<CameraDevice> camDev)
+#define FRAME_TIMEOUT_MS 1000
+
+static const char *getGstPixFormat(CameraParameters::PixelFormat pixFormat)
+{
+    switch (pixFormat) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return "RGB";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return "UYVY";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return "YUY2";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return "GRAY8";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return "NV12";
+    default:
+        return "I420";
+    }
+}
+
+VideoStreamUdp::VideoStreamUdp(std::shared_ptr<CameraDevice> camDev,
+                               std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mFrameConsumer(nullptr)
     , mState(STATE_IDLE)
     , mWidth(640)
     , mHeight(360)
@@ -154,20 +180,22 @@ std::string VideoStreamUdp::getTextOverlay()
 
 GstBuffer *VideoStreamUdp::readFrame()
 {
-    GstBuffer *buffer;
+    GstBuffer *buffer = nullptr;
     static GstClockTime timestamp = 0;
     CameraData data;
-    CameraDevice::Status ret = mCamDev->read(data);
-    if (ret == CameraDevice::Status::SUCCESS) {
-        gsize size = data.bufSize;
-        gsize offset = 0;
-        gsize maxsize = size;
-        buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, data.buf, maxsize, offset, size,
-                                             NULL, NULL);
-    } else {
+    if (mFrameConsumer) {
+        if (mFrameConsumer->pop(data, FRAME_TIMEOUT_MS))
+            buffer = wrapCameraData(data);
+    } else if (mCamDev->read(data) == CameraDevice::Status::SUCCESS) {
+        buffer = wrapCameraData(data);
+    }
+
+    if (!buffer) {
         log_error("Camera returned no frame");
-        // TODO :: Change the multiplication factor based on pix format
-        gsize size = mWidth * mHeight * 3;
+        CameraParameters::PixelFormat format = CameraParameters::PIXEL_FORMAT_YUV420;
+        if (mCamDev->getPixelFormat(format) != CameraDevice::Status::SUCCESS)
+            return nullptr;
+        gsize size = pixel_get_frame_size(format, mWidth, mHeight);
         buffer = gst_buffer_new_allocate(NULL, size, NULL);
         // this makes the image white
         gst_buffer_memset(buffer, 0, 0xff, size);
@@ -229,11 +257,18 @@ int VideoStreamUdp::createAppsrcPipeline()
     GstElement *src, *conv, *enc, *parser, *payload, *sink;
     GstCaps *caps;
 
+    // Appsrc caps follow the frames of the camera
+    CameraParameters::PixelFormat format = CameraParameters::PIXEL_FORMAT_YUV420;
+    if (mCamDev->getPixelFormat(format) != CameraDevice::Status::SUCCESS) {
+        log_error("Camera pixel format unknown");
+        return -1;
+    }
+
     mPipeline = gst_pipeline_new("UdpStream");
     src = gst_element_factory_make("appsrc", "VideoSrc");
     conv = gst_element_factory_make("videoconvert", "Conv");
     mTextOverlay = gst_element_factory_make("textoverlay", "textoverlay");
-    enc = gst_element_factory_make("x264enc", "H264Enc");
+    enc = EncoderRegistry::makeEncoder(CameraParameters::VIDEO_CODING_AVC, 0, 25);
     parser = gst_element_factory_make("h264parse", "Parser");
     payload = gst_element_factory_make("rtph264pay", "H264Rtp");
     sink = gst_element_factory_make("udpsink", "UdpSink");
@@ -244,12 +279,12 @@ int VideoStreamUdp::createAppsrcPipeline()
         return -1;
     }
 
-    // Set appsrc caps
-    // TODO :: Remove the format hardcode
+    // Set appsrc caps, videoconvert is passthrough when the camera gives I420
     gst_app_src_set_caps(GST_APP_SRC(src),
-                         gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB", "width",
-                                             G_TYPE_INT, mWidth, "height", G_TYPE_INT, mHeight,
-                                             "framerate", GST_TYPE_FRACTION, 25, 1, NULL));
+                         gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING,
+                                             getGstPixFormat(format), "width", G_TYPE_INT, mWidth,
+                                             "height", G_TYPE_INT, mHeight, "framerate",
+                                             GST_TYPE_FRACTION, 25, 1, NULL));
 
     // Setup appsrc
     g_object_set(G_OBJECT(src), "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
@@ -284,6 +319,11 @@ int VideoStreamUdp::createAppsrcPipeline()
     cbs.seek_data = cb_seek_data;
     gst_app_src_set_callbacks(GST_APP_SRC_CAST(src), &cbs, this, NULL);
 
+    // Share the camera frames with the other consumers, if supported by the device.
+    // Live stream only takes the latest frame so latency does not build up.
+    if (mFrameHub)
+        mFrameConsumer = mFrameHub->subscribe("udp", FrameHub::LATEST_FRAME);
+
     // Set pipeline to play
     gst_element_set_state(mPipeline, GST_STATE_PLAYING);
 
@@ -296,9 +336,14 @@ int VideoStreamUdp::destroyAppsrcPipeline()
 
     int ret = 0;
 
+    // Unblock the streaming thread waiting for a frame
+    if (mFrameHub)
+        mFrameHub->unsubscribe(mFrameConsumer);
+
     // clean up
     gst_element_set_state(mPipeline, GST_STATE_NULL);
     gst_object_unref(GST_OBJECT(mPipeline));
+    mFrameConsumer.reset();
 
     return ret;
 }
@@ -22,11 +22,13 @@
 #include <memory>
 
 #include "CameraDevice.h"
+#include "FrameHub.h"
 #include "VideoStream.h"
 
 class VideoStreamUdp final : public VideoStream {
 public:
-    VideoStreamUdp(std::shared_ptr<CameraDevice> camDev);
+    VideoStreamUdp(std::shared_ptr<CameraDevice> camDev,
+                   std::shared_ptr<FrameHub> frameHub = nullptr);
     ~VideoStreamUdp();
 
     int init();
@@ -53,6 +55,8 @@ private:
     int createAppsrcPipeline();
     int destroyAppsrcPipeline();
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
+    std::shared_ptr<FrameHub::Consumer> mFrameConsumer;
     std::atomic<int> mState;
     uint32_t mWidth;
     uint32_t mHeight;
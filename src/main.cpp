@@ -19,6 +19,8 @@
 #include <assert.h>
 #include <dirent.h>
 #include <getopt.h>
+#include <glib-unix.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -30,6 +32,7 @@
 #include "settings.h"
 #include "util.h"
 #include "CameraServer.h"
+#include "CaptureLatency.h"
 
 #define DEFAULT_CONFFILE "/etc/dcm/main.conf"
 #define DEFAULT_CONF_DIR "/etc/dcm/config.d"
@@ -158,6 +161,12 @@ fail:
     return ret;
 }
 
+static gboolean dump_latency_handler(gpointer user_data)
+{
+    CaptureLatency::dumpAll();
+    return G_SOURCE_CONTINUE;
+}
+
 static int log_level_from_str(const char *str)
 {
     if (strcaseeq(str, "error"))
@@ -253,6 +262,9 @@ int main(int argc, char *argv[])
     CameraServer camServer(*conf);
     camServer.start();
 
+    /* kill -USR1 logs the time taken by the stages of the captures so far */
+    g_unix_signal_add(SIGUSR1, dump_latency_handler, nullptr);
+
     delete conf;
     log_debug("Starting Dronecode Camera Manager");
 
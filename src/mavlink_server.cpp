@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
 #include <cstddef>
@@ -25,6 +26,7 @@
 #include "log.h"
 #include "mainloop.h"
 #include "mavlink_server.h"
+#include "PoseCache.h"
 #include "util.h"
 
 using namespace std::placeholders;
@@ -34,12 +36,18 @@ using namespace std::placeholders;
 #define DEFAULT_RTSP_SERVER_ADDR "0.0.0.0"
 #define MAX_MAVLINK_MESSAGE_SIZE 1024
 #define DEFAULT_SYSTEM_ID 1
+/* Tick of the status streams, highest frequency they are sent at */
+#define CAPTURE_STATUS_TICK_MS 50
 
 static const float epsilon = std::numeric_limits<float>::epsilon();
 
+bool _capture_status_cb(void *data);
+bool _image_captured_main_cb(void *data);
+
 MavlinkServer::MavlinkServer(const ConfFile &conf)
     : _is_running(false)
     , _timeout_handler(0)
+    , _status_timeout_handler(0)
     , _broadcast_addr{}
     , _is_sys_id_found(false)
     , _system_id(DEFAULT_SYSTEM_ID)
@@ -192,8 +200,8 @@ void MavlinkServer::_handle_request_storage_information(const struct sockaddr_in
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
-        // TODO:: Fill with appropriate value
-        const StorageInfo &storeInfo = tgtComp->getStorageInfo();
+        /* Values cached by the storage monitor, the file system is not read here */
+        const StorageInfo storeInfo = tgtComp->getStorageInfo();
         mavlink_msg_storage_information_pack(_system_id, cmd.target_component, &msg, 0,
                                              storeInfo.storage_id, storeInfo.storage_count,
                                              storeInfo.status, storeInfo.total_capacity,
@@ -237,10 +245,11 @@ void MavlinkServer::_handle_image_start_capture(const struct sockaddr_in &addr,
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
+        tgtComp->getLatency()->command(CaptureLatency::IMAGE);
         cb_data.comp_id = cmd.target_component;
         cb_data.addr = addr;
         if (!tgtComp->startImageCapture(
-                (uint32_t)cmd.param2 /*interval*/, (uint32_t)cmd.param3 /*count*/,
+                cmd.param2 /*interval in sec*/, (uint32_t)cmd.param3 /*count*/,
                 std::bind(&MavlinkServer::_image_captured_cb, this, cb_data, _1, _2)))
             success = true;
     }
@@ -267,24 +276,58 @@ void MavlinkServer::_handle_image_stop_capture(const struct sockaddr_in &addr,
 void MavlinkServer::_image_captured_cb(image_callback_t cb_data, int result, int seq_num)
 {
     log_debug("%s result:%d seq:%d", __func__, result, seq_num);
+
+    /* Called from the encoder threads, the message is sent from the main loop */
+    image_captured *data = new image_captured{this, cb_data, result, seq_num};
+    Mainloop::get_mainloop()->add_timeout(0, _image_captured_main_cb, data);
+}
+
+bool _image_captured_main_cb(void *data)
+{
+    assert(data);
+    image_captured *captured = (image_captured *)data;
+
+    captured->server->_send_image_captured(captured->cb_data, captured->result,
+                                           captured->seq_num);
+    delete captured;
+
+    return false;
+}
+
+void MavlinkServer::_send_image_captured(const image_callback_t &cb_data, int result,
+                                         int seq_num)
+{
     log_debug("Comp Id:%d", cb_data.comp_id);
-    // TODO :: Fill MAVLINK message with correct info including geo location etc
-    bool success = !result;
-    mavlink_message_t msg;
-    float q[4] = {0}; // Quaternion of camera orientation
-    mavlink_msg_camera_image_captured_pack(
-        _system_id, cb_data.comp_id, &msg, 0 /*time_boot_ms*/, 0 /*time_utc*/, 1 /*camera_id*/,
-        0 /*lat*/, 0 /*lon*/, 0 /*alt*/, 0 /*relative_alt*/, q, seq_num /*image_index*/,
-        success /*capture_result*/, 0 /*file_url*/);
 
-    if (!_send_mavlink_message(&cb_data.addr, msg)) {
-        log_error("Sending camera image captured failed for camera %d.", cb_data.comp_id);
+    if (!_send_camera_image_captured(cb_data.comp_id, cb_data.addr, seq_num, !result))
         return;
-    }
+
+    CameraComponent *tgtComp = getCameraComponent(cb_data.comp_id);
+    if (tgtComp)
+        tgtComp->getLatency()->messageSent(seq_num);
 
     _send_camera_capture_status(cb_data.comp_id, cb_data.addr);
 }
 
+void MavlinkServer::_handle_request_camera_image_capture(const struct sockaddr_in &addr,
+                                                         mavlink_command_long_t &cmd)
+{
+    log_debug("%s", __func__);
+
+    bool success = false;
+    CaptureCatalog::Record record;
+
+    /* Only images in the catalog, captured or failed, are sent again */
+    CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
+    if (tgtComp && cmd.param1 >= 0
+        && !tgtComp->getImageCaptureRecord((uint32_t)cmd.param1 /*image index*/, record)
+        && record.state != CaptureCatalog::STATE_PENDING)
+        success = _send_camera_image_captured(cmd.target_component, addr, record.seq,
+                                              record.state == CaptureCatalog::STATE_DONE);
+
+    _send_ack(addr, cmd.command, cmd.target_component, success);
+}
+
 void MavlinkServer::_handle_video_start_capture(const struct sockaddr_in &addr,
                                                 mavlink_command_long_t &cmd)
 {
@@ -292,15 +335,23 @@ void MavlinkServer::_handle_video_start_capture(const struct sockaddr_in &addr,
     bool success = false;
     image_callback_t cb_data;
 
+    usec_t commandUs = now_usec();
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
+        tgtComp->getLatency()->command(CaptureLatency::VIDEO_START, commandUs);
         cb_data.comp_id = cmd.target_component;
         memcpy(&cb_data.addr, &addr, sizeof(struct sockaddr_in));
-        if (!tgtComp->startVideoCapture((uint32_t)cmd.param2 /*camera_Capture_status freq*/))
+        if (!tgtComp->startVideoCapture())
             success = true;
     }
 
     _send_ack(addr, cmd.command, cmd.target_component, success);
+    if (success) {
+        tgtComp->getLatency()->mark(CaptureLatency::VIDEO_START,
+                                    CaptureLatency::STAGE_MESSAGE_SENT, commandUs);
+        _add_capture_status_stream(cmd.target_component, addr,
+                                   cmd.param2 /*camera_capture_status freq*/);
+    }
 }
 
 void MavlinkServer::_handle_video_stop_capture(const struct sockaddr_in &addr,
@@ -310,13 +361,20 @@ void MavlinkServer::_handle_video_stop_capture(const struct sockaddr_in &addr,
 
     bool success = false;
 
+    usec_t commandUs = now_usec();
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
+        tgtComp->getLatency()->command(CaptureLatency::VIDEO_STOP, commandUs);
         if (!tgtComp->stopVideoCapture())
             success = true;
     }
 
     _send_ack(addr, cmd.command, cmd.target_component, success);
+    if (success) {
+        tgtComp->getLatency()->mark(CaptureLatency::VIDEO_STOP,
+                                    CaptureLatency::STAGE_MESSAGE_SENT, commandUs);
+        _remove_capture_status_streams(cmd.target_component);
+    }
 }
 
 void MavlinkServer::_handle_request_camera_capture_status(const struct sockaddr_in &addr,
@@ -496,6 +554,31 @@ void MavlinkServer::_handle_heartbeat(const struct sockaddr_in &addr, mavlink_me
     }
 }
 
+void MavlinkServer::_handle_global_position_int(mavlink_message_t *msg)
+{
+    mavlink_global_position_int_t global_position;
+    mavlink_msg_global_position_int_decode(msg, &global_position);
+
+    PoseCache::Position position;
+    position.lat = global_position.lat;
+    position.lon = global_position.lon;
+    position.alt = global_position.alt;
+    position.relativeAlt = global_position.relative_alt;
+    position.vx = global_position.vx;
+    position.vy = global_position.vy;
+    position.vz = global_position.vz;
+    PoseCache::getInstance().pushPosition(global_position.time_boot_ms, position);
+}
+
+void MavlinkServer::_handle_attitude_quaternion(mavlink_message_t *msg)
+{
+    mavlink_attitude_quaternion_t attitude;
+    mavlink_msg_attitude_quaternion_decode(msg, &attitude);
+
+    float q[4] = {attitude.q1, attitude.q2, attitude.q3, attitude.q4};
+    PoseCache::getInstance().pushAttitude(attitude.time_boot_ms, q);
+}
+
 void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavlink_message_t *msg)
 {
     // log_debug("Message received: (sysid: %d compid: %d msgid: %d)", msg->sysid, msg->compid,
@@ -555,6 +638,9 @@ void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavl
             this->_handle_video_stop_capture(addr, cmd);
             break;
         case MAV_CMD_REQUEST_CAMERA_IMAGE_CAPTURE:
+            log_debug("MAV_CMD_REQUEST_CAMERA_IMAGE_CAPTURE");
+            this->_handle_request_camera_image_capture(addr, cmd);
+            break;
         case MAV_CMD_DO_TRIGGER_CONTROL:
         case MAV_CMD_VIDEO_START_STREAMING:
         case MAV_CMD_VIDEO_STOP_STREAMING:
@@ -568,6 +654,15 @@ void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavl
             if (!_is_sys_id_found)
                 this->_handle_heartbeat(addr, msg);
             break;
+        case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+            /* Pose of the vehicle, to geotag the images */
+            if (msg->sysid == _system_id && msg->compid == MAV_COMP_ID_AUTOPILOT1)
+                this->_handle_global_position_int(msg);
+            break;
+        case MAVLINK_MSG_ID_ATTITUDE_QUATERNION:
+            if (msg->sysid == _system_id && msg->compid == MAV_COMP_ID_AUTOPILOT1)
+                this->_handle_attitude_quaternion(msg);
+            break;
         case MAVLINK_MSG_ID_PARAM_EXT_REQUEST_READ:
             this->_handle_param_ext_request_read(addr, msg);
             break;
@@ -602,22 +697,23 @@ bool MavlinkServer::_send_camera_capture_status(int compid, const struct sockadd
 
     bool success = false;
     mavlink_message_t msg;
-    uint32_t time_boot_ms = 0;
+    uint32_t time_boot_ms = now_usec() / USEC_PER_MSEC;
     uint8_t image_status = 0;
     uint8_t video_status = 0;
-    int image_interval = 0;
+    float image_interval = 0;
     uint32_t recording_time_ms = 0;
-    int available_capacity = 50; // in MiB
+    float available_capacity = 0; // in MiB
     CameraComponent *tgtComp = getCameraComponent(compid);
     if (tgtComp) {
+        available_capacity = tgtComp->getStorageInfo().available_capacity;
         // Get image capture status
         tgtComp->getImageCaptureStatus(image_status, image_interval);
         // Get video capture status
         video_status = tgtComp->getVideoCaptureStatus();
+        recording_time_ms = tgtComp->getVideoCaptureTime();
         mavlink_msg_camera_capture_status_pack(_system_id, compid, &msg, time_boot_ms, image_status,
-                                               video_status, static_cast<float>(image_interval),
-                                               recording_time_ms,
-                                               static_cast<float>(available_capacity));
+                                               video_status, image_interval,
+                                               recording_time_ms, available_capacity);
         if (!_send_mavlink_message(&addr, msg)) {
             log_error("Sending camera setting failed for camera %d.", compid);
             return false;
@@ -629,6 +725,107 @@ bool MavlinkServer::_send_camera_capture_status(int compid, const struct sockadd
     return success;
 }
 
+void MavlinkServer::_add_capture_status_stream(int compid, const struct sockaddr_in &addr,
+                                               float freq)
+{
+    if (freq <= epsilon)
+        return;
+
+    usec_t period_us
+        = std::max<usec_t>(USEC_PER_SEC / freq, CAPTURE_STATUS_TICK_MS * USEC_PER_MSEC);
+    capture_status_stream stream = {compid, addr, period_us, now_usec() + period_us};
+
+    /* A client starting the recording again gets one stream, at the last frequency */
+    auto it = std::find_if(_status_streams.begin(), _status_streams.end(),
+                           [&](const capture_status_stream &s) {
+                               return s.comp_id == compid
+                                   && s.addr.sin_addr.s_addr == addr.sin_addr.s_addr
+                                   && s.addr.sin_port == addr.sin_port;
+                           });
+    if (it != _status_streams.end())
+        *it = stream;
+    else
+        _status_streams.push_back(stream);
+
+    if (!_status_timeout_handler)
+        _status_timeout_handler = Mainloop::get_mainloop()->add_timeout(CAPTURE_STATUS_TICK_MS,
+                                                                        _capture_status_cb, this);
+}
+
+void MavlinkServer::_remove_capture_status_streams(int compid)
+{
+    /* Last status tells the clients the recording is over */
+    for (auto it = _status_streams.begin(); it != _status_streams.end();) {
+        if (it->comp_id == compid) {
+            _send_camera_capture_status(it->comp_id, it->addr);
+            it = _status_streams.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    if (_status_streams.empty() && _status_timeout_handler) {
+        Mainloop::get_mainloop()->del_timeout(_status_timeout_handler);
+        _status_timeout_handler = 0;
+    }
+}
+
+bool _capture_status_cb(void *data)
+{
+    assert(data);
+    MavlinkServer *server = (MavlinkServer *)data;
+    usec_t now = now_usec();
+
+    for (auto it = server->_status_streams.begin(); it != server->_status_streams.end();) {
+        /* Recording ended without a stop command, on an error of the capture */
+        CameraComponent *tgtComp = server->getCameraComponent(it->comp_id);
+        if (!tgtComp || !tgtComp->getVideoCaptureStatus()) {
+            server->_send_camera_capture_status(it->comp_id, it->addr);
+            it = server->_status_streams.erase(it);
+            continue;
+        }
+
+        if (now >= it->next_us) {
+            server->_send_camera_capture_status(it->comp_id, it->addr);
+            /* A late tick delays the next status, no burst to catch up */
+            it->next_us = std::max(it->next_us + it->period_us, now + it->period_us / 2);
+        }
+        it++;
+    }
+
+    if (server->_status_streams.empty()) {
+        server->_status_timeout_handler = 0;
+        return false;
+    }
+    return true;
+}
+
+bool MavlinkServer::_send_camera_image_captured(int compid, const struct sockaddr_in &addr,
+                                                int seq_num, bool success)
+{
+    log_debug("%s", __func__);
+
+    /* Time, pose of the vehicle and file of the image from the catalog, if the directory has one */
+    CaptureCatalog::Record record = {};
+    CameraComponent *tgtComp = getCameraComponent(compid);
+    if (tgtComp)
+        tgtComp->getImageCaptureRecord(seq_num, record);
+
+    mavlink_message_t msg;
+    mavlink_msg_camera_image_captured_pack(
+        _system_id, compid, &msg, record.timeBootMs /*time_boot_ms*/,
+        record.timeUtcUs /*time_utc*/, 1 /*camera_id*/, record.lat, record.lon, record.alt,
+        record.relativeAlt, record.q, seq_num /*image_index*/, success /*capture_result*/,
+        record.path /*file_url*/);
+
+    if (!_send_mavlink_message(&addr, msg)) {
+        log_error("Sending camera image captured failed for camera %d.", compid);
+        return false;
+    }
+
+    return true;
+}
+
 bool MavlinkServer::_send_mavlink_message(const struct sockaddr_in *addr, mavlink_message_t &msg)
 {
     uint8_t buffer[MAX_MAVLINK_MESSAGE_SIZE];
@@ -686,6 +883,11 @@ void MavlinkServer::stop()
 
     if (_timeout_handler > 0)
         Mainloop::get_mainloop()->del_timeout(_timeout_handler);
+
+    if (_status_timeout_handler > 0)
+        Mainloop::get_mainloop()->del_timeout(_status_timeout_handler);
+    _status_timeout_handler = 0;
+    _status_streams.clear();
 }
 
 int MavlinkServer::addCameraComponent(CameraComponent *camComp)
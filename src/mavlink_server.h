@@ -31,6 +31,24 @@ typedef struct image_callback {
     struct sockaddr_in addr; /* Requester address */
 } image_callback_t;
 
+class MavlinkServer;
+
+/* Result of an image, passed from the thread of its encoder to the main loop */
+struct image_captured {
+    MavlinkServer *server;
+    image_callback_t cb_data;
+    int result;
+    int seq_num;
+};
+
+/* CAMERA_CAPTURE_STATUS sent to a client while a camera records */
+struct capture_status_stream {
+    int comp_id;             /* Component ID */
+    struct sockaddr_in addr; /* Requester address */
+    uint64_t period_us;      /* Period asked by the requester */
+    uint64_t next_us;        /* Next status due, monotonic time */
+};
+
 class MavlinkServer {
 public:
     MavlinkServer(const ConfFile &conf);
@@ -44,6 +62,8 @@ public:
 private:
     bool _is_running;
     unsigned int _timeout_handler;
+    unsigned int _status_timeout_handler; /* Shared by all the status streams */
+    std::vector<capture_status_stream> _status_streams;
     UDPSocket _udp;
     struct sockaddr_in _broadcast_addr = {};
     bool _is_sys_id_found;
@@ -66,6 +86,9 @@ private:
     void _handle_video_start_capture(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
     void _handle_video_stop_capture(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
     void _image_captured_cb(image_callback_t cb_data, int result, int seq_num);
+    void _send_image_captured(const image_callback_t &cb_data, int result, int seq_num);
+    void _handle_request_camera_image_capture(const struct sockaddr_in &addr,
+                                              mavlink_command_long_t &cmd);
     void _handle_request_camera_capture_status(const struct sockaddr_in &addr,
                                                mavlink_command_long_t &cmd);
     void _handle_param_ext_request_read(const struct sockaddr_in &addr, mavlink_message_t *msg);
@@ -73,13 +96,21 @@ private:
     void _handle_param_ext_set(const struct sockaddr_in &addr, mavlink_message_t *msg);
     void _handle_reset_camera_settings(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
     void _handle_heartbeat(const struct sockaddr_in &addr, mavlink_message_t *msg);
+    void _handle_global_position_int(mavlink_message_t *msg);
+    void _handle_attitude_quaternion(mavlink_message_t *msg);
     bool _send_camera_capture_status(int compid, const struct sockaddr_in &addr);
+    void _add_capture_status_stream(int compid, const struct sockaddr_in &addr, float freq);
+    void _remove_capture_status_streams(int compid);
+    bool _send_camera_image_captured(int compid, const struct sockaddr_in &addr, int seq_num,
+                                     bool success);
     bool _send_mavlink_message(const struct sockaddr_in *addr, mavlink_message_t &msg);
     void _send_ack(const struct sockaddr_in &addr, int cmd, int comp_id, bool success);
 #if 0
     const Stream::FrameSize *_find_best_frame_size(Stream &s, uint32_t w, uint32_t v);
 #endif
     friend bool _heartbeat_cb(void *data);
+    friend bool _capture_status_cb(void *data);
+    friend bool _image_captured_main_cb(void *data);
 
     CameraParameters::Mode mav2dcmCameraMode(uint32_t mode);
     uint32_t dcm2mavCameraMode(CameraParameters::Mode mode);
@@ -0,0 +1,735 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <string.h>
+
+#include "pixel_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86 1
+#include <immintrin.h>
+/* Kernels are built for their instruction set only, and selected at runtime */
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Each kernel converts a line, or a pair of lines for 4:2:0 output, from pixel x and returns
+ * the first pixel it did not convert. The scalar kernels finish the lines.
+ */
+
+/* BT.601 limited range, 8 bits fixed point */
+static inline uint8_t rgb_to_y(int r, int g, int b)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t rgb_to_u(int r, int g, int b)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t rgb_to_v(int r, int g, int b)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static uint32_t rgb24_to_i420_c(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                                uint8_t *u, uint8_t *v, uint32_t x, uint32_t width)
+{
+    for (; x < width; x += 2) {
+        const uint8_t *a = s0 + 3 * x;
+        const uint8_t *b = s1 + 3 * x;
+
+        y0[x] = rgb_to_y(a[0], a[1], a[2]);
+        y0[x + 1] = rgb_to_y(a[3], a[4], a[5]);
+        y1[x] = rgb_to_y(b[0], b[1], b[2]);
+        y1[x + 1] = rgb_to_y(b[3], b[4], b[5]);
+
+        int r = (a[0] + a[3] + b[0] + b[3] + 2) >> 2;
+        int g = (a[1] + a[4] + b[1] + b[4] + 2) >> 2;
+        int bl = (a[2] + a[5] + b[2] + b[5] + 2) >> 2;
+        u[x / 2] = rgb_to_u(r, g, bl);
+        v[x / 2] = rgb_to_v(r, g, bl);
+    }
+
+    return x;
+}
+
+static uint32_t uyvy_to_i420_c(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                               uint8_t *u, uint8_t *v, uint32_t x, uint32_t width)
+{
+    for (; x < width; x += 2) {
+        const uint8_t *a = s0 + 2 * x;
+        const uint8_t *b = s1 + 2 * x;
+
+        y0[x] = a[1];
+        y0[x + 1] = a[3];
+        y1[x] = b[1];
+        y1[x + 1] = b[3];
+        u[x / 2] = (a[0] + b[0] + 1) >> 1;
+        v[x / 2] = (a[2] + b[2] + 1) >> 1;
+    }
+
+    return x;
+}
+
+static uint32_t uyvy_to_nv12_c(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                               uint8_t *uv, uint32_t x, uint32_t width)
+{
+    for (; x < width; x += 2) {
+        const uint8_t *a = s0 + 2 * x;
+        const uint8_t *b = s1 + 2 * x;
+
+        y0[x] = a[1];
+        y0[x + 1] = a[3];
+        y1[x] = b[1];
+        y1[x + 1] = b[3];
+        uv[x] = (a[0] + b[0] + 1) >> 1;
+        uv[x + 1] = (a[2] + b[2] + 1) >> 1;
+    }
+
+    return x;
+}
+
+static uint32_t gray8_to_rgb24_c(const uint8_t *s, uint8_t *d, uint32_t x, uint32_t width)
+{
+    for (; x < width; x++) {
+        d[3 * x] = s[x];
+        d[3 * x + 1] = s[x];
+        d[3 * x + 2] = s[x];
+    }
+
+    return x;
+}
+
+#ifdef PIXEL_X86
+/* 16 pixels of RGB24 to one vector per component */
+TARGET_SSSE3 static inline void rgb24_load_sse(const uint8_t *p, __m128i &r, __m128i &g,
+                                               __m128i &b)
+{
+    const __m128i p0 = _mm_loadu_si128((const __m128i *)p);
+    const __m128i p1 = _mm_loadu_si128((const __m128i *)(p + 16));
+    const __m128i p2 = _mm_loadu_si128((const __m128i *)(p + 32));
+
+    r = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(p0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1,
+                                                        -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(p1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14,
+                                                        -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(p2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7,
+                                           10, 13)));
+    g = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(p0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1,
+                                                        -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(p1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15,
+                                                        -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(p2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8,
+                                           11, 14)));
+    b = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(p0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1,
+                                                        -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(p1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1,
+                                                        -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(p2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9,
+                                           12, 15)));
+}
+
+/* Luma of 8 pixels, components are 16 bits */
+TARGET_SSSE3 static inline __m128i rgb_to_y_sse(__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_mullo_epi16(r, _mm_set1_epi16(66));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+TARGET_SSSE3 static inline __m128i rgb_to_y16_sse(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = rgb_to_y_sse(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero),
+                              _mm_unpacklo_epi8(b, zero));
+    __m128i hi = rgb_to_y_sse(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero),
+                              _mm_unpackhi_epi8(b, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* Rounded average of the 2x2 blocks of 16 pixels on 2 lines, 8 values of 16 bits */
+TARGET_SSSE3 static inline __m128i avg2x2_sse(__m128i c0, __m128i c1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(c0, zero), _mm_unpacklo_epi8(c1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(c0, zero), _mm_unpackhi_epi8(c1, zero));
+    __m128i sum = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+TARGET_SSSE3 static inline __m128i rgb_to_chroma_sse(__m128i r, __m128i g, __m128i b, short cr,
+                                                     short cg, short cb)
+{
+    __m128i c = _mm_mullo_epi16(r, _mm_set1_epi16(cr));
+    c = _mm_add_epi16(c, _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+    c = _mm_srai_epi16(_mm_add_epi16(c, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(c, _mm_set1_epi16(128));
+}
+
+TARGET_SSSE3 static uint32_t rgb24_to_i420_sse(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                               uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t x,
+                                               uint32_t width)
+{
+    for (; x + 16 <= width; x += 16) {
+        __m128i r0, g0, b0, r1, g1, b1;
+        rgb24_load_sse(s0 + 3 * x, r0, g0, b0);
+        rgb24_load_sse(s1 + 3 * x, r1, g1, b1);
+
+        _mm_storeu_si128((__m128i *)(y0 + x), rgb_to_y16_sse(r0, g0, b0));
+        _mm_storeu_si128((__m128i *)(y1 + x), rgb_to_y16_sse(r1, g1, b1));
+
+        __m128i r = avg2x2_sse(r0, r1);
+        __m128i g = avg2x2_sse(g0, g1);
+        __m128i b = avg2x2_sse(b0, b1);
+        __m128i uv = _mm_packus_epi16(rgb_to_chroma_sse(r, g, b, -38, -74, 112),
+                                      rgb_to_chroma_sse(r, g, b, 112, -94, -18));
+        _mm_storel_epi64((__m128i *)(u + x / 2), uv);
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_srli_si128(uv, 8));
+    }
+
+    return x;
+}
+
+/* Luma of 16 pixels of UYVY on 32 bytes */
+TARGET_SSSE3 static inline __m128i uyvy_to_y_sse(const uint8_t *p)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+/* Interleaved chroma of 16 pixels of UYVY on 2 lines, averaged vertically */
+TARGET_SSSE3 static inline __m128i uyvy_to_uv_sse(const uint8_t *p0, const uint8_t *p1)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    __m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)p0),
+                             _mm_loadu_si128((const __m128i *)p1));
+    __m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(p0 + 16)),
+                             _mm_loadu_si128((const __m128i *)(p1 + 16)));
+    return _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+}
+
+TARGET_SSSE3 static uint32_t uyvy_to_i420_sse(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                              uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t x,
+                                              uint32_t width)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+
+    for (; x + 16 <= width; x += 16) {
+        _mm_storeu_si128((__m128i *)(y0 + x), uyvy_to_y_sse(s0 + 2 * x));
+        _mm_storeu_si128((__m128i *)(y1 + x), uyvy_to_y_sse(s1 + 2 * x));
+
+        __m128i uv = uyvy_to_uv_sse(s0 + 2 * x, s1 + 2 * x);
+        uv = _mm_packus_epi16(_mm_and_si128(uv, mask), _mm_srli_epi16(uv, 8));
+        _mm_storel_epi64((__m128i *)(u + x / 2), uv);
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_srli_si128(uv, 8));
+    }
+
+    return x;
+}
+
+TARGET_SSSE3 static uint32_t uyvy_to_nv12_sse(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                              uint8_t *y1, uint8_t *uv, uint32_t x,
+                                              uint32_t width)
+{
+    for (; x + 16 <= width; x += 16) {
+        _mm_storeu_si128((__m128i *)(y0 + x), uyvy_to_y_sse(s0 + 2 * x));
+        _mm_storeu_si128((__m128i *)(y1 + x), uyvy_to_y_sse(s1 + 2 * x));
+        _mm_storeu_si128((__m128i *)(uv + x), uyvy_to_uv_sse(s0 + 2 * x, s1 + 2 * x));
+    }
+
+    return x;
+}
+
+TARGET_SSSE3 static uint32_t gray8_to_rgb24_sse(const uint8_t *s, uint8_t *d, uint32_t x,
+                                               uint32_t width)
+{
+    const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i m2
+        = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i g = _mm_loadu_si128((const __m128i *)(s + x));
+        _mm_storeu_si128((__m128i *)(d + 3 * x), _mm_shuffle_epi8(g, m0));
+        _mm_storeu_si128((__m128i *)(d + 3 * x + 16), _mm_shuffle_epi8(g, m1));
+        _mm_storeu_si128((__m128i *)(d + 3 * x + 32), _mm_shuffle_epi8(g, m2));
+    }
+
+    return x;
+}
+
+/*
+ * AVX2 packs within each 128 bits lane, the 64 bits quarters are put back in order after each
+ * pack. RGB24 is left to SSSE3, its 3 bytes pixels cannot be shuffled across lanes cheaply.
+ */
+#define AVX2_REORDER(v) _mm256_permute4x64_epi64(v, 0xd8)
+
+/* Luma of 32 pixels of UYVY on 64 bytes */
+TARGET_AVX2 static inline __m256i uyvy_to_y_avx2(const uint8_t *p)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+    return AVX2_REORDER(_mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)));
+}
+
+/* Interleaved chroma of 32 pixels of UYVY on 2 lines, averaged vertically */
+TARGET_AVX2 static inline __m256i uyvy_to_uv_avx2(const uint8_t *p0, const uint8_t *p1)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+    __m256i a = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)p0),
+                                _mm256_loadu_si256((const __m256i *)p1));
+    __m256i b = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(p0 + 32)),
+                                _mm256_loadu_si256((const __m256i *)(p1 + 32)));
+    return AVX2_REORDER(
+        _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)));
+}
+
+TARGET_AVX2 static uint32_t uyvy_to_i420_avx2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                              uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t x,
+                                              uint32_t width)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+
+    for (; x + 32 <= width; x += 32) {
+        _mm256_storeu_si256((__m256i *)(y0 + x), uyvy_to_y_avx2(s0 + 2 * x));
+        _mm256_storeu_si256((__m256i *)(y1 + x), uyvy_to_y_avx2(s1 + 2 * x));
+
+        __m256i uv = uyvy_to_uv_avx2(s0 + 2 * x, s1 + 2 * x);
+        uv = AVX2_REORDER(
+            _mm256_packus_epi16(_mm256_and_si256(uv, mask), _mm256_srli_epi16(uv, 8)));
+        _mm_storeu_si128((__m128i *)(u + x / 2), _mm256_castsi256_si128(uv));
+        _mm_storeu_si128((__m128i *)(v + x / 2), _mm256_extracti128_si256(uv, 1));
+    }
+    /* Avoid the SSE transition penalty in the caller */
+    _mm256_zeroupper();
+
+    return x;
+}
+
+TARGET_AVX2 static uint32_t uyvy_to_nv12_avx2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                              uint8_t *y1, uint8_t *uv, uint32_t x,
+                                              uint32_t width)
+{
+    for (; x + 32 <= width; x += 32) {
+        _mm256_storeu_si256((__m256i *)(y0 + x), uyvy_to_y_avx2(s0 + 2 * x));
+        _mm256_storeu_si256((__m256i *)(y1 + x), uyvy_to_y_avx2(s1 + 2 * x));
+        _mm256_storeu_si256((__m256i *)(uv + x), uyvy_to_uv_avx2(s0 + 2 * x, s1 + 2 * x));
+    }
+    _mm256_zeroupper();
+
+    return x;
+}
+#endif
+
+#ifdef PIXEL_NEON
+/* Luma of 8 pixels */
+static inline uint8x8_t rgb_to_y_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    uint16x8_t y = vmull_u8(r, vdup_n_u8(66));
+    y = vmlal_u8(y, g, vdup_n_u8(129));
+    y = vmlal_u8(y, b, vdup_n_u8(25));
+    return vadd_u8(vshrn_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+}
+
+static inline uint8x16_t rgb_to_y16_neon(const uint8x16x3_t &p)
+{
+    return vcombine_u8(
+        rgb_to_y_neon(vget_low_u8(p.val[0]), vget_low_u8(p.val[1]), vget_low_u8(p.val[2])),
+        rgb_to_y_neon(vget_high_u8(p.val[0]), vget_high_u8(p.val[1]), vget_high_u8(p.val[2])));
+}
+
+/* Rounded average of the 2x2 blocks of 16 pixels on 2 lines */
+static inline int16x8_t avg2x2_neon(uint8x16_t c0, uint8x16_t c1)
+{
+    uint16x8_t sum = vpadalq_u8(vpaddlq_u8(c0), c1);
+    return vreinterpretq_s16_u16(vshrq_n_u16(vaddq_u16(sum, vdupq_n_u16(2)), 2));
+}
+
+static inline uint8x8_t rgb_to_chroma_neon(int16x8_t r, int16x8_t g, int16x8_t b, int16_t cr,
+                                           int16_t cg, int16_t cb)
+{
+    int16x8_t c = vmulq_n_s16(r, cr);
+    c = vmlaq_n_s16(c, g, cg);
+    c = vmlaq_n_s16(c, b, cb);
+    c = vshrq_n_s16(vaddq_s16(c, vdupq_n_s16(128)), 8);
+    return vqmovun_s16(vaddq_s16(c, vdupq_n_s16(128)));
+}
+
+static uint32_t rgb24_to_i420_neon(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                   uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t x,
+                                   uint32_t width)
+{
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x3_t a = vld3q_u8(s0 + 3 * x);
+        uint8x16x3_t b = vld3q_u8(s1 + 3 * x);
+
+        vst1q_u8(y0 + x, rgb_to_y16_neon(a));
+        vst1q_u8(y1 + x, rgb_to_y16_neon(b));
+
+        int16x8_t r = avg2x2_neon(a.val[0], b.val[0]);
+        int16x8_t g = avg2x2_neon(a.val[1], b.val[1]);
+        int16x8_t bl = avg2x2_neon(a.val[2], b.val[2]);
+        vst1_u8(u + x / 2, rgb_to_chroma_neon(r, g, bl, -38, -74, 112));
+        vst1_u8(v + x / 2, rgb_to_chroma_neon(r, g, bl, 112, -94, -18));
+    }
+
+    return x;
+}
+
+static uint32_t gray8_to_rgb24_neon(const uint8_t *s, uint8_t *d, uint32_t x, uint32_t width)
+{
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t g = vld1q_u8(s + x);
+        uint8x16x3_t rgb = {{g, g, g}};
+        vst3q_u8(d + 3 * x, rgb);
+    }
+
+    return x;
+}
+
+/* UYVY is loaded as U, Y0, V, Y1 vectors of 16 values each, for 32 pixels */
+static uint32_t uyvy_to_i420_neon(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                  uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t x,
+                                  uint32_t width)
+{
+    for (; x + 32 <= width; x += 32) {
+        uint8x16x4_t a = vld4q_u8(s0 + 2 * x);
+        uint8x16x4_t b = vld4q_u8(s1 + 2 * x);
+        uint8x16x2_t ya = {{a.val[1], a.val[3]}};
+        uint8x16x2_t yb = {{b.val[1], b.val[3]}};
+
+        vst2q_u8(y0 + x, ya);
+        vst2q_u8(y1 + x, yb);
+        vst1q_u8(u + x / 2, vrhaddq_u8(a.val[0], b.val[0]));
+        vst1q_u8(v + x / 2, vrhaddq_u8(a.val[2], b.val[2]));
+    }
+
+    return x;
+}
+
+static uint32_t uyvy_to_nv12_neon(const uint8_t *s0, const uint8_t *s1, uint8_t *y0,
+                                  uint8_t *y1, uint8_t *uv, uint32_t x, uint32_t width)
+{
+    for (; x + 32 <= width; x += 32) {
+        uint8x16x4_t a = vld4q_u8(s0 + 2 * x);
+        uint8x16x4_t b = vld4q_u8(s1 + 2 * x);
+        uint8x16x2_t ya = {{a.val[1], a.val[3]}};
+        uint8x16x2_t yb = {{b.val[1], b.val[3]}};
+        uint8x16x2_t c = {{vrhaddq_u8(a.val[0], b.val[0]), vrhaddq_u8(a.val[2], b.val[2])}};
+
+        vst2q_u8(y0 + x, ya);
+        vst2q_u8(y1 + x, yb);
+        vst2q_u8(uv + x, c);
+    }
+
+    return x;
+}
+#endif
+
+static pixel_simd detect_simd()
+{
+#if defined(PIXEL_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PIXEL_SIMD_AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return PIXEL_SIMD_SSE;
+#elif defined(PIXEL_NEON)
+    return PIXEL_SIMD_NEON;
+#endif
+    return PIXEL_SIMD_NONE;
+}
+
+static const pixel_simd sSupportedSimd = detect_simd();
+static std::atomic<int> sSimd(sSupportedSimd);
+
+pixel_simd pixel_get_simd()
+{
+    return (pixel_simd)sSimd.load(std::memory_order_relaxed);
+}
+
+pixel_simd pixel_set_simd(pixel_simd simd)
+{
+    /* NEON and x86 levels are not comparable, only the one found or none can be set */
+    if (simd == PIXEL_SIMD_NONE || simd == sSupportedSimd
+        || (simd == PIXEL_SIMD_SSE && sSupportedSimd == PIXEL_SIMD_AVX2))
+        sSimd = simd;
+
+    return pixel_get_simd();
+}
+
+const char *pixel_simd_name(pixel_simd simd)
+{
+    switch (simd) {
+    case PIXEL_SIMD_SSE:
+        return "sse";
+    case PIXEL_SIMD_AVX2:
+        return "avx2";
+    case PIXEL_SIMD_NEON:
+        return "neon";
+    case PIXEL_SIMD_NONE:
+    default:
+        return "none";
+    }
+}
+
+int pixel_rgb24_to_i420(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                        uint8_t *y, uint32_t yStride, uint8_t *u, uint32_t uStride, uint8_t *v,
+                        uint32_t vStride)
+{
+    if (!src || !y || !u || !v || (width & 1) || (height & 1))
+        return -1;
+
+    pixel_simd simd = pixel_get_simd();
+    for (uint32_t row = 0; row < height; row += 2) {
+        const uint8_t *s0 = src + (size_t)row * srcStride;
+        const uint8_t *s1 = s0 + srcStride;
+        uint8_t *y0 = y + (size_t)row * yStride;
+        uint8_t *y1 = y0 + yStride;
+        uint8_t *u0 = u + (size_t)row / 2 * uStride;
+        uint8_t *v0 = v + (size_t)row / 2 * vStride;
+        uint32_t x = 0;
+
+#if defined(PIXEL_X86)
+        if (simd != PIXEL_SIMD_NONE)
+            x = rgb24_to_i420_sse(s0, s1, y0, y1, u0, v0, x, width);
+#elif defined(PIXEL_NEON)
+        if (simd == PIXEL_SIMD_NEON)
+            x = rgb24_to_i420_neon(s0, s1, y0, y1, u0, v0, x, width);
+#endif
+        rgb24_to_i420_c(s0, s1, y0, y1, u0, v0, x, width);
+    }
+
+    return 0;
+}
+
+int pixel_uyvy_to_i420(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                       uint8_t *y, uint32_t yStride, uint8_t *u, uint32_t uStride, uint8_t *v,
+                       uint32_t vStride)
+{
+    if (!src || !y || !u || !v || (width & 1) || (height & 1))
+        return -1;
+
+    pixel_simd simd = pixel_get_simd();
+    for (uint32_t row = 0; row < height; row += 2) {
+        const uint8_t *s0 = src + (size_t)row * srcStride;
+        const uint8_t *s1 = s0 + srcStride;
+        uint8_t *y0 = y + (size_t)row * yStride;
+        uint8_t *y1 = y0 + yStride;
+        uint8_t *u0 = u + (size_t)row / 2 * uStride;
+        uint8_t *v0 = v + (size_t)row / 2 * vStride;
+        uint32_t x = 0;
+
+#if defined(PIXEL_X86)
+        if (simd == PIXEL_SIMD_AVX2)
+            x = uyvy_to_i420_avx2(s0, s1, y0, y1, u0, v0, x, width);
+        if (simd != PIXEL_SIMD_NONE)
+            x = uyvy_to_i420_sse(s0, s1, y0, y1, u0, v0, x, width);
+#elif defined(PIXEL_NEON)
+        if (simd == PIXEL_SIMD_NEON)
+            x = uyvy_to_i420_neon(s0, s1, y0, y1, u0, v0, x, width);
+#endif
+        uyvy_to_i420_c(s0, s1, y0, y1, u0, v0, x, width);
+    }
+
+    return 0;
+}
+
+int pixel_uyvy_to_nv12(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                       uint8_t *y, uint32_t yStride, uint8_t *uv, uint32_t uvStride)
+{
+    if (!src || !y || !uv || (width & 1) || (height & 1))
+        return -1;
+
+    pixel_simd simd = pixel_get_simd();
+    for (uint32_t row = 0; row < height; row += 2) {
+        const uint8_t *s0 = src + (size_t)row * srcStride;
+        const uint8_t *s1 = s0 + srcStride;
+        uint8_t *y0 = y + (size_t)row * yStride;
+        uint8_t *y1 = y0 + yStride;
+        uint8_t *uv0 = uv + (size_t)row / 2 * uvStride;
+        uint32_t x = 0;
+
+#if defined(PIXEL_X86)
+        if (simd == PIXEL_SIMD_AVX2)
+            x = uyvy_to_nv12_avx2(s0, s1, y0, y1, uv0, x, width);
+        if (simd != PIXEL_SIMD_NONE)
+            x = uyvy_to_nv12_sse(s0, s1, y0, y1, uv0, x, width);
+#elif defined(PIXEL_NEON)
+        if (simd == PIXEL_SIMD_NEON)
+            x = uyvy_to_nv12_neon(s0, s1, y0, y1, uv0, x, width);
+#endif
+        uyvy_to_nv12_c(s0, s1, y0, y1, uv0, x, width);
+    }
+
+    return 0;
+}
+
+int pixel_gray8_to_i420(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                        uint8_t *y, uint32_t yStride, uint8_t *u, uint32_t uStride, uint8_t *v,
+                        uint32_t vStride)
+{
+    if (!src || !y || !u || !v || (width & 1) || (height & 1))
+        return -1;
+
+    /* Plain copy and fill, memcpy and memset are already vectorized by the C library */
+    for (uint32_t row = 0; row < height; row++)
+        memcpy(y + (size_t)row * yStride, src + (size_t)row * srcStride, width);
+
+    for (uint32_t row = 0; row < height / 2; row++) {
+        memset(u + (size_t)row * uStride, 128, width / 2);
+        memset(v + (size_t)row * vStride, 128, width / 2);
+    }
+
+    return 0;
+}
+
+int pixel_gray8_to_rgb24(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                         uint8_t *dst, uint32_t dstStride)
+{
+    if (!src || !dst)
+        return -1;
+
+    pixel_simd simd = pixel_get_simd();
+    for (uint32_t row = 0; row < height; row++) {
+        const uint8_t *s = src + (size_t)row * srcStride;
+        uint8_t *d = dst + (size_t)row * dstStride;
+        uint32_t x = 0;
+
+#if defined(PIXEL_X86)
+        if (simd != PIXEL_SIMD_NONE)
+            x = gray8_to_rgb24_sse(s, d, x, width);
+#elif defined(PIXEL_NEON)
+        if (simd == PIXEL_SIMD_NEON)
+            x = gray8_to_rgb24_neon(s, d, x, width);
+#endif
+        gray8_to_rgb24_c(s, d, x, width);
+    }
+
+    return 0;
+}
+
+static inline uint32_t round_up(uint32_t value, uint32_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+uint32_t pixel_get_stride(CameraParameters::PixelFormat format, uint32_t width)
+{
+    switch (format) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return round_up(width, 4);
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return round_up(width * 2, 4);
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return round_up(width * 3, 4);
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB32:
+        return width * 4;
+    default:
+        return 0;
+    }
+}
+
+/* Stride of the U and V planes of I420 */
+static inline uint32_t i420_chroma_stride(uint32_t width)
+{
+    return round_up(round_up(width, 2) / 2, 4);
+}
+
+size_t pixel_get_frame_size(CameraParameters::PixelFormat format, uint32_t width,
+                            uint32_t height)
+{
+    size_t stride = pixel_get_stride(format, width);
+    size_t lines = round_up(height, 2);
+
+    switch (format) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+        return stride * lines + 2 * i420_chroma_stride(width) * (lines / 2);
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return stride * lines + stride * (lines / 2);
+    default:
+        return stride * height;
+    }
+}
+
+bool pixel_can_convert(CameraParameters::PixelFormat from, CameraParameters::PixelFormat to)
+{
+    switch (from) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return to == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return to == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420
+            || to == CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return to == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420
+            || to == CameraParameters::PixelFormat::PIXEL_FORMAT_NV12;
+    default:
+        return false;
+    }
+}
+
+int pixel_convert(CameraParameters::PixelFormat from, const uint8_t *src, uint32_t srcStride,
+                  CameraParameters::PixelFormat to, uint8_t *dst, uint32_t width,
+                  uint32_t height)
+{
+    if (!dst || !pixel_can_convert(from, to))
+        return -1;
+
+    if (to == CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24)
+        return pixel_gray8_to_rgb24(src, srcStride, width, height, dst,
+                                    pixel_get_stride(to, width));
+
+    uint32_t yStride = pixel_get_stride(to, width);
+    uint8_t *chroma = dst + (size_t)yStride * round_up(height, 2);
+
+    if (to == CameraParameters::PixelFormat::PIXEL_FORMAT_NV12)
+        return pixel_uyvy_to_nv12(src, srcStride, width, height, dst, yStride, chroma, yStride);
+
+    uint32_t cStride = i420_chroma_stride(width);
+    uint8_t *v = chroma + (size_t)cStride * (round_up(height, 2) / 2);
+    switch (from) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return pixel_rgb24_to_i420(src, srcStride, width, height, dst, yStride, chroma, cStride,
+                                   v, cStride);
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return pixel_uyvy_to_i420(src, srcStride, width, height, dst, yStride, chroma, cStride,
+                                  v, cStride);
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return pixel_gray8_to_i420(src, srcStride, width, height, dst, yStride, chroma, cStride,
+                                   v, cStride);
+    default:
+        return -1;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "CameraParameters.h"
+
+/*
+ * Pixel format conversion of camera frames to the formats taken by the video encoders.
+ *
+ * YUV output is BT.601 limited range, chroma is the average of each 2x2 block. Width and height
+ * must be even. The kernels use the best instruction set of the CPU found at runtime, with a
+ * scalar fallback giving the same output bit for bit.
+ */
+
+enum pixel_simd {
+    PIXEL_SIMD_NONE = 0, /* Scalar code */
+    PIXEL_SIMD_SSE,      /* SSE2 and SSSE3 */
+    PIXEL_SIMD_AVX2,
+    PIXEL_SIMD_NEON,
+};
+
+/* Instruction set in use by the kernels */
+pixel_simd pixel_get_simd();
+/* Limit the instruction set in use to the one given, if supported by the CPU. Returns the one
+ * in use after the call. */
+pixel_simd pixel_set_simd(pixel_simd simd);
+const char *pixel_simd_name(pixel_simd simd);
+
+int pixel_rgb24_to_i420(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                        uint8_t *y, uint32_t yStride, uint8_t *u, uint32_t uStride, uint8_t *v,
+                        uint32_t vStride);
+int pixel_uyvy_to_i420(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                       uint8_t *y, uint32_t yStride, uint8_t *u, uint32_t uStride, uint8_t *v,
+                       uint32_t vStride);
+int pixel_uyvy_to_nv12(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                       uint8_t *y, uint32_t yStride, uint8_t *uv, uint32_t uvStride);
+int pixel_gray8_to_i420(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                        uint8_t *y, uint32_t yStride, uint8_t *u, uint32_t uStride, uint8_t *v,
+                        uint32_t vStride);
+/* Grey replicated to the 3 components, width and height may be odd */
+int pixel_gray8_to_rgb24(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t height,
+                         uint8_t *dst, uint32_t dstStride);
+
+/*
+ * Frames below use the default GStreamer layout of the format: planes packed one after the
+ * other, each line aligned to 4 bytes. Such frames can be pushed to appsrc as is.
+ */
+
+/* Stride of the first plane, 0 if the format is unknown */
+uint32_t pixel_get_stride(CameraParameters::PixelFormat format, uint32_t width);
+/* Size of a frame, 0 if the format is unknown */
+size_t pixel_get_frame_size(CameraParameters::PixelFormat format, uint32_t width,
+                            uint32_t height);
+bool pixel_can_convert(CameraParameters::PixelFormat from, CameraParameters::PixelFormat to);
+/* Convert a frame to dst, of pixel_get_frame_size(to, width, height) bytes at least */
+int pixel_convert(CameraParameters::PixelFormat from, const uint8_t *src, uint32_t srcStride,
+                  CameraParameters::PixelFormat to, uint8_t *dst, uint32_t width,
+                  uint32_t height);
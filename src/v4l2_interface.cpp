@@ -16,23 +16,43 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <dirent.h>
 #include <fcntl.h>
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "log.h"
 #include "v4l2_interface.h"
 
+static int sys_open(const char *path, int flags)
+{
+    return open(path, flags, 0);
+}
+
+static int sys_ioctl(int fd, unsigned long request, void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+static const struct v4l2_backend sys_backend = {sys_open, close, sys_ioctl, mmap, munmap, poll};
+static const struct v4l2_backend *backend = &sys_backend;
+
+void v4l2_set_backend(const struct v4l2_backend *b)
+{
+    backend = b ? b : &sys_backend;
+}
+
 int v4l2_ioctl(int fd, int request, void *arg)
 {
     int r;
 
     do
-        r = ioctl(fd, request, arg);
+        r = backend->ioctl(fd, request, arg);
     while (-1 == r && EINTR == errno);
 
     return r;
@@ -65,7 +85,7 @@ int v4l2_open(std::string deviceID)
 {
     std::string devicePath = V4L2_DEVICE_PATH + deviceID;
     int fd = -1;
-    fd = open(devicePath.c_str(), O_RDWR, 0);
+    fd = backend->open(devicePath.c_str(), O_RDWR | O_CLOEXEC);
     if (fd < 0) {
         log_error("Cannot open device '%s': %d: ", devicePath.c_str(), errno);
     }
@@ -91,7 +111,7 @@ int v4l2_close(int fd)
     if (fd < 1)
         return -1;
 
-    close(fd);
+    backend->close(fd);
     return 0;
 }
 
@@ -183,6 +203,43 @@ int v4l2_query_framesizes(int fd)
     return 0;
 }
 
+int v4l2_enum_formats(int fd, std::vector<struct v4l2_fmtdesc> &formats)
+{
+    if (fd < 1)
+        return -1;
+
+    struct v4l2_fmtdesc fmt = {};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (fmt.index = 0; v4l2_ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++)
+        formats.push_back(fmt);
+
+    return 0;
+}
+
+bool v4l2_has_framesize(int fd, uint32_t pixelformat, uint32_t width, uint32_t height)
+{
+    if (fd < 1)
+        return false;
+
+    struct v4l2_frmsizeenum size = {};
+    size.pixel_format = pixelformat;
+    for (size.index = 0; v4l2_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++) {
+        if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            if (size.discrete.width == width && size.discrete.height == height)
+                return true;
+            continue;
+        }
+
+        /* Continuous and stepwise sizes are given by the first and only entry */
+        const struct v4l2_frmsize_stepwise &s = size.stepwise;
+        return width >= s.min_width && width <= s.max_width && height >= s.min_height
+            && height <= s.max_height && (width - s.min_width) % std::max(s.step_width, 1u) == 0
+            && (height - s.min_height) % std::max(s.step_height, 1u) == 0;
+    }
+
+    return false;
+}
+
 int v4l2_set_input(int fd, int id)
 {
     int ret = -1;
@@ -240,6 +297,20 @@ int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf)
     return ret;
 }
 
+int v4l2_get_format(int fd, struct v4l2_format &fmt)
+{
+    int ret = -1;
+
+    memset(&fmt, 0, sizeof(struct v4l2_format));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = v4l2_ioctl(fd, VIDIOC_G_FMT, &fmt);
+    if (ret) {
+        log_error("Getting pixel format: %s", strerror(errno));
+    }
+
+    return ret;
+}
+
 int v4l2_streamon(int fd)
 {
     int ret = -1;
@@ -284,6 +355,73 @@ int v4l2_buf_req(int fd, uint32_t count)
     return ret;
 }
 
+int v4l2_buf_req(int fd, uint32_t &count, enum v4l2_memory memory)
+{
+    int ret = -1;
+
+    // Initiate I/O, driver may allocate a different number of buffers
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(struct v4l2_requestbuffers));
+    req.count = count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = memory;
+    ret = v4l2_ioctl(fd, VIDIOC_REQBUFS, &req);
+    if (ret) {
+        log_error("Error in REQBUFS %s", strerror(errno));
+        return ret;
+    }
+
+    count = req.count;
+    return ret;
+}
+
+int v4l2_buf_query(int fd, uint32_t index, struct v4l2_buffer &buf)
+{
+    int ret = -1;
+
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    ret = v4l2_ioctl(fd, VIDIOC_QUERYBUF, &buf);
+    if (ret) {
+        log_error("Error in QUERYBUF %s | i=%u", strerror(errno), index);
+    }
+
+    return ret;
+}
+
+void *v4l2_mmap(int fd, size_t length, off_t offset)
+{
+    void *addr = backend->mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    if (addr == MAP_FAILED) {
+        log_error("Error in mapping buffer: %s", strerror(errno));
+        return nullptr;
+    }
+
+    return addr;
+}
+
+int v4l2_munmap(void *addr, size_t length)
+{
+    return backend->munmap(addr, length);
+}
+
+int v4l2_poll(int fd, int timeout)
+{
+    int ret = -1;
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    do
+        ret = backend->poll(&pfd, 1, timeout);
+    while (-1 == ret && EINTR == errno);
+
+    if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+        ret = -1;
+
+    return ret;
+}
+
 int v4l2_buf_q(int fd, uint32_t i, unsigned long bufptr, uint32_t buflen)
 {
     int ret = -1;
@@ -16,12 +16,29 @@
  * limitations under the License.
  */
 #pragma once
+#include <linux/videodev2.h>
+#include <poll.h>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 #define V4L2_DEVICE_PATH "/dev/"
 #define V4L2_VIDEO_PREFIX "video"
 
+/**
+ *  System calls used to access the V4L2 devices. A test backend faking the devices can be set
+ *  with v4l2_set_backend(), the system calls are used when no backend is set.
+ */
+struct v4l2_backend {
+    int (*open)(const char *path, int flags);
+    int (*close)(int fd);
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+    void *(*mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+    int (*munmap)(void *addr, size_t length);
+    int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout);
+};
+
+void v4l2_set_backend(const struct v4l2_backend *backend);
 int v4l2_ioctl(int fd, int request, void *arg);
 int v4l2_list_devices(std::vector<std::string> &devList);
 int v4l2_open(std::string deviceID);
@@ -30,13 +47,21 @@ int v4l2_close(int fd);
 int v4l2_query_cap(int fd, struct v4l2_capability &vcap);
 int v4l2_query_control(int fd);
 int v4l2_query_framesizes(int fd);
+int v4l2_enum_formats(int fd, std::vector<struct v4l2_fmtdesc> &formats);
+bool v4l2_has_framesize(int fd, uint32_t pixelformat, uint32_t width, uint32_t height);
 int v4l2_set_input(int fd, int id);
 int v4l2_get_input(int fd);
 int v4l2_set_capturemode(int fd, uint32_t mode);
 int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf);
+int v4l2_get_format(int fd, struct v4l2_format &fmt);
 int v4l2_streamon(int fd);
 int v4l2_streamoff(int fd);
 int v4l2_buf_req(int fd, uint32_t count);
+int v4l2_buf_req(int fd, uint32_t &count, enum v4l2_memory memory);
+int v4l2_buf_query(int fd, uint32_t index, struct v4l2_buffer &buf);
+void *v4l2_mmap(int fd, size_t length, off_t offset);
+int v4l2_munmap(void *addr, size_t length);
+int v4l2_poll(int fd, int timeout);
 int v4l2_buf_q(int fd, struct v4l2_buffer *pbuf);
 int v4l2_buf_q(int fd, uint32_t i, unsigned long bufptr, uint32_t buflen);
 int v4l2_buf_dq(int fd, struct v4l2_buffer *pbuf);
@@ -0,0 +1,178 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the capture catalog. Sequence numbers must go on after the catalog is opened again,
+ * captures pending when it was closed must be reported as failed, and the records of a large
+ * catalog must be written and found in constant time.
+ *
+ * Usage: test-capture-catalog [captures]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "CaptureCatalog.h"
+#include "log.h"
+#include "test_check.h"
+
+#define DEFAULT_CAPTURES 100000
+
+typedef std::chrono::steady_clock Clock;
+
+static CaptureCatalog::Record newRecord(int seq, const std::string &dir)
+{
+    CaptureCatalog::Record record = {};
+    record.seq = seq;
+    record.state = CaptureCatalog::STATE_DONE;
+    record.timeUtcUs = 1500000000000000ULL + seq;
+    record.size = 1000 + seq;
+    snprintf(record.path, sizeof(record.path), "%s/img_%d.jpg", dir.c_str(), seq);
+
+    return record;
+}
+
+static void testRestart(const std::string &dir)
+{
+    {
+        CaptureCatalog catalog(dir, CaptureCatalog::Media::IMAGE);
+        CHECK(catalog.open() == 0);
+        CHECK(catalog.getCount() == 0);
+        CHECK(catalog.reserve() == 0);
+        CHECK(catalog.reserve() == 1);
+        CHECK(catalog.reserve() == 2);
+
+        CHECK(catalog.commit(newRecord(0, dir)) == 0);
+        CaptureCatalog::Record failed = newRecord(1, dir);
+        failed.state = CaptureCatalog::STATE_FAILED;
+        CHECK(catalog.commit(failed) == 0);
+        CHECK(catalog.commit(newRecord(3, dir)) == -1);
+
+        CaptureCatalog::Record record;
+        CHECK(catalog.lookup(2, record));
+        CHECK(record.state == CaptureCatalog::STATE_PENDING);
+        CHECK(!catalog.lookup(3, record));
+        CHECK(catalog.getDoneCount() == 1);
+    }
+
+    /* Process restarted with the capture of number 2 in progress */
+    CaptureCatalog catalog(dir, CaptureCatalog::Media::IMAGE);
+    CHECK(catalog.open() == 0);
+    CHECK(catalog.getCount() == 3);
+    CHECK(catalog.getDoneCount() == 1);
+
+    CaptureCatalog::Record record;
+    CHECK(catalog.lookup(0, record));
+    CHECK(record.state == CaptureCatalog::STATE_DONE);
+    CHECK(record.size == 1000);
+    CHECK(!strcmp(record.path, (dir + "/img_0.jpg").c_str()));
+    CHECK(catalog.lookup(1, record));
+    CHECK(record.state == CaptureCatalog::STATE_FAILED);
+    CHECK(catalog.lookup(2, record));
+    CHECK(record.state == CaptureCatalog::STATE_FAILED);
+    CHECK(catalog.reserve() == 3);
+
+    /* Videos have a catalog of their own in the directory */
+    CaptureCatalog videos(dir, CaptureCatalog::Media::VIDEO);
+    CHECK(videos.getFilePath() != catalog.getFilePath());
+    CHECK(videos.open() == 0);
+    CHECK(videos.getCount() == 0);
+
+    unlink(catalog.getFilePath().c_str());
+    unlink(videos.getFilePath().c_str());
+}
+
+static void testLarge(const std::string &dir, int captures)
+{
+    std::chrono::duration<double, std::micro> writeUs, readUs;
+    {
+        CaptureCatalog catalog(dir, CaptureCatalog::Media::IMAGE);
+        CHECK(catalog.open() == 0);
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < captures; i++) {
+            int seq = catalog.reserve();
+            if (seq != i) {
+                CHECK(seq == i);
+                return;
+            }
+            catalog.commit(newRecord(seq, dir));
+        }
+        writeUs = Clock::now() - start;
+    }
+
+    CaptureCatalog catalog(dir, CaptureCatalog::Media::IMAGE);
+    Clock::time_point start = Clock::now();
+    CHECK(catalog.open() == 0);
+    std::chrono::duration<double, std::micro> openUs = Clock::now() - start;
+    CHECK(catalog.getCount() == (uint32_t)captures);
+    CHECK(catalog.getDoneCount() == (uint32_t)captures);
+
+    int found = 0;
+    start = Clock::now();
+    for (int i = 0; i < captures; i++) {
+        uint32_t seq = (i * 7919U) % captures;
+        CaptureCatalog::Record record;
+        if (catalog.lookup(seq, record) && record.seq == seq && record.size == 1000 + seq)
+            found++;
+    }
+    readUs = Clock::now() - start;
+    CHECK(found == captures);
+
+    log_info("%d captures: %.2f us per capture written, %.2f us per lookup, opened in %.0f us",
+             captures, writeUs.count() / captures, readUs.count() / captures, openUs.count());
+
+    unlink(catalog.getFilePath().c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Capture catalog test");
+
+    int captures = argc > 1 ? atoi(argv[1]) : DEFAULT_CAPTURES;
+    if (captures <= 0) {
+        log_error("Invalid arguments");
+        return 1;
+    }
+
+    char dir[] = "/tmp/test-capture-catalog-XXXXXX";
+    if (!mkdtemp(dir)) {
+        log_error("Unable to create temporary directory");
+        return 1;
+    }
+
+    testRestart(dir);
+    testLarge(dir, captures);
+
+    /* Missing directory, captures are numbered without catalog */
+    CHECK(!CaptureCatalog::get(std::string(dir) + "/missing", CaptureCatalog::Media::IMAGE));
+    std::shared_ptr<CaptureCatalog> catalog
+        = CaptureCatalog::get(dir, CaptureCatalog::Media::IMAGE);
+    CHECK(catalog);
+    CHECK(catalog == CaptureCatalog::get(std::string(dir) + "/", CaptureCatalog::Media::IMAGE));
+    if (catalog)
+        unlink(catalog->getFilePath().c_str());
+
+    rmdir(dir);
+
+    return finishChecks();
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the capture latency histograms. Percentiles of a known distribution must be found
+ * within the width of a bucket, a capture must start at its command only if it follows it, and
+ * the message sent stage of an image must be added once. The cost of a stage added by a few
+ * threads at once is reported, it is paid on the capture path.
+ *
+ * Usage: test-capture-latency
+ */
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "CaptureLatency.h"
+#include "log.h"
+#include "test_check.h"
+
+#define THREADS 4
+#define MARKS 1000000
+
+typedef std::chrono::steady_clock Clock;
+
+/* Value within a quarter of octave, the width of a bucket */
+static bool near(usec_t value, usec_t expected)
+{
+    return value >= expected * 3 / 4 && value <= expected * 5 / 4;
+}
+
+static void testPercentiles()
+{
+    CaptureLatency latency("camera");
+    const usec_t startUs = 1000 * USEC_PER_SEC;
+
+    /* 1 ms to 100 ms, one capture per 10 us */
+    for (usec_t us = 1000; us <= 100000; us += 10)
+        latency.mark(CaptureLatency::IMAGE, CaptureLatency::STAGE_FRAME, startUs, startUs + us);
+
+    CaptureLatency::Summary s
+        = latency.getSummary(CaptureLatency::IMAGE, CaptureLatency::STAGE_FRAME);
+    log_info("%s: %llu, mean %llu us, p50 %llu us, p90 %llu us, p99 %llu us, max %llu us",
+             __func__, (unsigned long long)s.count, (unsigned long long)s.meanUs,
+             (unsigned long long)s.p50Us, (unsigned long long)s.p90Us,
+             (unsigned long long)s.p99Us, (unsigned long long)s.maxUs);
+    CHECK(s.count == 9901);
+    CHECK(s.meanUs == 50500);
+    CHECK(near(s.p50Us, 50500));
+    CHECK(near(s.p90Us, 90100));
+    CHECK(near(s.p99Us, 99010));
+    CHECK(s.p99Us <= s.maxUs);
+    CHECK(s.maxUs == 100000);
+
+    /* Other stages and kinds are apart */
+    CHECK(!latency.getSummary(CaptureLatency::IMAGE, CaptureLatency::STAGE_ENCODED).count);
+    CHECK(!latency.getSummary(CaptureLatency::VIDEO_START, CaptureLatency::STAGE_FRAME).count);
+
+    /* Stage before the start, from a frame of the ring taken before the trigger */
+    latency.mark(CaptureLatency::IMAGE, CaptureLatency::STAGE_ENCODED, startUs, startUs - 500);
+    s = latency.getSummary(CaptureLatency::IMAGE, CaptureLatency::STAGE_ENCODED);
+    CHECK(s.count == 1 && s.maxUs == 0);
+}
+
+static void testCommand()
+{
+    CaptureLatency latency("camera");
+    const usec_t commandUs = 1000 * USEC_PER_SEC;
+
+    /* First image starts at the command, the next ones at their trigger */
+    latency.command(CaptureLatency::IMAGE, commandUs);
+    CHECK(latency.begin(CaptureLatency::IMAGE, commandUs + 200) == commandUs);
+    CHECK(latency.begin(CaptureLatency::IMAGE, commandUs + 500000) == commandUs + 500000);
+
+    /* Command of a capture that failed to start is not taken by a later one */
+    latency.command(CaptureLatency::VIDEO_START, commandUs);
+    CHECK(latency.begin(CaptureLatency::VIDEO_START, commandUs + 5 * USEC_PER_SEC)
+          == commandUs + 5 * USEC_PER_SEC);
+    CHECK(latency.begin(CaptureLatency::VIDEO_STOP, commandUs) == commandUs);
+
+    /* Message sent once per image, only for images waiting for it */
+    latency.waitMessage(7, commandUs);
+    latency.messageSent(8, commandUs + 1000);
+    latency.messageSent(7, commandUs + 2000);
+    latency.messageSent(7, commandUs + 3000);
+    CaptureLatency::Summary s
+        = latency.getSummary(CaptureLatency::IMAGE, CaptureLatency::STAGE_MESSAGE_SENT);
+    CHECK(s.count == 1 && s.maxUs == 2000);
+
+    CHECK(CaptureLatency::get("video0") == CaptureLatency::get("video0"));
+    CHECK(CaptureLatency::get("video0") != CaptureLatency::get("video1"));
+    CaptureLatency::get("video0")->mark(CaptureLatency::IMAGE, CaptureLatency::STAGE_FRAME, 0,
+                                        12345);
+    CaptureLatency::dumpAll();
+}
+
+static void testOverhead()
+{
+    CaptureLatency latency("camera");
+    std::vector<std::thread> threads;
+
+    Clock::time_point start = Clock::now();
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&latency, t] {
+            for (int i = 0; i < MARKS; i++) {
+                usec_t startUs = now_usec();
+                latency.mark(CaptureLatency::IMAGE, (CaptureLatency::Stage)(t % 2), startUs);
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    std::chrono::duration<double, std::nano> total = Clock::now() - start;
+
+    uint64_t count = latency.getSummary(CaptureLatency::IMAGE, CaptureLatency::STAGE_FRAME).count
+        + latency.getSummary(CaptureLatency::IMAGE, CaptureLatency::STAGE_PIPELINE_READY).count;
+    CHECK(count == (uint64_t)THREADS * MARKS);
+
+    log_info("%s: %d thread(s), %.0f ns per stage added with its clock reads", __func__,
+             THREADS, total.count() * THREADS / count);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Capture latency test");
+
+    testPercentiles();
+    testCommand();
+    testOverhead();
+
+    return finishChecks();
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include "log.h"
+
+/*
+ * Checks of the unit tests: a failed check is logged and counted, the test goes on. Included
+ * once per test program.
+ */
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            log_error("%s:%d check failed: %s", __func__, __LINE__, #cond);                        \
+            failures++;                                                                            \
+        }                                                                                          \
+    } while (0)
+
+static int failures = 0;
+
+/**
+ *  Log the result of the checks and close the log, at the end of main().
+ *
+ *  @return Exit status of the test, 0 if all checks passed.
+ */
+static inline int finishChecks()
+{
+    if (failures)
+        log_error("%d check(s) failed", failures);
+    else
+        log_info("All checks passed");
+
+    Log::close();
+
+    return failures ? 1 : 0;
+}
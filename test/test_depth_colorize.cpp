@@ -0,0 +1,182 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Micro-benchmark of the coloring of the RealSense depth and infrared images. The per pixel
+ * loops formerly used by the RealSense camera device are timed against the depth colorizer,
+ * with one thread and with its default thread count, and against the infrared replication
+ * kernel. Outputs must match bit for bit.
+ *
+ * Usage: test-depth-colorize [width height [iterations]]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "log.h"
+#include "pixel_convert.h"
+#include "plugins/RealSenseCamera/DepthColorizer.h"
+#include "test_check.h"
+
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_ITERATIONS 100
+#define MIN_DEPTH 300
+#define MAX_DEPTH 4000
+
+/* Per pixel coloring of the camera device, with the normalization of the depth */
+static void rainbow_scale(double value, uint8_t rgb[])
+{
+    rgb[0] = rgb[1] = rgb[2] = 0;
+
+    if (value < 0.25) { // RED to YELLOW
+        rgb[0] = 255;
+        rgb[1] = 255 * (value / 0.25);
+    } else if (value < 0.5) { // YELLOW to GREEN
+        rgb[0] = 255 * (1 - ((value - 0.25) / 0.25));
+        rgb[1] = 255;
+    } else if (value < 0.75) { // GREEN to CYAN
+        rgb[1] = 255;
+        rgb[2] = 255 * ((value - 0.5) / 0.25);
+    } else if (value < 1.0) { // CYAN to BLUE
+        rgb[1] = 255 * (1 - ((value - 0.75) / 0.25));
+        rgb[2] = 255;
+    } else { // BLUE
+        rgb[2] = 255;
+    }
+}
+
+static void colorizeLegacy(const uint16_t *depth, uint32_t width, uint32_t height, uint8_t *rgb)
+{
+    for (int i = 0, end = width * height; i < end; ++i) {
+        uint8_t rainbow[3] = {};
+        if (depth[i]) {
+            double value = ((double)depth[i] - MIN_DEPTH) / (MAX_DEPTH - MIN_DEPTH);
+            rainbow_scale(std::min(std::max(value, 0.0), 1.0), rainbow);
+        }
+
+        rgb[3 * i] = rainbow[0];
+        rgb[3 * i + 1] = rainbow[1];
+        rgb[3 * i + 2] = rainbow[2];
+    }
+}
+
+static void replicateLegacy(const uint8_t *ir, uint32_t width, uint32_t height, uint8_t *rgb)
+{
+    for (int i = 0, end = width * height; i < end; ++i) {
+        rgb[3 * i] = ir[i];
+        rgb[3 * i + 1] = ir[i];
+        rgb[3 * i + 2] = ir[i];
+    }
+}
+
+/* Average time of one frame in ms */
+static double timeFrame(const std::function<void()> &fn, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        fn();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / iterations;
+}
+
+static void benchDepth(uint32_t width, uint32_t height, int iterations)
+{
+    /* Depths over the whole 16 bits range, some of them without data */
+    std::vector<uint16_t> depth(width * height);
+    srand(width * height);
+    for (uint16_t &d : depth)
+        d = rand() % 8 ? rand() : 0;
+
+    size_t size = width * height * 3;
+    std::vector<uint8_t> legacy(size), single(size), multi(size);
+
+    DepthColorizer singleThread(1);
+    DepthColorizer multiThread;
+    CHECK(singleThread.setRange(MIN_DEPTH, MAX_DEPTH) == 0);
+    CHECK(multiThread.setRange(MIN_DEPTH, MAX_DEPTH) == 0);
+    CHECK(multiThread.setRange(MAX_DEPTH, MIN_DEPTH) == -1);
+
+    double legacyMs = timeFrame(
+        [&] { colorizeLegacy(depth.data(), width, height, legacy.data()); }, iterations);
+    double singleMs = timeFrame(
+        [&] { singleThread.colorize(depth.data(), width, height, single.data(), width * 3); },
+        iterations);
+    double multiMs = timeFrame(
+        [&] { multiThread.colorize(depth.data(), width, height, multi.data(), width * 3); },
+        iterations);
+
+    CHECK(legacy == single);
+    CHECK(single == multi);
+
+    log_info("Depth   per pixel %7.3f ms  LUT 1 thread %7.3f ms  LUT %u threads %7.3f ms  x%.1f",
+             legacyMs, singleMs, multiThread.getThreadCount(), multiMs,
+             multiMs > 0 ? legacyMs / multiMs : 0);
+}
+
+static void benchInfrared(uint32_t width, uint32_t height, int iterations)
+{
+    std::vector<uint8_t> ir(width * height);
+    for (uint8_t &p : ir)
+        p = rand();
+
+    size_t size = width * height * 3;
+    std::vector<uint8_t> legacy(size), scalar(size), simd(size);
+    pixel_simd best = pixel_get_simd();
+
+    double legacyMs
+        = timeFrame([&] { replicateLegacy(ir.data(), width, height, legacy.data()); }, iterations);
+    pixel_set_simd(PIXEL_SIMD_NONE);
+    double scalarMs = timeFrame(
+        [&] { pixel_gray8_to_rgb24(ir.data(), width, width, height, scalar.data(), width * 3); },
+        iterations);
+    pixel_set_simd(best);
+    double simdMs = timeFrame(
+        [&] { pixel_gray8_to_rgb24(ir.data(), width, width, height, simd.data(), width * 3); },
+        iterations);
+
+    CHECK(legacy == scalar);
+    CHECK(scalar == simd);
+
+    log_info("IR      per pixel %7.3f ms  scalar %7.3f ms  %-4s %7.3f ms  x%.1f", legacyMs,
+             scalarMs, pixel_simd_name(best), simdMs, simdMs > 0 ? legacyMs / simdMs : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+
+    uint32_t width = argc > 2 ? atoi(argv[1]) : DEFAULT_WIDTH;
+    uint32_t height = argc > 2 ? atoi(argv[2]) : DEFAULT_HEIGHT;
+    int iterations = argc > 3 ? atoi(argv[3]) : DEFAULT_ITERATIONS;
+    if (!width || !height || iterations <= 0) {
+        log_error("Invalid arguments");
+        return 1;
+    }
+
+    log_info("Depth coloring %ux%u, %d iterations", width, height, iterations);
+
+    benchDepth(width, height, iterations);
+    benchInfrared(width, height, iterations);
+
+    return finishChecks();
+}
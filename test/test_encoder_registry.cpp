@@ -0,0 +1,70 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the selection of the video encoder. An encoder of the preference that is not installed
+ * must be skipped for the next one, an element unknown to the registry must be used as it is with
+ * its options of the configuration, not the ones of the other encoders, and the selection must
+ * not change once probed. identity stands in for the encoder, it is always installed.
+ *
+ * Usage: test-encoder-registry
+ */
+#include <gst/gst.h>
+#include <string.h>
+
+#include "EncoderRegistry.h"
+#include "log.h"
+#include "test_check.h"
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+    log_info("Encoder registry test");
+
+    EncoderRegistry::setPreference({"nosuchenc", "identity", "x264enc"},
+                                   {{"identity", "silent=true"}, {"x264enc", "threads=1"}});
+
+    std::string desc = EncoderRegistry::getEncoder(CameraParameters::VIDEO_CODING_AVC, 512, 30);
+    log_info("H.264 encoder: %s", desc.c_str());
+    CHECK(desc == "identity silent=true");
+
+    /* Codec without encoder */
+    CHECK(EncoderRegistry::getEncoder(CameraParameters::VIDEO_CODING_WMV).empty());
+    CHECK(!EncoderRegistry::makeEncoder(CameraParameters::VIDEO_CODING_WMV));
+
+    /* Selection is kept for the process */
+    EncoderRegistry::setPreference({"x264enc"}, {});
+    EncoderRegistry::probe();
+    CHECK(EncoderRegistry::getEncoder(CameraParameters::VIDEO_CODING_AVC) == desc);
+
+    GstElement *encoder = EncoderRegistry::makeEncoder(CameraParameters::VIDEO_CODING_AVC);
+    CHECK(encoder);
+    if (encoder) {
+        GstElementFactory *factory = gst_element_get_factory(encoder);
+        CHECK(!strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "identity"));
+
+        gboolean silent = FALSE;
+        g_object_get(G_OBJECT(encoder), "silent", &silent, NULL);
+        CHECK(silent);
+
+        gst_object_unref(gst_object_ref_sink(encoder));
+    }
+
+    return finishChecks();
+}
@@ -0,0 +1,224 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the pre-trigger frame ring of zero shutter lag still capture. A synthetic camera
+ * device delivers timestamped frames through the frame hub. The frame picked for a trigger must
+ * be the one taken at the trigger, the memory budget must limit the frames kept, the camera
+ * must keep its buffers, and it must stop delivering once the ring leaves the hub.
+ *
+ * Usage: test-frame-ring
+ */
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+#include "CameraDevice.h"
+#include "FrameHub.h"
+#include "FrameRing.h"
+#include "log.h"
+#include "test_check.h"
+#include "util.h"
+
+#define FRAME_SIZE (64 * 1024)
+#define FRAME_PERIOD_US 10000
+#define DEVICE_POOL_SIZE 3
+/* Scheduling noise allowed, generous for loaded CI machines */
+#define TOLERANCE_US 5000
+
+static uint64_t systemTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts_usec(&ts);
+}
+
+static uint64_t frameTimeUs(const CameraData &data)
+{
+    return (uint64_t)data.sec * USEC_PER_SEC + data.nsec / NSEC_PER_USEC;
+}
+
+/* Camera delivering one frame every FRAME_PERIOD_US, stamped with the system time */
+class CameraDeviceSynthetic final : public CameraDevice {
+public:
+    CameraDeviceSynthetic()
+        : mRunning(false)
+        , mStarveCnt(0)
+    {
+    }
+
+    ~CameraDeviceSynthetic() { stop(); }
+
+    std::string getDeviceId() const { return "synthetic"; }
+    Status getInfo(CameraInfo &camInfo) const { return Status::NOT_SUPPORTED; }
+    bool isGstV4l2Src() const { return false; }
+    Status init(CameraParameters &camParam) { return Status::SUCCESS; }
+    Status uninit() { return Status::SUCCESS; }
+
+    Status start(const std::function<void(CameraData &)> cb)
+    {
+        mPool = FramePool::create(DEVICE_POOL_SIZE, FRAME_SIZE);
+        if (!mPool)
+            return Status::NO_MEMORY;
+
+        mRunning = true;
+        mThread = std::thread([this, cb] {
+            uint32_t index = 0;
+            while (mRunning) {
+                usleep(FRAME_PERIOD_US);
+
+                std::shared_ptr<FrameBuffer> frame = mPool->acquire();
+                if (!frame) {
+                    mStarveCnt++;
+                    continue;
+                }
+
+                uint64_t now = systemTimeUs();
+                CameraData data;
+                data.sec = now / USEC_PER_SEC;
+                data.nsec = (now % USEC_PER_SEC) * NSEC_PER_USEC;
+                data.buf = frame->data;
+                data.bufSize = FRAME_SIZE;
+                data.frame = frame;
+                memcpy(data.buf, &index, sizeof(index));
+                index++;
+                cb(data);
+            }
+        });
+
+        return Status::SUCCESS;
+    }
+
+    Status stop()
+    {
+        mRunning = false;
+        if (mThread.joinable())
+            mThread.join();
+        return Status::SUCCESS;
+    }
+
+    Status stopAsync() { return stop(); }
+
+    bool isRunning() const { return mRunning; }
+
+    /* Frames not delivered because all the buffers were held by consumers */
+    uint64_t getStarveCount() const { return mStarveCnt; }
+
+private:
+    std::shared_ptr<FramePool> mPool;
+    std::thread mThread;
+    std::atomic<bool> mRunning;
+    std::atomic<uint64_t> mStarveCnt;
+};
+
+static void testClosest(const std::shared_ptr<FrameHub> &hub,
+                        const std::shared_ptr<CameraDeviceSynthetic> &device)
+{
+    FrameRing ring(hub, 50, 50 * FRAME_SIZE);
+    CHECK(ring.start() == 0);
+    usleep(20 * FRAME_PERIOD_US);
+
+    /* Trigger in the past, the frame at the trigger is kept, not the newest one */
+    CameraData data;
+    uint64_t trigger = systemTimeUs() - 5 * FRAME_PERIOD_US - FRAME_PERIOD_US / 3;
+    CHECK(ring.get(trigger, data, 1000));
+    int64_t offset = (int64_t)frameTimeUs(data) - (int64_t)trigger;
+    log_info("%s: past trigger, frame %lld us from trigger", __func__, (long long)offset);
+    CHECK(std::abs(offset) <= FRAME_PERIOD_US / 2 + TOLERANCE_US);
+
+    /* Trigger now, waits for the next frame if it is the closest */
+    trigger = systemTimeUs();
+    CHECK(ring.get(trigger, data, 1000));
+    offset = (int64_t)frameTimeUs(data) - (int64_t)trigger;
+    log_info("%s: trigger now, frame %lld us from trigger", __func__, (long long)offset);
+    CHECK(std::abs(offset) <= FRAME_PERIOD_US / 2 + TOLERANCE_US);
+
+    /* Frame held by the capture stays valid while the ring goes on */
+    uint32_t index;
+    memcpy(&index, data.buf, sizeof(index));
+    usleep(60 * FRAME_PERIOD_US);
+    uint32_t later;
+    memcpy(&later, data.buf, sizeof(later));
+    CHECK(index == later);
+
+    ring.stop();
+    CHECK(!ring.isRunning());
+    CHECK(ring.getCount() == 0);
+    CHECK(!ring.get(systemTimeUs(), data, 10));
+
+    /* Last consumer gone, the camera is not read for nothing */
+    CHECK(!device->isRunning());
+}
+
+static void testFirstAfter(const std::shared_ptr<FrameHub> &hub)
+{
+    FrameRing ring(hub, 50, 50 * FRAME_SIZE, FrameRing::Policy::FIRST_AFTER);
+    CHECK(ring.start() == 0);
+    usleep(10 * FRAME_PERIOD_US);
+
+    for (int i = 0; i < 10; i++) {
+        CameraData data;
+        uint64_t trigger = systemTimeUs() - (i % 3) * FRAME_PERIOD_US;
+        CHECK(ring.get(trigger, data, 1000));
+        CHECK(frameTimeUs(data) >= trigger);
+        CHECK(frameTimeUs(data) - trigger <= FRAME_PERIOD_US + TOLERANCE_US);
+        usleep(FRAME_PERIOD_US / 3);
+    }
+}
+
+static void testBudget(const std::shared_ptr<FrameHub> &hub,
+                       const std::shared_ptr<CameraDeviceSynthetic> &device)
+{
+    /* Room for 5 frames only, out of the 100 asked */
+    FrameRing ring(hub, 100, 5 * FRAME_SIZE + FRAME_SIZE / 2);
+    CHECK(ring.start() == 0);
+
+    uint64_t starved = device->getStarveCount();
+    usleep(30 * FRAME_PERIOD_US);
+    log_info("%s: %u frame(s) in ring, camera starved of buffers %llu time(s)", __func__,
+             ring.getCount(), (unsigned long long)(device->getStarveCount() - starved));
+    CHECK(ring.getCount() == 5);
+    CHECK(device->getStarveCount() == starved);
+
+    /* Budget too small for one frame */
+    FrameRing tiny(hub, 10, FRAME_SIZE / 2);
+    CHECK(tiny.start() == 0);
+    usleep(5 * FRAME_PERIOD_US);
+    CHECK(!tiny.isRunning());
+    CHECK(tiny.getCount() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Pre-trigger frame ring test");
+
+    std::shared_ptr<CameraDeviceSynthetic> device = std::make_shared<CameraDeviceSynthetic>();
+    std::shared_ptr<FrameHub> hub = std::make_shared<FrameHub>(device);
+
+    testClosest(hub, device);
+    testFirstAfter(hub);
+    testBudget(hub, device);
+
+    hub->stop();
+    device->stop();
+
+    return finishChecks();
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of still capture during a video stream. Frames are grabbed from a live pipeline standing
+ * in for the stream while it runs. Every grab must return a raw frame and the stream must not
+ * lose a frame, checked on the frame numbers reaching its sink. A still capture pipeline parked
+ * on the camera must be stopped once, when another pipeline needs the device.
+ *
+ * Usage: test-frame-tap
+ */
+#include <atomic>
+#include <gst/gst.h>
+#include <unistd.h>
+
+#include "FrameTap.h"
+#include "log.h"
+#include "test_check.h"
+
+#define DEVICE_ID "video-test"
+#define GRABS 10
+#define GRAB_PERIOD_US 100000
+#define GRAB_TIMEOUT_MS 1000
+
+/* Frames reaching the sink of the stream, and frame numbers skipped */
+static std::atomic<guint64> frames(0);
+static std::atomic<guint64> skipped(0);
+
+static GstPadProbeReturn countFrame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    /* videotestsrc numbers its frames in the offset */
+    if (frames && GST_BUFFER_OFFSET(buffer) != frames)
+        skipped += GST_BUFFER_OFFSET(buffer) - frames;
+    frames = GST_BUFFER_OFFSET(buffer) + 1;
+
+    return GST_PAD_PROBE_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+    log_info("Frame tap test");
+
+    GError *error = nullptr;
+    GstElement *pipeline
+        = gst_parse_launch("videotestsrc name=camsrc is-live=true ! "
+                           "video/x-raw, format=I420, width=320, height=240, framerate=30/1 ! "
+                           "fakesink name=sink sync=true",
+                           &error);
+    if (!pipeline) {
+        log_error("Error creating pipeline");
+        if (error)
+            g_clear_error(&error);
+        return 1;
+    }
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstPad *pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, countFrame, NULL, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(sink);
+
+    CHECK(!FrameTap::get(DEVICE_ID));
+    std::shared_ptr<FrameTap> tap = FrameTap::attach(DEVICE_ID, pipeline);
+    CHECK(tap);
+    CHECK(FrameTap::get(DEVICE_ID) == tap);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    usleep(GRAB_PERIOD_US);
+
+    for (int i = 0; i < GRABS && tap; i++) {
+        GstSample *sample = FrameTap::get(DEVICE_ID)->grab(GRAB_TIMEOUT_MS);
+        CHECK(sample);
+        if (sample) {
+            GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+            CHECK(gst_structure_has_name(s, "video/x-raw"));
+            CHECK(gst_buffer_get_size(gst_sample_get_buffer(sample)) == 320 * 240 * 3 / 2);
+            gst_sample_unref(sample);
+        }
+        usleep(GRAB_PERIOD_US);
+    }
+
+    log_info("%llu frame(s) streamed, %llu skipped", (unsigned long long)frames.load(),
+             (unsigned long long)skipped.load());
+    CHECK(frames > GRABS);
+    CHECK(skipped == 0);
+
+    /* Pipeline stops, capture falls back to its own pipeline */
+    if (tap) {
+        tap->detach();
+        CHECK(!FrameTap::get(DEVICE_ID));
+        CHECK(!tap->grab(10));
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    /* Still capture parked on the camera is stopped once, for the pipeline opening the device */
+    int released = 0;
+    FrameTap::park(DEVICE_ID, [&released] { released++; });
+    FrameTap::releaseDevice(DEVICE_ID);
+    FrameTap::releaseDevice(DEVICE_ID);
+    CHECK(released == 1);
+
+    /* Back to a click, the pipeline is not stopped under it */
+    FrameTap::park(DEVICE_ID, [&released] { released++; });
+    FrameTap::unpark(DEVICE_ID);
+    FrameTap::releaseDevice(DEVICE_ID);
+    CHECK(released == 1);
+
+    return finishChecks();
+}
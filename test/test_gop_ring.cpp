@@ -0,0 +1,202 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the ring of encoded GOPs of the pre-record of video capture. A synthetic encoder gives
+ * a key frame every GOP_FRAMES buffers. The ring must start on a key frame, cover its duration
+ * without holding more than one extra GOP, stay within its memory budget, and a reader must get
+ * the ring then the live buffers without gap until it is detached.
+ *
+ * Usage: test-gop-ring
+ */
+#include <gst/gst.h>
+#include <vector>
+
+#include "GopRing.h"
+#include "log.h"
+#include "test_check.h"
+
+#define FRAME_SIZE 1000
+#define KEY_FRAME_SIZE 10000
+#define FRAME_RATE 10
+#define GOP_FRAMES 10
+#define FRAME_DURATION (GST_SECOND / FRAME_RATE)
+
+/* Encoded buffer number n of the synthetic encoder */
+static GstBuffer *makeBuffer(uint32_t n)
+{
+    bool key = n % GOP_FRAMES == 0;
+    GstBuffer *buffer
+        = gst_buffer_new_allocate(nullptr, key ? KEY_FRAME_SIZE : FRAME_SIZE, nullptr);
+
+    GST_BUFFER_PTS(buffer) = n * FRAME_DURATION;
+    GST_BUFFER_DTS(buffer) = n * FRAME_DURATION;
+    if (!key)
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    return buffer;
+}
+
+static bool isKey(GstBuffer *buffer)
+{
+    return !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+/* Numbers of the buffers given to a reader */
+class Reader {
+public:
+    ~Reader() { clear(); }
+
+    GopRing::Reader get()
+    {
+        return [this](GstBuffer *buffer) { buffers.push_back(buffer); };
+    }
+
+    uint32_t number(size_t i) const { return GST_BUFFER_PTS(buffers[i]) / FRAME_DURATION; }
+
+    /* Buffers follow each other from a key frame */
+    bool isContiguous() const
+    {
+        if (buffers.empty() || !isKey(buffers[0]))
+            return false;
+        for (size_t i = 1; i < buffers.size(); i++) {
+            if (number(i) != number(i - 1) + 1)
+                return false;
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        for (GstBuffer *buffer : buffers)
+            gst_buffer_unref(buffer);
+        buffers.clear();
+    }
+
+    std::vector<GstBuffer *> buffers;
+};
+
+static void testDuration()
+{
+    GopRing ring(3 * GST_SECOND, 64 * 1024 * 1024);
+
+    /* Encoder started in the middle of a GOP */
+    for (uint32_t n = 5; n < 10; n++)
+        ring.push(makeBuffer(n));
+    CHECK(ring.getCount() == 0);
+    CHECK(ring.getDropCount() == 5);
+
+    for (uint32_t n = 10; n < 100; n++)
+        ring.push(makeBuffer(n));
+
+    /* At least 3 s, less than one GOP more */
+    GstClockTime duration = ring.getDuration();
+    CHECK(duration >= 3 * GST_SECOND);
+    CHECK(duration < 3 * GST_SECOND + GOP_FRAMES * FRAME_DURATION);
+    CHECK(ring.getDropCount() == 5);
+
+    Reader reader;
+    CHECK(ring.attach(reader.get()) == duration);
+    ring.detach();
+    CHECK(reader.isContiguous());
+    CHECK(reader.buffers.size() == ring.getCount());
+    CHECK(reader.number(reader.buffers.size() - 1) == 99);
+    CHECK(ring.getSize() == (reader.buffers.size() / GOP_FRAMES) * KEY_FRAME_SIZE
+              + (reader.buffers.size() - reader.buffers.size() / GOP_FRAMES) * FRAME_SIZE);
+}
+
+static void testMemory()
+{
+    /* Budget of two and a half GOPs, shorter than the duration */
+    size_t gopSize = KEY_FRAME_SIZE + (GOP_FRAMES - 1) * FRAME_SIZE;
+    GopRing ring(10 * GST_SECOND, gopSize * 5 / 2);
+
+    for (uint32_t n = 0; n < 100; n++) {
+        ring.push(makeBuffer(n));
+        CHECK(ring.getSize() <= gopSize * 5 / 2);
+    }
+    CHECK(ring.getDuration() >= GST_SECOND);
+    CHECK(ring.getDuration() < 3 * GST_SECOND);
+
+    Reader reader;
+    ring.attach(reader.get());
+    ring.detach();
+    CHECK(reader.isContiguous());
+
+    /* GOP over the budget is not kept, the next key frame starts again */
+    GopRing tiny(10 * GST_SECOND, KEY_FRAME_SIZE + 5 * FRAME_SIZE);
+    for (uint32_t n = 0; n < 25; n++)
+        tiny.push(makeBuffer(n));
+    CHECK(tiny.getCount() == 5);
+    CHECK(tiny.getSize() == KEY_FRAME_SIZE + 4 * FRAME_SIZE);
+    CHECK(tiny.getDropCount() == 20);
+}
+
+static void testReader()
+{
+    size_t gopSize = KEY_FRAME_SIZE + (GOP_FRAMES - 1) * FRAME_SIZE;
+    GopRing ring(2 * GST_SECOND, gopSize / 2);
+    Reader reader;
+
+    /* Reader attached to an empty ring waits for a key frame */
+    ring.attach(reader.get());
+    for (uint32_t n = 5; n < 10; n++)
+        ring.push(makeBuffer(n));
+    CHECK(reader.buffers.empty());
+
+    /* Live buffers go on even when the ring drops the GOP they belong to */
+    for (uint32_t n = 10; n < 40; n++)
+        ring.push(makeBuffer(n));
+    CHECK(reader.buffers.size() == 30);
+    CHECK(reader.isContiguous());
+
+    ring.detach();
+    ring.push(makeBuffer(40));
+    CHECK(reader.buffers.size() == 30);
+
+    /* Ring given first, then the next buffers */
+    reader.clear();
+    GopRing big(2 * GST_SECOND, 64 * 1024 * 1024);
+    for (uint32_t n = 0; n < 35; n++)
+        big.push(makeBuffer(n));
+    CHECK(big.attach(reader.get()) > 0);
+    for (uint32_t n = 35; n < 50; n++)
+        big.push(makeBuffer(n));
+    big.detach();
+    CHECK(reader.isContiguous());
+    CHECK(reader.number(0) == 10);
+    CHECK(reader.number(reader.buffers.size() - 1) == 49);
+
+    /* Buffers handed out stay valid once the ring drops them */
+    big.clear();
+    CHECK(big.getCount() == 0 && big.getSize() == 0);
+    CHECK(gst_buffer_get_size(reader.buffers[0]) == KEY_FRAME_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+    log_info("GOP ring test");
+
+    testDuration();
+    testMemory();
+    testReader();
+
+    return finishChecks();
+}
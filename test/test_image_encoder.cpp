@@ -0,0 +1,229 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Burst benchmark of the still image encoder pool. A burst of raw I420 frames is queued as the
+ * capture thread does, with one worker and with the default worker count. The time the capture
+ * side waits in push() and the time to write the whole burst are reported, for JPEG, PNG and raw
+ * images. Every image must be reported once and be a valid file on disk, raw images with their
+ * header. The location tagged on each image must be in the EXIF of JPEG images and in the header
+ * of raw images.
+ *
+ * Usage: test-image-encoder [width height [images]]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <gst/gst.h>
+#include <iterator>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ImageEncoderPool.h"
+#include "RawImageWriter.h"
+#include "log.h"
+#include "test_check.h"
+
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_IMAGES 30
+
+typedef std::chrono::steady_clock Clock;
+
+/* I420 frame with some texture, so the encoder has work to do */
+static GstSample *newFrame(uint32_t width, uint32_t height, int index)
+{
+    size_t size = width * height * 3 / 2;
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    GstMapInfo map;
+    gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+    for (size_t i = 0; i < size; i++)
+        map.data[i] = (i * 7 + (i / width) * 3 + index * 11) & 0xff;
+    gst_buffer_unmap(buffer, &map);
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", "width",
+                                        G_TYPE_INT, width, "height", G_TYPE_INT, height,
+                                        "framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+    GstSample *sample = gst_sample_new(buffer, caps, NULL, NULL);
+    gst_caps_unref(caps);
+    gst_buffer_unref(buffer);
+
+    return sample;
+}
+
+static bool hasMagic(const std::string &path, const std::string &magic)
+{
+    std::vector<char> head(magic.size());
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    size_t n = fread(head.data(), 1, head.size(), file);
+    fclose(file);
+
+    return n == head.size() && std::string(head.begin(), head.end()) == magic;
+}
+
+/* Raw frame of the size of the frame queued, described by its header */
+static bool isRaw(const std::string &path, uint32_t width, uint32_t height)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) || (size_t)st.st_size != width * height * 3 / 2)
+        return false;
+
+    std::ifstream header(RawImageWriter::getHeaderPath(path));
+    std::string line;
+    bool format = false, w = false, h = false;
+    while (std::getline(header, line)) {
+        format |= line == "format=I420";
+        w |= line == "width=" + std::to_string(width);
+        h |= line == "height=" + std::to_string(height);
+    }
+
+    return format && w && h;
+}
+
+/* Location of the image in the EXIF block or in the raw header */
+static bool hasLocation(const std::string &path, const std::string &ext)
+{
+    std::string content;
+    if (ext == "jpg") {
+        std::ifstream file(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return content.find(std::string("Exif\0\0", 6)) != std::string::npos;
+    }
+    if (ext == "raw") {
+        std::ifstream header(RawImageWriter::getHeaderPath(path));
+        while (std::getline(header, content)) {
+            if (!content.compare(0, 22, GST_TAG_GEO_LOCATION_LATITUDE "="))
+                return true;
+        }
+        return false;
+    }
+
+    /* No tags in PNG images */
+    return true;
+}
+
+static GstTagList *newLocation(int index)
+{
+    return gst_tag_list_new(GST_TAG_GEO_LOCATION_LATITUDE, 47.3977 + index * 1E-5,
+                            GST_TAG_GEO_LOCATION_LONGITUDE, 8.5455,
+                            GST_TAG_GEO_LOCATION_ELEVATION, 488.0, NULL);
+}
+
+static bool isImage(const std::string &path, const std::string &ext, uint32_t width,
+                    uint32_t height)
+{
+    if (ext == "jpg")
+        return hasMagic(path, "\xff\xd8");
+    if (ext == "png")
+        return hasMagic(path, "\x89PNG");
+    return isRaw(path, width, height);
+}
+
+static void burst(unsigned int workers, const std::string &encoder, const std::string &ext,
+                  uint32_t width, uint32_t height, int images, const std::string &dir)
+{
+    std::vector<GstSample *> frames;
+    for (int i = 0; i < images; i++)
+        frames.push_back(newFrame(width, height, i));
+
+    std::atomic<int> done(0), errors(0);
+    std::vector<std::string> paths;
+    double pushMs = 0, maxPushMs = 0;
+    Clock::time_point start = Clock::now();
+    unsigned int count;
+    {
+        ImageEncoderPool pool(workers);
+        count = pool.getWorkerCount();
+        auto onDone = [&](int result, usec_t encodedUs) {
+            done++;
+            if (result)
+                errors++;
+        };
+
+        for (int i = 0; i < images; i++) {
+            paths.push_back(dir + "/img_" + std::to_string(count) + "_" + std::to_string(i) + "."
+                            + ext);
+
+            GstTagList *tags = newLocation(i);
+            Clock::time_point t = Clock::now();
+            int ret = pool.push(frames[i], tags, encoder, 0, 0, paths.back(), onDone);
+            std::chrono::duration<double, std::milli> waited = Clock::now() - t;
+            CHECK(ret == 0);
+
+            pushMs += waited.count();
+            maxPushMs = std::max(maxPushMs, waited.count());
+        }
+
+        pool.flush();
+        CHECK(pool.getPendingCount() == 0);
+    }
+    std::chrono::duration<double, std::milli> total = Clock::now() - start;
+
+    CHECK(done == images);
+    CHECK(errors == 0);
+    for (const std::string &path : paths) {
+        CHECK(isImage(path, ext, width, height));
+        CHECK(hasLocation(path, ext));
+        unlink(path.c_str());
+        if (ext == "raw")
+            unlink(RawImageWriter::getHeaderPath(path).c_str());
+    }
+
+    log_info("%s %u worker(s): burst written in %7.1f ms  %5.1f images/s  capture waited %6.1f ms "
+             "total, %6.1f ms max",
+             ext.c_str(), count, total.count(), images * 1000.0 / total.count(), pushMs, maxPushMs);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+
+    uint32_t width = argc > 2 ? atoi(argv[1]) : DEFAULT_WIDTH;
+    uint32_t height = argc > 2 ? atoi(argv[2]) : DEFAULT_HEIGHT;
+    int images = argc > 3 ? atoi(argv[3]) : DEFAULT_IMAGES;
+    if (!width || !height || width % 2 || height % 2 || images <= 0) {
+        log_error("Invalid arguments");
+        return 1;
+    }
+
+    char dir[] = "/tmp/test-image-encoder-XXXXXX";
+    if (!mkdtemp(dir)) {
+        log_error("Unable to create temporary directory");
+        return 1;
+    }
+
+    log_info("Burst of %d images %ux%u", images, width, height);
+
+    burst(1, "jpegenc", "jpg", width, height, images, dir);
+    burst(0, "jpegenc", "jpg", width, height, images, dir);
+    burst(0, "pngenc", "png", width, height, images, dir);
+    burst(1, "", "raw", width, height, images, dir);
+    burst(0, "", "raw", width, height, images, dir);
+
+    rmdir(dir);
+
+    return finishChecks();
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the interval timer pacing interval image capture: ticks stay on the grid of the
+ * period whatever the time taken by the task, overruns are counted and skipped, cancel wakes up
+ * a long wait.
+ *
+ * Usage: test-interval-timer
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+#include "IntervalTimer.h"
+#include "log.h"
+#include "test_check.h"
+#include "util.h"
+
+/* Scheduling noise allowed, generous for loaded CI machines */
+#define TOLERANCE_US 20000
+
+static usec_t monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_usec(&ts);
+}
+
+/* 5 Hz with a task taking 60% of the period, as a click at 5 Hz would */
+static void testNoDrift()
+{
+    const uint64_t period = 200000;
+    const int ticks = 10;
+    IntervalTimer timer;
+
+    CHECK(timer.start(period) == 0);
+    usec_t start = monotonicUs();
+    int64_t worst = 0;
+    for (int i = 1; i <= ticks; i++) {
+        usleep(period * 6 / 10);
+        CHECK(timer.wait() == 0);
+        int64_t error = (int64_t)(monotonicUs() - start) - (int64_t)(i * period);
+        worst = std::max(worst, std::abs(error));
+    }
+
+    log_info("%s: %d ticks of %llu us, worst error %lld us", __func__, ticks,
+             (unsigned long long)period, (long long)worst);
+    CHECK(worst < TOLERANCE_US);
+    CHECK(timer.getTickCount() == (uint64_t)ticks);
+    CHECK(timer.getOverrunCount() == 0);
+}
+
+static void testOverrun()
+{
+    const uint64_t period = 50000;
+    IntervalTimer timer;
+
+    CHECK(timer.start(period) == 0);
+    usec_t start = monotonicUs();
+
+    /* Task runs for 2.5 periods, ticks 1 and 2 are missed, tick 3 is on time */
+    usleep(period * 5 / 2);
+    CHECK(timer.wait() == 2);
+    int64_t error = (int64_t)(monotonicUs() - start) - (int64_t)(3 * period);
+    CHECK(std::abs(error) < TOLERANCE_US);
+
+    /* Back to normal */
+    CHECK(timer.wait() == 0);
+    error = (int64_t)(monotonicUs() - start) - (int64_t)(4 * period);
+    CHECK(std::abs(error) < TOLERANCE_US);
+
+    log_info("%s: overruns %llu, max lateness %llu us", __func__,
+             (unsigned long long)timer.getOverrunCount(),
+             (unsigned long long)timer.getMaxLatenessUs());
+    CHECK(timer.getOverrunCount() == 2);
+    CHECK(timer.getTickCount() == 2);
+}
+
+static void testCancel()
+{
+    IntervalTimer timer;
+
+    CHECK(timer.start(0) == -1);
+    CHECK(timer.start(10 * USEC_PER_SEC) == 0);
+
+    usec_t start = monotonicUs();
+    std::thread canceller([&timer] {
+        usleep(100000);
+        timer.cancel();
+    });
+    CHECK(timer.wait() == -1);
+    canceller.join();
+
+    usec_t elapsed = monotonicUs() - start;
+    log_info("%s: wait of 10 s cancelled after %llu us", __func__, (unsigned long long)elapsed);
+    CHECK(elapsed < 100000 + 100000);
+
+    /* Restarted timer ticks again */
+    CHECK(timer.start(10000) == 0);
+    CHECK(timer.wait() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Interval timer test");
+
+    testNoDrift();
+    testOverrun();
+    testCancel();
+
+    return finishChecks();
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Micro-benchmark of the pixel format conversion kernels against the gstreamer video converter
+ * used by videoconvert. Each conversion is timed with the scalar code, the SIMD code and
+ * videoconvert. The SIMD output must match the scalar output bit for bit, the difference with
+ * videoconvert is given for information.
+ *
+ * Usage: test-pixel-convert [width height [iterations]]
+ * Sizes below 720 lines keep videoconvert on BT.601, as the kernels.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <vector>
+
+#include "log.h"
+#include "pixel_convert.h"
+#include "test_check.h"
+
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_ITERATIONS 200
+
+struct Conversion {
+    const char *name;
+    CameraParameters::PixelFormat from;
+    GstVideoFormat gstFrom;
+    CameraParameters::PixelFormat to;
+    GstVideoFormat gstTo;
+};
+
+static const Conversion conversions[] = {
+    {"RGB24->I420", CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24, GST_VIDEO_FORMAT_RGB,
+     CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420, GST_VIDEO_FORMAT_I420},
+    {"UYVY->I420", CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY, GST_VIDEO_FORMAT_UYVY,
+     CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420, GST_VIDEO_FORMAT_I420},
+    {"UYVY->NV12", CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY, GST_VIDEO_FORMAT_UYVY,
+     CameraParameters::PixelFormat::PIXEL_FORMAT_NV12, GST_VIDEO_FORMAT_NV12},
+    {"GRAY8->I420", CameraParameters::PixelFormat::PIXEL_FORMAT_GREY, GST_VIDEO_FORMAT_GRAY8,
+     CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420, GST_VIDEO_FORMAT_I420},
+};
+
+/* Average time of one conversion in ms */
+static double timeKernel(const Conversion &conv, const uint8_t *src, uint32_t stride,
+                         uint8_t *dst, uint32_t width, uint32_t height, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (pixel_convert(conv.from, src, stride, conv.to, dst, width, height))
+            return -1;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / iterations;
+}
+
+static double timeVideoConvert(GstVideoConverter *convert, GstVideoFrame *in,
+                               GstVideoFrame *out, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        gst_video_converter_frame(convert, in, out);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / iterations;
+}
+
+static void benchConversion(const Conversion &conv, uint32_t width, uint32_t height,
+                            int iterations)
+{
+    GstVideoInfo inInfo, outInfo;
+    gst_video_info_set_format(&inInfo, conv.gstFrom, width, height);
+    gst_video_info_set_format(&outInfo, conv.gstTo, width, height);
+
+    /* Frames are pushed to appsrc as is, the layout must be the one expected by gstreamer */
+    size_t size = pixel_get_frame_size(conv.to, width, height);
+    CHECK(size == GST_VIDEO_INFO_SIZE(&outInfo));
+    CHECK(pixel_get_stride(conv.from, width)
+          == (uint32_t)GST_VIDEO_INFO_PLANE_STRIDE(&inInfo, 0));
+
+    GstBuffer *inBuf = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&inInfo), NULL);
+    GstBuffer *outBuf = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&outInfo), NULL);
+    GstVideoFrame in, out;
+    gst_video_frame_map(&in, &inInfo, inBuf, GST_MAP_READWRITE);
+    gst_video_frame_map(&out, &outInfo, outBuf, GST_MAP_READWRITE);
+
+    /* Same random image for all */
+    uint8_t *src = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&in, 0);
+    uint32_t stride = GST_VIDEO_FRAME_PLANE_STRIDE(&in, 0);
+    srand(width * height);
+    for (size_t i = 0; i < GST_VIDEO_INFO_SIZE(&inInfo); i++)
+        src[i] = rand();
+
+    std::vector<uint8_t> scalar(size), simd(size);
+    pixel_simd best = pixel_get_simd();
+
+    pixel_set_simd(PIXEL_SIMD_NONE);
+    double scalarMs = timeKernel(conv, src, stride, scalar.data(), width, height, iterations);
+    pixel_set_simd(best);
+    double simdMs = timeKernel(conv, src, stride, simd.data(), width, height, iterations);
+    CHECK(scalarMs >= 0 && simdMs >= 0);
+    CHECK(scalar == simd);
+
+    GstVideoConverter *convert = gst_video_converter_new(&inInfo, &outInfo, NULL);
+    double gstMs = timeVideoConvert(convert, &in, &out, iterations);
+    gst_video_converter_free(convert);
+
+    int maxDiff = 0;
+    const uint8_t *gstOut = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&out, 0);
+    for (size_t i = 0; i < size; i++)
+        maxDiff = std::max(maxDiff, std::abs(gstOut[i] - simd[i]));
+
+    log_info("%-12s scalar %7.3f ms  %-4s %7.3f ms  videoconvert %7.3f ms  x%.1f  max diff %d",
+             conv.name, scalarMs, pixel_simd_name(best), simdMs, gstMs,
+             simdMs > 0 ? gstMs / simdMs : 0, maxDiff);
+
+    gst_video_frame_unmap(&in);
+    gst_video_frame_unmap(&out);
+    gst_buffer_unref(inBuf);
+    gst_buffer_unref(outBuf);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+
+    uint32_t width = argc > 2 ? atoi(argv[1]) : DEFAULT_WIDTH;
+    uint32_t height = argc > 2 ? atoi(argv[2]) : DEFAULT_HEIGHT;
+    int iterations = argc > 3 ? atoi(argv[3]) : DEFAULT_ITERATIONS;
+    if (!width || !height || (width & 1) || (height & 1) || iterations <= 0) {
+        log_error("Invalid arguments, width and height must be even");
+        return 1;
+    }
+
+    log_info("Pixel conversion %ux%u, %d iterations, best SIMD: %s", width, height, iterations,
+             pixel_simd_name(pixel_get_simd()));
+
+    for (const Conversion &conv : conversions)
+        benchConversion(conv, width, height, iterations);
+
+    return finishChecks();
+}
@@ -0,0 +1,190 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the vehicle pose cache used to geotag the images. A vehicle flying a straight line
+ * and turning sends its position and attitude over a link with a varying delay. The pose looked
+ * up at a time must be the pose of the vehicle at that time, not at the time the messages were
+ * received. Readers running along the writer must never see a torn sample.
+ *
+ * Usage: test-pose-cache
+ */
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+#include "PoseCache.h"
+#include "log.h"
+#include "test_check.h"
+
+/* Local time of the boot of the vehicle */
+#define BOOT_US (1000 * USEC_PER_SEC)
+#define PERIOD_MS 100
+#define LINK_DELAY_MIN_US 5000
+#define LINK_DELAY_MAX_US 40000
+/* Vehicle flying north at 100 m/s, 1E-7 deg of latitude is 1.1 cm */
+#define SPEED_CM_S 10000
+#define LAT_PER_MS 9
+#define START_LAT 473977000
+#define START_LON 85455000
+/* Turning 90 degrees per second */
+#define YAW_RATE (M_PI / 2)
+
+static PoseCache::Position positionAt(uint32_t timeMs)
+{
+    PoseCache::Position position = {};
+    position.lat = START_LAT + LAT_PER_MS * (int32_t)timeMs;
+    position.lon = START_LON;
+    position.alt = 500000;
+    position.relativeAlt = 50000 + timeMs;
+    position.vx = SPEED_CM_S;
+    return position;
+}
+
+static double yawOf(const float q[4])
+{
+    return atan2(2.0 * (q[0] * q[3] + q[1] * q[2]), 1 - 2.0 * (q[2] * q[2] + q[3] * q[3]));
+}
+
+static void fly(PoseCache &cache, uint32_t fromMs, uint32_t toMs)
+{
+    for (uint32_t t = fromMs; t <= toMs; t += PERIOD_MS) {
+        usec_t delay = LINK_DELAY_MIN_US + rand() % (LINK_DELAY_MAX_US - LINK_DELAY_MIN_US);
+        /* One message without delay, as the link gets one through now and then */
+        if (t == fromMs)
+            delay = LINK_DELAY_MIN_US;
+        usec_t recvUs = BOOT_US + t * USEC_PER_MSEC + delay;
+
+        cache.pushPosition(t, positionAt(t), recvUs);
+
+        double yaw = YAW_RATE * t / 1000.0;
+        float q[4] = {(float)cos(yaw / 2), 0, 0, (float)sin(yaw / 2)};
+        cache.pushAttitude(t, q, recvUs);
+    }
+}
+
+static void testInterpolation()
+{
+    PoseCache cache;
+    PoseCache::Pose pose;
+    CHECK(!cache.get(BOOT_US, pose));
+
+    fly(cache, 0, 2000);
+
+    /* Between two samples, link delay removed */
+    uint32_t t = 1234;
+    usec_t timeUs = BOOT_US + t * USEC_PER_MSEC + LINK_DELAY_MIN_US;
+    CHECK(cache.get(timeUs, pose));
+    CHECK(pose.hasPosition && pose.hasAttitude);
+    int32_t error = pose.position.lat - positionAt(t).lat;
+    log_info("%s: latitude off by %d E-7 deg", __func__, error);
+    CHECK(std::abs(error) <= 2);
+    CHECK(std::abs(pose.position.relativeAlt - positionAt(t).relativeAlt) <= 1);
+
+    double yaw = yawOf(pose.q);
+    log_info("%s: yaw %.3f rad, expected %.3f rad", __func__, yaw, YAW_RATE * t / 1000.0);
+    CHECK(std::fabs(yaw - YAW_RATE * t / 1000.0) < 0.01);
+
+    /* After the last sample, moved on with the speed */
+    t = 2300;
+    timeUs = BOOT_US + t * USEC_PER_MSEC + LINK_DELAY_MIN_US;
+    CHECK(cache.get(timeUs, pose));
+    error = pose.position.lat - positionAt(t).lat;
+    log_info("%s: extrapolated latitude off by %d E-7 deg", __func__, error);
+    CHECK(std::abs(error) <= 30);
+
+    /* Too old or too far after the last sample */
+    CHECK(!cache.get(BOOT_US + 5000 * USEC_PER_MSEC, pose));
+    CHECK(!cache.get(BOOT_US - 5000 * USEC_PER_MSEC, pose));
+}
+
+static void testOverwrite()
+{
+    PoseCache cache;
+    PoseCache::Pose pose;
+
+    /* More samples than the ring holds, the oldest are gone */
+    uint32_t lastMs = PERIOD_MS * (PoseCache::SAMPLES * 2);
+    fly(cache, 0, lastMs);
+    CHECK(!cache.get(BOOT_US + 1000 * USEC_PER_MSEC, pose));
+
+    /* Offset now measured over the last window only, a bit above the smallest delay */
+    usec_t timeUs = BOOT_US + (lastMs - 1000) * USEC_PER_MSEC + LINK_DELAY_MIN_US;
+    CHECK(cache.get(timeUs, pose));
+    int32_t error = pose.position.lat - positionAt(lastMs - 1000).lat;
+    log_info("%s: latitude off by %d E-7 deg", __func__, error);
+    CHECK(std::abs(error) <= LAT_PER_MS);
+}
+
+static void testConcurrent()
+{
+    PoseCache cache;
+    std::atomic<bool> running(true);
+    std::atomic<int> torn(0), found(0);
+    std::atomic<uint32_t> last(0);
+
+    std::thread writer([&] {
+        for (uint32_t t = 0; t < 200000; t++) {
+            /* Every field of a sample is derived from its time */
+            PoseCache::Position position = {};
+            position.lat = position.lon = position.alt = position.relativeAlt = t;
+            cache.pushPosition(t, position, BOOT_US + t * USEC_PER_MSEC);
+            last = t;
+        }
+        running = false;
+    });
+
+    std::thread readers[2];
+    for (std::thread &reader : readers) {
+        reader = std::thread([&] {
+            unsigned int seed = 1;
+            while (running) {
+                /* Somewhere in the samples kept, the oldest being written over */
+                uint32_t t = last - rand_r(&seed) % PoseCache::SAMPLES;
+                PoseCache::Pose pose;
+                if (!cache.get(BOOT_US + t * USEC_PER_MSEC + rand_r(&seed) % USEC_PER_MSEC, pose))
+                    continue;
+                found++;
+                const PoseCache::Position &p = pose.position;
+                if (p.lat != p.lon || p.lat != p.alt || p.lat != p.relativeAlt)
+                    torn++;
+            }
+        });
+    }
+
+    writer.join();
+    for (std::thread &reader : readers)
+        reader.join();
+
+    log_info("%s: %d lookup(s) found a pose, %d torn", __func__, found.load(), torn.load());
+    CHECK(torn == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Vehicle pose cache test");
+
+    srand(1);
+    testInterpolation();
+    testOverwrite();
+    testConcurrent();
+
+    return finishChecks();
+}
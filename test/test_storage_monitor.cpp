@@ -0,0 +1,126 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the storage monitor of the capture locations. The capacity of a directory must be read
+ * and kept until the next refresh, the recording time left must follow the bitrate of the
+ * recordings, and the writes must be given to the deepest location holding the file.
+ *
+ * Usage: test-storage-monitor [directory]
+ */
+#include <cmath>
+#include <limits>
+#include <string>
+#include <unistd.h>
+
+#include "StorageMonitor.h"
+#include "log.h"
+#include "test_check.h"
+
+static const float epsilon = std::numeric_limits<float>::epsilon();
+
+static void testCapacity(const std::string &dir)
+{
+    std::shared_ptr<StorageMonitor> monitor = StorageMonitor::get(dir);
+    CHECK(monitor == StorageMonitor::get(dir + "/"));
+    CHECK(monitor->getPath().back() == '/');
+
+    StorageMonitor::Status status = monitor->getStatus();
+    CHECK(status.available);
+    CHECK(status.totalBytes > 0);
+    CHECK(status.availableBytes <= status.totalBytes);
+    CHECK(status.usedBytes <= status.totalBytes);
+    CHECK(status.recordingTimeMs == -1);
+
+    /* Location that does not exist is reported, not failed on */
+    std::shared_ptr<StorageMonitor> missing = StorageMonitor::get(dir + "/no/such/location");
+    CHECK(!missing->getStatus().available);
+    CHECK(missing->getStatus().totalBytes == 0);
+}
+
+static void testRecordingTime(const std::string &dir)
+{
+    std::shared_ptr<StorageMonitor> monitor = StorageMonitor::get(dir);
+    uint64_t available = monitor->getStatus().availableBytes;
+
+    /* 8000 kbps fill 1 MB per second */
+    monitor->addRecording(8000);
+    StorageMonitor::Status status = monitor->getStatus();
+    CHECK(status.bitRate == 8000);
+    CHECK(status.recordingTimeMs == (int64_t)(available / 1000));
+
+    /* Two recordings halve the time left */
+    monitor->addRecording(8000);
+    CHECK(monitor->getStatus().recordingTimeMs == (int64_t)(available / 2000));
+
+    monitor->removeRecording(8000);
+    monitor->removeRecording(8000);
+    CHECK(monitor->getStatus().bitRate == 0);
+    CHECK(monitor->getStatus().recordingTimeMs == -1);
+
+    /* More removed than added does not wrap */
+    monitor->removeRecording(100);
+    CHECK(monitor->getStatus().bitRate == 0);
+}
+
+static void testWrite(const std::string &dir)
+{
+    std::shared_ptr<StorageMonitor> parent = StorageMonitor::get(dir);
+    std::shared_ptr<StorageMonitor> child = StorageMonitor::get(dir + "/no/such/location");
+    float parentSpeed = parent->getStatus().writeSpeed;
+
+    /* 1 MiB in 100 ms */
+    StorageMonitor::reportWrite(child->getPath() + "img_1.raw", 1024 * 1024, 100000);
+    CHECK(child->getStatus().writeSpeed > 9.9 && child->getStatus().writeSpeed < 10.1);
+    CHECK(std::abs(parent->getStatus().writeSpeed - parentSpeed) <= epsilon);
+
+    StorageMonitor::reportWrite(parent->getPath() + "img_1.raw", 1024 * 1024, 0);
+    CHECK(std::abs(parent->getStatus().writeSpeed - parentSpeed) <= epsilon);
+    StorageMonitor::reportWrite(parent->getPath() + "img_1.raw", 1024 * 1024, 1000000);
+    CHECK(parent->getStatus().writeSpeed > 0);
+
+    /* File out of all the locations */
+    StorageMonitor::reportWrite("/nowhere/img_1.raw", 1024 * 1024, 100000);
+}
+
+static void testRefresh(const std::string &dir)
+{
+    CHECK(StorageMonitor::startRefresh(0) < 0);
+    CHECK(StorageMonitor::startRefresh(10) == 0);
+    CHECK(StorageMonitor::startRefresh(10) == 0);
+    usleep(50000);
+    StorageMonitor::stopRefresh();
+    StorageMonitor::stopRefresh();
+
+    CHECK(StorageMonitor::get(dir)->getStatus().available);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Storage monitor test");
+
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+
+    testCapacity(dir);
+    testRecordingTime(dir);
+    testWrite(dir);
+    testRefresh(dir);
+
+    return finishChecks();
+}
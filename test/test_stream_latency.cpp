@@ -0,0 +1,489 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Glass to glass latency benchmark of the video streams.
+ *
+ * A synthetic camera device writes the time of capture of each frame in its pixels, as blocks
+ * of black and white pixels that survive the encoder. Frames go through the frame hub to
+ * VideoStreamUdp or VideoStreamRtsp, as for a camera component, and the stream is received,
+ * decoded and read back on loopback. Latency is the time between the capture and the decoded
+ * frame reaching the receiver. Nothing is displayed, no camera is needed.
+ *
+ * Usage: test-stream-latency [udp|rtsp|all [seconds [width height]]]
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <gst/app/gstappsink.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "CaptureEngine.h"
+#include "FrameHub.h"
+#include "VideoStreamRtsp.h"
+#include "VideoStreamUdp.h"
+#include "log.h"
+#include "pixel_convert.h"
+#include "test_check.h"
+
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_DURATION_SEC 10
+/* Frames received before are not measured, while the pipelines settle */
+#define WARMUP_SEC 2
+/* Frame rate of the caps set by the video streams */
+#define FRAME_RATE 25
+#define FRAME_POOL_SIZE 8
+#define UDP_PORT 15600
+#define RTSP_PORT 18554
+
+/* Timestamp is written in blocks of STAMP_BLOCK x STAMP_BLOCK luma pixels, one per bit */
+#define STAMP_BLOCK 16
+#define STAMP_MARKER 0xa5ULL
+#define STAMP_TIME_BITS 48
+#define STAMP_BITS (8 + STAMP_TIME_BITS)
+#define STAMP_WHITE 235
+#define STAMP_BLACK 16
+
+static uint64_t monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Block of pixels of a bit of the timestamp, the blocks fill the last lines of the frame */
+static uint32_t stampOffset(uint32_t stride, uint32_t width, uint32_t height, uint32_t bit)
+{
+    uint32_t columns = width / STAMP_BLOCK;
+    uint32_t rows = (STAMP_BITS + columns - 1) / columns;
+    uint32_t y = height - (rows - bit / columns) * STAMP_BLOCK;
+
+    return y * stride + (bit % columns) * STAMP_BLOCK;
+}
+
+static void writeStamp(uint8_t *luma, uint32_t stride, uint32_t width, uint32_t height,
+                       uint64_t timeUs)
+{
+    uint64_t stamp = (STAMP_MARKER << STAMP_TIME_BITS)
+        | (timeUs & ((1ULL << STAMP_TIME_BITS) - 1));
+
+    for (uint32_t bit = 0; bit < STAMP_BITS; bit++) {
+        uint8_t value = (stamp >> (STAMP_BITS - 1 - bit)) & 1 ? STAMP_WHITE : STAMP_BLACK;
+        uint8_t *block = luma + stampOffset(stride, width, height, bit);
+        for (uint32_t y = 0; y < STAMP_BLOCK; y++)
+            memset(block + y * stride, value, STAMP_BLOCK);
+    }
+}
+
+/* Read the timestamp back from the center of the blocks, false if the marker is not found */
+static bool readStamp(const uint8_t *luma, uint32_t stride, uint32_t width, uint32_t height,
+                      uint64_t &timeUs)
+{
+    uint64_t stamp = 0;
+
+    for (uint32_t bit = 0; bit < STAMP_BITS; bit++) {
+        const uint8_t *block = luma + stampOffset(stride, width, height, bit);
+        uint32_t sum = 0;
+        for (uint32_t y = STAMP_BLOCK / 4; y < STAMP_BLOCK * 3 / 4; y++)
+            for (uint32_t x = STAMP_BLOCK / 4; x < STAMP_BLOCK * 3 / 4; x++)
+                sum += block[y * stride + x];
+        uint32_t mean = sum / (STAMP_BLOCK * STAMP_BLOCK / 4);
+        stamp = (stamp << 1) | (mean > (STAMP_WHITE + STAMP_BLACK) / 2);
+    }
+
+    if (stamp >> STAMP_TIME_BITS != STAMP_MARKER)
+        return false;
+
+    timeUs = stamp & ((1ULL << STAMP_TIME_BITS) - 1);
+    return true;
+}
+
+/*
+ * Camera device giving I420 frames at FRAME_RATE, with a moving background so the encoder has
+ * some work to do, and the time of capture written in the last lines, away from the text
+ * overlay of the UDP stream.
+ */
+class CameraDeviceSynthetic final : public CameraDevice {
+public:
+    CameraDeviceSynthetic(uint32_t width, uint32_t height)
+        : mWidth(width)
+        , mHeight(height)
+        , mState(State::STATE_IDLE)
+        , mFrameCnt(0)
+        , mNextFrame{}
+        , mCaptureEngine([this](CameraData &data) { return read(data); })
+    {
+    }
+
+    ~CameraDeviceSynthetic() { stop(); }
+
+    std::string getDeviceId() const { return "synthetic"; }
+    Status getInfo(CameraInfo &camInfo) const { return Status::NOT_SUPPORTED; }
+    bool isGstV4l2Src() const { return false; }
+    Status init(CameraParameters &camParam) { return Status::SUCCESS; }
+    Status uninit() { return Status::SUCCESS; }
+
+    Status start()
+    {
+        if (mState == State::STATE_RUN)
+            return Status::SUCCESS;
+
+        size_t size
+            = pixel_get_frame_size(CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420, mWidth,
+                                   mHeight);
+        mFramePool = FramePool::create(FRAME_POOL_SIZE, size);
+        if (!mFramePool)
+            return Status::NO_MEMORY;
+
+        clock_gettime(CLOCK_MONOTONIC, &mNextFrame);
+        mState = State::STATE_RUN;
+        return Status::SUCCESS;
+    }
+
+    Status start(const std::function<void(CameraData &)> cb)
+    {
+        if (!cb)
+            return Status::INVALID_ARGUMENT;
+
+        Status ret = start();
+        if (ret != Status::SUCCESS)
+            return ret;
+
+        if (mCaptureEngine.start(cb))
+            return Status::INVALID_STATE;
+
+        return Status::SUCCESS;
+    }
+
+    Status stop()
+    {
+        mCaptureEngine.stop();
+        mState = State::STATE_IDLE;
+        return Status::SUCCESS;
+    }
+
+    Status stopAsync()
+    {
+        mCaptureEngine.stop();
+        return Status::SUCCESS;
+    }
+
+    Status read(CameraData &data)
+    {
+        if (mState != State::STATE_RUN)
+            return Status::INVALID_STATE;
+
+        /* Sensor pace, a late reader does not get a burst of frames */
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &mNextFrame, NULL);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        mNextFrame.tv_nsec += 1000000000 / FRAME_RATE;
+        if (mNextFrame.tv_nsec >= 1000000000) {
+            mNextFrame.tv_sec++;
+            mNextFrame.tv_nsec -= 1000000000;
+        }
+        if (mNextFrame.tv_sec < now.tv_sec
+            || (mNextFrame.tv_sec == now.tv_sec && mNextFrame.tv_nsec < now.tv_nsec))
+            mNextFrame = now;
+
+        std::shared_ptr<FrameBuffer> frame = mFramePool->acquire();
+        if (!frame)
+            return Status::NO_MEMORY;
+
+        uint8_t *luma = (uint8_t *)frame->data;
+        uint32_t stride
+            = pixel_get_stride(CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420, mWidth);
+        size_t size
+            = pixel_get_frame_size(CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420, mWidth,
+                                   mHeight);
+        for (uint32_t y = 0; y < mHeight; y++)
+            memset(luma + y * stride, (y + mFrameCnt * 4) & 0xff, stride);
+        memset(luma + stride * mHeight, 128, size - stride * mHeight);
+        writeStamp(luma, stride, mWidth, mHeight, monotonicUs());
+        mFrameCnt++;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        data.sec = ts.tv_sec;
+        data.nsec = ts.tv_nsec;
+        data.width = mWidth;
+        data.height = mHeight;
+        data.stride = stride;
+        data.buf = frame->data;
+        data.bufSize = size;
+        frame->bytesUsed = size;
+        data.frame = frame;
+
+        return Status::SUCCESS;
+    }
+
+    Status getSize(uint32_t &width, uint32_t &height) const
+    {
+        width = mWidth;
+        height = mHeight;
+        return Status::SUCCESS;
+    }
+
+    Status getPixelFormat(CameraParameters::PixelFormat &format) const
+    {
+        format = CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+        return Status::SUCCESS;
+    }
+
+    Status getFrameRate(uint32_t &fps) const
+    {
+        fps = FRAME_RATE;
+        return Status::SUCCESS;
+    }
+
+    uint64_t getFrameCount() const { return mFrameCnt; }
+
+private:
+    uint32_t mWidth;
+    uint32_t mHeight;
+    std::atomic<State> mState;
+    std::atomic<uint64_t> mFrameCnt;
+    std::shared_ptr<FramePool> mFramePool;
+    struct timespec mNextFrame;
+    CaptureEngine mCaptureEngine;
+};
+
+/* Decoding end of the stream */
+struct Receiver {
+    GstElement *pipeline = nullptr;
+    GMainLoop *loop = nullptr;
+    uint64_t warmupEndUs = 0;
+    uint64_t firstUs = 0;
+    uint64_t lastUs = 0;
+    uint64_t invalidCnt = 0;
+    bool error = false;
+    std::vector<uint64_t> latencies;
+};
+
+static GstFlowReturn cb_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    Receiver *rx = (Receiver *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (!sample)
+        return GST_FLOW_ERROR;
+
+    uint64_t nowUs = monotonicUs();
+    GstVideoInfo info;
+    GstVideoFrame frame;
+    if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample))
+        && gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+        uint64_t captureUs;
+        if (!readStamp((const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                       GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0), GST_VIDEO_FRAME_WIDTH(&frame),
+                       GST_VIDEO_FRAME_HEIGHT(&frame), captureUs)) {
+            rx->invalidCnt++;
+        } else if (nowUs >= rx->warmupEndUs) {
+            if (rx->latencies.empty())
+                rx->firstUs = nowUs;
+            rx->lastUs = nowUs;
+            rx->latencies.push_back(nowUs - captureUs);
+        }
+        gst_video_frame_unmap(&frame);
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static gboolean cb_bus(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    Receiver *rx = (Receiver *)user_data;
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError *err = NULL;
+        gst_message_parse_error(msg, &err, NULL);
+        log_error("Receiver error: %s", err ? err->message : "unknown");
+        g_clear_error(&err);
+        rx->error = true;
+        g_main_loop_quit(rx->loop);
+    }
+
+    return TRUE;
+}
+
+static gboolean cb_timeout(gpointer user_data)
+{
+    g_main_loop_quit((GMainLoop *)user_data);
+    return FALSE;
+}
+
+static bool startReceiver(Receiver &rx, const std::string &source)
+{
+    std::string launch = source
+        + " ! rtph264depay ! decodebin ! videoconvert ! video/x-raw, format=I420"
+          " ! appsink name=sink emit-signals=false sync=false";
+    log_debug("Receiver: %s", launch.c_str());
+
+    GError *error = NULL;
+    rx.pipeline = gst_parse_launch(launch.c_str(), &error);
+    if (!rx.pipeline) {
+        log_error("Receiver pipeline: %s", error ? error->message : "unknown");
+        g_clear_error(&error);
+        return false;
+    }
+    g_clear_error(&error);
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(rx.pipeline), "sink");
+    GstAppSinkCallbacks cbs = {};
+    cbs.new_sample = cb_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &cbs, &rx, NULL);
+    gst_object_unref(sink);
+
+    GstBus *bus = gst_element_get_bus(rx.pipeline);
+    gst_bus_add_watch(bus, cb_bus, &rx);
+    gst_object_unref(bus);
+
+    gst_element_set_state(rx.pipeline, GST_STATE_PLAYING);
+    return true;
+}
+
+static void stopReceiver(Receiver &rx)
+{
+    if (!rx.pipeline)
+        return;
+
+    gst_element_set_state(rx.pipeline, GST_STATE_NULL);
+    GstBus *bus = gst_element_get_bus(rx.pipeline);
+    gst_bus_remove_watch(bus);
+    gst_object_unref(bus);
+    gst_object_unref(rx.pipeline);
+    rx.pipeline = nullptr;
+}
+
+static void report(const char *name, Receiver &rx, uint64_t sentCnt)
+{
+    std::vector<uint64_t> &lat = rx.latencies;
+    CHECK(!rx.error);
+    CHECK(!lat.empty());
+    if (lat.empty())
+        return;
+
+    std::sort(lat.begin(), lat.end());
+    size_t n = lat.size();
+    double fps = rx.lastUs > rx.firstUs ? (n - 1) * 1e6 / (rx.lastUs - rx.firstUs) : 0;
+
+    log_info("%-4s sent %llu received %zu invalid %llu  fps %.1f  latency p50 %.1f ms  "
+             "p99 %.1f ms  max %.1f ms",
+             name, (unsigned long long)sentCnt, n, (unsigned long long)rx.invalidCnt, fps,
+             lat[n / 2] / 1000.0, lat[std::min(n - 1, n * 99 / 100)] / 1000.0,
+             lat[n - 1] / 1000.0);
+}
+
+static void runStream(GMainLoop *loop, const std::string &mode, uint32_t width, uint32_t height,
+                      uint32_t seconds)
+{
+    std::shared_ptr<CameraDeviceSynthetic> device
+        = std::make_shared<CameraDeviceSynthetic>(width, height);
+    std::shared_ptr<FrameHub> frameHub = std::make_shared<FrameHub>(device);
+    std::shared_ptr<VideoStream> stream;
+    std::string source;
+
+    CHECK(device->start() == CameraDevice::Status::SUCCESS);
+
+    if (mode == "udp") {
+        stream = std::make_shared<VideoStreamUdp>(device, frameHub);
+        stream->setResolution(width, height);
+        stream->setAddress("127.0.0.1");
+        stream->setPort(UDP_PORT);
+        source = "udpsrc port=" + std::to_string(UDP_PORT)
+            + " caps=\"application/x-rtp, media=video, clock-rate=90000, encoding-name=H264\"";
+    } else {
+        /* Without VA-API, encode as in the sample configuration */
+        GstElementFactory *factory = gst_element_factory_find("vaapih264enc");
+        if (factory) {
+            gst_object_unref(factory);
+        } else {
+            log_info("vaapih264enc not found, RTSP stream encoded with x264enc");
+            device->setGstRTSPPipeline("appsrc name=mysrc ! videoconvert"
+                                       " ! video/x-raw, format=I420"
+                                       " ! x264enc speed-preset=ultrafast tune=zerolatency"
+                                       " ! rtph264pay name=pay0");
+        }
+        stream = std::make_shared<VideoStreamRtsp>(device, frameHub);
+        stream->setPort(RTSP_PORT);
+        source = "rtspsrc latency=0 location=rtsp://127.0.0.1:" + std::to_string(RTSP_PORT) + "/"
+            + device->getDeviceId();
+    }
+
+    Receiver rx;
+    rx.loop = loop;
+    rx.warmupEndUs = monotonicUs() + WARMUP_SEC * 1000000ULL;
+
+    /* Receiver listens before the first packet is sent */
+    CHECK(stream->init() == 0);
+    bool ok;
+    if (mode == "udp")
+        ok = startReceiver(rx, source) && stream->start() == 0;
+    else
+        ok = stream->start() == 0 && startReceiver(rx, source);
+    CHECK(ok);
+
+    if (ok) {
+        guint timeout = g_timeout_add_seconds(seconds + WARMUP_SEC, cb_timeout, loop);
+        g_main_loop_run(loop);
+        if (rx.error)
+            g_source_remove(timeout);
+    }
+
+    stopReceiver(rx);
+    if (stream->getState() == VideoStream::STATE_RUN)
+        stream->stop();
+    stream->uninit();
+    frameHub->stop();
+    device->stop();
+
+    report(mode.c_str(), rx, device->getFrameCount());
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+
+    std::string mode = argc > 1 ? argv[1] : "all";
+    uint32_t seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_DURATION_SEC;
+    uint32_t width = argc > 4 ? atoi(argv[3]) : DEFAULT_WIDTH;
+    uint32_t height = argc > 4 ? atoi(argv[4]) : DEFAULT_HEIGHT;
+    if ((mode != "udp" && mode != "rtsp" && mode != "all") || !seconds || (width & 1)
+        || (height & 1) || (width / STAMP_BLOCK) * (height / STAMP_BLOCK) < STAMP_BITS) {
+        log_error("Invalid arguments");
+        return 1;
+    }
+
+    log_info("Stream latency %ux%u@%d, %u s per stream", width, height, FRAME_RATE, seconds);
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    if (mode != "rtsp")
+        runStream(loop, "udp", width, height, seconds);
+    if (mode != "udp")
+        runStream(loop, "rtsp", width, height, seconds);
+    g_main_loop_unref(loop);
+
+    return finishChecks();
+}
@@ -0,0 +1,151 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the triple buffer handing the latest frame from the thread of the camera to a
+ * consumer. The reader must get nothing until a new frame is published, then the newest one
+ * only, and a writer racing the reader must never hand out a frame written partly.
+ *
+ * Usage: test-triple-buffer
+ */
+#include <stdint.h>
+#include <thread>
+
+#include "TripleBuffer.h"
+#include "log.h"
+#include "test_check.h"
+
+#define FRAME_WORDS 64
+#define RACE_FRAMES 200000
+
+/* Frame written whole has all its words equal to its sequence number */
+struct Frame {
+    uint64_t words[FRAME_WORDS];
+};
+
+static Frame makeFrame(uint64_t seq)
+{
+    Frame frame;
+    for (int i = 0; i < FRAME_WORDS; i++)
+        frame.words[i] = seq;
+
+    return frame;
+}
+
+static bool isWhole(const Frame &frame)
+{
+    for (int i = 1; i < FRAME_WORDS; i++) {
+        if (frame.words[i] != frame.words[0])
+            return false;
+    }
+
+    return true;
+}
+
+static void testEmpty()
+{
+    TripleBuffer<Frame> buffer;
+    Frame frame = makeFrame(7);
+
+    /* Nothing published yet */
+    CHECK(!buffer.hasNew());
+    CHECK(!buffer.read(frame));
+    CHECK(frame.words[0] == 7);
+
+    /* Frame read once only */
+    CHECK(!buffer.write(makeFrame(1)));
+    CHECK(buffer.hasNew());
+    CHECK(buffer.read(frame));
+    CHECK(frame.words[0] == 1);
+    CHECK(!buffer.hasNew());
+    CHECK(!buffer.read(frame));
+    CHECK(frame.words[0] == 1);
+}
+
+static void testNewest()
+{
+    TripleBuffer<Frame> buffer;
+    Frame frame;
+
+    /* Frames not read are replaced, the writer is told */
+    CHECK(!buffer.write(makeFrame(1)));
+    CHECK(buffer.write(makeFrame(2)));
+    CHECK(buffer.write(makeFrame(3)));
+    CHECK(buffer.read(frame));
+    CHECK(frame.words[0] == 3 && isWhole(frame));
+    CHECK(!buffer.read(frame));
+
+    /* Read frame is not replaced */
+    CHECK(!buffer.write(makeFrame(4)));
+    CHECK(buffer.read(frame));
+    CHECK(frame.words[0] == 4 && isWhole(frame));
+}
+
+static void testRace()
+{
+    TripleBuffer<Frame> buffer;
+    uint64_t replaced = 0;
+
+    std::thread writer([&buffer, &replaced] {
+        for (uint64_t seq = 1; seq <= RACE_FRAMES; seq++) {
+            if (buffer.write(makeFrame(seq)))
+                replaced++;
+        }
+    });
+
+    /* Reader keeps up as it can, each frame whole and newer than the last one */
+    uint64_t last = 0;
+    uint64_t reads = 0;
+    int torn = 0;
+    int stale = 0;
+    Frame frame;
+    while (last < RACE_FRAMES) {
+        if (!buffer.read(frame)) {
+            std::this_thread::yield();
+            continue;
+        }
+        reads++;
+        if (!isWhole(frame))
+            torn++;
+        if (frame.words[0] <= last)
+            stale++;
+        last = frame.words[0];
+    }
+    writer.join();
+
+    CHECK(torn == 0);
+    CHECK(stale == 0);
+    CHECK(last == RACE_FRAMES);
+    CHECK(!buffer.read(frame));
+    /* Each frame either read or replaced */
+    CHECK(reads + replaced == RACE_FRAMES);
+    log_info("%llu frames read, %llu replaced", (unsigned long long)reads,
+             (unsigned long long)replaced);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Triple buffer test");
+
+    testEmpty();
+    testNewest();
+    testRace();
+
+    return finishChecks();
+}
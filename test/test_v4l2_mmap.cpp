@@ -0,0 +1,367 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the native V4L2 capture of CameraDeviceV4l2 against a fake V4L2 device.
+ * The fake backend implements the ioctls of a capture device streaming YUYV frames
+ * in MMAP buffers, no camera is needed.
+ */
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <linux/videodev2.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "log.h"
+#include "plugins/V4l2Camera/CameraDeviceV4l2.h"
+#include "test_check.h"
+#include "v4l2_interface.h"
+
+#define FAKE_FD 42
+#define FAKE_WIDTH 64
+#define FAKE_HEIGHT 48
+#define FAKE_FRAME_SIZE (FAKE_WIDTH * FAKE_HEIGHT * 2)
+#define FAKE_BUFFER_SIZE 8192
+#define FAKE_CAPTURE_DELAY_NS 5000000ULL
+
+/* State of the fake device */
+static struct {
+    std::mutex lock;
+    bool open = false;
+    bool streaming = false;
+    uint32_t width = FAKE_WIDTH;
+    uint32_t height = FAKE_HEIGHT;
+    uint32_t requested = 0;
+    std::vector<void *> memory;
+    std::vector<bool> mapped;
+    std::deque<uint32_t> queue;
+    uint32_t sequence = 0;
+    int unmapped = 0;
+} fake;
+
+static uint64_t clockNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int fakeOpen(const char *path, int flags)
+{
+    fake.open = true;
+    return FAKE_FD;
+}
+
+static int fakeClose(int fd)
+{
+    std::lock_guard<std::mutex> locker(fake.lock);
+    fake.open = false;
+    fake.streaming = false;
+    fake.queue.clear();
+    return 0;
+}
+
+static void fakeFillFrame(uint32_t index, struct v4l2_buffer *buf)
+{
+    /* Every byte of the frame holds the sequence number */
+    memset(fake.memory[index], fake.sequence & 0xff, FAKE_FRAME_SIZE);
+
+    uint64_t ts = clockNs(CLOCK_MONOTONIC) - FAKE_CAPTURE_DELAY_NS;
+    buf->index = index;
+    buf->bytesused = FAKE_FRAME_SIZE;
+    buf->sequence = fake.sequence++;
+    buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buf->timestamp.tv_sec = ts / 1000000000ULL;
+    buf->timestamp.tv_usec = (ts % 1000000000ULL) / 1000;
+}
+
+static int fakeIoctl(int fd, unsigned long request, void *arg)
+{
+    std::lock_guard<std::mutex> locker(fake.lock);
+
+    if (fd != FAKE_FD || !fake.open) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Request is passed as int by v4l2_ioctl(), ioctl numbers are 32 bits */
+    switch ((uint32_t)request) {
+    case VIDIOC_QUERYCAP: {
+        struct v4l2_capability *cap = (struct v4l2_capability *)arg;
+        memset(cap, 0, sizeof(*cap));
+        strcpy((char *)cap->driver, "fake");
+        strcpy((char *)cap->card, "Fake Camera");
+        cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+        return 0;
+    }
+    case VIDIOC_G_FMT:
+    case VIDIOC_S_FMT: {
+        struct v4l2_format *fmt = (struct v4l2_format *)arg;
+        if ((uint32_t)request == VIDIOC_S_FMT) {
+            if (fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+                errno = EINVAL;
+                return -1;
+            }
+            fake.width = fmt->fmt.pix.width;
+            fake.height = fmt->fmt.pix.height;
+        }
+        fmt->fmt.pix.width = fake.width;
+        fmt->fmt.pix.height = fake.height;
+        fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        fmt->fmt.pix.bytesperline = fake.width * 2;
+        fmt->fmt.pix.sizeimage = fake.width * fake.height * 2;
+        return 0;
+    }
+    case VIDIOC_REQBUFS: {
+        struct v4l2_requestbuffers *req = (struct v4l2_requestbuffers *)arg;
+        if (req->memory != V4L2_MEMORY_MMAP) {
+            errno = EINVAL;
+            return -1;
+        }
+        fake.requested = req->count;
+        while (fake.memory.size() < req->count) {
+            fake.memory.push_back(aligned_alloc(4096, FAKE_BUFFER_SIZE));
+            fake.mapped.push_back(false);
+        }
+        return 0;
+    }
+    case VIDIOC_QUERYBUF: {
+        struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+        if (buf->index >= fake.requested) {
+            errno = EINVAL;
+            return -1;
+        }
+        buf->length = FAKE_BUFFER_SIZE;
+        buf->m.offset = buf->index * FAKE_BUFFER_SIZE;
+        return 0;
+    }
+    case VIDIOC_QBUF: {
+        struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+        if (buf->index >= fake.requested) {
+            errno = EINVAL;
+            return -1;
+        }
+        fake.queue.push_back(buf->index);
+        return 0;
+    }
+    case VIDIOC_DQBUF: {
+        struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+        if (!fake.streaming || fake.queue.empty()) {
+            errno = EAGAIN;
+            return -1;
+        }
+        uint32_t index = fake.queue.front();
+        fake.queue.pop_front();
+        fakeFillFrame(index, buf);
+        return 0;
+    }
+    case VIDIOC_STREAMON:
+        fake.streaming = true;
+        return 0;
+    case VIDIOC_STREAMOFF:
+        fake.streaming = false;
+        fake.queue.clear();
+        return 0;
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
+
+static void *fakeMmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    std::lock_guard<std::mutex> locker(fake.lock);
+    uint32_t index = offset / FAKE_BUFFER_SIZE;
+    if (fd != FAKE_FD || index >= fake.requested || length != FAKE_BUFFER_SIZE) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    fake.mapped[index] = true;
+    return fake.memory[index];
+}
+
+static int fakeMunmap(void *addr, size_t length)
+{
+    std::lock_guard<std::mutex> locker(fake.lock);
+    for (size_t i = 0; i < fake.memory.size(); i++) {
+        if (fake.memory[i] == addr && fake.mapped[i]) {
+            fake.mapped[i] = false;
+            fake.unmapped++;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int fakePoll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    {
+        std::lock_guard<std::mutex> locker(fake.lock);
+        if (fake.streaming && !fake.queue.empty()) {
+            fds[0].revents = POLLIN;
+            return 1;
+        }
+    }
+
+    /* Nothing queued, the real driver would wait for the timeout */
+    usleep(10000);
+    fds[0].revents = 0;
+    return 0;
+}
+
+static const struct v4l2_backend fakeBackend
+    = {fakeOpen, fakeClose, fakeIoctl, fakeMmap, fakeMunmap, fakePoll};
+
+static size_t queuedCount()
+{
+    std::lock_guard<std::mutex> locker(fake.lock);
+    return fake.queue.size();
+}
+
+static bool isMapped(const void *addr)
+{
+    for (auto mem : fake.memory) {
+        if ((const uint8_t *)addr >= (uint8_t *)mem
+            && (const uint8_t *)addr < (uint8_t *)mem + FAKE_BUFFER_SIZE)
+            return true;
+    }
+
+    return false;
+}
+
+static void testRead()
+{
+    log_info("%s", __func__);
+
+    CameraDeviceV4l2 dev("video99");
+    CHECK(dev.setBufferCount(1) == CameraDevice::Status::INVALID_ARGUMENT);
+    CHECK(dev.setBufferCount(3) == CameraDevice::Status::SUCCESS);
+    CHECK(dev.setGstV4l2Src(false) == CameraDevice::Status::SUCCESS);
+    CHECK(!dev.isGstV4l2Src());
+
+    CameraData data;
+    CHECK(dev.read(data) == CameraDevice::Status::SUCCESS);
+    CHECK(fake.requested == 3);
+    CHECK(data.width == FAKE_WIDTH && data.height == FAKE_HEIGHT);
+    CHECK(data.stride == FAKE_WIDTH * 2);
+    CHECK(data.bufSize == FAKE_FRAME_SIZE);
+    CHECK(data.frame && data.buf == data.frame->data);
+    CHECK(isMapped(data.buf));
+
+    /* Capture time converted from monotonic to system time */
+    uint64_t ts = (uint64_t)data.sec * 1000000000ULL + data.nsec;
+    uint64_t now = clockNs(CLOCK_REALTIME);
+    CHECK(ts <= now - FAKE_CAPTURE_DELAY_NS && ts > now - 100 * FAKE_CAPTURE_DELAY_NS);
+
+    CameraParameters::PixelFormat format;
+    CHECK(dev.getPixelFormat(format) == CameraDevice::Status::SUCCESS);
+    CHECK(format == CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV);
+
+    /* Lease holds the buffer, release queues it back to the driver */
+    CHECK(queuedCount() == 2);
+    data = CameraData();
+    CHECK(queuedCount() == 3);
+
+    CHECK(dev.stop() == CameraDevice::Status::SUCCESS);
+    CHECK(fake.unmapped == 3);
+}
+
+static void testLeases()
+{
+    log_info("%s", __func__);
+
+    fake.unmapped = 0;
+    CameraDeviceV4l2 dev("video99");
+    dev.setBufferCount(3);
+
+    /* Consumers hold the frames, the driver always keeps a buffer */
+    std::vector<CameraData> held(5);
+    for (size_t i = 0; i < held.size(); i++) {
+        CHECK(dev.read(held[i]) == CameraDevice::Status::SUCCESS);
+        CHECK(queuedCount() >= 1);
+    }
+    CHECK(isMapped(held[0].buf));
+    CHECK(!isMapped(held[1].buf) && !isMapped(held[3].buf));
+    /* Copy pool exhausted, the frame is leased from the last but one queued buffer */
+    CHECK(isMapped(held[4].buf));
+
+    /* Copied frames hold their own data */
+    uint8_t first = ((uint8_t *)held[1].buf)[0];
+    CHECK(((uint8_t *)held[2].buf)[0] == (uint8_t)(first + 1));
+    CHECK(((uint8_t *)held[3].buf)[FAKE_FRAME_SIZE - 1] == (uint8_t)(first + 2));
+
+    /* Stop with leases held, buffers are unmapped on last release */
+    CHECK(dev.stop() == CameraDevice::Status::SUCCESS);
+    CHECK(fake.unmapped == 0);
+    held.clear();
+    CHECK(fake.unmapped == 3);
+}
+
+static void testAsync()
+{
+    log_info("%s", __func__);
+
+    fake.unmapped = 0;
+    CameraDeviceV4l2 dev("video99");
+    dev.setBufferCount(4);
+    dev.setFrameQueue(2, CameraDevice::DropPolicy::DROP_OLDEST);
+
+    std::atomic<int> frames(0);
+    std::atomic<uint32_t> lastSec(0);
+    CHECK(dev.start([&](CameraData &data) {
+        if (data.bufSize == FAKE_FRAME_SIZE)
+            frames++;
+        lastSec = data.sec;
+        usleep(1000);
+    }) == CameraDevice::Status::SUCCESS);
+
+    for (int i = 0; i < 100 && frames < 20; i++)
+        usleep(10000);
+
+    CHECK(dev.stop() == CameraDevice::Status::SUCCESS);
+    CHECK(frames >= 20);
+    CHECK(lastSec != 0);
+    CHECK(fake.unmapped == 4);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("Native V4L2 capture test");
+
+    v4l2_set_backend(&fakeBackend);
+
+    testRead();
+    testLeases();
+    testAsync();
+
+    v4l2_set_backend(nullptr);
+    for (auto mem : fake.memory)
+        free(mem);
+
+    return finishChecks();
+}
@@ -0,0 +1,187 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the selection of the frames read from a V4L2 camera against fake devices enumerating
+ * their formats. Compressed frames must be passed through only at a size the camera gives,
+ * H.264 before MJPEG, raw frames read otherwise and compressed frames only decoded when the
+ * camera gives nothing else.
+ *
+ * Usage: test-v4l2-source
+ */
+#include <cerrno>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <vector>
+
+#include "V4l2Source.h"
+#include "log.h"
+#include "test_check.h"
+#include "v4l2_interface.h"
+
+#define FAKE_FD 42
+
+/* Format of the fake device, with its discrete sizes or one stepwise range */
+struct FakeFormat {
+    uint32_t pixelformat;
+    uint32_t flags;
+    std::vector<std::pair<uint32_t, uint32_t>> sizes;
+    bool stepwise;
+};
+
+static std::vector<FakeFormat> fakeFormats;
+static bool fakePresent = true;
+
+static int fakeOpen(const char *path, int flags)
+{
+    if (!fakePresent) {
+        errno = ENOENT;
+        return -1;
+    }
+    return FAKE_FD;
+}
+
+static int fakeClose(int fd)
+{
+    return 0;
+}
+
+static int fakeIoctl(int fd, unsigned long request, void *arg)
+{
+    switch ((uint32_t)request) {
+    case VIDIOC_ENUM_FMT: {
+        struct v4l2_fmtdesc *fmt = (struct v4l2_fmtdesc *)arg;
+        if (fmt->index >= fakeFormats.size())
+            break;
+        fmt->pixelformat = fakeFormats[fmt->index].pixelformat;
+        fmt->flags = fakeFormats[fmt->index].flags;
+        return 0;
+    }
+    case VIDIOC_ENUM_FRAMESIZES: {
+        struct v4l2_frmsizeenum *size = (struct v4l2_frmsizeenum *)arg;
+        for (const FakeFormat &f : fakeFormats) {
+            if (f.pixelformat != size->pixel_format)
+                continue;
+            if (f.stepwise) {
+                if (size->index)
+                    break;
+                size->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+                size->stepwise = {f.sizes[0].first, f.sizes[1].first, 16,
+                                  f.sizes[0].second, f.sizes[1].second, 8};
+                return 0;
+            }
+            if (size->index >= f.sizes.size())
+                break;
+            size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+            size->discrete = {f.sizes[size->index].first, f.sizes[size->index].second};
+            return 0;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static const struct v4l2_backend fakeBackend
+    = {fakeOpen, fakeClose, fakeIoctl, nullptr, nullptr, nullptr};
+
+static const FakeFormat yuyv = {V4L2_PIX_FMT_YUYV, 0, {{640, 480}, {1280, 720}}, false};
+static const FakeFormat mjpeg
+    = {V4L2_PIX_FMT_MJPEG, V4L2_FMT_FLAG_COMPRESSED, {{640, 480}, {1920, 1080}}, false};
+static const FakeFormat h264
+    = {V4L2_PIX_FMT_H264, V4L2_FMT_FLAG_COMPRESSED, {{320, 240}, {1920, 1080}}, true};
+
+static void testFramesize()
+{
+    fakeFormats = {mjpeg, h264};
+    int fd = v4l2_open("video0");
+
+    CHECK(v4l2_has_framesize(fd, V4L2_PIX_FMT_MJPEG, 1920, 1080));
+    CHECK(!v4l2_has_framesize(fd, V4L2_PIX_FMT_MJPEG, 1280, 720));
+    CHECK(v4l2_has_framesize(fd, V4L2_PIX_FMT_H264, 1280, 720));
+    /* Off the steps of the range, out of the range */
+    CHECK(!v4l2_has_framesize(fd, V4L2_PIX_FMT_H264, 1281, 720));
+    CHECK(!v4l2_has_framesize(fd, V4L2_PIX_FMT_H264, 3840, 2160));
+    CHECK(!v4l2_has_framesize(fd, V4L2_PIX_FMT_YUYV, 640, 480));
+
+    std::vector<struct v4l2_fmtdesc> formats;
+    CHECK(!v4l2_enum_formats(fd, formats));
+    CHECK(formats.size() == 2 && formats[1].pixelformat == V4L2_PIX_FMT_H264);
+
+    v4l2_close(fd);
+}
+
+static void testSource()
+{
+    V4l2Source source;
+
+    /* MJPEG at the size of the video */
+    fakeFormats = {yuyv, mjpeg};
+    source = getV4l2Source("video0", 1920, 1080, 30);
+    CHECK(source.format == V4l2Source::MJPEG);
+    CHECK(source.filter == "image/jpeg, width=1920, height=1080, framerate=30/1 ! jpegparse");
+
+    /* Size only given raw, or raw frames needed */
+    source = getV4l2Source("video0", 1280, 720, 30);
+    CHECK(source.format == V4l2Source::RAW && source.filter.empty());
+    source = getV4l2Source("video0", 1920, 1080, 30, true);
+    CHECK(source.format == V4l2Source::RAW && source.filter.empty());
+
+    /* H.264 preferred, any size of the camera */
+    fakeFormats = {mjpeg, yuyv, h264};
+    source = getV4l2Source("video0", 0, 0, 0);
+    CHECK(source.format == V4l2Source::H264);
+    CHECK(source.filter == "video/x-h264, stream-format=byte-stream ! h264parse");
+    source = getV4l2Source("video0", 640, 480, 0);
+    CHECK(source.format == V4l2Source::H264);
+    source = getV4l2Source("video0", 1920, 1080, 0);
+    CHECK(source.format == V4l2Source::H264);
+    source = getV4l2Source("video0", 3840, 2160, 0);
+    CHECK(source.format == V4l2Source::RAW && source.filter.empty());
+
+    /* Camera without raw frames, decoded to be scaled */
+    fakeFormats = {mjpeg};
+    source = getV4l2Source("video0", 1280, 720, 25);
+    CHECK(source.format == V4l2Source::RAW);
+    CHECK(source.filter == "image/jpeg, framerate=25/1 ! decodebin ! videoconvert ! videoscale");
+
+    /* Camera gone */
+    fakePresent = false;
+    source = getV4l2Source("video0", 1920, 1080, 30);
+    CHECK(source.format == V4l2Source::RAW && source.filter.empty());
+    fakePresent = true;
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    log_info("V4L2 source test");
+
+    v4l2_set_backend(&fakeBackend);
+
+    testFramesize();
+    testSource();
+
+    v4l2_set_backend(nullptr);
+
+    return finishChecks();
+}
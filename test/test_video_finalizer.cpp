@@ -0,0 +1,133 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the finalizer of the recordings stopped. Live test pipelines are stopped with an end
+ * of stream and handed to the finalizer: queueing must not block, each pipeline must be released
+ * once its end of stream reaches the sink, in order, and a device held must be free as soon as it
+ * is released, before the file is closed.
+ *
+ * Usage: test-video-finalizer
+ */
+#include <atomic>
+#include <gst/gst.h>
+#include <vector>
+
+#include "VideoFinalizer.h"
+#include "log.h"
+#include "test_check.h"
+#include "util.h"
+
+#define PIPELINE "videotestsrc is-live=true ! video/x-raw, width=320, height=240 ! fakesink"
+#define QUEUE_MAX_US (10 * USEC_PER_MSEC)
+#define WAIT_TIMEOUT_MS 5000
+
+static GstElement *startPipeline()
+{
+    GstElement *pipeline = gst_parse_launch(PIPELINE, nullptr);
+    if (!pipeline)
+        return nullptr;
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    gst_element_get_state(pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE);
+
+    return pipeline;
+}
+
+static void testOrder()
+{
+    std::shared_ptr<VideoFinalizer> finalizer = VideoFinalizer::get();
+    std::vector<int> done;
+    std::atomic<int> failed(0);
+
+    for (int i = 0; i < 3; i++) {
+        GstElement *pipeline = startPipeline();
+        CHECK(pipeline);
+        if (!pipeline)
+            return;
+
+        /* Stop returns at once, the file is closed later */
+        usec_t startUs = now_usec();
+        gst_element_send_event(pipeline, gst_event_new_eos());
+        finalizer->finalize("camera-a", pipeline, [&done, &failed, i](bool success) {
+            done.push_back(i);
+            if (!success)
+                failed++;
+        });
+        CHECK(now_usec() - startUs < QUEUE_MAX_US);
+    }
+
+    CHECK(finalizer->wait(WAIT_TIMEOUT_MS) == 0);
+    CHECK(finalizer->getPending() == 0);
+    CHECK(failed == 0);
+    CHECK(done == std::vector<int>({0, 1, 2}));
+}
+
+static void testWait()
+{
+    std::shared_ptr<VideoFinalizer> finalizer = VideoFinalizer::get();
+    std::atomic<bool> done(false);
+
+    /* End of stream not sent yet, the pipeline is kept to send it later */
+    GstElement *pipeline = startPipeline();
+    CHECK(pipeline);
+    if (!pipeline)
+        return;
+    gst_object_ref(pipeline);
+    uint64_t hold = finalizer->holdDevice("camera-a");
+    finalizer->finalize("camera-a", pipeline, [&done](bool success) { done = success; }, hold);
+
+    CHECK(finalizer->waitDevice("camera-a", 100) < 0);
+    CHECK(finalizer->waitDevice("camera-b", 100) == 0);
+    CHECK(finalizer->wait(100) < 0);
+    CHECK(finalizer->getPending() == 1);
+
+    /* Device is free while the file is still being closed */
+    finalizer->releaseDevice(hold);
+    finalizer->releaseDevice(hold);
+    CHECK(finalizer->waitDevice("camera-a", 100) == 0);
+    CHECK(finalizer->getPending() == 1);
+
+    gst_element_send_event(pipeline, gst_event_new_eos());
+    gst_object_unref(pipeline);
+    CHECK(finalizer->wait(WAIT_TIMEOUT_MS) == 0);
+    CHECK(done);
+
+    /* Hold not released is dropped with its pipeline */
+    pipeline = startPipeline();
+    CHECK(pipeline);
+    if (!pipeline)
+        return;
+    hold = finalizer->holdDevice("camera-a");
+    gst_element_send_event(pipeline, gst_event_new_eos());
+    finalizer->finalize("camera-a", pipeline, nullptr, hold);
+    CHECK(finalizer->waitDevice("camera-a", WAIT_TIMEOUT_MS) == 0);
+    CHECK(finalizer->wait(WAIT_TIMEOUT_MS) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    gst_init(&argc, &argv);
+    log_info("Video finalizer test");
+
+    testOrder();
+    testWait();
+
+    return finishChecks();
+}